@@ -1,10 +1,715 @@
 /**
- * @file trans.c
- * @desc binary translation from Java bytecode to native code
+ * @file bt.c
+ * @desc dynamic binary translation of bytecode into translation blocks
+ *
+ * a block is made the first time execution reaches its pc, from the
+ * straight-line bytecode there, with one template per instruction and no
+ * analysis.  the operand stack stays in the interpreter's frame; within a
+ * block its top is tracked as an offset from EDI, which is brought up to
+ * date only where the block can be left.  an instruction that would throw
+ * leaves the block before it, and the interpreter runs it again to throw.
+ * an exit to another block goes through a jump that first leads back to
+ * the dispatcher and is then patched to lead to the block itself, so a
+ * loop whose blocks are chained runs without the dispatcher
  *
  * @author cjeong
  */
+#include <stdio.h>
 #include <java/java_instr.h>
+#include <java/java_vm.h>
+#include <java/java_compiler.h>
+#include <java/java_codecache.h>
+#include <java/java_bt.h>
+
+#define LEN   JAVA_ARRAY_LENGTH_OFFSET
+#define DATA  JAVA_ARRAY_DATA_OFFSET
+
+/* what translating one instruction leads to */
+enum {
+  BT_NEXT,                      /* the block goes on after it */
+  BT_END,                       /* it ended the block */
+  BT_STOP                       /* blocks do not do it; nothing emitted */
+};
+
+JavaSpinLock JavaBt::_lock;
+JavaBtBlock *JavaBt::_table[JAVA_BT_HASH_SIZE];
+JavaBtEnter JavaBt::_enter;
+u1 *JavaBt::_codeTop;
+u1 *JavaBt::_codeEnd;
+u4 JavaBt::_codeBytes;
+u4 JavaBt::_numBlocks;
+u4 JavaBt::_numChained;
+volatile u4 JavaBt::_numRuns;
+volatile u4 JavaBt::_numExits;
+
+/* IFEQ to IFLE, and IF_ICMPEQ to IF_ICMPLE and IF_ACMPEQ to IF_ACMPNE
+   in the same order */
+static const JavaCondCodeE if_conds[] = {
+  JavaCondE, JavaCondNE, JavaCondL, JavaCondGE, JavaCondG, JavaCondLE
+};
+
+static inline bool is_wide(char type)
+{
+  return type == 'J' || type == 'D';
+}
+
+/* the operation on the low word of a long, or with 'high', the high one */
+static JavaAluE long_alu(u1 op, bool high)
+{
+  switch (op) {
+  case JOP_LADD:
+    return high ? JavaAluAdc : JavaAluAdd;
+  case JOP_LSUB:
+    return high ? JavaAluSbb : JavaAluSub;
+  case JOP_LAND:
+    return JavaAluAnd;
+  case JOP_LOR:
+    return JavaAluOr;
+  default:
+    return JavaAluXor;
+  }
+}
+
+static inline u4 bt_hash(JavaVMMethod *m, u4 pc)
+{
+  return (((u4) (uintptr) m >> 4) ^ pc * 31) % JAVA_BT_HASH_SIZE;
+}
+
+
+JavaBtTranslator::JavaBtTranslator(JavaVMMethod *m, u4 pc) :
+  _method(m), _pc(pc), _off(0)
+{
+}
+
+/* a long or double: the low word on top */
+void JavaBtTranslator::pushImm2(uint64 v)
+{
+  _off -= 2;
+  _buf.movImm(slot(0), (u4) v);
+  _buf.movImm(slot(1), (u4) (v >> 32));
+}
+
+/* brings EDI to the top of the operand stack; lea leaves the flags as
+   they are, so this can come between a compare and its jump */
+void JavaBtTranslator::flush()
+{
+  if (_off) {
+    _buf.lea(JavaEDI, JavaMem(JavaEDI, 4 * _off));
+    _off = 0;
+  }
+}
+
+/* a new exit to 'pc' as the operand stack is now; returns its label */
+int JavaBtTranslator::stub(u4 pc, u1 kind)
+{
+  JavaBtStub s;
+
+  s.label = _buf.newLabel();
+  s.pc = pc;
+  s.off = _off;
+  s.kind = kind;
+  s.jump = 0;
+  s.imm = 0;
+  _stubs.push_back(s);
+  return s.label;
+}
+
+/* leaves for the block at 'pc' */
+void JavaBtTranslator::exitTo(u4 pc)
+{
+  int label;
+
+  flush();
+  /* the rel32 is rewritten in place when the exit is chained, and must
+     not straddle a 4-byte boundary for that */
+  while ((_buf.size() + 1) & 3)
+    _buf.emit1(0x90);
+  label = stub(pc, JavaBtChain);
+  _stubs.back().jump = _buf.size() + 1;
+  _buf.jmp(label);
+}
+
+/* counts a backward branch to 'target' for the compilation policy, and
+   leaves once the loop is hot enough for compiled code */
+void JavaBtTranslator::backedge(u4 target)
+{
+  const void *n = (const void *) _method->backedgesAddr();
+
+  _buf.aluImm(JavaAluAdd, javaAbs(n), 1);
+  _buf.aluImm(JavaAluCmp, javaAbs(n), JAVA_TIER1_BACKEDGES);
+  _buf.jcc(JavaCondAE, stub(target, JavaBtHot));
+}
+
+void JavaBtTranslator::nullCheck(JavaRegE r, u4 pc)
+{
+  _buf.test(r, r);
+  _buf.jcc(JavaCondE, stub(pc, JavaBtSide));
+}
+
+/* a negative index compares as a huge unsigned one */
+void JavaBtTranslator::indexCheck(JavaRegE array, JavaRegE index, u4 pc)
+{
+  nullCheck(array, pc);
+  _buf.alu(JavaAluCmp, index, JavaMem(array, LEN));
+  _buf.jcc(JavaCondAE, stub(pc, JavaBtSide));
+}
+
+/* fields narrower than a slot, as the interpreter widens them */
+void JavaBtTranslator::loadField(JavaRegE d, const JavaMem &m, char type)
+{
+  switch (type) {
+  case 'Z': case 'B':
+    _buf.movsx8(d, m);
+    break;
+  case 'C':
+    _buf.movzx16(d, m);
+    break;
+  case 'S':
+    _buf.movsx16(d, m);
+    break;
+  default:
+    _buf.mov(d, m);
+    break;
+  }
+}
+
+void JavaBtTranslator::storeField(const JavaMem &m, JavaRegE s, char type)
+{
+  switch (type) {
+  case 'Z': case 'B':
+    _buf.mov8(m, s);
+    break;
+  case 'C': case 'S':
+    _buf.mov16(m, s);
+    break;
+  default:
+    _buf.mov(m, s);
+    break;
+  }
+}
+
+/* the flags are set for the branch at 'pc' and its operands popped */
+void JavaBtTranslator::branch(JavaCondCodeE c, u4 pc, s4 offset, u4 next)
+{
+  int taken = _buf.newLabel();
+
+  flush();
+  _buf.jcc(c, taken);
+  exitTo(next);
+  _buf.bind(taken);
+  if (offset <= 0)
+    backedge(pc + offset);
+  exitTo(pc + offset);
+}
+
+int JavaBtTranslator::translate(u4 pc)
+{
+  const u1 *code = _method->code();
+  JavaVMCpEntry *cp = _method->cpool(), *e;
+  u4 i = 0, n, next = pc + jopLength(code, pc);
+  u1 op = code[pc];
+  s4 offset;
+
+  /* the short forms of the local variable instructions as the long ones */
+  if (op >= JOP_ILOAD_0 && op <= JOP_ALOAD_3) {
+    i = (op - JOP_ILOAD_0) % 4;
+    op = JOP_ILOAD + (op - JOP_ILOAD_0) / 4;
+  } else if (op >= JOP_ISTORE_0 && op <= JOP_ASTORE_3) {
+    i = (op - JOP_ISTORE_0) % 4;
+    op = JOP_ISTORE + (op - JOP_ISTORE_0) / 4;
+  } else if ((op >= JOP_ILOAD && op <= JOP_ALOAD) ||
+             (op >= JOP_ISTORE && op <= JOP_ASTORE) || op == JOP_IINC)
+    i = code[pc + 1];
+
+  switch (op) {
+  case JOP_NOP:
+    break;
+
+  /* constants */
+  case JOP_ACONST_NULL:
+    pushImm(0);
+    break;
+  case JOP_ICONST_M1: case JOP_ICONST_0: case JOP_ICONST_1:
+  case JOP_ICONST_2: case JOP_ICONST_3: case JOP_ICONST_4:
+  case JOP_ICONST_5:
+    pushImm(op - JOP_ICONST_0);
+    break;
+  case JOP_LCONST_0: case JOP_LCONST_1:
+    pushImm2(op - JOP_LCONST_0);
+    break;
+  case JOP_FCONST_0: case JOP_FCONST_1: case JOP_FCONST_2:
+    pushImm(javaFloatBits(op - JOP_FCONST_0));
+    break;
+  case JOP_DCONST_0: case JOP_DCONST_1:
+    pushImm2(javaDoubleBits(op - JOP_DCONST_0));
+    break;
+  case JOP_BIPUSH:
+    pushImm((s1) code[pc + 1]);
+    break;
+  case JOP_SIPUSH:
+    pushImm(jopS2(code + pc + 1));
+    break;
+  case JOP_LDC:
+    pushImm(cp[code[pc + 1]].value);
+    break;
+  case JOP_LDC_W:
+    pushImm(cp[jopU2(code + pc + 1)].value);
+    break;
+  case JOP_LDC2_W:
+    pushImm2(cp[jopU2(code + pc + 1)].wide);
+    break;
+
+  /* locals; a two-slot local i has its high word in slot i */
+  case JOP_ILOAD: case JOP_FLOAD: case JOP_ALOAD:
+    _buf.mov(JavaEAX, local(i));
+    push(JavaEAX);
+    break;
+  case JOP_LLOAD: case JOP_DLOAD:
+    _buf.mov(JavaEAX, local(i + 1));
+    _buf.mov(JavaEDX, local(i));
+    _off -= 2;
+    _buf.mov(slot(0), JavaEAX);
+    _buf.mov(slot(1), JavaEDX);
+    break;
+  case JOP_ISTORE: case JOP_FSTORE: case JOP_ASTORE:
+    _buf.mov(JavaEAX, slot(0));
+    _off++;
+    _buf.mov(local(i), JavaEAX);
+    break;
+  case JOP_LSTORE: case JOP_DSTORE:
+    _buf.mov(JavaEAX, slot(0));
+    _buf.mov(JavaEDX, slot(1));
+    _off += 2;
+    _buf.mov(local(i + 1), JavaEAX);
+    _buf.mov(local(i), JavaEDX);
+    break;
+  case JOP_IINC:
+    _buf.aluImm(JavaAluAdd, local(i), (s1) code[pc + 2]);
+    break;
+
+  /* stack */
+  case JOP_POP:
+    _off++;
+    break;
+  case JOP_POP2:
+    _off += 2;
+    break;
+  case JOP_DUP:
+    _buf.mov(JavaEAX, slot(0));
+    push(JavaEAX);
+    break;
+  case JOP_DUP2:
+    _buf.mov(JavaEAX, slot(0));
+    _buf.mov(JavaECX, slot(1));
+    _off -= 2;
+    _buf.mov(slot(0), JavaEAX);
+    _buf.mov(slot(1), JavaECX);
+    break;
+  case JOP_DUP_X1:
+    _buf.mov(JavaEAX, slot(0));
+    _buf.mov(JavaECX, slot(1));
+    _off--;
+    _buf.mov(slot(0), JavaEAX);
+    _buf.mov(slot(1), JavaECX);
+    _buf.mov(slot(2), JavaEAX);
+    break;
+  case JOP_SWAP:
+    _buf.mov(JavaEAX, slot(0));
+    _buf.mov(JavaECX, slot(1));
+    _buf.mov(slot(0), JavaECX);
+    _buf.mov(slot(1), JavaEAX);
+    break;
+
+  /* integer arithmetic */
+  case JOP_IADD: case JOP_ISUB: case JOP_IAND: case JOP_IOR: case JOP_IXOR:
+    _buf.mov(JavaEAX, slot(0));
+    _off++;
+    _buf.alu(op == JOP_IADD ? JavaAluAdd : op == JOP_ISUB ? JavaAluSub :
+             op == JOP_IAND ? JavaAluAnd : op == JOP_IOR ? JavaAluOr :
+             JavaAluXor, slot(0), JavaEAX);
+    break;
+  case JOP_LADD: case JOP_LSUB: case JOP_LAND: case JOP_LOR: case JOP_LXOR:
+    _buf.mov(JavaEAX, slot(0));
+    _buf.mov(JavaEDX, slot(1));
+    _off += 2;
+    _buf.alu(long_alu(op, false), slot(0), JavaEAX);
+    _buf.alu(long_alu(op, true), slot(1), JavaEDX);
+    break;
+  case JOP_IMUL:
+    _buf.mov(JavaEAX, slot(1));
+    _buf.imul(JavaEAX, slot(0));
+    _off++;
+    _buf.mov(slot(0), JavaEAX);
+    break;
+  case JOP_IDIV: case JOP_IREM:
+    /* the interpreter throws on a zero divisor, and does MIN_VALUE / -1,
+       which faults here */
+    _buf.mov(JavaECX, slot(0));
+    _buf.test(JavaECX, JavaECX);
+    _buf.jcc(JavaCondE, stub(pc, JavaBtSide));
+    _buf.aluImm(JavaAluCmp, JavaECX, -1);
+    _buf.jcc(JavaCondE, stub(pc, JavaBtSide));
+    _buf.mov(JavaEAX, slot(1));
+    _buf.cdq();
+    _buf.idiv(JavaECX);
+    _off++;
+    _buf.mov(slot(0), op == JOP_IDIV ? JavaEAX : JavaEDX);
+    break;
+  case JOP_INEG:
+    _buf.neg(slot(0));
+    break;
+  case JOP_ISHL: case JOP_ISHR: case JOP_IUSHR:
+    /* the CPU masks the count to 5 bits, as Java does */
+    _buf.mov(JavaECX, slot(0));
+    _off++;
+    _buf.shift(op == JOP_ISHL ? JavaShiftShl :
+               op == JOP_ISHR ? JavaShiftSar : JavaShiftShr, slot(0));
+    break;
+  case JOP_I2B:
+    _buf.movsx8(JavaEAX, slot(0));
+    _buf.mov(slot(0), JavaEAX);
+    break;
+  case JOP_I2C:
+    _buf.movzx16(JavaEAX, slot(0));
+    _buf.mov(slot(0), JavaEAX);
+    break;
+  case JOP_I2S:
+    _buf.movsx16(JavaEAX, slot(0));
+    _buf.mov(slot(0), JavaEAX);
+    break;
+
+  /* branches end the block */
+  case JOP_IFEQ: case JOP_IFNE: case JOP_IFLT:
+  case JOP_IFGE: case JOP_IFGT: case JOP_IFLE:
+    _buf.aluImm(JavaAluCmp, slot(0), 0);
+    _off++;
+    branch(if_conds[op - JOP_IFEQ], pc, jopS2(code + pc + 1), next);
+    return BT_END;
+  case JOP_IF_ICMPEQ: case JOP_IF_ICMPNE: case JOP_IF_ICMPLT:
+  case JOP_IF_ICMPGE: case JOP_IF_ICMPGT: case JOP_IF_ICMPLE:
+  case JOP_IF_ACMPEQ: case JOP_IF_ACMPNE:
+    _buf.mov(JavaEAX, slot(1));
+    _buf.alu(JavaAluCmp, JavaEAX, slot(0));
+    _off += 2;
+    branch(if_conds[op >= JOP_IF_ACMPEQ ? op - JOP_IF_ACMPEQ :
+                    op - JOP_IF_ICMPEQ], pc, jopS2(code + pc + 1), next);
+    return BT_END;
+  case JOP_IFNULL: case JOP_IFNONNULL:
+    _buf.aluImm(JavaAluCmp, slot(0), 0);
+    _off++;
+    branch(op == JOP_IFNULL ? JavaCondE : JavaCondNE, pc,
+           jopS2(code + pc + 1), next);
+    return BT_END;
+  case JOP_GOTO: case JOP_GOTO_W:
+    offset = op == JOP_GOTO ? jopS2(code + pc + 1) : jopS4(code + pc + 1);
+    flush();
+    if (offset <= 0)
+      backedge(pc + offset);
+    exitTo(pc + offset);
+    return BT_END;
+
+  /* arrays */
+  case JOP_ARRAYLENGTH:
+    _buf.mov(JavaEAX, slot(0));
+    nullCheck(JavaEAX, pc);
+    _buf.mov(JavaEAX, JavaMem(JavaEAX, LEN));
+    _buf.mov(slot(0), JavaEAX);
+    break;
+  case JOP_IALOAD: case JOP_FALOAD: case JOP_AALOAD:
+  case JOP_BALOAD: case JOP_CALOAD: case JOP_SALOAD:
+    _buf.mov(JavaEAX, slot(1));
+    _buf.mov(JavaECX, slot(0));
+    indexCheck(JavaEAX, JavaECX, pc);
+    if (op == JOP_BALOAD)
+      _buf.movsx8(JavaEDX, JavaMem(JavaEAX, JavaECX, 1, DATA));
+    else if (op == JOP_CALOAD)
+      _buf.movzx16(JavaEDX, JavaMem(JavaEAX, JavaECX, 2, DATA));
+    else if (op == JOP_SALOAD)
+      _buf.movsx16(JavaEDX, JavaMem(JavaEAX, JavaECX, 2, DATA));
+    else
+      _buf.mov(JavaEDX, JavaMem(JavaEAX, JavaECX, 4, DATA));
+    _off++;
+    _buf.mov(slot(0), JavaEDX);
+    break;
+  case JOP_LALOAD: case JOP_DALOAD:
+    _buf.mov(JavaEAX, slot(1));
+    _buf.mov(JavaECX, slot(0));
+    indexCheck(JavaEAX, JavaECX, pc);
+    _buf.mov(JavaEDX, JavaMem(JavaEAX, JavaECX, 8, DATA));
+    _buf.mov(JavaEAX, JavaMem(JavaEAX, JavaECX, 8, DATA + 4));
+    _buf.mov(slot(0), JavaEDX);
+    _buf.mov(slot(1), JavaEAX);
+    break;
+  case JOP_IASTORE: case JOP_FASTORE:
+  case JOP_BASTORE: case JOP_CASTORE: case JOP_SASTORE:
+    /* AASTORE is left out: it needs a store check */
+    _buf.mov(JavaEAX, slot(2));
+    _buf.mov(JavaECX, slot(1));
+    indexCheck(JavaEAX, JavaECX, pc);
+    _buf.mov(JavaEDX, slot(0));
+    _off += 3;
+    if (op == JOP_BASTORE)
+      _buf.mov8(JavaMem(JavaEAX, JavaECX, 1, DATA), JavaEDX);
+    else if (op == JOP_CASTORE || op == JOP_SASTORE)
+      _buf.mov16(JavaMem(JavaEAX, JavaECX, 2, DATA), JavaEDX);
+    else
+      _buf.mov(JavaMem(JavaEAX, JavaECX, 4, DATA), JavaEDX);
+    break;
+  case JOP_LASTORE: case JOP_DASTORE:
+    _buf.mov(JavaEAX, slot(3));
+    _buf.mov(JavaECX, slot(2));
+    indexCheck(JavaEAX, JavaECX, pc);
+    _buf.mov(JavaEDX, slot(0));
+    _buf.mov(JavaMem(JavaEAX, JavaECX, 8, DATA), JavaEDX);
+    _buf.mov(JavaEDX, slot(1));
+    _buf.mov(JavaMem(JavaEAX, JavaECX, 8, DATA + 4), JavaEDX);
+    _off += 4;
+    break;
+
+  /* fields; class initialization is assumed done at link time */
+  case JOP_GETFIELD:
+    e = &cp[jopU2(code + pc + 1)];
+    _buf.mov(JavaEAX, slot(0));
+    nullCheck(JavaEAX, pc);
+    if (is_wide(e->type)) {
+      _buf.mov(JavaECX, JavaMem(JavaEAX, e->offset));
+      _buf.mov(JavaEDX, JavaMem(JavaEAX, e->offset + 4));
+      _off--;
+      _buf.mov(slot(0), JavaECX);
+      _buf.mov(slot(1), JavaEDX);
+    } else {
+      loadField(JavaECX, JavaMem(JavaEAX, e->offset), e->type);
+      _buf.mov(slot(0), JavaECX);
+    }
+    break;
+  case JOP_PUTFIELD:
+    e = &cp[jopU2(code + pc + 1)];
+    n = is_wide(e->type) ? 2 : 1;
+    _buf.mov(JavaEAX, slot(n));
+    nullCheck(JavaEAX, pc);
+    _buf.mov(JavaEDX, slot(0));
+    if (is_wide(e->type)) {
+      _buf.mov(JavaMem(JavaEAX, e->offset), JavaEDX);
+      _buf.mov(JavaEDX, slot(1));
+      _buf.mov(JavaMem(JavaEAX, e->offset + 4), JavaEDX);
+    } else
+      storeField(JavaMem(JavaEAX, e->offset), JavaEDX, e->type);
+    _off += n + 1;
+    break;
+  case JOP_GETSTATIC:
+    e = &cp[jopU2(code + pc + 1)];
+    if (is_wide(e->type)) {
+      _buf.mov(JavaEAX, javaAbs(e->addr));
+      _buf.mov(JavaEDX, javaAbs(e->addr + 4));
+      _off -= 2;
+      _buf.mov(slot(0), JavaEAX);
+      _buf.mov(slot(1), JavaEDX);
+    } else {
+      loadField(JavaEAX, javaAbs(e->addr), e->type);
+      push(JavaEAX);
+    }
+    break;
+  case JOP_PUTSTATIC:
+    e = &cp[jopU2(code + pc + 1)];
+    _buf.mov(JavaEDX, slot(0));
+    if (is_wide(e->type)) {
+      _buf.mov(javaAbs(e->addr), JavaEDX);
+      _buf.mov(JavaEDX, slot(1));
+      _buf.mov(javaAbs(e->addr + 4), JavaEDX);
+      _off += 2;
+    } else {
+      storeField(javaAbs(e->addr), JavaEDX, e->type);
+      _off++;
+    }
+    break;
+
+  /* calls, allocation, monitors, returns, switches, floating point and
+     the rest are the interpreter's */
+  default:
+    return BT_STOP;
+  }
+  return BT_NEXT;
+}
+
+bool JavaBtTranslator::translate()
+{
+  const u1 *code = _method->code();
+  int r = BT_NEXT, epilogue = _buf.newLabel();
+  JavaBtStub *s;
+  u4 pc = _pc, n;
+
+  for (n = 0; n < JAVA_BT_MAX_INSNS && pc < _method->codeLength(); n++) {
+    if ((r = translate(pc)) != BT_NEXT)
+      break;
+    pc += jopLength(code, pc);
+  }
+  if (r == BT_STOP) {
+    if (n == 0)
+      return false;
+    _buf.jmp(stub(pc, JavaBtSide));
+  } else if (r == BT_NEXT) {
+    /* a long region goes on in the next block */
+    exitTo(pc);
+  }
+
+  /* the stubs load the address of their exit, which install() fills in */
+  for (n = 0; n < _stubs.size(); n++) {
+    s = &_stubs[n];
+    _buf.bind(s->label);
+    if (s->off)
+      _buf.lea(JavaEDI, JavaMem(JavaEDI, 4 * s->off));
+    s->imm = _buf.size() + 1;
+    _buf.movImm(JavaEAX, 0);
+    _buf.jmp(epilogue);
+  }
+
+  /* undoes the entry stub (see JavaBt::init) */
+  _buf.bind(epilogue);
+  _buf.mov(JavaECX, JavaMem(JavaEBP, 12));
+  _buf.mov(JavaMem(JavaECX, 0), JavaEDI);
+  _buf.pop(JavaEDI);
+  _buf.pop(JavaESI);
+  _buf.pop(JavaEBP);
+  _buf.ret();
+  return _buf.finish();
+}
+
+void JavaBtTranslator::install(u1 *mem, JavaBtBlock *b)
+{
+  JavaBtExit *exits = new JavaBtExit[_stubs.size()];
+  u4 i;
+
+  for (i = 0; i < _stubs.size(); i++) {
+    exits[i].block = b;
+    exits[i].pc = _stubs[i].pc;
+    exits[i].jump = _stubs[i].jump;
+    exits[i].kind = _stubs[i].kind;
+    _buf.patch4(_stubs[i].imm, (u4) (uintptr) &exits[i]);
+  }
+  _buf.install(mem);
+  b->code(mem);
+  b->size(_buf.size());
+  b->exits(exits);
+  b->numExits(_stubs.size());
+}
+
+
+/* saves what blocks use and sets up ESI and EDI; the blocks' epilogue
+   undoes it */
+void JavaBt::init()
+{
+  JavaCodeBuffer buf;
+  u1 *code;
+
+  buf.push(JavaEBP);
+  buf.mov(JavaEBP, JavaESP);
+  buf.push(JavaESI);
+  buf.push(JavaEDI);
+  buf.mov(JavaESI, JavaMem(JavaEBP, 8));
+  buf.mov(JavaECX, JavaMem(JavaEBP, 12));
+  buf.mov(JavaEDI, JavaMem(JavaECX, 0));
+  buf.jmp(JavaMem(JavaEBP, 16));
+  if (!buf.finish() || (code = JavaCodeCache::allocStub(buf.size())) == 0)
+    return;
+  buf.install(code);
+  _enter = (JavaBtEnter) (uintptr) code;
+}
+
+/* blocks are never freed, so code is bump allocated */
+u1 *JavaBt::allocCode(u4 size)
+{
+  u1 *code;
+
+  size = (size + 15) & ~15;
+  if (size > (u4) (_codeEnd - _codeTop)) {
+    if (size > JAVA_BT_CHUNK || _codeBytes + JAVA_BT_CHUNK > JAVA_BT_CODE_LIMIT)
+      return 0;
+    if ((_codeTop = JavaCodeCache::allocStub(JAVA_BT_CHUNK)) == 0) {
+      _codeEnd = 0;
+      return 0;
+    }
+    _codeEnd = _codeTop + JAVA_BT_CHUNK;
+    _codeBytes += JAVA_BT_CHUNK;
+  }
+  code = _codeTop;
+  _codeTop += size;
+  return code;
+}
+
+JavaBtBlock *JavaBt::lookup(JavaVMMethod *m, u4 pc)
+{
+  JavaBtBlock *b;
+
+  for (b = _table[bt_hash(m, pc)]; b; b = b->next())
+    if (b->method() == m && b->pc() == pc)
+      return b;
+  return 0;
+}
+
+/* a block that can not be made is cached too, without code */
+JavaBtBlock *JavaBt::translate(JavaVMMethod *m, u4 pc)
+{
+  JavaBtTranslator t(m, pc);
+  JavaBtBlock *b = new JavaBtBlock(m, pc);
+  u4 h = bt_hash(m, pc);
+  u1 *code;
+
+  if (t.translate() && (code = allocCode(t.size())) != 0) {
+    t.install(code, b);
+    _numBlocks++;
+  }
+  b->next(_table[h]);
+  _table[h] = b;
+  return b;
+}
+
+/* the rel32 is aligned, so a thread taking the jump while it changes
+   goes either to the dispatcher or to the block */
+void JavaBt::chain(JavaBtExit *e, JavaBtBlock *to)
+{
+  u1 *field = e->block->code() + e->jump;
+
+  *(volatile u4 *) field =
+    (u4) (uintptr) to->code() - (u4) (uintptr) (field + 4);
+  _numChained++;
+}
+
+JavaOsrEntry JavaBt::run(JavaVMFrame *f)
+{
+  JavaVMMethod *m = f->method();
+  JavaBtBlock *b;
+  JavaBtExit *e = 0;
+  JavaOsrEntry osr = 0;
+  u4 *sp = f->sp();
+  u4 pc = f->pc();
 
+  javaAtomicAdd(&_numRuns, 1);
+  for (;;) {
+    _lock.lock();
+    if ((b = lookup(m, pc)) == 0)
+      b = translate(m, pc);
+    if (e && e->kind == JavaBtChain && b->code())
+      chain(e, b);
+    _lock.unlock();
+    if (!b->code())
+      break;
 
+    e = _enter(f->locals(), &sp, b->code());
+    javaAtomicAdd(&_numExits, 1);
+    pc = e->pc;
+    if (e->kind == JavaBtSide)
+      break;
+    /* until the OSR code is there, the loop goes on in blocks */
+    if (e->kind == JavaBtHot && (osr = JavaCompiler::checkOsr(m, pc)) != 0)
+      break;
+  }
+  f->pc(pc);
+  f->sp(sp);
+  return osr;
+}
 
+void JavaBt::dumpStats()
+{
+  printf("bt: %u blocks, %u chained, %u code bytes, %u runs, %u exits\n",
+         _numBlocks, _numChained, _codeBytes, _numRuns, _numExits);
+}
@@ -0,0 +1,46 @@
+/**
+ * @file e820.h
+ * @desc the BIOS memory map, which boot/bootasm.S asks for with INT 15h,
+ *       AX=E820h while still in real mode, and leaves at E820_MAP for
+ *       i386_detect_memory() to read
+ */
+#ifndef E820_H
+#define E820_H
+
+/* where the map is left, in low memory that nothing uses before the
+   kernel has read it: just above the boot sector */
+#define E820_MAP     0x8000
+#define E820_MAX     32           /* entries the map has room for */
+#define E820_SMAP    0x534D4150   /* "SMAP", both the BIOS's and ours */
+
+/* the layout at E820_MAP: em_magic, em_count, em_entries */
+#define E820_COUNT   (E820_MAP + 4)
+#define E820_ENTRIES (E820_MAP + 8)
+#define E820_ENTSIZE 20           /* bytes of an entry, as the BIOS writes it */
+
+/* values of ee_type */
+#define E820_RAM       1          /* usable memory */
+#define E820_RESERVED  2
+#define E820_ACPI      3          /* ACPI tables; usable once read */
+#define E820_NVS       4          /* ACPI non-volatile storage */
+#define E820_BAD       5
+
+#ifndef __ASSEMBLER__
+#include <types.h>
+
+struct e820_entry {
+  uint64_t ee_addr;
+  uint64_t ee_len;
+  uint32_t ee_type;
+} __attribute__((packed));
+
+/* em_magic is E820_SMAP if the boot sector filled in the map; a kernel
+   booted some other way finds something else there */
+struct e820_map {
+  uint32_t em_magic;
+  uint32_t em_count;
+  struct e820_entry em_entries[E820_MAX];
+} __attribute__((packed));
+#endif /* __ASSEMBLER__ */
+
+#endif /* E820_H */
@@ -0,0 +1,25 @@
+/**
+ * @file common.h
+ * @brief definitions shared by all Java virtual machine headers
+ *
+ * @author cjeong
+ */
+#ifndef JAVA_COMMON_H
+#define JAVA_COMMON_H
+
+/* fixed-width integer types; the VM code does not include <types.h> since
+   its 'bool' typedef clashes with C++ */
+typedef unsigned char       uint8;
+typedef unsigned short      uint16;
+typedef unsigned int        uint32;
+typedef unsigned long long  uint64;
+typedef unsigned long       uintptr;  /* integer wide enough for a pointer */
+
+/* defines an accessor 'name()' and a mutator 'name(v)' for data member
+   'field'; the cast lets bitfields and enums be exposed with their 
+   declared type */
+#define GET_SET(type, field, name)              \
+  type name() const { return (type) field; }    \
+  void name(type v) { field = v; }
+
+#endif /* JAVA_COMMON_H */
@@ -0,0 +1,165 @@
+/**
+ * @file java_aot.h
+ * @brief ahead-of-time compilation: baseline code for a set of methods
+ *        saved as a relocatable image, and the loader that installs the
+ *        image in a VM so the methods start out compiled
+ *
+ * @author cjeong
+ */
+#ifndef JAVA_AOT_H
+#define JAVA_AOT_H
+
+#include <vector>
+#include "java/java_vm.h"
+#include "java/java_trans.h"
+
+#define JAVA_AOT_MAGIC    0x544f414a    /* "JAOT" */
+#define JAVA_AOT_VERSION  1
+
+/* an image is the header, then the method, OSR entry, symbol and
+   relocation tables, the string table and the code, in that order.  the
+   code refers to nothing outside it but through relocations, which name
+   what they refer to by symbol, so the image can be loaded anywhere and
+   into a VM whose objects are elsewhere than in the one that built it */
+struct JavaAotHeader {
+  u4 magic;
+  u4 version;
+  u4 numMethods;
+  u4 numOsr;
+  u4 numSymbols;
+  u4 numRelocs;
+  u4 stringsSize;
+  u4 codeSize;
+};
+
+struct JavaAotMethod {
+  u4 symbol;                    /* of the method itself */
+  u4 code;                      /* offset in the code */
+  u4 size;
+  u4 firstOsr;
+  u4 numOsr;
+  u4 firstReloc;
+  u4 numRelocs;
+};
+
+struct JavaAotOsr {
+  u4 pc;                        /* of the loop header */
+  u4 entry;                     /* offset in the method's code */
+};
+
+enum JavaAotSymbolE {
+  JavaAotMethodSym,             /* method 'name' 'desc' of class 'owner' */
+  JavaAotOsrSym,                /* OSR point at pc 'arg' of that method */
+  JavaAotClassSym,              /* class 'owner' */
+  JavaAotMirrorSym,             /* its java.lang.Class instance */
+  JavaAotArrayClassSym,         /* JavaRuntime::arrayClass('arg') */
+  JavaAotStaticSym,             /* static field 'name' of class 'owner' */
+  JavaAotRuntimeSym             /* runtime routine 'name' */
+};
+
+/* names are offsets of NUL-terminated strings in the string table; 0 is
+   the empty string */
+struct JavaAotSymbol {
+  u2 kind;                      /* JavaAotSymbolE */
+  u2 arg;
+  u4 owner;
+  u4 name;
+  u4 desc;
+};
+
+/* how the 4-byte field at 'offset' in a method's code is patched */
+enum JavaAotRelocE {
+  JavaAotAbs,                   /* address of the symbol plus addend */
+  JavaAotRel,                   /* rel32 to the symbol */
+  JavaAotCode                   /* address of the code plus addend */
+};
+
+#define JAVA_AOT_RELOC(kind, sym)  ((u4) (kind) << 24 | (sym))
+#define JAVA_AOT_KIND(info)        ((info) >> 24)
+#define JAVA_AOT_SYMBOL(info)      ((info) & 0xFFFFFF)
+
+struct JavaAotReloc {
+  u4 offset;
+  u4 info;                      /* JAVA_AOT_RELOC */
+  s4 addend;
+};
+
+/* finds what the symbols of an image name in the VM loading it; each
+   returns 0 if there is no such thing */
+class JavaAotResolver {
+public:
+  virtual ~JavaAotResolver() { }
+
+  virtual JavaVMClass *findClass(const char *name) = 0;
+  virtual char *findStatic(JavaVMClass *c, const char *name) = 0;
+  virtual JavaVMMethod *findMethod(JavaVMClass *c, const char *name,
+                                   const char *desc) {
+    return c->lookupMethod(name, desc);
+  }
+};
+
+/* builds an image out of the baseline compiler's code.  the methods must
+   be linked, since the compiler reads their resolved constant pools, and
+   everything their code refers to must have a name: methods whose code
+   holds the address of a string, or of a class without a classfile, are
+   left out and will be compiled at run time as before */
+class JavaAotCompiler {
+private:
+  /* an address range of the VM objects a method refers to */
+  struct JavaAotTarget {
+    u4 lo;
+    u4 size;
+    u4 symbol;
+  };
+
+  std::vector<JavaAotMethod> _methods;
+  std::vector<JavaAotOsr> _osr;
+  std::vector<JavaAotSymbol> _symbols;
+  std::vector<JavaAotReloc> _relocs;
+  std::vector<char> _strings;
+  std::vector<u1> _code;
+  std::vector<JavaAotTarget> _targets;
+  u4 _numRejected;
+
+  u4 string(const char *s, u4 length);
+  u4 symbol(u2 kind, u2 arg, u4 owner, u4 name, u4 desc);
+  bool className(JavaVMClass *c, u4 *name);
+  bool methodSymbol(JavaVMMethod *m, u2 kind, u2 arg, u4 *sym);
+  void target(const void *p, u4 size, u4 sym);
+  bool collect(JavaVMMethod *m, JavaTranslator &t);
+  bool relocate(JavaCodeBuffer &buf, std::vector<JavaAotReloc> &relocs);
+
+public:
+  JavaAotCompiler();
+  ~JavaAotCompiler() { }
+
+  GET_SET(u4, _numRejected, numRejected);
+  u4 numMethods() const { return _methods.size(); }
+
+  /* compiles 'm' into the image; false if it is left out */
+  bool add(JavaVMMethod *m);
+
+  /* adds every method of 'c' that has bytecode; returns how many were
+     added */
+  u4 add(JavaVMClass *c);
+
+  /* the image as it stands */
+  void write(std::vector<u1> &image) const;
+};
+
+class JavaAot {
+public:
+  /* the runtime routine at 'fn', by name, and the other way around; 0 if
+     compiled code does not call it */
+  static const char *routineName(const void *fn);
+  static const void *routine(const char *name);
+
+  /* installs the code of an image for its methods that have no compiled
+     code yet; their counters still run in it, so hot methods move on to
+     the optimizing compiler as usual.  methods some symbol of which does
+     not resolve are skipped.  returns the number of methods installed, or
+     -1 if the image is malformed */
+  static int load(const u1 *image, u4 size, JavaAotResolver *r);
+};
+
+#endif /* JAVA_AOT_H */
@@ -7,9 +7,104 @@
 #ifndef JAVA_BASE_H
 #define JAVA_BASE_H
 
+#include "common.h"
+
 /* typedefs */
 typedef uint8   u1;
 typedef uint16  u2;
 typedef uint32  u4;
+typedef signed char  s1;
+typedef short        s2;
+typedef int          s4;
+typedef long long    s8;
+
+/* root of the classfile-level VM classes */
+class JavaBase {
+};
+
+/* atomically replaces *p with 'nv' if it still holds 'ov'; returns the
+   value found in *p, which equals 'ov' on success */
+static inline u4 javaCas(volatile u4 *p, u4 ov, u4 nv)
+{
+  u4 prev;
+  __asm __volatile("lock; cmpxchgl %2, %1"
+                   : "=a" (prev), "+m" (*p)
+                   : "r" (nv), "0" (ov)
+                   : "memory", "cc");
+  return prev;
+}
+
+/* atomically adds 'v' to *p; returns the previous value */
+static inline u4 javaAtomicAdd(volatile u4 *p, u4 v)
+{
+  __asm __volatile("lock; xaddl %0, %1"
+                   : "+r" (v), "+m" (*p)
+                   :
+                   : "memory", "cc");
+  return v;
+}
+
+/* spin-wait hint; lets a hyperthreaded sibling run while we spin */
+static inline void javaCpuRelax()
+{
+  __asm __volatile("pause" ::: "memory");
+}
+
+static inline uint64 javaReadTsc()
+{
+  u4 lo, hi;
+  __asm __volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64) hi << 32) | lo;
+}
+
+/* float and double values travel through slots and registers as their
+   bit patterns */
+static inline u4 javaFloatBits(float f)
+{
+  union { float f; u4 u; } v;
+  v.f = f;
+  return v.u;
+}
+
+static inline float javaBitsFloat(u4 u)
+{
+  union { float f; u4 u; } v;
+  v.u = u;
+  return v.f;
+}
+
+static inline uint64 javaDoubleBits(double d)
+{
+  union { double d; uint64 u; } v;
+  v.d = d;
+  return v.u;
+}
+
+static inline double javaBitsDouble(uint64 u)
+{
+  union { double d; uint64 u; } v;
+  v.u = u;
+  return v.d;
+}
+
+/* test-and-test-and-set spinlock for short VM-internal critical sections */
+class JavaSpinLock {
+private:
+  volatile u4 _locked;
+
+public:
+  JavaSpinLock() : _locked(0) { }
+
+  void lock() {
+    while (javaCas(&_locked, 0, 1) != 0)
+      while (_locked)
+        javaCpuRelax();
+  }
+
+  void unlock() {
+    __asm __volatile("" ::: "memory");
+    _locked = 0;
+  }
+};
 
 #endif /* JAVA_BASE_H */
@@ -0,0 +1,62 @@
+/**
+ * @file java_bench.h
+ * @brief microbenchmarks for the VM runtime; each reports TSC cycles per
+ *        operation
+ *
+ * @author cjeong
+ */
+#ifndef JAVA_BENCH_H
+#define JAVA_BENCH_H
+
+#include "java/java_base.h"
+
+class JavaVMHeap;
+class JavaVMClass;
+class JavaObject;
+class JavaArray;
+class JavaVMThread;
+class JavaThreadI;
+class JavaStealingScheduler;
+
+class JavaBench {
+public:
+  /* heap footprint of an object-heavy workload: a linked list of 'n'
+     instances of 'node', whose first field must be a reference to the
+     next one (class Node { Node next; int value; }), each with a small
+     array of class 'ints' of 0 to 3 elements; reports the bytes taken
+     with the one-word header against a two-word one, rather than cycles */
+  static void heapFootprint(JavaVMHeap *h, JavaVMClass *node,
+                            JavaVMClass *ints, u4 n);
+
+  /* lock/unlock of an object nobody else touches; stays thin-locked, then
+     the same loop on an object whose lock has been inflated */
+  static void lockUncontended(JavaObject *thin, JavaObject *inflated,
+                              JavaVMThread *t, u4 iters);
+
+  /* 'n' threads, each started with JavaVMThread::start() and kept for
+     later runs, doing 'iters' lock/unlock pairs on 'o' at once; reports
+     the throughput of all of them together and how many monitors were
+     inflated meanwhile */
+  static void lockContended(JavaObject *o, int n, u4 iters);
+
+  /* scheduler cost of a context switch: 'n' threads round-robin on CPU 0
+     through pickNextThread() and addThread(); also reports the resulting
+     switch rate given the TSC frequency in MHz */
+  static void schedSwitch(JavaStealingScheduler *s, JavaThreadI **threads,
+                          int n, u4 iters, u4 mhz);
+
+  /* wakeup latency: cycles from addThread() of a sleeping thread until a
+     CPU picks it, both on its own CPU with 'n' threads queued ahead of it
+     and on an idle CPU that has to steal it */
+  static void schedWakeup(JavaStealingScheduler *s, JavaThreadI **threads,
+                          int n, JavaThreadI *sleeper, u4 iters);
+
+  /* the interpreter and both compiled tiers on three loops: an integer
+     arithmetic loop run 'n' times, a fill-and-sum over the int[] 'a' and
+     a loop around a small static call; checks that the tiers agree,
+     that a method gets compiled once it passes the invocation threshold
+     and that one long call moves to compiled code mid-loop */
+  static void jitLoops(JavaArray *a, u4 n, u4 iters);
+};
+
+#endif /* JAVA_BENCH_H */
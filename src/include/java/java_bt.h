@@ -0,0 +1,168 @@
+/**
+ * @file java_bt.h
+ * @brief dynamic binary translation: straight-line bytecode regions turned
+ *        into native translation blocks that run on the interpreter's own
+ *        frame, cached by method and pc and chained to each other
+ *
+ * @author cjeong
+ */
+#ifndef JAVA_BT_H
+#define JAVA_BT_H
+
+#include <vector>
+#include "java/java_vm.h"
+#include "java/java_trans.h"
+
+/* a loop is run as translation blocks once it has taken this many
+   backward branches; well below the compilers' thresholds, since a block
+   costs little more to make than to interpret once */
+#define JAVA_BT_BACKEDGES   64
+
+/* instructions in one block at most */
+#define JAVA_BT_MAX_INSNS   64
+
+/* buckets of the block cache */
+#define JAVA_BT_HASH_SIZE   1024
+
+/* code memory is taken from the code cache in chunks, up to a limit;
+   past it, regions not yet translated stay interpreted */
+#define JAVA_BT_CHUNK       (16 * 1024)
+#define JAVA_BT_CODE_LIMIT  (1024 * 1024)
+
+class JavaBtBlock;
+
+/* how a block gives control back to the dispatcher */
+enum JavaBtExitE {
+  JavaBtChain,                  /* to another block, directly once chained */
+  JavaBtSide,                   /* to the interpreter, for an instruction
+                                   blocks do not do or that is to throw */
+  JavaBtHot                     /* a backward branch of a loop hot enough
+                                   for compiled code */
+};
+
+struct JavaBtExit {
+  JavaBtBlock *block;
+  u4 pc;                        /* where execution goes on */
+  u4 jump;                      /* offset of the rel32 that chains it */
+  u1 kind;                      /* JavaBtExitE */
+};
+
+/* native code for the bytecode from 'pc' up to a branch or to the first
+   instruction blocks do not do.  blocks keep locals in ESI and the
+   operand stack pointer in EDI, and work on the interpreter's frame in
+   place, so an exit hands the frame back as the interpreter left it at
+   the exit's pc.  a block with no code stands for a pc where translation
+   is not possible, so it is not tried again */
+class JavaBtBlock {
+private:
+  JavaVMMethod *_method;
+  u4 _pc;
+  u1 *_code;
+  u4 _size;
+  JavaBtExit *_exits;
+  u4 _numExits;
+  JavaBtBlock *_next;           /* in its bucket */
+
+public:
+  JavaBtBlock(JavaVMMethod *m, u4 pc) :
+    _method(m), _pc(pc), _code(0), _size(0), _exits(0), _numExits(0),
+    _next(0) { }
+  ~JavaBtBlock() { }
+
+  GET_SET(JavaVMMethod *, _method, method);
+  GET_SET(u4, _pc, pc);
+  GET_SET(u1 *, _code, code);
+  GET_SET(u4, _size, size);
+  GET_SET(JavaBtExit *, _exits, exits);
+  GET_SET(u4, _numExits, numExits);
+  GET_SET(JavaBtBlock *, _next, next);
+};
+
+/* emits the code of one block */
+class JavaBtTranslator {
+private:
+  /* an exit stub: restores EDI if the block was 'off' slots away from
+     it, and returns the exit to the dispatcher */
+  struct JavaBtStub {
+    int label;
+    u4 pc;
+    s4 off;
+    u1 kind;
+    u4 jump;                    /* offset of the chaining rel32, or 0 */
+    u4 imm;                     /* offset of the exit's address */
+  };
+
+  JavaVMMethod *_method;
+  u4 _pc;
+  JavaCodeBuffer _buf;
+  std::vector<JavaBtStub> _stubs;
+  s4 _off;                      /* operand stack top, in slots from EDI */
+
+  JavaMem slot(s4 i) const { return JavaMem(JavaEDI, 4 * (_off + i)); }
+  JavaMem local(u4 i) const { return JavaMem(JavaESI, -4 * (s4) i); }
+  void push(JavaRegE r) { _off--; _buf.mov(slot(0), r); }
+  void pushImm(u4 v) { _off--; _buf.movImm(slot(0), v); }
+  void pushImm2(uint64 v);
+  void flush();
+
+  int stub(u4 pc, u1 kind);
+  void exitTo(u4 pc);
+  void backedge(u4 target);
+  void nullCheck(JavaRegE r, u4 pc);
+  void indexCheck(JavaRegE array, JavaRegE index, u4 pc);
+  void loadField(JavaRegE d, const JavaMem &m, char type);
+  void storeField(const JavaMem &m, JavaRegE s, char type);
+  void branch(JavaCondCodeE c, u4 pc, s4 offset, u4 next);
+  int translate(u4 pc);
+
+public:
+  JavaBtTranslator(JavaVMMethod *m, u4 pc);
+  ~JavaBtTranslator() { }
+
+  /* emits the block; false if the instruction at its pc is one blocks do
+     not do */
+  bool translate();
+
+  /* places the code at 'mem' and fills in 'b', whose exits it allocates */
+  void install(u1 *mem, JavaBtBlock *b);
+
+  u4 size() const { return _buf.size(); }
+};
+
+/* enters block code with locals and the operand stack pointer; the exit
+   taken comes back, with '*sp' moved to where the block left it */
+typedef JavaBtExit *(*JavaBtEnter)(u4 *locals, u4 **sp, const u1 *code);
+
+class JavaBt {
+private:
+  static JavaSpinLock _lock;    /* guards the cache and chaining */
+  static JavaBtBlock *_table[JAVA_BT_HASH_SIZE];
+  static JavaBtEnter _enter;
+  static u1 *_codeTop;          /* of the current chunk */
+  static u1 *_codeEnd;
+  static u4 _codeBytes;
+  static u4 _numBlocks;
+  static u4 _numChained;
+  static volatile u4 _numRuns;
+  static volatile u4 _numExits;
+
+  static u1 *allocCode(u4 size);
+  static JavaBtBlock *lookup(JavaVMMethod *m, u4 pc);
+  static JavaBtBlock *translate(JavaVMMethod *m, u4 pc);
+  static void chain(JavaBtExit *e, JavaBtBlock *to);
+
+public:
+  /* makes the entry stub; until then loops are interpreted */
+  static void init();
+  static bool enabled() { return _enter != 0; }
+
+  /* runs 'f' from its pc as translation blocks until one leaves for the
+     interpreter, then updates the frame's pc and operand stack.  returns
+     OSR code to take over the frame at its pc if the loop got hot enough
+     for it, else 0 */
+  static JavaOsrEntry run(JavaVMFrame *f);
+
+  static void dumpStats();
+};
+
+#endif /* JAVA_BT_H */
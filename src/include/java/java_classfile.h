@@ -244,6 +244,8 @@ public:
   ~JavaFieldInfo() { }
 
   GET_SET(u2, _accessFlags, accessFlags);
+  GET_SET(u2, _nameIndex, nameIndex);
+  GET_SET(u2, _descIndex, descIndex);
   
   std::vector<JavaAttr *>& attributes() { return _attributes; }
 };
@@ -265,6 +267,8 @@ public:
   ~JavaMethodInfo() { }
 
   GET_SET(u2, _accessFlags, accessFlags);
+  GET_SET(u2, _nameIndex, nameIndex);
+  GET_SET(u2, _descIndex, descIndex);
   GET_SET(JavaCodeAttr *, _codeAttr, codeAttr);
 
   std::vector<JavaAttr *>& attributes() { return _attributes; }
@@ -0,0 +1,79 @@
+/**
+ * @file java_codecache.h
+ * @brief the VM's side of the code cache: executable memory for compiled
+ *        code by segment, and the sweeper that gives back the memory of
+ *        code that is no longer used or has gone cold
+ *
+ * @author cjeong
+ */
+#ifndef JAVA_CODECACHE_H
+#define JAVA_CODECACHE_H
+
+#include <vector>
+#include "java/java_base.h"
+#include "java/java_trans.h"
+
+/* segments, numbered as the kernel's code cache numbers them */
+enum JavaCodeSegmentE {
+  JavaCodeStubs = 0,
+  JavaCodeBaseline,
+  JavaCodeOptimized
+};
+
+/* compiled code whose method's counters have not moved for this many
+   sweeps is cold; the method goes back to the interpreter */
+#define JAVA_CODE_COLD_SWEEPS     4
+
+/* the cache is swept after this many compilations, and whenever a
+   segment is full */
+#define JAVA_CODE_SWEEP_INTERVAL  64
+
+/* the kernel's code cache; see kern/codecache.h */
+struct JavaCodeCacheOps {
+  void *(*alloc)(int seg, u4 size);
+  void (*retire)(void *code);           /* frees it once nothing runs it */
+  u4 (*sweep)();                        /* frees retired code */
+};
+
+class JavaCodeCache {
+private:
+  static JavaCodeCacheOps _ops;
+  static JavaSpinLock _lock;            /* guards _code */
+  static std::vector<JavaCompiledMethod *> _code;
+  static volatile u4 _numSinceSweep;
+  static volatile u4 _numFull;
+  static u4 _numSweeps;
+  static u4 _numStale;
+  static u4 _numCold;
+  static volatile u4 _bytesRetired;
+
+  static bool referenced(JavaCompiledMethod *cm);
+  static bool hasOptimizedOsr(JavaVMMethod *m);
+
+public:
+  /* without it, code comes from the heap, which the kernel maps
+     executable, and is never freed */
+  static void init(const JavaCodeCacheOps *ops);
+
+  /* 'size' bytes for code of 'tier'; sweeps and tries again if the
+     segment is full, and returns 0 if it still is */
+  static u1 *alloc(u1 tier, u4 size);
+
+  /* 'size' bytes in the stubs segment, for code that is kept for good;
+     it is neither tracked nor swept */
+  static u1 *allocStub(u4 size);
+
+  /* starts tracking installed code; sweeps every
+     JAVA_CODE_SWEEP_INTERVAL calls */
+  static void add(JavaCompiledMethod *cm);
+
+  /* retires code that neither a method entry nor an OSR point leads to
+     any more, and sends methods whose code has gone cold back to the
+     interpreter.  methods with optimized OSR code are left alone: a loop
+     running in it moves no counter */
+  static void sweep();
+
+  static void dumpStats();
+};
+
+#endif /* JAVA_CODECACHE_H */
@@ -0,0 +1,85 @@
+/**
+ * @file java_compiler.h
+ * @brief tiered compilation policy and the background compiler thread
+ *
+ * @author cjeong
+ */
+#ifndef JAVA_COMPILER_H
+#define JAVA_COMPILER_H
+
+#include "java/java_vm.h"
+#include "java/java_trans.h"
+
+/* a method moves up a tier once either of its counters reaches the
+   tier's threshold; backedge thresholds are higher since one call of a
+   loopy method takes many backedges */
+#define JAVA_TIER1_INVOCATIONS    1000
+#define JAVA_TIER1_BACKEDGES     10000
+#define JAVA_TIER2_INVOCATIONS   10000
+#define JAVA_TIER2_BACKEDGES    100000
+
+/* pending compilations; requests beyond this are dropped and made again
+   the next time the method's counters are checked */
+#define JAVA_COMPILE_QUEUE_SIZE  256
+
+/* a queued compilation: the whole method, or its OSR entry at a loop
+   header */
+struct JavaCompileTask {
+  JavaVMMethod *method;
+  u4 osrPc;                     /* JAVA_NO_OSR for the whole method */
+};
+
+class JavaCompiler {
+private:
+  static JavaSpinLock _lock;    /* guards the queue */
+  static JavaCompileTask _queue[JAVA_COMPILE_QUEUE_SIZE];
+  static u4 _head;
+  static u4 _count;
+  static JavaVMThread *_thread; /* the compiler thread; 0 until started */
+  static volatile u4 _numCompiled[JAVA_TIER_OPTIMIZED + 1];
+  static volatile u4 _numOsr;
+  static volatile u4 _numFailed;
+  static volatile u4 _numDropped;
+
+  static bool enqueue(JavaVMMethod *m, u4 osrPc);
+  static bool dequeue(JavaCompileTask *task);
+  static void perform(JavaVMMethod *m, u4 osrPc);
+  static void request(JavaVMMethod *m, u4 osrPc, volatile u4 *requested,
+                      u4 queued, u4 want);
+
+public:
+  /* the tier a method's counters call for */
+  static u1 tierFor(JavaVMMethod *m);
+
+  /* called when one of 'm's counters may have crossed a threshold;
+     queues the method for the tier it now qualifies for, unless it is
+     already there or queued for it.  until the compiler thread is
+     started, the method is compiled right away on the calling thread */
+  static void checkTier(JavaVMMethod *m);
+
+  /* called from a hot loop about to run its header at 'pc' again: does
+     checkTier(), asks for optimized OSR code at 'pc' once the counters
+     call for the optimizing tier, and returns the best OSR code there
+     is for 'pc' so far, or 0 */
+  static JavaOsrEntry checkOsr(JavaVMMethod *m, u4 pc);
+
+  /* compiles 'm' for 'tier' and installs the code; false if the tier's
+     compiler turned the method down */
+  static bool compile(JavaVMMethod *m, u1 tier);
+
+  /* compiles optimized OSR code for the loop header at 'pc' of 'm' */
+  static bool compileOsr(JavaVMMethod *m, u4 pc);
+
+  /* the compiler thread's body, run on 't'; compiles queued methods
+     and pause()s while the queue is empty.  mutators only queue a
+     method and keep running at their current tier */
+  static void run(JavaVMThread *t);
+
+  /* compiles everything queued on the calling thread */
+  static void drain();
+
+  static u4 queueLength() { return _count; }
+  static void dumpStats();
+};
+
+#endif /* JAVA_COMPILER_H */
@@ -0,0 +1,86 @@
+/**
+ * @file java_deopt.h
+ * @brief deoptimization: leaving optimized code for the interpreter where
+ *        one of its speculations fails, and invalidating code whose class
+ *        hierarchy assumptions a newly loaded class breaks
+ *
+ * @author cjeong
+ */
+#ifndef JAVA_DEOPT_H
+#define JAVA_DEOPT_H
+
+#include <vector>
+#include "java/java_vm.h"
+
+/* traps at one deopt point after which the compiled method is thrown
+   away and profiled again in the interpreter */
+#define JAVA_DEOPT_RECOMPILE  16
+
+/* where the value of a local or stack slot is when the code traps: a
+   register, as saved by the trap's pushad; a slot of the compiled frame,
+   at an offset from ebp; a constant; or nowhere, for a dead local */
+struct JavaDeoptValue {
+  enum { Reg, Frame, Const, Dead } kind;
+  s4 v;
+};
+
+/* one interpreter frame to rebuild.  the innermost frame resumes at the
+   invoke it was about to make and makes it; the ones it was inlined into
+   resume after their invoke, with the result of the inner frame pushed */
+struct JavaDeoptFrame {
+  JavaVMMethod *method;
+  u4 pc;                        /* of the invoke */
+  u4 first;                     /* index of its first value */
+  u2 numLocals;
+  u2 numStack;                  /* from the bottom */
+};
+
+/* what the compiler records for each place its code can trap */
+struct JavaDeoptPoint {
+  JavaVMMethod *method;         /* the compiled method */
+  const char *reason;
+  std::vector<JavaDeoptFrame> frames;   /* innermost first */
+  std::vector<JavaDeoptValue> values;   /* locals, then the stack */
+  volatile u4 traps;
+};
+
+class JavaDeopt {
+private:
+  /* compiled methods that inlined a method on the assumption that no
+     loaded class overrides it */
+  struct JavaDependency {
+    JavaVMMethod *assumed;
+    JavaVMMethod *dependent;
+  };
+
+  static JavaSpinLock _lock;    /* guards _deps */
+  static std::vector<JavaDependency> _deps;
+  static volatile u4 _numTraps;
+  static volatile u4 _numInvalidated;
+
+  static uint64 resume(JavaDeoptPoint *p, u4 frame, u4 *regs,
+                       JavaVMFrame *prev);
+
+public:
+  /* called from compiled code at 'p' with the registers as pushad left
+     them at 'regs': rebuilds the interpreter frames 'p' describes, runs
+     them to completion and returns what the compiled method returns */
+  static uint64 deoptimize(JavaDeoptPoint *p, u4 *regs);
+
+  /* sends 'm' back to the interpreter with fresh counters, its OSR code
+     included; activations already running its code finish there, and
+     the code cache frees the code after them */
+  static void invalidate(JavaVMMethod *m);
+
+  /* records that the code of 'dependent' inlined 'assumed' as the only
+     implementation of its vtable slot */
+  static void addDependency(JavaVMMethod *assumed, JavaVMMethod *dependent);
+
+  /* called when a class being loaded overrides 'm'; invalidates the
+     methods that depend on 'm' not being overridden */
+  static void overridden(JavaVMMethod *m);
+
+  static void dumpStats();
+};
+
+#endif /* JAVA_DEOPT_H */
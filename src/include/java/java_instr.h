@@ -18,8 +18,8 @@
 #define JOP_ICONST_3         0x06
 #define JOP_ICONST_4         0x07
 #define JOP_ICONST_5         0x08
-#define JOP_LCONST_1         0x09
-#define JOP_LCONST_2         0x0A
+#define JOP_LCONST_0         0x09
+#define JOP_LCONST_1         0x0A
 #define JOP_FCONST_0         0x0B
 #define JOP_FCONST_1         0x0C
 #define JOP_FCONST_2         0x0D
@@ -223,11 +223,23 @@
 
 typedef struct {
   const char *str;    /* opcode string */
-  int size;           /* size of the opcode in bytes */
+  int size;           /* size of the opcode in bytes; 0 if it varies */
 } jop_info_t, *jop_p;
 
 extern const jop_info_t jop_info[];
 
+/* big-endian operand fetches from the code array */
+static inline u2 jopU2(const u1 *p) { return (u2) (p[0] << 8 | p[1]); }
+static inline s2 jopS2(const u1 *p) { return (s2) jopU2(p); }
+static inline s4 jopS4(const u1 *p)
+{
+  return (s4) ((u4) p[0] << 24 | (u4) p[1] << 16 | (u4) p[2] << 8 | p[3]);
+}
+
+/* length in bytes of the instruction at 'pc', including the padding and
+   tables of TABLESWITCH and LOOKUPSWITCH and the WIDE prefix */
+u4 jopLength(const u1 *code, u4 pc);
+
 
 /* Java virtual machine instruction */
 class JavaInstr {
@@ -264,7 +276,7 @@ public:
 };
 
 /* ACONST_NUL, ICONST_M1, ICONST_0, ICONST_1, ICONST_2, ICONST_3, ICONST_4,
-   ICONST_5, LCONST_1, LCONST_2, FCONST_0, FCONST_1, FCONST_2, DCONST_0,
+   ICONST_5, LCONST_0, LCONST_1, FCONST_0, FCONST_1, FCONST_2, DCONST_0,
    DCONST_1 */
 class JavaConstInstr : public JavaInstr {
 public:
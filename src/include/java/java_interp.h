@@ -0,0 +1,27 @@
+/**
+ * @file java_interp.h
+ * @brief bytecode interpreter; every method starts out here and moves to
+ *        compiled code once it gets hot
+ *
+ * @author cjeong
+ */
+#ifndef JAVA_INTERP_H
+#define JAVA_INTERP_H
+
+#include "java/java_vm.h"
+
+class JavaInterp {
+public:
+  /* the JavaEntry of every method that has not been compiled: counts the
+     invocation, asks the compilation policy for a higher tier once the
+     method gets warm, and interprets it until compiled code is in place */
+  static uint64 entry(JavaVMMethod *m, u4 *args);
+
+  /* interprets one invocation of 'm' without counting it */
+  static uint64 interpret(JavaVMMethod *m, u4 *args);
+
+  /* runs 'f' from its current pc until its method returns */
+  static uint64 execute(JavaVMFrame *f);
+};
+
+#endif /* JAVA_INTERP_H */
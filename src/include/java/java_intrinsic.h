@@ -0,0 +1,63 @@
+/**
+ * @file java_intrinsic.h
+ * @brief intrinsics: hand-written code for hot library methods, bound in
+ *        place of their bytecode or native stub when their class is loaded
+ *
+ * @author cjeong
+ */
+#ifndef JAVA_INTRINSIC_H
+#define JAVA_INTRINSIC_H
+
+#include "java/java_vm.h"
+
+/* the methods with an intrinsic; JavaVMMethod::intrinsic() holds one */
+enum JavaIntrinsicE {
+  JavaIntrinsicNone,
+  JavaIntrinsicArraycopy,       /* System.arraycopy */
+  JavaIntrinsicStringEquals,    /* String.equals */
+  JavaIntrinsicStringHashCode,  /* String.hashCode */
+  JavaIntrinsicMinI,            /* Math.min, max and abs of int */
+  JavaIntrinsicMaxI,
+  JavaIntrinsicAbsI,
+  JavaIntrinsicMinJ,            /* and of long */
+  JavaIntrinsicMaxJ,
+  JavaIntrinsicAbsJ,
+  JavaIntrinsicFill             /* Arrays.fill of a primitive array */
+};
+
+/* an intrinsic is a JavaEntry, so the interpreter and compiled code reach
+   it through the method's entry like any other code; methods bound to one
+   are never compiled.  the float and double forms of Math.min, max and abs
+   are left to their bytecode, for NaN and -0.0 */
+class JavaIntrinsic {
+private:
+  /* offsets of String's fields; 0 if it has none of that name */
+  static u2 _stringValue;       /* char[] value */
+  static u2 _stringHash;        /* int hash, the cached hashCode */
+
+  static bool stringLayout(JavaVMClass *c);
+
+  static uint64 arraycopy(JavaVMMethod *m, u4 *args);
+  static uint64 stringEquals(JavaVMMethod *m, u4 *args);
+  static uint64 stringHashCode(JavaVMMethod *m, u4 *args);
+  static uint64 minI(JavaVMMethod *m, u4 *args);
+  static uint64 maxI(JavaVMMethod *m, u4 *args);
+  static uint64 absI(JavaVMMethod *m, u4 *args);
+  static uint64 minJ(JavaVMMethod *m, u4 *args);
+  static uint64 maxJ(JavaVMMethod *m, u4 *args);
+  static uint64 absJ(JavaVMMethod *m, u4 *args);
+  static uint64 fill(JavaVMMethod *m, u4 *args);
+
+public:
+  /* looks 'm' up by class, name and descriptor, and if it has an
+     intrinsic makes that its entry; 'm' must have its class */
+  static void bind(JavaVMMethod *m);
+
+  /* true for intrinsics short enough that the optimizing compiler does
+     better inlining the method's bytecode than calling them */
+  static bool isArithmetic(u1 id) {
+    return id >= JavaIntrinsicMinI && id <= JavaIntrinsicAbsJ;
+  }
+};
+
+#endif /* JAVA_INTRINSIC_H */
@@ -0,0 +1,99 @@
+/**
+ * @file java_monitor.h
+ * @brief Java object monitors; thin locks in the object header that are
+ *        inflated to a full monitor only on contention
+ *
+ * @author cjeong
+ */
+#ifndef JAVA_MONITOR_H
+#define JAVA_MONITOR_H
+
+#include "java/java_base.h"
+#include "java/java_object.h"
+
+/* how many times a thread re-reads a thin lock held by another thread
+   before giving up and inflating it; most critical sections in the
+   collection classes are a handful of instructions long */
+#define JAVA_THIN_SPINS  64
+
+class JavaVMThread;
+
+/* an inflated monitor; installed in the object header (see java_object.h)
+   and keeps the displaced, unlocked form of that header so that the class
+   index, GC age and identity hash survive inflation
+
+   locking protocol:
+   - an unlocked, unhashed object is thin-locked by CAS'ing the owner's
+     thread id into the header; re-entry bumps the count in the header
+   - a contender spins for a while and then inflates the lock by CAS'ing
+     a monitor pointer into the header; the thin owner becomes the monitor
+     owner, with its recursion count carried over
+   - every header update is a CAS, so an owner releasing a thin lock that
+     got inflated under it notices and releases the monitor instead
+   - threads that lose on an inflated monitor queue up on the entry queue
+     and pause() until the releasing thread resume()s them */
+class JavaMonitor {
+private:
+  static volatile u4 _numInflations;
+
+  JavaObject *_object;
+  volatile u4 _displaced;
+  volatile u4 _owner;           /* thread id of the owner; 0 if free */
+  u4 _recursions;               /* re-entries by the owner */
+  JavaSpinLock _qlock;          /* guards the queues below */
+  JavaVMThread *_entryq;        /* threads blocked in enter(), FIFO */
+  JavaVMThread *_waitq;         /* threads in Object.wait(), FIFO */
+
+  static void enqueue(JavaVMThread **q, JavaVMThread *t);
+  static JavaVMThread *dequeue(JavaVMThread **q);
+  static bool unlink(JavaVMThread **q, JavaVMThread *t);
+
+  /* release ownership and wake the first blocked entrant, if any */
+  void release();
+
+public:
+  JavaMonitor(JavaObject *o, u4 d) :
+    _object(o), _displaced(d), _owner(0), _recursions(0),
+    _entryq(0), _waitq(0) { }
+  ~JavaMonitor() { }
+
+  GET_SET(JavaObject *, _object, object);
+  GET_SET(u4, _displaced, displaced);
+  volatile u4 *displacedAddr() { return &_displaced; }
+  GET_SET(u4, _owner, owner);
+
+  /* the header word that refers to this monitor */
+  u4 inflatedHeader() const {
+    return (u4) (uintptr) this | JAVA_LOCK_INFLATED;
+  }
+
+  /* the monitor referred to by an inflated header word */
+  static JavaMonitor *fromHeader(u4 h) {
+    return (JavaMonitor *) (uintptr) (h & JAVA_HDR_ADDR_MASK);
+  }
+
+  /* operations on an inflated monitor; exit(), wait() and notify() return
+     false if 't' does not own the monitor (IllegalMonitorStateException) */
+  void enter(JavaVMThread *t);
+  bool exit(JavaVMThread *t);
+  bool wait(JavaVMThread *t);
+  bool notify(JavaVMThread *t, bool all);
+
+  /* makes sure 'o' has an inflated monitor and returns it */
+  static JavaMonitor *inflate(JavaObject *o);
+
+  /* how many monitors inflate() has installed so far */
+  static u4 numInflations() { return _numInflations; }
+
+  /* JOP_MONITORENTER and JOP_MONITOREXIT, and entry to and exit from an
+     ACC_SYNCHRONIZED method; unlock() returns false if 't' does not own
+     the lock on 'o' */
+  static void lock(JavaObject *o, JavaVMThread *t);
+  static bool unlock(JavaObject *o, JavaVMThread *t);
+
+  /* Object.wait(), Object.notify() and Object.notifyAll() */
+  static bool wait(JavaObject *o, JavaVMThread *t);
+  static bool notify(JavaObject *o, JavaVMThread *t, bool all);
+};
+
+#endif /* JAVA_MONITOR_H */
@@ -0,0 +1,159 @@
+/**
+ * @file java_object.h
+ * @brief Java object layout; compact one-word object header and the
+ *        indexed class table used to expand its class index
+ *
+ * @author cjeong
+ */
+#ifndef JAVA_OBJECT_H
+#define JAVA_OBJECT_H
+
+#include <vector>
+#include "java/java_base.h"
+
+/* every Java object starts with a single 32-bit header word; the two low
+   bits give the lock state and decide how the rest of the word is read:
+
+    31                  16 15               6 5      2 1   0
+   +----------------------+------------------+--------+-----+
+   |     class index      |   identity hash  | GC age |  00 |  unlocked
+   +----------------------+--------+---------+--------+-----+
+   |     class index      | owner  |  count  | GC age |  01 |  thin-locked
+   +----------------------+--------+---------+--------+-----+
+   |         address of the inflated JavaMonitor      |  10 |  inflated
+   +--------------------------------------------------+-----+
+   |         forwarding address (GC only)             |  11 |  forwarded
+   +--------------------------------------------------+-----+
+
+   when the lock is inflated, the unlocked form of the header (the
+   "displaced" header) is kept in the monitor; monitors and objects are
+   word aligned, so their addresses always have the two low bits free;
+   a zero identity hash means that the hash has not been assigned yet */
+#define JAVA_HDR_LOCK_BITS         2
+#define JAVA_HDR_LOCK_SHIFT        0
+#define JAVA_HDR_LOCK_MASK         0x00000003
+#define JAVA_HDR_AGE_BITS          4
+#define JAVA_HDR_AGE_SHIFT         2
+#define JAVA_HDR_AGE_MASK          0x0000003C
+#define JAVA_HDR_HASH_BITS         10
+#define JAVA_HDR_HASH_SHIFT        6
+#define JAVA_HDR_HASH_MASK         0x0000FFC0
+#define JAVA_HDR_CLASS_BITS        16
+#define JAVA_HDR_CLASS_SHIFT       16
+#define JAVA_HDR_CLASS_MASK        0xFFFF0000
+#define JAVA_HDR_ADDR_MASK         (~JAVA_HDR_LOCK_MASK)
+
+/* thin lock payload; overlays the identity hash bits, so only objects that
+   were never hashed can be thin-locked; the count is the number of times
+   the owner re-entered the lock */
+#define JAVA_HDR_COUNT_BITS        3
+#define JAVA_HDR_COUNT_SHIFT       6
+#define JAVA_HDR_COUNT_MASK        0x000001C0
+#define JAVA_HDR_OWNER_BITS        7
+#define JAVA_HDR_OWNER_SHIFT       9
+#define JAVA_HDR_OWNER_MASK        0x0000FE00
+
+/* lock states */
+#define JAVA_LOCK_UNLOCKED         0x0
+#define JAVA_LOCK_THIN             0x1
+#define JAVA_LOCK_INFLATED         0x2
+#define JAVA_LOCK_FORWARDED        0x3
+
+/* limits implied by the header format */
+#define JAVA_MAX_CLASSES           (1 << JAVA_HDR_CLASS_BITS)
+#define JAVA_MAX_AGE               ((1 << JAVA_HDR_AGE_BITS) - 1)
+#define JAVA_MAX_HASH              ((1 << JAVA_HDR_HASH_BITS) - 1)
+#define JAVA_THIN_MAX_COUNT        ((1 << JAVA_HDR_COUNT_BITS) - 1)
+#define JAVA_THIN_MAX_OWNER        ((1 << JAVA_HDR_OWNER_BITS) - 1)
+
+/* class index 0 is never handed out, so a zeroed header is never mistaken
+   for a valid object */
+#define JAVA_CLASS_INDEX_INVALID   0
+
+/* header field extraction and construction; these work on the unlocked
+   (or displaced) form of the header */
+#define JAVA_HDR_LOCK(h)   (((h) & JAVA_HDR_LOCK_MASK) >> JAVA_HDR_LOCK_SHIFT)
+#define JAVA_HDR_AGE(h)    (((h) & JAVA_HDR_AGE_MASK) >> JAVA_HDR_AGE_SHIFT)
+#define JAVA_HDR_HASH(h)   (((h) & JAVA_HDR_HASH_MASK) >> JAVA_HDR_HASH_SHIFT)
+#define JAVA_HDR_CLASS(h)  (((h) & JAVA_HDR_CLASS_MASK) >> JAVA_HDR_CLASS_SHIFT)
+#define JAVA_HDR_MAKE(cls) (((u4) (cls)) << JAVA_HDR_CLASS_SHIFT)
+
+/* thin lock fields; valid only when the lock state is JAVA_LOCK_THIN */
+#define JAVA_HDR_OWNER(h)  (((h) & JAVA_HDR_OWNER_MASK) >> JAVA_HDR_OWNER_SHIFT)
+#define JAVA_HDR_COUNT(h)  (((h) & JAVA_HDR_COUNT_MASK) >> JAVA_HDR_COUNT_SHIFT)
+
+class JavaVMClass;
+class JavaMonitor;
+
+/* a Java object as laid out in the heap; instance fields follow the
+   header directly (see JavaVMClass::layout) */
+class JavaObject {
+protected:
+  volatile u4 _header;
+
+public:
+  /* the raw header word; may be in any lock state */
+  u4 header() const { return _header; }
+  void header(u4 h) { _header = h; }
+  volatile u4 *headerAddr() { return &_header; }
+
+  u4 lockState() const { return JAVA_HDR_LOCK(_header); }
+
+  /* the unlocked form of the header; follows an inflated header to the
+     monitor that displaced it */
+  u4 displacedHeader() const;
+
+  u2 classIndex() const { return JAVA_HDR_CLASS(displacedHeader()); }
+  JavaVMClass *javaClass() const;
+
+  u1 age() const { return JAVA_HDR_AGE(displacedHeader()); }
+
+  /* returns the identity hash, assigning one on first use */
+  u2 identityHash();
+
+  /* raw field access by byte offset from the start of the object */
+  char *fieldAddr(u4 offset) { return (char *) this + offset; }
+};
+
+/* arrays carry their length right after the header; elements follow.
+   compiled code reaches into arrays at these offsets */
+#define JAVA_ARRAY_LENGTH_OFFSET  4
+#define JAVA_ARRAY_DATA_OFFSET    8
+
+class JavaArray : public JavaObject {
+protected:
+  u4 _length;
+
+public:
+  GET_SET(u4, _length, length);
+
+  char *elements() { return (char *) (this + 1); }
+};
+
+/* maps the compressed class index stored in object headers back to the
+   runtime class; indices are handed out in load order and never reused */
+class JavaClassTable {
+private:
+  std::vector<JavaVMClass *> _classes;
+
+  JavaClassTable();
+
+public:
+  ~JavaClassTable() { }
+
+  static JavaClassTable *instance();
+
+  /* assigns the next free index to 'c'; returns JAVA_CLASS_INDEX_INVALID
+     when the header's class index field is exhausted */
+  u2 registerClass(JavaVMClass *c);
+
+  JavaVMClass *classAt(u2 idx) const { return _classes[idx]; }
+  int numClasses() const { return _classes.size() - 1; }
+};
+
+inline JavaVMClass *JavaObject::javaClass() const
+{
+  return JavaClassTable::instance()->classAt(classIndex());
+}
+
+#endif /* JAVA_OBJECT_H */
@@ -0,0 +1,319 @@
+/**
+ * @file java_opt.h
+ * @brief the optimizing compiler: an SSA IR built from the bytecode,
+ *        scalar optimizations on it, linear-scan register allocation and
+ *        x86-32 code generation
+ *
+ * @author cjeong
+ */
+#ifndef JAVA_OPT_H
+#define JAVA_OPT_H
+
+#include <vector>
+#include <map>
+#include "java/java_base.h"
+#include "java/java_trans.h"
+
+class JavaVMMethod;
+class JavaVMClass;
+struct JavaDeoptPoint;
+
+/* inlining limits; JavaOptimizer::inlineLimits() changes them */
+#define JAVA_INLINE_MAX_SIZE     35   /* bytes of bytecode in a callee */
+#define JAVA_INLINE_MAX_DEPTH     4   /* nested inlined calls */
+#define JAVA_INLINE_BUDGET      400   /* inlined bytecode per compilation */
+
+/* a receiver class must account for at least this share of the profiled
+   calls at a virtual call site to get a guarded inline copy */
+#define JAVA_INLINE_MIN_PERCENT  10
+
+/* IR operations.  every value is 32 bits, an int or a reference; methods
+   that use long, float or double values stay with the baseline compiler */
+enum JavaIrOpE {
+  JavaIrConst,                  /* imm */
+  JavaIrParam,                  /* imm: local index */
+  JavaIrPhi,                    /* args: one per predecessor */
+  JavaIrAdd, JavaIrSub, JavaIrMul, JavaIrDiv, JavaIrRem,
+  JavaIrAnd, JavaIrOr, JavaIrXor,
+  JavaIrShl, JavaIrShr, JavaIrUshr,
+  JavaIrNeg,
+  JavaIrNullCheck,              /* traps if args[0] is null */
+  JavaIrBoundsCheck,            /* traps unless 0 <= args[0] < args[1] */
+  JavaIrArrayLength,            /* of a non-null array */
+  JavaIrArrayLoad,              /* args: array, index */
+  JavaIrArrayStore,             /* args: array, index, value */
+  JavaIrLoad,                   /* args: object, or none for a static;
+                                   imm: offset or address */
+  JavaIrStore,                  /* args: [object,] value */
+  JavaIrCall,                   /* method; args as pushed; type: result;
+                                   imm: JavaIrCallE */
+  JavaIrIf,                     /* args: a, b; imm: JavaCondCodeE; taken
+                                   edge is succs[0] */
+  JavaIrGoto,
+  JavaIrReturn,                 /* args: the result, if any */
+  JavaIrDeopt                   /* continues in the interpreter; args: the
+                                   live values of 'state'; imm:
+                                   JavaIrDeoptE */
+};
+
+/* how a JavaIrCall finds its target */
+enum JavaIrCallE {
+  JavaIrCallDirect,             /* through the method's entry */
+  JavaIrCallVirtual,            /* through the receiver's vtable */
+  JavaIrCallInterface
+};
+
+/* the speculation a JavaIrDeopt backs out of */
+enum JavaIrDeoptE {
+  JavaIrDeoptClass,             /* no receiver class guard matched */
+  JavaIrDeoptHierarchy          /* the inlined method was overridden */
+};
+
+struct JavaIrBlock;
+struct JavaIrInstr;
+
+/* the interpreter frame a call is made from, for rebuilding it when
+   code inlined at the call deoptimizes; the frames of the calls it was
+   itself inlined into follow 'caller' */
+struct JavaIrState {
+  JavaVMMethod *method;
+  u4 pc;                        /* of the invoke */
+  u4 args;                      /* argument slots on top of 'stack' */
+  std::vector<JavaIrInstr *> locals;    /* by index; 0 if dead */
+  std::vector<JavaIrInstr *> stack;     /* bottom first */
+  JavaIrState *caller;
+};
+
+struct JavaIrInstr {
+  JavaIrOpE op;
+  int id;
+  s4 imm;
+  char type;                    /* 'I', 'L', or 'V' if it has no value */
+  char elem;                    /* memory accesses: 'I', 'L', 'B', 'C' or 'S' */
+  u4 pc;                        /* of the bytecode it came from */
+  JavaVMMethod *method;
+  std::vector<JavaIrInstr *> args;
+  JavaIrState *state;           /* calls and deopts; 0 otherwise */
+  JavaIrBlock *block;
+  JavaIrInstr *forward;         /* replacement once removed, or 0 */
+  bool removed;                 /* dropped without a replacement */
+
+  /* register allocation */
+  std::vector<std::pair<int, int> > ranges;  /* where live, in order */
+  int from, to;                 /* the hull of the ranges */
+  u4 weight;                    /* uses, weighted by loop depth */
+  JavaRegE reg;
+  s4 spill;                     /* frame offset if not in a register */
+
+  bool hasValue() const { return type != 'V'; }
+};
+
+struct JavaIrBlock {
+  int id;
+  u4 pc;                        /* first bytecode; ~0 if inserted */
+  u4 endPc;
+  std::vector<JavaIrInstr *> phis;
+  std::vector<JavaIrInstr *> code;  /* the last one ends the block */
+  std::vector<JavaIrBlock *> preds;
+  std::vector<JavaIrBlock *> succs;
+  JavaIrBlock *idom;
+  std::vector<JavaIrBlock *> children;  /* in the dominator tree */
+  int rpo;                      /* -1 if unreachable */
+  int loopDepth;
+  bool sealed;
+  bool filled;
+  int label;
+  int from, to;                 /* positions for the register allocator */
+
+  JavaIrInstr *last() const { return code.empty() ? 0 : code.back(); }
+  void addSucc(JavaIrBlock *s) {
+    succs.push_back(s);
+    s->preds.push_back(this);
+  }
+};
+
+/* a natural loop; 'blocks' is indexed by block id */
+struct JavaIrLoop {
+  JavaIrBlock *header;
+  JavaIrBlock *preheader;
+  std::vector<bool> blocks;
+  u4 size;
+
+  bool contains(JavaIrBlock *b) const {
+    return b->id < (int) blocks.size() && blocks[b->id];
+  }
+};
+
+/* where a value lives during generated code */
+struct JavaIrLoc {
+  enum { Reg, Mem, Imm } kind;
+  s4 v;                         /* register, ebp offset or constant */
+
+  bool operator==(const JavaIrLoc &l) const {
+    return kind == l.kind && v == l.v;
+  }
+};
+
+/* one inlining decision, for the debug dump */
+struct JavaInlineDecision {
+  u4 depth;                     /* 0 for calls in the compiled method */
+  u4 pc;                        /* of the call in 'caller' */
+  JavaVMMethod *caller;
+  JavaVMMethod *callee;
+  JavaVMClass *receiver;        /* the guard's class; 0 if unguarded */
+  bool hierarchy;               /* the only implementation loaded */
+  const char *reason;           /* why not; 0 if inlined */
+};
+
+class JavaOptimizer {
+private:
+  JavaVMMethod *_method;
+  JavaOptimizer *_parent;       /* the caller when building an inlinee */
+  u4 _depth;
+  u4 _osrPc;                    /* loop header entered from a running
+                                   frame, or JAVA_NO_OSR */
+  JavaIrState *_callerState;    /* of the call an inlinee replaces */
+  std::vector<JavaIrBlock *> _blocks;   /* by id; owned */
+  std::vector<JavaIrInstr *> _instrs;   /* by id; owned */
+  std::vector<JavaIrBlock *> _order;    /* reachable blocks in RPO */
+  std::vector<JavaIrLoop *> _loops;     /* innermost first */
+  JavaIrBlock *_entry;
+
+  /* SSA construction: current definition of each local per block */
+  std::vector<std::vector<JavaIrInstr *> > _defs;
+  std::vector<std::vector<JavaIrInstr *> > _incomplete;
+
+  /* deoptimization: the frame state of each call and the locals live at
+     each invoke */
+  std::vector<JavaIrState *> _states;   /* owned */
+  std::map<u4, std::vector<bool> > _liveLocals;
+
+  u4 _pc;                       /* bytecode being translated */
+
+  /* statistics for dump() */
+  u4 _folded, _numbered, _hoisted, _checks;
+
+  /* inlining; kept by the outermost optimizer */
+  u4 _inlinedBytes;
+  std::vector<JavaInlineDecision> _decisions;
+  std::vector<JavaVMMethod *> _assumed; /* inlined as not overridden */
+  static u4 _maxInlineSize, _maxInlineDepth, _inlineBudget;
+  static bool _trace;
+
+  /* code generation */
+  JavaCodeBuffer _buf;
+  std::vector<int> _calls;      /* positions of calls */
+  u4 _numSpills;
+  int _npeLabel, _rangeLabel, _arithLabel;
+  std::vector<JavaDeoptPoint *> _deoptPoints;  /* owned until installed */
+
+  JavaIrInstr *newInstr(JavaIrOpE op, JavaIrBlock *b, char type);
+  JavaIrInstr *newConst(JavaIrBlock *b, s4 v);
+  JavaIrBlock *newBlock(u4 pc);
+  JavaIrInstr *append(JavaIrBlock *b, JavaIrOpE op, char type,
+                      JavaIrInstr *a0 = 0, JavaIrInstr *a1 = 0,
+                      JavaIrInstr *a2 = 0);
+  static JavaIrInstr *resolve(JavaIrInstr *v);
+
+  /* control flow graph */
+  bool buildCfg();
+  void computeOrder();
+  void computeDominators();
+  bool dominates(JavaIrBlock *a, JavaIrBlock *b) const;
+  void findLoops();
+  void insertPreheaders();
+  void removeEdge(JavaIrBlock *from, JavaIrBlock *to);
+  void cleanCfg();
+  void splitCriticalEdges();
+
+  /* SSA construction, after Braun et al. */
+  bool buildIr();
+  bool buildSsa();
+  bool fillBlock(JavaIrBlock *b);
+  void writeLocal(JavaIrBlock *b, u4 local, JavaIrInstr *v);
+  JavaIrInstr *readLocal(JavaIrBlock *b, u4 local);
+  JavaIrInstr *addPhiOperands(u4 local, JavaIrInstr *phi);
+  void sealBlock(JavaIrBlock *b);
+  bool removeTrivialPhis();
+  void resolveArgs();
+  void compact();
+
+  /* frame states for deoptimization */
+  void computeLiveLocals();
+  JavaIrState *newState(JavaIrBlock *b, std::vector<JavaIrInstr *> &st,
+                        u4 args);
+  JavaIrInstr *appendDeopt(JavaIrBlock *b, JavaIrInstr *call,
+                           JavaIrDeoptE reason);
+  JavaDeoptPoint *deoptPoint(JavaIrInstr *v);
+  void installed(JavaVMMethod *m);
+
+  /* inlining */
+  JavaOptimizer *root() { return _parent ? _parent->root() : this; }
+  void inlineCalls();
+  bool inlineCall(JavaIrInstr *call);
+  const char *checkInline(JavaVMMethod *target);
+  u4 decide(JavaIrInstr *call, JavaVMMethod *target, JavaVMClass *k,
+            const char *reason);
+  void absorb(JavaOptimizer *o, JavaIrInstr *call, JavaIrBlock *join,
+              std::vector<JavaIrInstr *> &results);
+  void replaceUses(JavaIrInstr *v, JavaIrInstr *with);
+
+  /* optimizations */
+  void foldConstants();
+  void numberValues();
+  void hoistInvariants();
+  void eliminateChecks();
+  void eliminateDeadCode();
+
+  /* register allocation and code generation */
+  void computeIntervals();
+  void allocateRegisters();
+  JavaIrLoc loc(JavaIrInstr *v) const;
+  JavaMem mem(const JavaIrLoc &l) const { return JavaMem(JavaEBP, l.v); }
+  void load(JavaRegE r, JavaIrInstr *v);
+  void store(JavaIrInstr *v, JavaRegE r);
+  void aluOp(JavaAluE op, JavaRegE d, JavaIrInstr *v);
+  void storeValue(const JavaMem &m, JavaIrInstr *x, char elem);
+  JavaRegE inReg(JavaIrInstr *v, JavaRegE scratch);
+  JavaRegE target(JavaIrInstr *v) const {
+    return v->reg != JavaNoReg ? v->reg : JavaEAX;
+  }
+  void move(const JavaIrLoc &d, const JavaIrLoc &s);
+  void phiMoves(JavaIrBlock *b);
+  void emit(JavaIrInstr *v, JavaIrBlock *next);
+  void emitDivide(JavaIrInstr *v);
+  void emitShift(JavaIrInstr *v);
+  void emitEpilogue();
+  bool generate();
+
+public:
+  JavaOptimizer(JavaVMMethod *m, JavaOptimizer *parent = 0);
+  ~JavaOptimizer();
+
+  /* builds the IR and optimizes it; false if the method uses something
+     this compiler does not handle */
+  bool optimize();
+
+  /* the IR, with register assignments once generated */
+  void dump();
+
+  /* what was inlined where, and why other calls were not */
+  void dumpInlining();
+
+  JavaCodeBuffer& buffer() { return _buf; }
+
+  /* compiles 'm' at JAVA_TIER_OPTIMIZED and installs the code */
+  static bool compile(JavaVMMethod *m);
+
+  /* compiles a JavaOsrEntry for the loop header at 'pc' of 'm' and makes
+     it the method's OSR code there; the rest of the method is left out
+     unless the loop reaches it */
+  static bool compileOsr(JavaVMMethod *m, u4 pc);
+
+  static void inlineLimits(u4 size, u4 depth, u4 budget);
+
+  /* when on, compile() prints the inlining decisions of every method */
+  static void trace(bool on) { _trace = on; }
+};
+
+#endif /* JAVA_OPT_H */
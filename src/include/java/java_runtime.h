@@ -7,6 +7,9 @@
 #ifndef RZ_JAVA_RUNTIME_H
 #define RZ_JAVA_RUNTIME_H
 
+#include "java/java_base.h"
+#include "java/java_instr.h"
+
 
 enum JavaRuntimeLocE {
   JavaLocConstPool,
@@ -16,4 +19,87 @@ enum JavaRuntimeLocE {
   JavaEvalStack
 };
 
+/* exceptions raised by the runtime itself */
+enum JavaExceptionE {
+  JavaNullPointerException,
+  JavaArrayIndexOutOfBoundsException,
+  JavaArithmeticException,
+  JavaNegativeArraySizeException,
+  JavaClassCastException,
+  JavaArrayStoreException,
+  JavaIllegalMonitorStateException,
+  JavaAbstractMethodError,
+  JavaOutOfMemoryError,
+  JavaInternalError
+};
+
+class JavaObject;
+class JavaArray;
+class JavaVMClass;
+class JavaVMMethod;
+class JavaVMThread;
+class JavaVMHeap;
+
+/* services the interpreter and compiled code share.  compiled code calls
+   the static functions below directly with their arguments taken off its
+   operand stack, top first; that is why binary operations take their
+   right-hand operand first, and why everything is passed and returned as
+   raw bits rather than as float or double */
+class JavaRuntime {
+private:
+  static JavaVMHeap *_heap;
+  static JavaVMThread *(*_currentThread)();
+  static JavaVMClass *_arrayClasses[JavaNewInstr::JavaArrayLong + 1];
+  static JavaVMClass *_refArrayClass;
+
+public:
+  /* 'current' returns the VM thread running on the calling CPU */
+  static void init(JavaVMHeap *heap, JavaVMThread *(*current)());
+
+  static JavaVMHeap *heap() { return _heap; }
+  static JavaVMThread *currentThread() {
+    return _currentThread ? _currentThread() : 0;
+  }
+
+  /* array class for a NEWARRAY element type (JavaNewInstr::JavaArrayTypeE);
+     0 gives the class of reference arrays */
+  static JavaVMClass *arrayClass(u1 atype);
+
+  /* exceptions are not dispatched to handlers yet; these report the
+     exception and abort */
+  static void throwException(JavaExceptionE e) __attribute__((__noreturn__));
+  static void throwObject(JavaObject *o) __attribute__((__noreturn__));
+
+  static JavaObject *newObject(JavaVMClass *c);
+  static JavaArray *newArray(JavaVMClass *c, s4 length);
+
+  static void monitorEnter(JavaObject *o);
+  static void monitorExit(JavaObject *o);
+
+  /* method an INVOKEVIRTUAL or INVOKEINTERFACE of 'm' runs for 'recv' */
+  static JavaVMMethod *resolveVirtual(JavaObject *recv, JavaVMMethod *m);
+  static JavaVMMethod *resolveInterface(JavaObject *recv, JavaVMMethod *m);
+
+  static void checkCast(JavaObject *o, JavaVMClass *c);
+  static s4 instanceOf(JavaObject *o, JavaVMClass *c);
+
+  /* arithmetic the templates do not inline; operands are right first */
+  static s8 ldiv(s8 b, s8 a);
+  static s8 lrem(s8 b, s8 a);
+  static u4 frem(u4 b, u4 a);
+  static uint64 drem(uint64 b, uint64 a);
+  static s4 lcmp(s8 b, s8 a);
+  static s4 fcmpl(u4 b, u4 a);
+  static s4 fcmpg(u4 b, u4 a);
+  static s4 dcmpl(uint64 b, uint64 a);
+  static s4 dcmpg(uint64 b, uint64 a);
+
+  /* float to integer conversions: NaN gives 0, and out of range values
+     saturate */
+  static s4 f2i(u4 f);
+  static s8 f2l(u4 f);
+  static s4 d2i(uint64 d);
+  static s8 d2l(uint64 d);
+};
+
 #endif /* RZ_JAVA_RUNTIME_H */
@@ -7,6 +7,25 @@
 #ifndef JAVA_THREAD_H
 #define JAVA_THREAD_H
 
+#include "java/java_base.h"
+
+/* java.lang.Thread priorities */
+#define JAVA_MIN_PRIORITY     1
+#define JAVA_NORM_PRIORITY    5
+#define JAVA_MAX_PRIORITY    10
+#define JAVA_NUM_PRIORITIES  (JAVA_MAX_PRIORITY - JAVA_MIN_PRIORITY + 1)
+
+/* maximum number of CPUs the scheduler keeps run queues for */
+#define JAVA_MAX_CPUS        32
+
+/* a thread is placed on the CPU it last ran on, unless that CPU has more
+   than this many threads queued beyond the least loaded CPU */
+#define JAVA_SCHED_IMBALANCE  2
+
+/* a thread that has waited in a run queue for less than this many TSC
+   cycles is considered cache-hot on that CPU, and is only stolen if the
+   victim queue has other threads to run */
+#define JAVA_SCHED_HOT_CYCLES 500000
 
 enum JavaThreadStateE {
   JavaRunnable,
@@ -19,8 +38,32 @@ enum JavaThreadLocationE {
   JavaInSW
 };
 
+class JavaThreadI;
+
+/* the kernel's threads, on which a JavaVMThread runs and pause()s; see
+   kern/sched.h.  'spawn' starts a kernel thread running fn(arg) on behalf
+   of 'java', the thread's JavaThreadI, and returns its handle, or 0 if it
+   cannot (kthread_create_java() with a name); 'park' blocks the
+   calling thread for as long as '*permit' is 0, and 'unpark' makes
+   'thread', a kernel thread handle, runnable again if it is parked */
+struct JavaThreadOps {
+  void (*park)(volatile u4 *permit);
+  void (*unpark)(void *thread);
+  void *(*spawn)(void *java, void (*fn)(void *), void *arg);
+};
+
+/* per-thread bookkeeping owned by the scheduler */
+struct JavaSchedInfo {
+  JavaThreadI *next;            /* run queue link */
+  int cpu;                      /* CPU whose queue holds it; -1 if none */
+  int lastCpu;                  /* CPU it last ran on; -1 if never ran */
+  uint64 enqueued;              /* TSC when it was queued */
+  void *handle;                 /* the kernel thread that runs it */
+};
+
 class JavaThreadI {
 public:
+  virtual ~JavaThreadI() { }
 
 public:
   /* the state of the thread */
@@ -28,19 +71,99 @@ public:
 
   /* where this thread is executed at this point */
   virtual JavaThreadLocationE getThreadLocation() = 0;
+
+  /* java.lang.Thread priority, JAVA_MIN_PRIORITY..JAVA_MAX_PRIORITY */
+  virtual int getPriority() = 0;
+
+  /* scheduler bookkeeping for this thread */
+  virtual JavaSchedInfo *getSchedInfo() = 0;
 };
 
 
 class JavaThreadSchedulerI {
 public:
   /* add the thread to the scheduler */
-  virtual void addThread(JavaThread *) = 0;
+  virtual void addThread(JavaThreadI *) = 0;
 
   /* get the number of threads in the scheduler */
-  virtual void getNumThreads() = 0;
+  virtual int getNumThreads() = 0;
 
   /* returns the next runnable thread with the highest priority */
   virtual JavaThreadI *pickNextThread() = 0;
 };
 
+
+/* one CPU's run queue: a FIFO per priority level plus a bitmap of the
+   non-empty levels, so the highest runnable priority is a single bsr */
+class JavaRunQueue {
+private:
+  JavaSpinLock _lock;
+  u4 _bitmap;
+  JavaThreadI *_head[JAVA_NUM_PRIORITIES];
+  JavaThreadI *_tail[JAVA_NUM_PRIORITIES];
+  volatile u4 _count;
+
+  JavaThreadI *popLevel(int level);
+
+public:
+  JavaRunQueue();
+  ~JavaRunQueue() { }
+
+  u4 count() const { return _count; }
+
+  void push(JavaThreadI *t);
+
+  /* removes the first thread of the highest non-empty level */
+  JavaThreadI *pop();
+
+  /* like pop(), but leaves a cache-hot thread alone when it is the only
+     one queued */
+  JavaThreadI *steal(uint64 now);
+};
+
+/* the entry points through which the kernel scheduler runs the threads
+   of a JavaStealingScheduler, laid out as kern/sched.h's struct
+   sched_java: a thread goes in as its JavaThreadI with the kernel thread
+   that carries it, which is what comes back out */
+struct JavaSchedOps {
+  void (*enqueue)(void *thread, void *handle);
+  void *(*pick)(int cpu);
+  u4 (*queued)();
+};
+
+/* scheduler with per-CPU run queues; an idle CPU steals work from the
+   busiest other CPU, and threads are put back on the CPU they last ran
+   on unless that would unbalance the queues */
+class JavaStealingScheduler : public JavaThreadSchedulerI {
+private:
+  int _ncpu;
+  int (*_cpuid)();              /* returns the calling CPU's index */
+  JavaRunQueue _queues[JAVA_MAX_CPUS];
+  volatile u4 _numThreads;
+  volatile u4 _numSteals;
+
+  JavaThreadI *steal(int cpu);
+
+public:
+  JavaStealingScheduler(int ncpu, int (*cpuid)());
+  ~JavaStealingScheduler() { }
+
+  void addThread(JavaThreadI *t);
+  int getNumThreads() { return _numThreads; }
+  JavaThreadI *pickNextThread() { return pickNextThread(_cpuid()); }
+
+  /* pickNextThread() on behalf of a given CPU */
+  JavaThreadI *pickNextThread(int cpu);
+
+  /* makes this the scheduler the kernel runs Java threads with, and
+     fills in 'ops' for sched_set_java(); from then on only the kernel
+     adds and picks threads, with interrupts off, so that it is never
+     preempted holding a run queue lock */
+  void kernelOps(JavaSchedOps *ops);
+
+  int numCpus() const { return _ncpu; }
+  u4 numSteals() const { return _numSteals; }
+  u4 queueLength(int cpu) const { return _queues[cpu].count(); }
+};
+
 #endif /* JAVA_THREAD_H */
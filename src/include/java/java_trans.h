@@ -0,0 +1,326 @@
+/**
+ * @file java_trans.h
+ * @brief translation of Java bytecode to x86-32 machine code: a code buffer
+ *        with an assembler for the instructions the compilers use, and the
+ *        template-based baseline compiler
+ *
+ * @author cjeong
+ */
+#ifndef JAVA_TRANS_H
+#define JAVA_TRANS_H
+
+#include <vector>
+#include "java/java_base.h"
+
+class JavaVMMethod;
+
+/* registers, numbered as in the ModRM encoding */
+enum JavaRegE {
+  JavaNoReg = -1,
+  JavaEAX, JavaECX, JavaEDX, JavaEBX, JavaESP, JavaEBP, JavaESI, JavaEDI
+};
+
+/* condition codes, numbered as in the Jcc and SETcc encodings */
+enum JavaCondCodeE {
+  JavaCondO,  JavaCondNO, JavaCondB,  JavaCondAE,
+  JavaCondE,  JavaCondNE, JavaCondBE, JavaCondA,
+  JavaCondS,  JavaCondNS, JavaCondP,  JavaCondNP,
+  JavaCondL,  JavaCondGE, JavaCondLE, JavaCondG
+};
+
+/* integer ALU operations, numbered as the /digit of opcode 0x81 */
+enum JavaAluE {
+  JavaAluAdd, JavaAluOr, JavaAluAdc, JavaAluSbb,
+  JavaAluAnd, JavaAluSub, JavaAluXor, JavaAluCmp
+};
+
+/* shifts, numbered as the /digit of opcode 0xD3 */
+enum JavaShiftE {
+  JavaShiftShl = 4,
+  JavaShiftShr = 5,
+  JavaShiftSar = 7
+};
+
+/* x87 arithmetic, numbered as the /digit of opcodes 0xD8 and 0xDC */
+enum JavaFpuE {
+  JavaFpuAdd = 0,
+  JavaFpuMul = 1,
+  JavaFpuSub = 4,
+  JavaFpuDiv = 6
+};
+
+/* a memory operand [base + index * scale + disp]; with no base and no
+   index 'disp' is an absolute address */
+struct JavaMem {
+  JavaRegE base;
+  JavaRegE index;
+  u1 scale;
+  s4 disp;
+
+  JavaMem(JavaRegE b, s4 d) : base(b), index(JavaNoReg), scale(1), disp(d) { }
+  JavaMem(JavaRegE b, JavaRegE i, u1 s, s4 d) :
+    base(b), index(i), scale(s), disp(d) { }
+};
+
+static inline JavaMem javaAbs(const void *p)
+{
+  return JavaMem(JavaNoReg, (s4) (uintptr) p);
+}
+
+/* function addresses as call targets */
+#define JAVA_FN(f)  ((const void *) (uintptr) (f))
+
+/* places in the code that depend on where it is installed, or on where
+   the VM objects it refers to are */
+enum JavaRelocE {
+  JavaRelocCall,                /* rel32 to an absolute address */
+  JavaRelocLabel,               /* abs32 of a label in the code */
+  JavaRelocAbs                  /* abs32 of a VM object, already in place;
+                                   only code saved for another VM needs it */
+};
+
+struct JavaReloc {
+  u4 offset;                    /* of the 4-byte field to patch */
+  JavaRelocE kind;
+  u4 target;                    /* address, or label number */
+};
+
+/* machine code under construction.  jumps refer to labels, which may be
+   bound before or after the jump; finish() resolves them, and install()
+   copies the code to its final place and applies the relocations */
+class JavaCodeBuffer {
+private:
+  struct JavaFixup {
+    u4 offset;                  /* of the rel32 field */
+    int label;
+  };
+
+  std::vector<u1> _code;
+  std::vector<JavaReloc> _relocs;
+  std::vector<s4> _labels;      /* offset of each label; -1 if unbound */
+  std::vector<JavaFixup> _fixups;
+
+  void modrm(int reg, const JavaMem &m);
+  void modrmReg(int reg, JavaRegE rm) { emit1(0xC0 | reg << 3 | rm); }
+  void rel32(int label);
+  void abs32(const void *p);
+
+public:
+  JavaCodeBuffer() { }
+  ~JavaCodeBuffer() { }
+
+  u4 size() const { return _code.size(); }
+  const u1 *bytes() const { return &_code[0]; }
+  std::vector<JavaReloc>& relocs() { return _relocs; }
+
+  void emit1(u1 b) { _code.push_back(b); }
+  void emit2(u2 w) { emit1(w); emit1(w >> 8); }
+  void emit4(u4 d) { emit2(d); emit2(d >> 16); }
+  void patch4(u4 offset, u4 d);
+
+  int newLabel();
+  void bind(int label);
+  bool isBound(int label) const { return _labels[label] >= 0; }
+  u4 labelOffset(int label) const { return _labels[label]; }
+
+  /* pads with nops to a multiple of 'n' bytes */
+  void align(u4 n);
+
+  /* moves and stack */
+  void push(JavaRegE r) { emit1(0x50 + r); }
+  void pop(JavaRegE r) { emit1(0x58 + r); }
+  void pushad() { emit1(0x60); }
+  void push(const JavaMem &m) { emit1(0xFF); modrm(6, m); }
+  void pop(const JavaMem &m) { emit1(0x8F); modrm(0, m); }
+  void pushImm(s4 v);
+  void pushAddr(const void *p) { emit1(0x68); abs32(p); }
+  void mov(JavaRegE d, JavaRegE s) { emit1(0x89); modrmReg(s, d); }
+  void mov(JavaRegE d, const JavaMem &m) { emit1(0x8B); modrm(d, m); }
+  void mov(const JavaMem &m, JavaRegE s) { emit1(0x89); modrm(s, m); }
+  void movImm(JavaRegE d, u4 v) { emit1(0xB8 + d); emit4(v); }
+  void movAddr(JavaRegE d, const void *p) { emit1(0xB8 + d); abs32(p); }
+  void movImm(const JavaMem &m, u4 v) { emit1(0xC7); modrm(0, m); emit4(v); }
+  void mov8(const JavaMem &m, JavaRegE s) { emit1(0x88); modrm(s, m); }
+  void mov16(const JavaMem &m, JavaRegE s) {
+    emit1(0x66);
+    emit1(0x89);
+    modrm(s, m);
+  }
+  void movsx8(JavaRegE d, const JavaMem &m) { emit2(0xBE0F); modrm(d, m); }
+  void movsx16(JavaRegE d, const JavaMem &m) { emit2(0xBF0F); modrm(d, m); }
+  void movzx8(JavaRegE d, const JavaMem &m) { emit2(0xB60F); modrm(d, m); }
+  void movzx16(JavaRegE d, const JavaMem &m) { emit2(0xB70F); modrm(d, m); }
+  void movzx8(JavaRegE d, JavaRegE s) { emit2(0xB60F); modrmReg(d, s); }
+  void lea(JavaRegE d, const JavaMem &m) { emit1(0x8D); modrm(d, m); }
+  void xchg(JavaRegE d, JavaRegE s) { emit1(0x87); modrmReg(s, d); }
+
+  /* integer arithmetic */
+  void alu(JavaAluE op, JavaRegE d, JavaRegE s) {
+    emit1(op << 3 | 1);
+    modrmReg(s, d);
+  }
+  void alu(JavaAluE op, JavaRegE d, const JavaMem &m) {
+    emit1(op << 3 | 3);
+    modrm(d, m);
+  }
+  void alu(JavaAluE op, const JavaMem &m, JavaRegE s) {
+    emit1(op << 3 | 1);
+    modrm(s, m);
+  }
+  void aluImm(JavaAluE op, JavaRegE d, s4 v);
+  void aluImm(JavaAluE op, const JavaMem &m, s4 v);
+  void test(JavaRegE d, JavaRegE s) { emit1(0x85); modrmReg(s, d); }
+  void testImm8(JavaRegE d, u1 v) { emit1(0xF6); modrmReg(0, d); emit1(v); }
+  void imul(JavaRegE d, JavaRegE s) { emit2(0xAF0F); modrmReg(d, s); }
+  void imul(JavaRegE d, const JavaMem &m) { emit2(0xAF0F); modrm(d, m); }
+  void imulImm(JavaRegE d, JavaRegE s, s4 v);
+  void mul(const JavaMem &m) { emit1(0xF7); modrm(4, m); }
+  void idiv(JavaRegE r) { emit1(0xF7); modrmReg(7, r); }
+  void idiv(const JavaMem &m) { emit1(0xF7); modrm(7, m); }
+  void neg(JavaRegE r) { emit1(0xF7); modrmReg(3, r); }
+  void neg(const JavaMem &m) { emit1(0xF7); modrm(3, m); }
+  void cdq() { emit1(0x99); }
+  void shift(JavaShiftE op, JavaRegE r) { emit1(0xD3); modrmReg(op, r); }
+  void shift(JavaShiftE op, const JavaMem &m) { emit1(0xD3); modrm(op, m); }
+  void shiftImm(JavaShiftE op, JavaRegE r, u1 n) {
+    emit1(0xC1);
+    modrmReg(op, r);
+    emit1(n);
+  }
+  void shld(JavaRegE d, JavaRegE s) { emit2(0xA50F); modrmReg(s, d); }
+  void shrd(JavaRegE d, JavaRegE s) { emit2(0xAD0F); modrmReg(s, d); }
+  void setcc(JavaCondCodeE c, JavaRegE r) { emit1(0x0F); emit1(0x90 + c); modrmReg(0, r); }
+
+  /* control transfer */
+  void jcc(JavaCondCodeE c, int label) { emit1(0x0F); emit1(0x80 + c); rel32(label); }
+  void jmp(int label) { emit1(0xE9); rel32(label); }
+  void jmp(const JavaMem &m) { emit1(0xFF); modrm(4, m); }
+  void call(const void *target);
+  void call(const JavaMem &m) { emit1(0xFF); modrm(2, m); }
+  void call(JavaRegE r) { emit1(0xFF); modrmReg(2, r); }
+  void leave() { emit1(0xC9); }
+  void ret() { emit1(0xC3); }
+
+  /* x87; float and double operands are always in memory */
+  void fld32(const JavaMem &m) { emit1(0xD9); modrm(0, m); }
+  void fld64(const JavaMem &m) { emit1(0xDD); modrm(0, m); }
+  void fstp32(const JavaMem &m) { emit1(0xD9); modrm(3, m); }
+  void fstp64(const JavaMem &m) { emit1(0xDD); modrm(3, m); }
+  void fild32(const JavaMem &m) { emit1(0xDB); modrm(0, m); }
+  void fild64(const JavaMem &m) { emit1(0xDF); modrm(5, m); }
+  void fop32(JavaFpuE op, const JavaMem &m) { emit1(0xD8); modrm(op, m); }
+  void fop64(JavaFpuE op, const JavaMem &m) { emit1(0xDC); modrm(op, m); }
+
+  /* a 4-byte absolute address of 'label', for jump tables */
+  void labelAddr(int label);
+
+  /* resolves jumps to labels; false if one was never bound */
+  bool finish();
+
+  /* copies the code to 'mem' and relocates it for that address */
+  void install(u1 *mem) const;
+};
+
+
+/* compiled code of one method, or of one of its OSR entries */
+class JavaCompiledMethod {
+private:
+  JavaVMMethod *_method;
+  u1 *_code;
+  u4 _size;
+  u1 _tier;
+
+  /* for the code cache sweeper: the method's counters at the last sweep,
+     and the sweeps since they last moved */
+  u4 _lastCount;
+  u4 _idleSweeps;
+
+public:
+  JavaCompiledMethod(JavaVMMethod *m, u1 *code, u4 size, u1 tier) :
+    _method(m), _code(code), _size(size), _tier(tier), _lastCount(0),
+    _idleSweeps(0) { }
+  ~JavaCompiledMethod() { }
+
+  GET_SET(JavaVMMethod *, _method, method);
+  GET_SET(u1 *, _code, code);
+  GET_SET(u4, _size, size);
+  GET_SET(u1, _tier, tier);
+  GET_SET(u4, _lastCount, lastCount);
+  GET_SET(u4, _idleSweeps, idleSweeps);
+
+  bool contains(const void *pc) const {
+    return (const u1 *) pc >= _code && (const u1 *) pc < _code + _size;
+  }
+};
+
+/* compilation tiers */
+#define JAVA_TIER_INTERP    0
+#define JAVA_TIER_BASELINE  1
+#define JAVA_TIER_OPTIMIZED 2
+
+
+/* the baseline compiler: one machine code template per opcode.  the
+   operand stack lives on the native stack and locals in the native frame,
+   in the slot order of JavaVMFrame:
+
+     [ebp + 12]         args, as passed to the JavaEntry
+     [ebp + 8]          the JavaVMMethod
+     [ebp - 4 * (i+1)]  local i
+     below that         the operand stack, top at [esp]
+
+   values are only in registers within a template, so every bytecode
+   boundary is a point where the frame is complete.  since the layout is
+   the interpreter's, on-stack replacement into and out of baseline code
+   copies the frame as it is: each loop header gets an OSR entry that
+   rebuilds the frame and jumps to the header, and code at the header
+   that moves to optimized OSR code once there is some */
+class JavaTranslator {
+private:
+  JavaVMMethod *_method;
+  JavaCodeBuffer _buf;
+  std::vector<int> _pcLabels;   /* label of each bytecode pc; -1 if none */
+  int _npeLabel;
+  int _rangeLabel;
+  int _arithLabel;
+  s4 _syncSlot;                 /* frame offset of the locked object */
+  std::vector<bool> _loopHeaders;
+  std::vector<std::pair<u4, int> > _osrLabels;  /* pc, label of entry */
+
+  int pcLabel(u4 pc);
+  JavaMem local(u4 i) const { return JavaMem(JavaEBP, -4 * (s4) (i + 1)); }
+
+  void prologue();
+  void epilogue(char type);
+  void tierCheck(volatile u4 *counter, u4 threshold, u4 osrPc);
+  void findLoopHeaders();
+  void osrCheck(u4 pc);
+  void osrEntry(u4 pc);
+  void nullCheck(JavaRegE r);
+  void indexCheck(JavaRegE array, JavaRegE index);
+  void branch(JavaCondCodeE c, u4 pc, s4 offset);
+  void invoke(JavaVMMethod *callee, const void *resolver);
+  bool intrinsic(JavaVMMethod *callee);
+  void pushResult(char type);
+  bool translate(u4 pc);
+
+public:
+  JavaTranslator(JavaVMMethod *m);
+  ~JavaTranslator() { }
+
+  JavaCodeBuffer& buffer() { return _buf; }
+
+  /* each loop header's pc and the label of its OSR entry */
+  const std::vector<std::pair<u4, int> >& osrLabels() const {
+    return _osrLabels;
+  }
+
+  /* emits the code of the whole method; false if it uses an instruction
+     the templates do not cover */
+  bool translate();
+
+  /* compiles 'm' and makes the result its entry point; a method that
+     cannot be compiled is marked so and stays interpreted */
+  static bool compile(JavaVMMethod *m);
+};
+
+#endif /* JAVA_TRANS_H */
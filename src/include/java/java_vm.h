@@ -11,41 +11,228 @@
 #include <map>
 #include "java/java_base.h"
 #include "java/java_classfile.h"
+#include "java/java_object.h"
+#include "java/java_thread.h"
 
 
+/* maximum number of live VM threads; thread ids are 1..JAVA_MAX_THREADS-1,
+   and only ids up to JAVA_THIN_MAX_OWNER fit in a thin lock */
+#define JAVA_MAX_THREADS  1024
+
 class JavaVMFrame;
-class JavaVMThread {
+class JavaVMThread : public JavaThreadI {
 private:
+  static JavaThreadOps _ops;
+
   unsigned long _pc;
   JavaVMFrame *_frame_stack;
+  u2 _tid;
+  int _priority;
+  JavaThreadStateE _state;
+  JavaThreadLocationE _location;
+  JavaSchedInfo _sched;
+
+  /* set by resume(), taken by pause() */
+  volatile u4 _permit;
+
+  /* link for the monitor entry/wait queue this thread is blocked on */
+  JavaVMThread *_monitorNext;
+
+  JavaVMThread(u2 tid);
 
 public:
-  JavaVMThread();
   ~JavaVMThread();
 
+  /* without it, pause() spins until resume() */
+  static void init(const JavaThreadOps *ops);
+
+  /* a new thread with its own thread id; returns 0 if all
+     JAVA_MAX_THREADS - 1 ids are taken, since id 0 is the unowned value
+     of a lock */
+  static JavaVMThread *create();
+
+  GET_SET(u2, _tid, tid);
+  GET_SET(int, _priority, priority);
+  GET_SET(JavaThreadStateE, _state, state);
+
+  /* JavaThreadI */
+  JavaThreadStateE getThreadState() { return _state; }
+  JavaThreadLocationE getThreadLocation() { return _location; }
+  int getPriority() { return _priority; }
+  JavaSchedInfo *getSchedInfo() { return &_sched; }
+
+  /* the kernel thread that runs it, which resume() unparks; start()
+     records it, and so does the kernel scheduler when it first queues
+     the thread */
+  void *handle() const { return _sched.handle; }
+  void handle(void *h) { _sched.handle = h; }
+
+  GET_SET(JavaVMThread *, _monitorNext, monitorNext);
+  JavaVMThread **monitorNextAddr() { return &_monitorNext; }
+
+  /* innermost interpreter frame; compiled activations are not listed */
+  GET_SET(JavaVMFrame *, _frame_stack, frameStack);
+
 public:
-  void start();
+  /* runs fn(arg) on a kernel thread of its own; false if there is no
+     spawn op or the kernel is out of threads */
+  bool start(void (*fn)(void *), void *arg);
+
+  /* pause() blocks the calling thread until resume() is called on it;
+     a resume() that arrives before the pause() is remembered, so the 
+     following pause() returns at once (monitors depend on this) */
   void pause();
   void resume();
   void stop();
 };
 
 
-/* for heap area */
+/* objects are allocated on 8-byte boundaries so that long and double 
+   fields can be naturally aligned */
+#define JAVA_OBJ_ALIGN  8
+
+class JavaVMMethod;
+class JavaVMClass;
+
+/* the java.lang.Class instance of a class: what a static synchronized
+   method locks, and what a class literal stands for.  mirrors are made
+   with their class and last as long, outside the Java heap */
+class JavaClassMirror : public JavaObject {
+private:
+  JavaVMClass *_klass;
+
+public:
+  GET_SET(JavaVMClass *, _klass, klass);
+};
+
+/* runtime representation of a loaded class */
+class JavaVMClass {
+private:
+  static JavaVMClass *_mirrorClass;
+
+  JavaClassFile *_classFile;
+  JavaVMClass *_super;
+  unsigned _classIndex   : 16;  /* index in JavaClassTable */
+  unsigned _elemSize     : 16;  /* element size for array classes, else 0 */
+  u4 _instanceSize;             /* instance size in bytes, header included */
+  JavaObject *_mirror;          /* java.lang.Class instance for this class */
+
+  /* byte offset of each field of the classfile, in classfile order; 
+     static fields have no instance slot and get offset 0 */
+  std::vector<u2> _fieldOffsets;
+
+  /* methods declared by this class, and the virtual method table: the
+     superclass table with overridden slots replaced and new virtual
+     methods appended */
+  std::vector<JavaVMMethod *> _methods;
+  std::vector<JavaVMMethod *> _vtable;
+
+  /* the class of mirrors; has no classfile */
+  JavaVMClass();
+
+  void makeMirror();
+
+public:
+  JavaVMClass(JavaClassFile *cf, JavaVMClass *super);
+  JavaVMClass(u2 elemSize);
+  ~JavaVMClass() { }
+
+  /* the class every mirror is an instance of */
+  static JavaVMClass *mirrorClass();
+
+  GET_SET(JavaClassFile *, _classFile, classFile);
+  GET_SET(JavaVMClass *, _super, super);
+  GET_SET(u2, _classIndex, classIndex);
+  GET_SET(u2, _elemSize, elemSize);
+  GET_SET(u4, _instanceSize, instanceSize);
+  GET_SET(JavaObject *, _mirror, mirror);
+
+  bool isArray() const { return _elemSize != 0; }
+  u2 fieldOffset(int i) const { return _fieldOffsets[i]; }
+
+  std::vector<JavaVMMethod *>& methods() { return _methods; }
+  JavaVMMethod *vtableAt(u2 i) const { return _vtable[i]; }
+  u2 vtableLength() const { return _vtable.size(); }
+
+  /* true if this class is 'c' or one of its subclasses */
+  bool isSubclassOf(const JavaVMClass *c) const;
+
+  /* adds a method declared by this class and gives virtual methods a
+     vtable slot, reusing the slot of the superclass method it overrides */
+  void addMethod(JavaVMMethod *m);
+
+  /* finds a method by name and descriptor here or in a superclass */
+  JavaVMMethod *lookupMethod(const char *name, const char *desc) const;
+
+  /* assigns instance field offsets after the superclass fields; fields are
+     packed by decreasing size, and a 4-byte field fills the gap the 
+     one-word header leaves before the first 8-byte field */
+  void layout();
+};
+
+
+/* for heap area; a bump allocator over a contiguous region, shared by
+   every thread */
 class JavaVMHeap {
 private:
+  char *_base;
+  char *volatile _top;
+  char *_end;
+
+  /* allocation statistics; _wideBytes is what the same objects would take
+     with a two-word (lock word plus class pointer) header */
+  volatile u4 _numObjects;
+  volatile u4 _numBytes;
+  volatile u4 _wideBytes;
+
+  char *alloc(u4 size);
+
 public:
+  JavaVMHeap(char *base, u4 size);
+  ~JavaVMHeap() { }
+
+  /* allocate a zeroed instance or array of class 'c' with its header 
+     initialized; return 0 if the heap is exhausted */
+  JavaObject *allocObject(JavaVMClass *c);
+  JavaArray *allocArray(JavaVMClass *c, u4 length);
+
+  GET_SET(u4, _numObjects, numObjects);
+  GET_SET(u4, _numBytes, numBytes);
+  GET_SET(u4, _wideBytes, wideBytes);
+
+  void dumpStats();
 };
 
 
-/* for stack area; one frame for each thread */
+/* for stack area; an interpreter activation.  locals and operand stack
+   share one block of slots and both grow down: local i is _locals[-i],
+   the operand stack starts right below the last local and its top is
+   _sp[0].  a long or double takes two slots, the high word in the first
+   (higher) one, so the value reads as one 8-byte word at the lower slot.
+   arguments are passed in the same order, and compiled code lays out its
+   native frame the same way */
 class JavaVMFrame {
 private:
   JavaVMFrame *_prev;
+  JavaVMMethod *_method;
+  u4 *_locals;
+  u4 *_sp;
+  u4 _pc;
 
 public:
-  JavaVMFrame(JavaVMFrame *p);
-  ~JavaVMFrame();
+  /* 'slots' must hold maxStack + maxLocals words */
+  JavaVMFrame(JavaVMMethod *m, u4 *slots, JavaVMFrame *prev);
+  ~JavaVMFrame() { }
+
+  GET_SET(JavaVMFrame *, _prev, prev);
+  GET_SET(JavaVMMethod *, _method, method);
+  GET_SET(u4 *, _locals, locals);
+  GET_SET(u4 *, _sp, sp);
+  GET_SET(u4, _pc, pc);
+
+  /* _sp of the empty operand stack */
+  u4 *stackBase() const;
+  u4 stackDepth() const { return stackBase() - _sp; }
 };
 
 struct ltstr {
@@ -61,12 +248,193 @@ public:
 };
 
 
+/* calling convention shared by the interpreter and compiled code: 'args'
+   points at the last argument slot the caller pushed, so argument slots
+   sit in memory as they do on an operand stack (see JavaVMFrame); the
+   result comes back in the low word, or in both words for long and
+   double, and floats are returned as their bit pattern */
+typedef uint64 (*JavaEntry)(JavaVMMethod *m, u4 *args);
+
+/* compiled code that takes over a running activation at a loop header
+   (on-stack replacement): 'locals' points at local 0 of a frame laid out
+   as JavaVMFrame's, and 'slots' counts its locals and operand stack
+   slots.  it returns what the method returns */
+typedef uint64 (*JavaOsrEntry)(JavaVMMethod *m, u4 *locals, u4 slots);
+
+/* a constant pool entry as resolved when the class is linked; references
+   to strings are kept in 'value' as their address */
+struct JavaVMCpEntry {
+  union {
+    u4 value;                   /* Integer, Float, String */
+    uint64 wide;                /* Long, Double */
+    JavaVMMethod *method;       /* Methodref, InterfaceMethodref */
+    JavaVMClass *klass;         /* Class */
+    u4 offset;                  /* Fieldref of an instance field */
+    char *addr;                 /* Fieldref of a static field */
+  };
+  char type;                    /* Fieldref: first descriptor character */
+};
+
+class JavaCompiledMethod;
+
+/* receiver classes seen at one virtual or interface call site, for the
+   optimizing compiler's inlining decisions.  the interpreter updates it
+   without locking, so the counts are approximate */
+#define JAVA_PROFILE_RECEIVERS  2
+
+struct JavaCallProfile {
+  u4 pc;                        /* of the invoke instruction */
+  JavaVMClass *receivers[JAVA_PROFILE_RECEIVERS];
+  u4 counts[JAVA_PROFILE_RECEIVERS];
+  u4 others;                    /* calls on a class not listed */
+
+  u4 total() const;
+  void record(JavaVMClass *c);
+};
+
+/* a pc that is no loop header, for "no OSR entry" */
+#define JAVA_NO_OSR  (~0U)
+
+/* a loop header with OSR code; kept for the life of the method, since
+   compiled code tests 'tier' in place */
+struct JavaOsrPoint {
+  u4 pc;                        /* of the loop header */
+  JavaOsrEntry volatile entry;  /* best code so far; 0 if none */
+  volatile u4 tier;             /* of 'entry' */
+  volatile u4 requestedTier;    /* highest tier queued or compiled */
+  JavaOsrPoint *next;
+};
+
 class JavaVMMethod {
 private:
+  /* must stay the first member: compiled code calls through it without
+     knowing the rest of the layout.  points to JavaInterp::entry until 
+     the method is compiled */
+  JavaEntry volatile _entry;
+
   std::vector<JavaInstr *> _instructions;
+  JavaVMClass *_class;
+  u2 _accessFlags;
+  const char *_name;
+  const char *_desc;
+
+  /* bytecode from the Code attribute */
+  const u1 *_code;
+  u4 _codeLength;
+  u2 _maxStack;
+  u2 _maxLocals;
+  u2 _argSlots;                 /* argument slots, receiver included */
+  char _retType;                /* first character of the return type */
+  u2 _vtableIndex;
+  JavaVMCpEntry *_cpool;
+
+  /* profile for the compilation policy; compiled code bumps them too,
+     so it can move the method up a tier */
+  volatile u4 _invocations;
+  volatile u4 _backedges;       /* taken backward branches */
+  u1 _tier;                     /* tier of the code '_entry' points to */
+  volatile u4 _requestedTier;   /* highest tier queued or compiled */
+  JavaCompiledMethod *_compiled;
+  bool _notCompilable;          /* the translator gave up on it, or it
+                                   runs an intrinsic */
+  u1 _intrinsic;                /* JavaIntrinsicE */
+
+  /* one per virtual and interface call, sorted by pc; allocated on the
+     first profiled call */
+  JavaCallProfile *volatile _profiles;
+  u2 _numProfiles;
+
+  /* loop headers where a running activation can move to compiled code */
+  JavaOsrPoint *volatile _osrPoints;
+
+  /* set once a loaded class overrides this method; compiled code that
+     inlined it as the only implementation tests it first */
+  volatile u4 _overridden;
+
+  void init(const char *name, const char *desc, u2 flags);
 
 public:
+  JavaVMMethod(JavaVMClass *c, const char *name, const char *desc, u2 flags);
+  JavaVMMethod(JavaVMClass *c, JavaMethodInfo *mi);
+  ~JavaVMMethod() { }
+
   std::vector<JavaInstr *>& instructions();
+
+  GET_SET(JavaEntry, _entry, entry);
+  GET_SET(JavaVMClass *, _class, javaClass);
+  GET_SET(u2, _accessFlags, accessFlags);
+  GET_SET(const char *, _name, name);
+  GET_SET(const char *, _desc, desc);
+  GET_SET(const u1 *, _code, code);
+  GET_SET(u4, _codeLength, codeLength);
+  GET_SET(u2, _maxStack, maxStack);
+  GET_SET(u2, _maxLocals, maxLocals);
+  GET_SET(u2, _argSlots, argSlots);
+  GET_SET(char, _retType, retType);
+  GET_SET(u2, _vtableIndex, vtableIndex);
+  GET_SET(JavaVMCpEntry *, _cpool, cpool);
+  GET_SET(u4, _invocations, invocations);
+  GET_SET(u4, _backedges, backedges);
+  GET_SET(u1, _tier, tier);
+  GET_SET(u4, _requestedTier, requestedTier);
+  volatile u4 *invocationsAddr() { return &_invocations; }
+  volatile u4 *backedgesAddr() { return &_backedges; }
+  volatile u4 *requestedTierAddr() { return &_requestedTier; }
+  GET_SET(JavaCompiledMethod *, _compiled, compiled);
+  GET_SET(bool, _notCompilable, notCompilable);
+  GET_SET(u1, _intrinsic, intrinsic);
+  JavaOsrPoint *osrPoints() const { return _osrPoints; }
+  bool isOverridden() const { return _overridden != 0; }
+  void overridden(bool v) { _overridden = v; }
+  volatile u4 *overriddenAddr() { return &_overridden; }
+
+  void setCode(const u1 *code, u4 length, u2 maxStack, u2 maxLocals);
+
+  /* counts 'c' as the receiver class of the call at 'pc' */
+  void profileCall(u4 pc, JavaVMClass *c);
+
+  /* the receiver profile of the call at 'pc'; 0 if none was taken */
+  JavaCallProfile *callProfile(u4 pc) const;
+
+  /* the OSR point of the loop header at 'pc'; 0 if there is none yet */
+  JavaOsrPoint *osrPoint(u4 pc) const;
+
+  /* the OSR point at 'pc', made if there is none */
+  JavaOsrPoint *addOsrPoint(u4 pc);
+
+  bool isStatic() const { return _accessFlags & JAVA_METHOD_ACC_STATIC; }
+  bool isSynchronized() const {
+    return _accessFlags & JAVA_METHOD_ACC_SYNCHRONIZED;
+  }
+  bool isAbstract() const { return _accessFlags & JAVA_METHOD_ACC_ABSTRACT; }
+
+  /* true if calls can be bound statically: private, final, static or
+     constructor methods, and methods of final classes */
+  bool isFinal() const;
+
+  /* counts an invocation; returns the new count, which sticks at the
+     maximum instead of wrapping */
+  u4 countInvocation() {
+    if (_invocations != 0xFFFFFFFF)
+      _invocations++;
+    return _invocations;
+  }
+
+  u4 countBackedge() {
+    if (_backedges != 0xFFFFFFFF)
+      _backedges++;
+    return _backedges;
+  }
+
+  /* the object an ACC_SYNCHRONIZED method locks for the duration of the
+     call: the receiver, or the class mirror for static methods */
+  JavaObject *syncObject(JavaObject *receiver) const {
+    return isStatic() ? _class->mirror() : receiver;
+  }
+
+  /* argument slots taken by a method descriptor, receiver excluded, and
+     the first character of its return type */
+  static u2 descArgSlots(const char *desc, char *ret);
 };
 
 #endif /* JAVA_VM_H */
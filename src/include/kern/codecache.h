@@ -0,0 +1,61 @@
+/**
+ * @file codecache.h
+ * @desc the code cache: executable memory for compiled Java code, split
+ *       into segments by the kind of code, with deferred freeing of code
+ *       that may still be running
+ */
+#ifndef KERN_CODECACHE_H
+#define KERN_CODECACHE_H
+
+#ifndef COMPILE_KERNEL
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <types.h>
+
+/* code segments; each is a fixed range of [CODEBASE, CODELIM), so code
+   of one kind can not crowd out another */
+enum {
+  CC_STUBS = 0,                   /* small shared pieces of code */
+  CC_BASELINE,                    /* baseline compiler output */
+  CC_OPTIMIZED,                   /* optimizing compiler output */
+  CC_NSEG
+};
+
+/* code starts are aligned to this, which is also the allocation unit */
+#define CC_ALIGN          32
+
+/* a retired block is freed after this many sweeps, once no kernel stack
+   holds an address inside it */
+#define CC_GRACE_SWEEPS   2
+
+struct cc_stats {
+  const char *cs_name;
+  uint32_t cs_size;               /* of the segment's address range */
+  uint32_t cs_mapped;             /* bytes backed by pages */
+  uint32_t cs_used;               /* in live blocks, headers included */
+  uint32_t cs_nused;
+  uint32_t cs_zombie;             /* retired, not yet freed */
+  uint32_t cs_nzombie;
+  uint32_t cs_free;               /* in free blocks and above the break */
+  uint32_t cs_nfree;              /* free blocks below the break */
+  uint32_t cs_largest;            /* largest allocation that would fit */
+};
+
+/* returns 'size' bytes of executable memory in segment 'seg', or 0 if
+   the segment is full or out of pages */
+void *cc_alloc(int seg, uint32_t size);
+
+/* frees code nothing can be running any more */
+void cc_free(void *code);
+
+/* frees code once nothing can be running it: after CC_GRACE_SWEEPS
+   sweeps, and only while no kernel stack holds an address inside it */
+void cc_retire(void *code);
+
+/* frees the retired code that qualifies; returns the bytes freed */
+uint32_t cc_sweep(void);
+
+void cc_stats(int seg, struct cc_stats *st);
+
+#endif /* KERN_CODECACHE_H */
@@ -0,0 +1,112 @@
+/**
+ * @file cpu.h
+ * @desc per-CPU state, multiprocessor configuration and the local APIC
+ */
+#ifndef KERN_CPU_H
+#define KERN_CPU_H
+
+#ifndef COMPILE_KERNEL
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <types.h>
+#include <x86.h>
+#include <mmu.h>
+#include <vmmap.h>
+
+/* maximum number of CPUs; bounded by the per-CPU kernel stacks, which
+   must all fit in [KSTACKTOP-PTSIZE, KSTACKTOP) */
+#define NCPU  8
+
+/* values of cpu_status */
+enum {
+  CPU_UNUSED = 0,
+  CPU_STARTED,
+  CPU_HALTED
+};
+
+struct context;
+struct kthread;
+
+/* free pages a CPU keeps in front of the page allocator, so that most
+   page_alloc() and page_free() calls take no lock; see pmap.c */
+#define PAGE_MAG_SIZE   64
+#define PAGE_MAG_BATCH  16        /* pages moved to or from the free lists */
+
+struct page_magazine {
+  uint32_t pm_count;
+  struct page *pm_pages[PAGE_MAG_SIZE];   /* most recently freed last */
+  uint32_t pm_nalloc;             /* page_alloc() calls served */
+  uint32_t pm_nfree;              /* page_free() calls */
+  uint32_t pm_nrefill;            /* batches taken from the free lists */
+  uint32_t pm_ndrain;             /* batches given back */
+};
+
+/* per-CPU state; indexed by cpunum(), so code running on a CPU reaches
+   its own entry with 'thiscpu' and never needs a lock for it */
+struct cpuinfo {
+  uint8_t cpu_id;                 /* index into cpus[] */
+  uint8_t cpu_apicid;             /* local APIC id */
+  volatile unsigned cpu_status;   /* CPU_* */
+  struct taskstate cpu_ts;        /* used by x86 to find the kernel stack */
+  uint32_t cpu_nruns;             /* SMP self-test work items run here */
+
+  /* scheduler state; see sched.c */
+  struct context *cpu_scheduler;  /* swtch() here to enter sched_start() */
+  struct kthread *cpu_thread;     /* the thread running here, if any */
+  volatile int cpu_timer_armed;   /* a slice-end interrupt is pending */
+  int cpu_java_turn;              /* the Java run queue goes first next */
+  uint32_t cpu_nidle;             /* times the CPU went idle (hlt) */
+  uint64_t cpu_idle_cycles;       /* TSC cycles spent halted */
+
+  struct page_magazine cpu_pages;
+  volatile uint32_t cpu_tlb_gen;  /* last TLB shootdown done; see tlb.c */
+};
+
+/* initialized in mpconfig.c */
+extern struct cpuinfo cpus[NCPU];
+extern int ncpu;                  /* total number of CPUs in the system */
+extern struct cpuinfo *bootcpu;   /* the boot-strap processor (BSP) */
+extern physaddr_t lapicaddr;      /* physical MMIO address of the LAPIC */
+extern physaddr_t ioapicaddr;     /* physical MMIO address of the IOAPIC */
+
+/* per-CPU kernel stacks; CPU i's is mapped at
+   [KSTACKTOP - i * (KSTKSIZE + KSTKGAP) - KSTKSIZE, ...) by i386_vm_init() */
+extern unsigned char percpu_kstacks[NCPU][KSTKSIZE];
+#define percpu_kstacktop(i) (KSTACKTOP - (i) * (KSTKSIZE + KSTKGAP))
+
+int cpunum(void);
+#define thiscpu (&cpus[cpunum()])
+
+/* interrupts off, so the running thread stays on this CPU; the state
+   returned is what irq_restore() puts back */
+static inline uint32_t irq_save(void)
+{
+  uint32_t eflags = read_eflags();
+  __asm __volatile("cli" ::: "memory");
+  return eflags;
+}
+
+static inline void irq_restore(uint32_t eflags)
+{
+  if (eflags & EFLAGS_IF)
+    __asm __volatile("sti" ::: "memory");
+}
+
+void mp_init(void);
+void lapic_init(void);
+void lapic_startap(uint8_t apicid, uint32_t addr);
+void lapic_eoi(void);
+void lapic_ipi(int vector);
+void lapic_ipi_one(uint8_t apicid, int vector);
+void microdelay(int us);
+
+/* local APIC timer; one-shot only, so a CPU with nothing to time takes no
+   timer interrupts at all */
+extern uint32_t lapic_ticks_per_ms;
+extern uint32_t tsc_per_ms;
+void lapic_timer_calibrate(void);
+void lapic_timer_oneshot(uint32_t us);
+void lapic_timer_stop(void);
+
+#endif /* KERN_CPU_H */
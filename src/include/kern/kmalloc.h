@@ -0,0 +1,78 @@
+/**
+ * @file kmalloc.h
+ * @desc the kernel's object allocator: caches of fixed-size objects kept
+ *       in slabs of pages from the page allocator, with a per-CPU cache of
+ *       free objects in front of each, and kmalloc() over a set of them
+ */
+#ifndef KERN_KMALLOC_H
+#define KERN_KMALLOC_H
+
+#ifndef COMPILE_KERNEL
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <types.h>
+
+struct kmem_cache;
+
+/* free objects a CPU keeps of each cache, and how many it moves to or
+   from the cache's slabs at once */
+#define KMEM_CPU_SIZE   32
+#define KMEM_CPU_BATCH  16
+
+/* largest kmalloc() served from a cache; larger ones take whole blocks
+   from alloc_pages() */
+#define KMEM_MAX_SIZE   2048
+
+/* kmalloc() memory, and cache objects unless asked for more, is aligned
+   to this, enough for long and double fields */
+#define KMEM_ALIGN      8
+
+struct kmem_stats {
+  const char *ks_name;
+  uint32_t ks_size;               /* of an object, padding included */
+  uint32_t ks_order;              /* a slab is 2^ks_order pages */
+  uint32_t ks_perslab;            /* objects in a slab */
+  uint32_t ks_nslabs;
+  uint32_t ks_nempty;             /* slabs with no object in use */
+  uint32_t ks_ninuse;             /* objects handed out */
+  uint32_t ks_ncached;            /* free objects in CPU caches */
+  uint32_t ks_nalloc;             /* kmem_cache_alloc() calls */
+  uint32_t ks_nfree;              /* kmem_cache_free() calls */
+  uint32_t ks_nmiss;              /* allocations a CPU cache could not serve */
+  uint32_t ks_ngrow;              /* slabs made */
+  uint32_t ks_nreap;              /* slabs given back */
+};
+
+/* makes a cache of objects of 'size' bytes aligned to 'align', a power
+   of two (0 for KMEM_ALIGN); 'name' is kept, not copied.  'ctor', if not
+   0, is run on each object once, when its slab is made, rather than on
+   every allocation: objects are handed out as the constructor or the last
+   kmem_cache_free() of them left them, so a freed object must be in its
+   constructed state.  constructors run with interrupts off and must not
+   allocate.  caches are never destroyed.  returns 0 if out of memory or
+   if the object is too large for a slab */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+                                     size_t align, void (*ctor)(void *));
+
+/* an object of 'c', or 0 if out of memory */
+void *kmem_cache_alloc(struct kmem_cache *c);
+void kmem_cache_free(struct kmem_cache *c, void *obj);
+
+/* 'size' bytes aligned to KMEM_ALIGN, or 0 if out of memory; the memory
+   is not cleared */
+void *kmalloc(size_t size);
+void kfree(void *p);
+
+/* gives this CPU's cached objects back to their slabs, and the empty
+   slabs of every cache back to the page allocator; returns the pages
+   freed */
+uint32_t kmem_reap(void);
+
+/* statistics of the i'th cache; -E_INVAL past the last one */
+int kmem_stats(int i, struct kmem_stats *st);
+
+/* sets up the kmalloc() caches; after page_init() */
+void kmem_init(void);
+
+#endif /* KERN_KMALLOC_H */
@@ -19,5 +19,11 @@ void monitor(struct trapframe *tf);
 int mon_help(int argc, char **argv, struct trapframe *tf);
 int mon_kerninfo(int argc, char **argv, struct trapframe *tf);
 int mon_backtrace(int argc, char **argv, struct trapframe *tf);
+int mon_cpus(int argc, char **argv, struct trapframe *tf);
+int mon_threads(int argc, char **argv, struct trapframe *tf);
+int mon_codecache(int argc, char **argv, struct trapframe *tf);
+int mon_pages(int argc, char **argv, struct trapframe *tf);
+int mon_kmem(int argc, char **argv, struct trapframe *tf);
+int mon_bench(int argc, char **argv, struct trapframe *tf);
 
 #endif	/* KERN_MONITOR_H */
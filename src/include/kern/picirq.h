@@ -0,0 +1,27 @@
+/**
+ * @file picirq.h
+ * @desc the 8259A programmable interrupt controllers
+ */
+#ifndef KERN_PICIRQ_H
+#define KERN_PICIRQ_H
+
+#ifndef COMPILE_KERNEL
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <types.h>
+
+#define MAX_IRQS   16             /* number of IRQs */
+
+/* I/O addresses of the two 8259A programmable interrupt controllers */
+#define IO_PIC1    0x20           /* master (IRQs 0-7) */
+#define IO_PIC2    0xA0           /* slave (IRQs 8-15) */
+
+#define IRQ_SLAVE  2              /* IRQ at which slave connects to master */
+
+extern uint16_t irq_mask_8259A;
+
+void pic_init(void);
+void irq_setmask_8259A(uint16_t mask);
+
+#endif /* KERN_PICIRQ_H */
@@ -25,10 +25,10 @@
 	 non-kernel virtual address */
 #define PADDR(kva)																						\
 	({																													\
-		physaddr_t __m_kva = (physaddr_t) (kva);									\
+		uintptr_t __m_kva = (uintptr_t) (kva);										\
 		if (__m_kva < KERNBASE)																		\
 			panic("PADDR called with invalid kva %08lx", __m_kva);	\
-		__m_kva - KERNBASE;																				\
+		(physaddr_t) (__m_kva - KERNBASE);												\
 	})
 
 /* KADDR macro takes a physical address and returns the corresponding kernel
@@ -37,18 +37,63 @@
 	({																												\
 		physaddr_t __m_pa = (pa);																\
 		uint32_t __m_ppn = PPN(__m_pa);													\
-		if (__m_ppn >= npage)																		\
-			panic("KADDR called with invalid pa %08lx", __m_pa);	\
-		(void *) __m_pa + KERNBASE;                             \
+		if (__m_ppn >= nlowpage)																\
+			panic("KADDR called with invalid pa %08llx", __m_pa);	\
+		(void *) (uintptr_t) __m_pa + KERNBASE;                 \
 	})
 
 
+/* the page allocator hands out blocks of 2^order physically contiguous
+   pages, aligned on their size, for orders below PAGE_NORDER; a block of
+   order 10 is 4MB */
+#define PAGE_NORDER  11
+
+/* the order of a block that one 2MB page maps */
+#define PAGE_LARGE_ORDER  (PTSHIFT - PGSHIFT)
+
+/* most cache colors page_alloc_color() tells apart; see page_color_init() */
+#define PAGE_NCOLOR_MAX    64
+
+/* cleared pages idle CPUs keep ready for page_alloc_zeroed(); they stop
+   once free memory is down to PAGE_ZERO_MINFREE pages */
+#define PAGE_ZERO_POOL     256
+#define PAGE_ZERO_MINFREE  1024
+
+/* free memory by block size, for the "pages" monitor command */
+struct page_stats {
+  size_t ps_nfree;                     /* free pages on the free lists */
+  size_t ps_nblocks[PAGE_NORDER];      /* free blocks of each order */
+  size_t ps_ncached;                   /* free pages in CPU magazines */
+  size_t ps_nhigh;                     /* free pages past the KERNBASE map */
+  size_t ps_ncolored;                  /* free pages sorted by color */
+  size_t ps_nzero;                     /* cleared pages in the pool */
+  uint32_t ps_zero_nhit;               /* page_alloc_zeroed() from the pool */
+  uint32_t ps_zero_nmiss;              /* page_alloc_zeroed() that cleared */
+  uint32_t ps_zero_nfill;              /* pages idle CPUs cleared */
+};
+
+/* heap reservations, for the "pages" monitor command */
+struct heap_stats {
+  uint32_t hs_nreserved;               /* pages reserved by heap_reserve() */
+  uint32_t hs_ncommitted;              /* of them, backed by memory */
+  uint32_t hs_nfault;                  /* pages backed on first touch */
+  uint32_t hs_ndecommit;               /* pages given back by heap_decommit() */
+  uint32_t hs_nshared;                 /* pages mapped again by heap_share() */
+  uint32_t hs_ncopy;                   /* shared pages copied on a write */
+};
+
+/* heap_reserve() flags */
+#define HEAP_COLOR  0x1                /* consecutive pages, consecutive colors */
+
 extern char bootstacktop[], bootstack[];
 
 extern struct page *pages;
 extern size_t npage;
+extern size_t nlowpage;                /* pages KADDR() reaches */
 
-extern physaddr_t boot_cr3;
+extern uint32_t boot_cr3;              /* of the page dir pointer table */
+extern uint32_t boot_cr4;
+extern uint32_t page_ncolor;           /* cache colors; 1 if not coloring */
 extern pde_t *boot_pgdir;
 
 extern struct segdesc gdt[];
@@ -57,18 +102,45 @@ extern struct pseudodesc gdt_pd;
 /* setup memory management */
 void i386_detect_memory();
 void i386_vm_init();
+void gdt_init_percpu(void);
+void *mmio_map_region(physaddr_t pa, size_t size);
+void *heap_map(size_t size, int large);
+void heap_unmap(void *va, size_t size);
+void *heap_reserve(size_t size, int flags);
+void *heap_share(void *va, size_t size);
+void heap_release(void *va, size_t size);
+int  heap_fault(uintptr_t va, uint32_t err);
+uint32_t heap_decommit(void *va, size_t size);
+void heap_stats(struct heap_stats *st);
+void heap_check(void);
 
 /* page management functions */
 void page_init(void);
 void page_check(void);
 int  page_alloc(struct page **pp_store);
+int  page_alloc_zeroed(struct page **pp_store);
+int  page_alloc_high(struct page **pp_store);
+int  page_alloc_color(uint32_t color, struct page **pp_store);
+int  page_zero_wanted(void);
+void page_zero_idle(void);
 void page_free(struct page *pp);
+int  alloc_pages(int order, struct page **pp_store);
+void free_pages(struct page *pp, int order);
+void page_stats(struct page_stats *st);
 int  page_insert(pde_t *pgdir, struct page *pp, void *va, int perm);
+int  page_insert_large(pde_t *pgdir, struct page *pp, void *va, int perm);
 void page_remove(pde_t *pgdir, void *va);
+void page_remove_range(pde_t *pgdir, uintptr_t va, size_t size);
 struct page *page_lookup(pde_t *pgdir, void *va, pte_t **ppte);
 void page_decref(struct page *pp);
 void tlb_invalidate(pde_t *, void *va);
 
+/* allocator benchmarks, for the "bench" monitor command */
+void bench_page_churn(void);
+void bench_large_pages(void);
+void bench_page_coloring(void);
+void bench_zero_pool(void);
+
 /* returns page frame number for the given page */
 static inline ppn_t page2ppn(struct page *pp)
 {
@@ -78,7 +150,7 @@ static inline ppn_t page2ppn(struct page *pp)
 /* returns physical address for the given page frame number */
 static inline physaddr_t page2pa(struct page *pp)
 {
-	return page2ppn(pp) << PGSHIFT;
+	return (physaddr_t) page2ppn(pp) << PGSHIFT;
 }
 
 /* inverse of page2pa */
@@ -95,6 +167,23 @@ static inline void *page2kva(struct page *pp)
 	return KADDR(page2pa(pp));
 }
 
+/* stores 'pte' in the page table or page directory entry at 'ptep'; a
+   32-bit CPU stores the 64-bit entry in two halves, and the MMU of another
+   CPU may walk the table in between, so the half with PTE_P goes last
+   when the entry becomes present, and first when it stops being present */
+static inline void pte_write(pte_t *ptep, pte_t pte)
+{
+	volatile uint32_t *p = (volatile uint32_t *) ptep;
+
+	if (pte & PTE_P) {
+		p[1] = pte >> 32;
+		p[0] = pte;
+	} else {
+		p[0] = pte;
+		p[1] = pte >> 32;
+	}
+}
+
 static pte_t *pgdir_walk(pde_t* pgdir, const void *va, int create);
 
 #endif /* KERN_PMAP_H */
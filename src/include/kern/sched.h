@@ -0,0 +1,105 @@
+/**
+ * @file sched.h
+ * @desc kernel threads and the preemptive round-robin scheduler
+ */
+#ifndef KERN_SCHED_H
+#define KERN_SCHED_H
+
+#ifndef COMPILE_KERNEL
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <types.h>
+#include <mmu.h>
+
+#define NKTHREAD          32              /* maximum number of threads */
+#define KTHREAD_STKSIZE   (2 * PGSIZE)    /* size of a thread's stack */
+
+/* a running thread is preempted after this many microseconds, but only
+   if another thread is waiting for a CPU */
+#define SCHED_SLICE_US    10000
+
+/* values of kt_state */
+enum {
+  KT_FREE = 0,
+  KT_RUNNABLE,
+  KT_RUNNING,
+  KT_ZOMBIE,
+  KT_PARKED                       /* in kthread_park() */
+};
+
+/* callee-saved registers, saved on the stack by swtch(); the stack
+   pointer is the address of the struct */
+struct context {
+  uint32_t edi;
+  uint32_t esi;
+  uint32_t ebx;
+  uint32_t ebp;
+  uint32_t eip;
+};
+
+struct kthread {
+  struct context *kt_context;     /* saved registers; valid unless running */
+  struct kthread *kt_next;        /* run queue link */
+  int kt_id;                      /* index into kthreads[] */
+  volatile int kt_state;          /* KT_* */
+  int kt_cpu;                     /* CPU it runs, or last ran, on */
+  char kt_name[16];
+  void (*kt_fn)(void *);          /* thread body and its argument */
+  void *kt_arg;
+  void *kt_java;                  /* the Java thread it runs, if any */
+  uint32_t kt_nruns;              /* times switched to */
+  uint32_t kt_npreempt;           /* times preempted by the timer */
+  uint64_t kt_cycles;             /* TSC cycles spent running */
+  uint64_t kt_start;              /* TSC when last switched to */
+};
+
+/* the Java VM's run queues (JavaStealingScheduler), which hold the
+   runnable threads that carry Java threads; the VM side is made by
+   JavaStealingScheduler::kernelOps().  sj_enqueue() is passed a thread's
+   kt_java and the thread itself, which sj_pick() returns for 'cpu' when
+   it is that thread's turn.  both are called with interrupts off */
+struct sched_java {
+  void (*sj_enqueue)(void *java, struct kthread *t);
+  struct kthread *(*sj_pick)(int cpu);
+  uint32_t (*sj_nqueued)(void);
+};
+
+extern struct kthread kthreads[NKTHREAD];
+
+struct kthread *kthread_create(const char *name, void (*fn)(void *),
+                               void *arg);
+
+/* kthread_create() for a thread that runs the Java thread 'java', and is
+   queued on the Java VM's run queues once sched_set_java() installed
+   them, rather than on the kernel's */
+struct kthread *kthread_create_java(const char *name, void (*fn)(void *),
+                                    void *arg, void *java);
+struct kthread *kthread_current(void);
+void kthread_yield(void);
+void kthread_exit(void) __attribute__((noreturn));
+
+/* blocks the calling thread for as long as '*permit' is 0; the permit is
+   tested under the lock kthread_unpark() takes, so setting it and then
+   calling kthread_unpark() never loses the wakeup.  for
+   JavaVMThread::pause() */
+void kthread_park(volatile uint32_t *permit);
+void kthread_unpark(struct kthread *t);
+
+/* has Java threads queued on 'sj' from now on; before any is created */
+void sched_set_java(const struct sched_java *sj);
+
+/* per-CPU scheduler loop; never returns */
+void sched_start(void) __attribute__((noreturn));
+
+/* called from trap() on a timer interrupt and on a reschedule IPI */
+void sched_tick(void);
+void sched_ipi(void);
+
+/* number of threads waiting in the run queues */
+uint32_t sched_nrunnable(void);
+
+/* nonzero if a word on some thread's stack lies in [lo, hi) */
+int kthread_stack_refs(uintptr_t lo, uintptr_t hi);
+
+#endif /* KERN_SCHED_H */
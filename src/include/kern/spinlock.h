@@ -0,0 +1,27 @@
+/**
+ * @file spinlock.h
+ * @desc mutual exclusion spin locks
+ */
+#ifndef KERN_SPINLOCK_H
+#define KERN_SPINLOCK_H
+
+#ifndef COMPILE_KERNEL
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <types.h>
+
+struct spinlock {
+  volatile unsigned locked;       /* is the lock held? */
+  const char *name;               /* name of lock, for debugging */
+  struct cpuinfo *cpu;            /* the CPU holding the lock */
+};
+
+void spin_initlock(struct spinlock *lk, const char *name);
+void spin_lock(struct spinlock *lk);
+void spin_unlock(struct spinlock *lk);
+int  spin_holding(struct spinlock *lk);
+
+#define SPINLOCK_INITIALIZER(n) { 0, (n), 0 }
+
+#endif /* KERN_SPINLOCK_H */
@@ -0,0 +1,60 @@
+/**
+ * @file tlb.h
+ * @desc batched TLB invalidation: ranges are collected while page table
+ *       entries change, then flushed on every CPU at once, by page or by
+ *       reloading CR3, with one shootdown IPI for the lot
+ */
+#ifndef KERN_TLB_H
+#define KERN_TLB_H
+
+#ifndef COMPILE_KERNEL
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <types.h>
+
+/* ranges a batch holds before it gives up and flushes everything */
+#define TLB_BATCH_RANGES  8
+
+/* pages past which a flush reloads CR3 rather than invlpg each; reloading
+   costs the whole TLB, invlpg costs about as much as a miss per page */
+#define TLB_FLUSH_PAGES   32
+
+struct tlb_range {
+  uintptr_t tr_start;
+  uintptr_t tr_end;
+};
+
+struct tlb_batch {
+  uint32_t tb_nranges;
+  uint32_t tb_npages;
+  int tb_all;                     /* flush everything */
+  struct tlb_range tb_ranges[TLB_BATCH_RANGES];
+};
+
+/* shootdown counts, for the "cpus" monitor command */
+struct tlb_stats {
+  uint32_t ts_nflush;             /* tlb_batch_flush() calls that flushed */
+  uint32_t ts_nall;               /* of them, CR3 reloads */
+  uint32_t ts_npages;             /* pages flushed with invlpg */
+  uint32_t ts_nipi;               /* shootdown IPIs sent */
+};
+
+void tlb_batch_init(struct tlb_batch *b);
+
+/* adds [va, va + size) to the batch; adjacent and overlapping ranges
+   merge */
+void tlb_batch_add(struct tlb_batch *b, uintptr_t va, size_t size);
+
+/* invalidates what the batch holds on this CPU and on every other
+   started CPU, and returns once they all have; the batch is emptied.
+   the caller must not hold a lock other CPUs may spin on with interrupts
+   off, since they would not take the IPI */
+void tlb_batch_flush(struct tlb_batch *b);
+
+/* does the shootdown asked of this CPU, if any; from the IPI handler */
+void tlb_shootdown(void);
+
+void tlb_stats(struct tlb_stats *st);
+
+#endif /* KERN_TLB_H */
@@ -0,0 +1,24 @@
+/**
+ * @file trap.h
+ * @desc kernel trap handling
+ */
+#ifndef KERN_TRAP_H
+#define KERN_TRAP_H
+
+#ifndef COMPILE_KERNEL
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <trap.h>
+#include <mmu.h>
+
+/* the kernel's interrupt descriptor table */
+extern struct gatedesc idt[];
+extern struct pseudodesc idt_pd;
+
+void idt_init(void);
+void trap_init_percpu(void);
+void print_regs(struct pushregs *regs);
+void print_trapframe(struct trapframe *tf);
+
+#endif /* KERN_TRAP_H */
@@ -46,47 +46,66 @@
 #define CR0_CD           0x40000000   /* cache disable */
 #define CR0_PG           0x80000000   /* paging */
 
+/* CR4 control register flags: for architectural extensions */
+#define CR4_PSE          0x00000010   /* page size extensions (4MB pages) */
+#define CR4_PAE          0x00000020   /* physical address extension */
+
+/* feature flags CPUID leaf 1 returns in EDX */
+#define CPUID_FEAT_PSE   0x00000008   /* page size extensions */
+#define CPUID_FEAT_PAE   0x00000040   /* physical address extension */
+#define CPUID_FEAT_SSE2  0x04000000   /* SSE2, and movnti with it */
+
 /* 
  * #2: definitions for paging
  *
- * linear address, la, has a three-part structure as shown below:
+ * paging is PAE paging: entries are 64 bits wide and hold physical
+ * addresses past 4GB; a linear address, la, has a four-part structure
+ * as shown below:
  *
- * +--------10------+-------10-------+---------12----------+
- * | page directory |   page table   | offset within page  |
- * |      index     |      index     |                     |
- * +----------------+----------------+---------------------+
- *  \--- PDX(la) --/ \--- PTX(la) --/ \---- PGOFF(la) ----/
- *   \----------- PPN(la) ---------/
+ * +-2-+-------9--------+-------9--------+---------12----------+
+ * |PDP| page directory |   page table   | offset within page  |
+ * |idx|      index     |      index     |                     |
+ * +---+----------------+----------------+---------------------+
+ *  \------ PDX(la) ----/ \--- PTX(la) --/ \---- PGOFF(la) ----/
+ *   \--------------- VPN(la) ------------/
  *
- * PDX, PTX, PGOFF, and PPN macros decompose linear addresses as shown;
+ * CR3 points to a page directory pointer table of four entries, each for
+ * 1GB; the kernel allocates the four page directories they point to in
+ * one piece, so that they form a single table of NPDENTRIES entries,
+ * which PDX indexes with the top two bits and the page directory index
+ * together
+ *
+ * PDX, PTX, PGOFF, and VPN macros decompose linear addresses as shown;
  * to construct a linear address, la, from PDX(la), PTX(la), and
  * PGOFF(la), use PGADDR(PDX(la), PTX(la), PGOFF(la))
  */
 
 /* page directory and page table constants */
-#define NPDENTRIES   1024    /* page dir entries per page directory */
-#define NPTENTRIES   1024    /* page table entries per page table */
+#define NPDPTENTRIES 4       /* entries in the page dir pointer table */
+#define NPDENTRIES   2048    /* page dir entries, of all four page dirs */
+#define NPTENTRIES   512     /* page table entries per page table */
 
 #define PGSIZE       4096    /* bytes mapped by a page */
 #define PGSHIFT      12      /* log2(PGSIZE) */
 
 #define PTSIZE       (PGSIZE * NPTENTRIES) 
                              /* bytes mapped by a page dir entry */
-#define PTSHIFT      22      /* log2(PTSIZE) */
+#define PTSHIFT      21      /* log2(PTSIZE) */
  
 #define PTXSHIFT     12      /* offset of PTX in a linear address */
-#define PDXSHIFT     22      /* offset of PDX in a linear address */
+#define PDXSHIFT     21      /* offset of PDX in a linear address */
 
-/* page number field of address */
-#define PPN(la)   (((uintptr_t) (la)) >> PTXSHIFT)
-#define VPN(la)   PPN(la) 
+/* page number of a physical address, which may be past 4GB, and of a
+   linear address */
+#define PPN(pa)   ((uint32_t) ((pa) >> PGSHIFT))
+#define VPN(la)   (((uintptr_t) (la)) >> PTXSHIFT)
 
 /* page directory index */
-#define PDX(la)   ((((uintptr_t) (la)) >> PDXSHIFT) & 0x3FF)
+#define PDX(la)   ((((uintptr_t) (la)) >> PDXSHIFT) & 0x7FF)
 #define VPD(la)   PDX(la)
 
 /* page table index */
-#define PTX(la)   ((((uintptr_t) (la)) >> PTXSHIFT) & 0x3FF)
+#define PTX(la)   ((((uintptr_t) (la)) >> PTXSHIFT) & 0x1FF)
 
 /* offset in page */
 #define PGOFF(la) (((uintptr_t) (la)) & 0xFFF)
@@ -107,9 +126,15 @@
 #define PTE_D        0x040   /* dirty */
 #define PTE_PS       0x080   /* page size */
 #define PTE_MBZ      0x180   /* bits must be zero */
+#define PTE_AVAIL    0xE00   /* available for software use */
+
+/* address in page table or page directory entry; bits 12 to 51 */
+#define PTE_ADDR(pte) ((physaddr_t) (pte) & 0x000FFFFFFFFFF000ULL)
 
-/* address in page table or page directory entry */
-#define PTE_ADDR(pte) ((uint)(pte) & ~0xFFF)
+/* page fault error codes */
+#define FEC_PR       0x1     /* page fault caused by protection violation */
+#define FEC_WR       0x2     /* page fault caused by a write */
+#define FEC_U        0x4     /* page fault occured while in user mode */
 
 /*
  * #3: definitions for segmentation
@@ -35,13 +35,14 @@ typedef uint32_t size_t;
    error return */
 typedef int32_t ssize_t;
 
-/* pointers and addresses are 32 bits long; we use pointer types to 
-   represent virtual addresses; uintptr_t to represent the numerical 
+/* pointers and virtual addresses are 32 bits long; we use pointer types
+   to represent virtual addresses; uintptr_t to represent the numerical 
    values of virtual addresses, and physaddr_t to represent physical 
-   addresses (NOTE: used for memory management) */
+   addresses, which are 64 bits long with PAE paging (NOTE: used for
+   memory management) */
 typedef int32_t intptr_t;
 typedef uint32_t uintptr_t;
-typedef uint32_t physaddr_t;
+typedef uint64_t physaddr_t;
 
 
 /* efficient min and max operations */
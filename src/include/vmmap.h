@@ -17,7 +17,8 @@
 #define GD_KD     0x10     /* kernel data */
 #define GD_UT     0x18     /* user text */
 #define GD_UD     0x20     /* user data */
-#define GD_TSS    0x28     /* task segment selector */
+#define GD_TSS0   0x28     /* task segment selector for CPU 0; CPU i uses
+                              GD_TSS0 + (i << 3) */
 
 /* virtual memory map:                                 permissions
                                                       (kernel/user)
@@ -33,24 +34,37 @@
                       |   Remapped Physical Memory   | RW/--
                       |                              | RW/--
      KERNBASE ----->  +------------------------------+ 0xf0000000
-                      |  Cur. Page Table (Kern. RW)  | RW/--  PTSIZE
-     VPT,KSTACKTOP--> +------------------------------+ 0xefc00000      --+
-                      |         Kernel Stack         | RW/--  KSTKSIZE   |
+                      |  Cur. Page Table (Kern. RW)  | RW/--  VPTSIZE
+     VPT,KSTACKTOP--> +------------------------------+ 0xef800000      --+
+                      |     CPU0's Kernel Stack      | RW/--  KSTKSIZE   |
+                      | - - - - - - - - - - - - - - -|                   |
+                      |      Invalid Memory (*)      | --/--  KSTKGAP    |
+                      +------------------------------+                   |
+                      |     CPU1's Kernel Stack      | RW/--  KSTKSIZE   |
                       | - - - - - - - - - - - - - - -|                 PTSIZE
-                      |      Invalid Memory (*)      | --/--             |
-     ULIM     ------> +------------------------------+ 0xef800000      --+
-                      |  Cur. Page Table (User R-)   | R-/R-  PTSIZE
-     UVPT      ---->  +------------------------------+ 0xef400000
+                      |      Invalid Memory (*)      | --/--  KSTKGAP    |
+                      +------------------------------+                   |
+                      :              .               :                   |
+                      :              .               :                   |
+     MMIOLIM ------>  +------------------------------+ 0xef600000      --+
+                      |       Memory-mapped I/O      | RW/--  PTSIZE
+     MMIOBASE ----->  +------------------------------+ 0xef400000
+                      |          Code Cache          | RW/--  CODESIZE
+     CODEBASE ----->  +------------------------------+ 0xee400000
+                      |          Java Heap           | RW/--  HEAPSIZE
+     ULIM, HEAPBASE > +------------------------------+ 0xea400000
+                      |  Cur. Page Table (User R-)   | R-/R-  VPTSIZE
+     UVPT      ---->  +------------------------------+ 0xe9c00000
                       |          RO PAGES            | R-/R-  PTSIZE
-     UPAGES    ---->  +------------------------------+ 0xef000000
+     UPAGES    ---->  +------------------------------+ 0xe9a00000
                       |           RO ENVS            | R-/R-  PTSIZE
-  UTOP,UENVS ------>  +------------------------------+ 0xeec00000
+  UTOP,UENVS ------>  +------------------------------+ 0xe9800000
   UXSTACKTOP -/       |     User Exception Stack     | RW/RW  PGSIZE
-                      +------------------------------+ 0xeebff000
+                      +------------------------------+ 0xe97ff000
                       |       Empty Memory (*)       | --/--  PGSIZE
-     USTACKTOP  --->  +------------------------------+ 0xeebfe000
+     USTACKTOP  --->  +------------------------------+ 0xe97fe000
                       |      Normal User Stack       | RW/RW  PGSIZE
-                      +------------------------------+ 0xeebfd000
+                      +------------------------------+ 0xe97fd000
                       |                              |
                       |                              |
                       ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -59,14 +73,14 @@
                       .                              .
                       |~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~|
                       |     Program Data & Heap      |
-     UTEXT -------->  +------------------------------+ 0x00800000
+     UTEXT -------->  +------------------------------+ 0x00400000
      PFTEMP ------->  |       Empty Memory (*)       |        PTSIZE
                       |                              |
-     UTEMP -------->  +------------------------------+ 0x00400000      --+
+     UTEMP -------->  +------------------------------+ 0x00200000      --+
                       |       Empty Memory (*)       |                   |
                       | - - - - - - - - - - - - - - -|                   |
                       |  User STAB Data (optional)   |                 PTSIZE
-     USTABDATA ---->  +------------------------------+ 0x00200000        |
+     USTABDATA ---->  +------------------------------+ 0x00100000        |
                       |       Empty Memory (*)       |                   |
      0 ------------>  +------------------------------+                 --+
  
@@ -77,21 +91,48 @@
 
 /* NOTE: macro defs below are in decreasing order of addresses from 4GB */
 
-/* all physical memory mapped at this address */
+/* physical memory mapped at this address, up to the 256MB that fit */
 #define KERNBASE   0xF0000000
 
-/* virtual page table;  entry PDX[VPT] in the PD contains a pointer to
-   the page directory itself, essentially turning the PD into a page table,
-   which maps all the PTEs containing the page mappings for the entire
-   virtual address space into that 4MB region starting at VPT */
-#define VPT        (KERNBASE - PTSIZE)  /* kernel page table */
+/* virtual page table;  the NPDPTENTRIES entries from PDX[VPT] in the PD
+   contain pointers to the page directories themselves, essentially
+   turning the PD into page tables, which map all the PTEs containing the
+   page mappings for the entire virtual address space into that 8MB
+   region starting at VPT */
+#define VPTSIZE    (NPDPTENTRIES * PTSIZE)
+#define VPT        (KERNBASE - VPTSIZE) /* kernel page table */
 #define KSTACKTOP  VPT                  /* kernel stack top */
 #define KSTKSIZE   (8 * PGSIZE)         /* size of a kernel stack */
-#define ULIM       (KSTACKTOP - PTSIZE) /* boundary between kernal and user */
+#define KSTKGAP    (8 * PGSIZE)         /* unmapped guard below each stack */
+
+/* memory-mapped I/O; device registers (e.g. the local APIC) are mapped
+   here uncached by mmio_map_region() */
+#define MMIOLIM    (KSTACKTOP - PTSIZE)
+#define MMIOBASE   (MMIOLIM - PTSIZE)
+
+/* the top of the MMIO range is a page per CPU through which the kernel
+   reaches physical pages past the end of the KERNBASE map */
+#define KMAPSIZE   (8 * PGSIZE)
+#define KMAPBASE   (MMIOLIM - KMAPSIZE)
+
+/* executable memory for compiled Java code, in one fixed range per
+   segment; pages are mapped on demand by kern/codecache.c */
+#define CODELIM    MMIOBASE
+#define CODESIZE   (8 * PTSIZE)
+#define CODEBASE   (CODELIM - CODESIZE)
+
+/* the Java heap; handed out by heap_map(), and backed with 2MB pages
+   where it can be, or by heap_reserve(), and backed a page at a time as
+   it is touched */
+#define HEAPLIM    CODEBASE
+#define HEAPSIZE   (32 * PTSIZE)
+#define HEAPBASE   (HEAPLIM - HEAPSIZE)
+
+#define ULIM       HEAPBASE             /* boundary between kernal and user */
 
 /* user read-only mappings; anything below here til UTOP are readonly to 
    user; they are global pages mapped in at env allocation time */
-#define UVPT       (ULIM - PTSIZE)      /* same as VPT but RO for users */
+#define UVPT       (ULIM - VPTSIZE)     /* same as VPT but RO for users */
 #define UPAGES     (UVPT - PTSIZE)      /* RO copies of page structures */
 #define UENVS      (UPAGES - PTSIZE)    /* RO copies of global env structs */
 
@@ -114,12 +155,22 @@
 /* the location of the user-level STABS data structure */
 #define USTABDATA  (PTSIZE / 2) 
 
+/* physical memory past this address is not used; PAE paging reaches
+   further, but pages[] describes every page below it and must fit in the
+   KERNBASE map, and for 16GB it takes 48MB */
+#define PHYSLIM    0x400000000ULL
+
 /* at IOPHYSMEM (640K) there is a 384K hole for I/O; from the kernel,
    IOPHYSMEM can be addressed at KERNBASE + IOPHYSMEM;  the hole ends
    at physical address EXTPHYSMEM */
 #define EXTPHYSMEM 0x100000
 #define IOPHYSMEM  0x0A0000
 
+/* physical address where application processors start executing; the AP
+   bootstrap code (kern/mpentry.S) is copied here, so it must be below 1MB
+   and page aligned, and the page is never handed out by page_init() */
+#define MPENTRY_PADDR 0x7000
+
 #ifndef __ASSEMBLER__
 
 /* page numbers are 32 bits long */
@@ -128,20 +179,22 @@ typedef uint32_t ppn_t;
 /* off_t is used for file offsets and lengths */
 typedef int32_t off_t;
 
-/* the page directory entry corresponding to the virtual address range
-   [VPT, VPT + PTSIZE) points to the page directory itself; thus, the page
-   directory is treated as a page table as well as a page directory
+/* the page directory entries corresponding to the virtual address range
+   [VPT, VPT + VPTSIZE) point to the page directories themselves, in
+   order; thus, the page directories are treated as page tables as well
+   as page directories
    
-   one result of treating the page directory as a page table is that all 
+   one result of treating the page directories as page tables is that all 
    PTEs can be accessed through a "virtual page table" at virtual address 
    VPT (to which vpt is set in entry.S); the PTE for page number N is 
    stored in vpt[N] (it's worth drawing a diagram of this)
    
-   a second consequence is that the contents of the current page directory
-   will always be available at virtual address (VPT + (VPT >> PGSHIFT)), to
-   which vpd is set in entry.S */
-typedef uint32_t pte_t;
-typedef uint32_t pde_t;
+   a second consequence is that the contents of the current page
+   directories will always be available at virtual address
+   (VPT + (VPT >> PGSHIFT) * sizeof(pte_t)), to which vpd is set in
+   entry.S; entries are 64 bits wide with PAE */
+typedef uint64_t pte_t;
+typedef uint64_t pde_t;
 
 extern volatile pte_t vpt[];     /* va of virtual page table */
 extern volatile pde_t vpd[];     /* va of current page directory */
@@ -161,7 +214,19 @@ struct page {
      at boot time using pmap.c's boot_alloc do not have valid reference 
      count fields */
   uint16_t pp_ref;
+
+  /* the first page of a block of 2^pp_order pages, free or allocated,
+     holds its order; the other pages of the block are not looked at,
+     except that every page of a slab holds the slab's order */
+  uint8_t pp_order;
+  uint8_t pp_flags;         /* PP_* */
 };
 
+#define PP_FREE   0x01      /* first page of a block on a free list */
+#define PP_CACHED 0x02      /* in a CPU's page magazine */
+#define PP_SLAB   0x04      /* in a slab of kmalloc.c */
+#define PP_ZERO   0x08      /* cleared, in the pool of page_alloc_zeroed() */
+#define PP_COLOR  0x10      /* free, on a list of page_alloc_color() */
+
 #endif /* __ASSEMBLER__ */
 #endif /* VMMAP_H */
@@ -38,7 +38,10 @@ static __inline uint32_t read_ebp(void) __attribute__((always_inline));
 static __inline uint32_t read_esp(void) __attribute__((always_inline));
 static __inline void cpuid(uint32_t, uint32_t *, uint32_t *, uint32_t *, 
                            uint32_t *);
+static __inline void cpuid_count(uint32_t, uint32_t, uint32_t *, uint32_t *,
+                                 uint32_t *, uint32_t *);
 static __inline uint64_t read_tsc(void) __attribute__((always_inline));
+static __inline uint32_t xchg(volatile uint32_t *, uint32_t) __attribute__((always_inline));
 
 static __inline void breakpoint(void)
 {
@@ -242,6 +245,25 @@ static __inline void cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp,
     *edxp = edx;
 }
 
+/* cpuid for leaves that take a subleaf in ECX */
+static __inline void cpuid_count(uint32_t info, uint32_t count,
+                                 uint32_t *eaxp, uint32_t *ebxp,
+                                 uint32_t *ecxp, uint32_t *edxp)
+{
+  uint32_t eax, ebx, ecx, edx;
+  asm volatile("cpuid"
+               : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+               : "a" (info), "c" (count));
+  if (eaxp)
+    *eaxp = eax;
+  if (ebxp)
+    *ebxp = ebx;
+  if (ecxp)
+    *ecxp = ecx;
+  if (edxp)
+    *edxp = edx;
+}
+
 static __inline uint64_t read_tsc(void)
 {
   uint64_t tsc;
@@ -249,4 +271,16 @@ static __inline uint64_t read_tsc(void)
   return tsc;
 }
 
+/* atomically store 'newval' at 'addr' and return the old value; also a
+   full memory barrier */
+static __inline uint32_t xchg(volatile uint32_t *addr, uint32_t newval)
+{
+  uint32_t result;
+  __asm __volatile("lock; xchgl %0, %1"
+                   : "+m" (*addr), "=a" (result)
+                   : "1" (newval)
+                   : "cc", "memory");
+  return result;
+}
+
 #endif /* X86_H */
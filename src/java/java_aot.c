@@ -0,0 +1,270 @@
+/**
+ * @file java_aot.c
+ * @desc loading of ahead-of-time compiled images
+ *
+ * @author cjeong
+ */
+#include <string.h>
+#include <java/java_instr.h>
+#include <java/java_vm.h>
+#include <java/java_runtime.h>
+#include <java/java_compiler.h>
+#include <java/java_codecache.h>
+#include <java/java_aot.h>
+
+struct JavaAotRoutine {
+  const char *name;
+  const void *fn;
+};
+
+#define ROUTINE(c, f)  { #c "::" #f, JAVA_FN(&c::f) }
+
+/* everything the baseline compiler's code calls */
+static const JavaAotRoutine routines[] = {
+  ROUTINE(JavaRuntime, throwException),
+  ROUTINE(JavaRuntime, throwObject),
+  ROUTINE(JavaRuntime, newObject),
+  ROUTINE(JavaRuntime, newArray),
+  ROUTINE(JavaRuntime, monitorEnter),
+  ROUTINE(JavaRuntime, monitorExit),
+  ROUTINE(JavaRuntime, resolveVirtual),
+  ROUTINE(JavaRuntime, resolveInterface),
+  ROUTINE(JavaRuntime, checkCast),
+  ROUTINE(JavaRuntime, instanceOf),
+  ROUTINE(JavaRuntime, ldiv),
+  ROUTINE(JavaRuntime, lrem),
+  ROUTINE(JavaRuntime, frem),
+  ROUTINE(JavaRuntime, drem),
+  ROUTINE(JavaRuntime, lcmp),
+  ROUTINE(JavaRuntime, fcmpl),
+  ROUTINE(JavaRuntime, fcmpg),
+  ROUTINE(JavaRuntime, dcmpl),
+  ROUTINE(JavaRuntime, dcmpg),
+  ROUTINE(JavaRuntime, f2i),
+  ROUTINE(JavaRuntime, f2l),
+  ROUTINE(JavaRuntime, d2i),
+  ROUTINE(JavaRuntime, d2l),
+  ROUTINE(JavaCompiler, checkTier),
+  ROUTINE(JavaCompiler, checkOsr)
+};
+
+#define NROUTINES  (sizeof(routines) / sizeof(routines[0]))
+
+
+/* by the low 32 bits, which is all the code holds */
+const char *JavaAot::routineName(const void *fn)
+{
+  u4 i;
+
+  for (i = 0; i < NROUTINES; i++)
+    if ((u4) (uintptr) routines[i].fn == (u4) (uintptr) fn)
+      return routines[i].name;
+  return 0;
+}
+
+const void *JavaAot::routine(const char *name)
+{
+  u4 i;
+
+  for (i = 0; i < NROUTINES; i++)
+    if (strcmp(routines[i].name, name) == 0)
+      return routines[i].fn;
+  return 0;
+}
+
+static void put4(u1 *p, u4 v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+/* the tables of an image, found and checked by check() */
+struct JavaAotImage {
+  const JavaAotHeader *h;
+  const JavaAotMethod *methods;
+  const JavaAotOsr *osr;
+  const JavaAotSymbol *symbols;
+  const JavaAotReloc *relocs;
+  const char *strings;
+  const u1 *code;
+};
+
+static bool check(const u1 *image, u4 size, JavaAotImage *im)
+{
+  const JavaAotHeader *h = (const JavaAotHeader *) image;
+  const JavaAotMethod *am;
+  const JavaAotSymbol *s;
+  const JavaAotReloc *r;
+  uint64 end;
+  u4 i, j;
+
+  if (size < sizeof(*h) || h->magic != JAVA_AOT_MAGIC ||
+      h->version != JAVA_AOT_VERSION || h->stringsSize == 0)
+    return false;
+  end = sizeof(*h) + (uint64) h->numMethods * sizeof(JavaAotMethod) +
+    (uint64) h->numOsr * sizeof(JavaAotOsr) +
+    (uint64) h->numSymbols * sizeof(JavaAotSymbol) +
+    (uint64) h->numRelocs * sizeof(JavaAotReloc) +
+    h->stringsSize + h->codeSize;
+  if (end > size)
+    return false;
+
+  im->h = h;
+  im->methods = (const JavaAotMethod *) (h + 1);
+  im->osr = (const JavaAotOsr *) (im->methods + h->numMethods);
+  im->symbols = (const JavaAotSymbol *) (im->osr + h->numOsr);
+  im->relocs = (const JavaAotReloc *) (im->symbols + h->numSymbols);
+  im->strings = (const char *) (im->relocs + h->numRelocs);
+  im->code = (const u1 *) im->strings + h->stringsSize;
+  if (im->strings[h->stringsSize - 1] != '\0')
+    return false;
+
+  for (i = 0; i < h->numSymbols; i++) {
+    s = &im->symbols[i];
+    if (s->kind > JavaAotRuntimeSym || s->owner >= h->stringsSize ||
+        s->name >= h->stringsSize || s->desc >= h->stringsSize)
+      return false;
+  }
+  for (i = 0; i < h->numMethods; i++) {
+    am = &im->methods[i];
+    if (am->symbol >= h->numSymbols ||
+        im->symbols[am->symbol].kind != JavaAotMethodSym ||
+        (uint64) am->code + am->size > h->codeSize ||
+        (uint64) am->firstOsr + am->numOsr > h->numOsr ||
+        (uint64) am->firstReloc + am->numRelocs > h->numRelocs)
+      return false;
+    for (j = 0; j < am->numOsr; j++)
+      if (im->osr[am->firstOsr + j].entry >= am->size)
+        return false;
+    for (j = 0; j < am->numRelocs; j++) {
+      r = &im->relocs[am->firstReloc + j];
+      if (JAVA_AOT_KIND(r->info) > JavaAotCode ||
+          JAVA_AOT_SYMBOL(r->info) >= h->numSymbols ||
+          (uint64) r->offset + 4 > am->size)
+        return false;
+    }
+  }
+  return true;
+}
+
+static uintptr resolve(const JavaAotSymbol *s, const char *strings,
+                       JavaAotResolver *r)
+{
+  JavaVMClass *c = 0;
+  JavaVMMethod *m;
+
+  switch (s->kind) {
+  case JavaAotArrayClassSym:
+    if (s->arg != 0 && (s->arg < JavaNewInstr::JavaarrayBoolean ||
+                        s->arg > JavaNewInstr::JavaArrayLong))
+      return 0;
+    return (uintptr) JavaRuntime::arrayClass(s->arg);
+  case JavaAotRuntimeSym:
+    return (uintptr) JavaAot::routine(strings + s->name);
+  }
+
+  if ((c = r->findClass(strings + s->owner)) == 0)
+    return 0;
+  switch (s->kind) {
+  case JavaAotClassSym:
+    return (uintptr) c;
+  case JavaAotMirrorSym:
+    return (uintptr) c->mirror();
+  case JavaAotStaticSym:
+    return (uintptr) r->findStatic(c, strings + s->name);
+  }
+
+  if ((m = r->findMethod(c, strings + s->name, strings + s->desc)) == 0)
+    return 0;
+  if (s->kind == JavaAotOsrSym)
+    return (uintptr) m->addOsrPoint(s->arg);
+  return (uintptr) m;
+}
+
+static bool install(const JavaAotImage *im, const JavaAotMethod *am,
+                    const std::vector<uintptr> &addrs)
+{
+  JavaVMMethod *m = (JavaVMMethod *) addrs[am->symbol];
+  JavaCompiledMethod *cm;
+  const JavaAotReloc *r;
+  const JavaAotOsr *o;
+  JavaOsrPoint *p;
+  u1 *code;
+  u4 i, base, v, queued;
+
+  /* an intrinsic stays in place of any code */
+  if (!m || m->intrinsic())
+    return false;
+  for (i = 0; i < am->numRelocs; i++) {
+    r = &im->relocs[am->firstReloc + i];
+    if (JAVA_AOT_KIND(r->info) != JavaAotCode &&
+        !addrs[JAVA_AOT_SYMBOL(r->info)])
+      return false;
+  }
+
+  /* code compiled here already, or on its way, is at least as good */
+  queued = m->requestedTier();
+  if (m->tier() >= JAVA_TIER_BASELINE || queued >= JAVA_TIER_BASELINE ||
+      javaCas(m->requestedTierAddr(), queued, JAVA_TIER_BASELINE) != queued)
+    return false;
+  if ((code = JavaCodeCache::alloc(JAVA_TIER_BASELINE, am->size)) == 0) {
+    m->requestedTier(queued);
+    return false;
+  }
+
+  memcpy(code, im->code + am->code, am->size);
+  base = (u4) (uintptr) code;
+  for (i = 0; i < am->numRelocs; i++) {
+    r = &im->relocs[am->firstReloc + i];
+    switch (JAVA_AOT_KIND(r->info)) {
+    case JavaAotAbs:
+      v = (u4) addrs[JAVA_AOT_SYMBOL(r->info)] + r->addend;
+      break;
+    case JavaAotRel:
+      v = (u4) addrs[JAVA_AOT_SYMBOL(r->info)] - (base + r->offset + 4);
+      break;
+    default:
+      v = base + r->addend;
+      break;
+    }
+    put4(code + r->offset, v);
+  }
+
+  cm = new JavaCompiledMethod(m, code, am->size, JAVA_TIER_BASELINE);
+  m->compiled(cm);
+  for (i = 0; i < am->numOsr; i++) {
+    o = &im->osr[am->firstOsr + i];
+    p = m->addOsrPoint(o->pc);
+    if (p->tier < JAVA_TIER_BASELINE) {
+      p->entry = (JavaOsrEntry) (uintptr) (code + o->entry);
+      p->tier = JAVA_TIER_BASELINE;
+    }
+  }
+  m->tier(JAVA_TIER_BASELINE);
+  m->entry((JavaEntry) (uintptr) code);
+  JavaCodeCache::add(cm);
+  return true;
+}
+
+int JavaAot::load(const u1 *image, u4 size, JavaAotResolver *r)
+{
+  JavaAotImage im;
+  std::vector<uintptr> addrs;
+  u4 i;
+  int n = 0;
+
+  if (!check(image, size, &im))
+    return -1;
+
+  /* each symbol once, however many methods refer to it */
+  addrs.resize(im.h->numSymbols);
+  for (i = 0; i < im.h->numSymbols; i++)
+    addrs[i] = resolve(&im.symbols[i], im.strings, r);
+
+  for (i = 0; i < im.h->numMethods; i++)
+    if (install(&im, &im.methods[i], addrs))
+      n++;
+  return n;
+}
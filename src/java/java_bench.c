@@ -0,0 +1,318 @@
+/**
+ * @file java_bench.c
+ * @desc microbenchmarks for the VM runtime
+ *
+ * @author cjeong
+ */
+#include <stdio.h>
+#include <java/java_vm.h>
+#include <java/java_object.h>
+#include <java/java_monitor.h>
+#include <java/java_thread.h>
+#include <java/java_interp.h>
+#include <java/java_compiler.h>
+#include <java/java_opt.h>
+#include <java/java_bench.h>
+
+void JavaBench::heapFootprint(JavaVMHeap *h, JavaVMClass *node,
+                              JavaVMClass *ints, u4 n)
+{
+  JavaObject *o, *prev = 0;
+  u4 objects, bytes, wide, i;
+
+  objects = h->numObjects();
+  bytes = h->numBytes();
+  wide = h->wideBytes();
+
+  for (i = 0; i < n; i++) {
+    if ((o = h->allocObject(node)) == 0 ||
+        h->allocArray(ints, i % 4) == 0)
+      break;
+    *(u4 *) o->fieldAddr(node->fieldOffset(0)) = (u4) (uintptr) prev;
+    prev = o;
+  }
+
+  objects = h->numObjects() - objects;
+  bytes = h->numBytes() - bytes;
+  wide = h->wideBytes() - wide;
+  printf("heap footprint (%u nodes%s): %u objects, %u bytes with a "
+         "one-word header, %u with two words (%u saved, %u%%)\n",
+         i, i < n ? ", heap full" : "", objects, bytes, wide,
+         wide - bytes, wide ? (wide - bytes) * 100 / wide : 0);
+}
+
+static uint64 lock_loop(JavaObject *o, JavaVMThread *t, u4 iters)
+{
+  uint64 start = javaReadTsc();
+  u4 i;
+
+  for (i = 0; i < iters; i++) {
+    JavaMonitor::lock(o, t);
+    JavaMonitor::unlock(o, t);
+  }
+  return javaReadTsc() - start;
+}
+
+void JavaBench::lockUncontended(JavaObject *thin, JavaObject *inflated,
+                                JavaVMThread *t, u4 iters)
+{
+  uint64 cycles;
+
+  JavaMonitor::inflate(inflated);
+
+  cycles = lock_loop(thin, t, iters);
+  printf("lock uncontended (thin):     %u cycles/op\n",
+         (u4) (cycles / iters));
+  cycles = lock_loop(inflated, t, iters);
+  printf("lock uncontended (inflated): %u cycles/op\n",
+         (u4) (cycles / iters));
+}
+
+/* the threads of lockContended(), made on first use and parked between
+   runs, and what the current run has them do */
+#define BENCH_MAX_THREADS  16
+
+static JavaVMThread *contenders[BENCH_MAX_THREADS];
+static int ncontenders;
+static JavaObject *volatile contend_obj;
+static volatile u4 contend_iters;
+static volatile u4 contend_done;
+
+static void contend(void *arg)
+{
+  JavaVMThread *t = (JavaVMThread *) arg;
+
+  for (;;) {
+    t->pause();
+    lock_loop(contend_obj, t, contend_iters);
+    javaAtomicAdd(&contend_done, 1);
+  }
+}
+
+void JavaBench::lockContended(JavaObject *o, int n, u4 iters)
+{
+  JavaVMThread *t;
+  uint64 cycles;
+  u4 inflations;
+  int i;
+
+  if (n > BENCH_MAX_THREADS)
+    n = BENCH_MAX_THREADS;
+  for (; ncontenders < n; ncontenders++) {
+    if ((t = JavaVMThread::create()) == 0)
+      break;
+    if (!t->start(contend, t)) {
+      delete t;
+      break;
+    }
+    contenders[ncontenders] = t;
+  }
+  if (ncontenders < n) {
+    printf("lock contended: only %d of %d threads could be started\n",
+           ncontenders, n);
+    return;
+  }
+
+  contend_obj = o;
+  contend_iters = iters;
+  contend_done = 0;
+  inflations = JavaMonitor::numInflations();
+
+  cycles = javaReadTsc();
+  for (i = 0; i < n; i++)
+    contenders[i]->resume();
+  while (contend_done != (u4) n)
+    javaCpuRelax();
+  cycles = javaReadTsc() - cycles;
+
+  printf("lock contended (%d threads): %u cycles/op, %u ops per Mcycle, "
+         "%u inflations, header %s\n",
+         n, (u4) (cycles / ((uint64) n * iters)),
+         (u4) ((uint64) n * iters * 1000000 / cycles),
+         JavaMonitor::numInflations() - inflations,
+         o->lockState() == JAVA_LOCK_INFLATED ? "inflated" : "thin");
+}
+
+void JavaBench::schedSwitch(JavaStealingScheduler *s, JavaThreadI **threads,
+                            int n, u4 iters, u4 mhz)
+{
+  JavaThreadI *t;
+  uint64 start, cycles;
+  u4 i, per;
+
+  for (i = 0; i < n; i++) {
+    threads[i]->getSchedInfo()->lastCpu = 0;
+    s->addThread(threads[i]);
+  }
+
+  start = javaReadTsc();
+  for (i = 0; i < iters; i++) {
+    t = s->pickNextThread(0);
+    s->addThread(t);
+  }
+  cycles = javaReadTsc() - start;
+
+  while (s->pickNextThread(0) || s->pickNextThread(1))
+    ;
+
+  per = cycles / iters;
+  printf("sched switch (%d threads): %u cycles/switch, %u switches/s\n",
+         n, per, per ? (u4) ((uint64) mhz * 1000000 / per) : 0);
+}
+
+void JavaBench::schedWakeup(JavaStealingScheduler *s, JavaThreadI **threads,
+                            int n, JavaThreadI *sleeper, u4 iters)
+{
+  JavaThreadI *t;
+  uint64 local = 0, remote = 0, start;
+  u4 i;
+  int j;
+
+  for (i = 0; i < iters; i++) {
+    /* same CPU, behind 'n' runnable threads of equal priority */
+    for (j = 0; j < n; j++) {
+      threads[j]->getSchedInfo()->lastCpu = 0;
+      s->addThread(threads[j]);
+    }
+    sleeper->getSchedInfo()->lastCpu = 0;
+    start = javaReadTsc();
+    s->addThread(sleeper);
+    while ((t = s->pickNextThread(0)) != sleeper)
+      ;
+    local += javaReadTsc() - start;
+
+    /* woken onto CPU 0, picked up by idle CPU 1 */
+    for (j = 0; j < n; j++) {
+      threads[j]->getSchedInfo()->lastCpu = 0;
+      s->addThread(threads[j]);
+    }
+    sleeper->getSchedInfo()->lastCpu = 0;
+    start = javaReadTsc();
+    s->addThread(sleeper);
+    while ((t = s->pickNextThread(1)) != sleeper)
+      ;
+    remote += javaReadTsc() - start;
+    while (s->pickNextThread(0) || s->pickNextThread(1))
+      ;
+  }
+
+  printf("sched wakeup (%d queued): %u cycles local, %u cycles stolen\n",
+         n, (u4) (local / iters), (u4) (remote / iters));
+}
+
+/* static int arith(int n)
+   { int s = 0; for (int i = 0; i < n; i++) s += i * i ^ s >> 3;
+     return s; } */
+static const u1 arith_code[] = {
+  0x03, 0x3C, 0x03, 0x3D, 0xA7, 0x00, 0x10, 0x1B, 0x1C, 0x1C, 0x68, 0x1B,
+  0x06, 0x7A, 0x82, 0x60, 0x3C, 0x84, 0x02, 0x01, 0x1C, 0x1A, 0xA1, 0xFF,
+  0xF1, 0x1B, 0xAC
+};
+
+/* static int sum(int[] a)
+   { for (int i = 0; i < a.length; i++) a[i] = i;
+     int s = 0; for (int i = 0; i < a.length; i++) s += a[i];
+     return s; } */
+static const u1 sum_code[] = {
+  0x03, 0x3C, 0xA7, 0x00, 0x0A, 0x2A, 0x1B, 0x1B, 0x4F, 0x84, 0x01, 0x01,
+  0x1B, 0x2A, 0xBE, 0xA1, 0xFF, 0xF6, 0x03, 0x3D, 0x03, 0x3C, 0xA7, 0x00,
+  0x0C, 0x1C, 0x2A, 0x1B, 0x2E, 0x60, 0x3D, 0x84, 0x01, 0x01, 0x1B, 0x2A,
+  0xBE, 0xA1, 0xFF, 0xF4, 0x1C, 0xAC
+};
+
+/* static int sq(int x) { return x * x; }
+   static int calls(int n)
+   { int s = 0; for (int i = 0; i < n; i++) s += sq(i); return s; } */
+static const u1 sq_code[] = { 0x1A, 0x1A, 0x68, 0xAC };
+static const u1 calls_code[] = {
+  0x03, 0x3C, 0x03, 0x3D, 0xA7, 0x00, 0x0D, 0x1B, 0x1C, 0xB8, 0x00, 0x01,
+  0x60, 0x3C, 0x84, 0x02, 0x01, 0x1C, 0x1A, 0xA1, 0xFF, 0xF4, 0x1B, 0xAC
+};
+
+/* calls 'e' 'iters' times; returns the result and the cycles per call */
+static u4 jit_run(JavaEntry e, JavaVMMethod *m, u4 arg, u4 iters,
+                  u4 *cycles)
+{
+  uint64 start;
+  u4 r = 0, i;
+
+  start = javaReadTsc();
+  for (i = 0; i < iters; i++)
+    r = (u4) e(m, &arg);
+  *cycles = (u4) ((javaReadTsc() - start) / iters);
+  return r;
+}
+
+/* runs 'm' with the single argument 'arg' through every tier */
+static void jit_compare(const char *name, JavaVMMethod *m, u4 arg, u4 iters)
+{
+  u4 ri, rb, ro, interp, base, opt, baseSize;
+
+  ri = jit_run(JavaInterp::interpret, m, arg, iters, &interp);
+  if (!JavaTranslator::compile(m)) {
+    printf("jit %s: not compilable\n", name);
+    return;
+  }
+  rb = jit_run(m->entry(), m, arg, iters, &base);
+  baseSize = m->compiled()->size();
+  printf("jit %s: %u cycles interpreted, %u cycles baseline (%u.%02ux), "
+         "%u bytes of code%s\n", name, interp, base,
+         base ? interp / base : 0, base ? interp * 100 / base % 100 : 0,
+         baseSize, ri == rb ? "" : ", RESULTS DIFFER");
+
+  if (!JavaOptimizer::compile(m)) {
+    printf("jit %s: not handled by the optimizing tier\n", name);
+    return;
+  }
+  ro = jit_run(m->entry(), m, arg, iters, &opt);
+  printf("jit %s: %u cycles optimized (%u.%02ux over baseline), "
+         "%u bytes of code%s\n", name, opt,
+         opt ? base / opt : 0, opt ? base * 100 / opt % 100 : 0,
+         m->compiled()->size(), ri == ro ? "" : ", RESULTS DIFFER");
+}
+
+void JavaBench::jitLoops(JavaArray *a, u4 n, u4 iters)
+{
+  JavaVMMethod arith(0, "arith", "(I)I", JAVA_METHOD_ACC_STATIC);
+  JavaVMMethod sum(0, "sum", "([I)I", JAVA_METHOD_ACC_STATIC);
+  JavaVMMethod sq(0, "sq", "(I)I", JAVA_METHOD_ACC_STATIC);
+  JavaVMMethod calls(0, "calls", "(I)I", JAVA_METHOD_ACC_STATIC);
+  JavaVMMethod hot(0, "hot", "(I)I", JAVA_METHOD_ACC_STATIC);
+  JavaVMMethod once(0, "once", "(I)I", JAVA_METHOD_ACC_STATIC);
+  JavaVMCpEntry cp[2];
+  JavaOsrPoint *p;
+  u4 arg = 1, i, r, s;
+
+  arith.setCode(arith_code, sizeof(arith_code), 3, 3);
+  sum.setCode(sum_code, sizeof(sum_code), 3, 3);
+  jit_compare("arith", &arith, n, iters);
+  jit_compare("sum", &sum, (u4) (uintptr) a, iters);
+
+  /* the optimizing tier inlines sq() into the loop */
+  sq.setCode(sq_code, sizeof(sq_code), 2, 1);
+  cp[1].method = &sq;
+  calls.setCode(calls_code, sizeof(calls_code), 2, 3);
+  calls.cpool(cp);
+  jit_compare("calls", &calls, n, iters);
+
+  /* the tier switch happens on the call that reaches the threshold */
+  hot.setCode(arith_code, sizeof(arith_code), 3, 3);
+  for (i = 0; i <= JAVA_TIER1_INVOCATIONS; i++)
+    hot.entry()(&hot, &arg);
+  JavaCompiler::drain();
+  printf("jit threshold: %s after %u calls (tier %u)\n",
+         hot.compiled() ? "compiled" : "NOT compiled", i, hot.tier());
+
+  /* a single call whose loop outlasts both backedge thresholds moves to
+     compiled code at the loop header, at pc 7, without returning */
+  once.setCode(arith_code, sizeof(arith_code), 3, 3);
+  arg = 2 * JAVA_TIER2_BACKEDGES;
+  r = (u4) once.entry()(&once, &arg);
+  JavaCompiler::drain();
+  for (i = s = 0; i < arg; i++)
+    s += i * i ^ (s4) s >> 3;
+  p = once.osrPoint(7);
+  printf("jit osr: loop %s (tier %u)%s\n",
+         p && p->entry ? "replaced" : "NOT replaced", p ? p->tier : 0,
+         r == s ? "" : ", RESULTS DIFFER");
+}
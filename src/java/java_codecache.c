@@ -0,0 +1,159 @@
+/**
+ * @file java_codecache.c
+ * @desc the VM's side of the code cache
+ *
+ * @author cjeong
+ */
+#include <stdio.h>
+#include <java/java_vm.h>
+#include <java/java_deopt.h>
+#include <java/java_codecache.h>
+
+JavaCodeCacheOps JavaCodeCache::_ops;
+JavaSpinLock JavaCodeCache::_lock;
+std::vector<JavaCompiledMethod *> JavaCodeCache::_code;
+volatile u4 JavaCodeCache::_numSinceSweep;
+volatile u4 JavaCodeCache::_numFull;
+u4 JavaCodeCache::_numSweeps;
+u4 JavaCodeCache::_numStale;
+u4 JavaCodeCache::_numCold;
+volatile u4 JavaCodeCache::_bytesRetired;
+
+static const char *segment_names[] = { "stubs", "baseline", "optimized" };
+
+
+void JavaCodeCache::init(const JavaCodeCacheOps *ops)
+{
+  _ops = *ops;
+}
+
+u1 *JavaCodeCache::alloc(u1 tier, u4 size)
+{
+  int seg = tier == JAVA_TIER_OPTIMIZED ? JavaCodeOptimized : JavaCodeBaseline;
+  void *code;
+
+  if (!_ops.alloc)
+    return new u1[size];
+
+  if ((code = _ops.alloc(seg, size)) == 0) {
+    sweep();
+    code = _ops.alloc(seg, size);
+  }
+  if (!code) {
+    javaAtomicAdd(&_numFull, 1);
+    printf("java: %s code cache full, %u bytes not compiled\n",
+           segment_names[seg], size);
+  }
+  return (u1 *) code;
+}
+
+u1 *JavaCodeCache::allocStub(u4 size)
+{
+  void *code;
+
+  if (!_ops.alloc)
+    return new u1[size];
+
+  if ((code = _ops.alloc(JavaCodeStubs, size)) == 0) {
+    javaAtomicAdd(&_numFull, 1);
+    printf("java: %s code cache full, %u bytes not allocated\n",
+           segment_names[JavaCodeStubs], size);
+  }
+  return (u1 *) code;
+}
+
+void JavaCodeCache::add(JavaCompiledMethod *cm)
+{
+  _lock.lock();
+  _code.push_back(cm);
+  _lock.unlock();
+
+  /* heap code is never freed, so there is nothing to sweep it for */
+  if (_ops.alloc &&
+      javaAtomicAdd(&_numSinceSweep, 1) + 1 >= JAVA_CODE_SWEEP_INTERVAL)
+    sweep();
+}
+
+/* baseline OSR entries point into the code of the whole method, so the
+   code can outlive the method's entry */
+bool JavaCodeCache::referenced(JavaCompiledMethod *cm)
+{
+  JavaVMMethod *m = cm->method();
+  JavaOsrPoint *o;
+
+  if (m->entry() == (JavaEntry) (uintptr) cm->code())
+    return true;
+  for (o = m->osrPoints(); o; o = o->next)
+    if (cm->contains((const void *) (uintptr) o->entry))
+      return true;
+  return false;
+}
+
+bool JavaCodeCache::hasOptimizedOsr(JavaVMMethod *m)
+{
+  JavaOsrPoint *o;
+
+  for (o = m->osrPoints(); o; o = o->next)
+    if (o->tier == JAVA_TIER_OPTIMIZED)
+      return true;
+  return false;
+}
+
+void JavaCodeCache::sweep()
+{
+  std::vector<JavaCompiledMethod *> dead;
+  JavaCompiledMethod *cm;
+  JavaVMMethod *m;
+  u4 i, n = 0, count;
+
+  _numSinceSweep = 0;
+  _lock.lock();
+  _numSweeps++;
+  for (i = 0; i < _code.size(); i++) {
+    cm = _code[i];
+    m = cm->method();
+    if (!referenced(cm)) {
+      _numStale++;
+      dead.push_back(cm);
+      continue;
+    }
+
+    /* both counters, since a loop can keep a method busy in one call */
+    count = m->invocations() + m->backedges();
+    if (count != cm->lastCount() || hasOptimizedOsr(m)) {
+      cm->lastCount(count);
+      cm->idleSweeps(0);
+    } else if (cm->idleSweeps() + 1 >= JAVA_CODE_COLD_SWEEPS) {
+      /* counts as invalidated too; the interpreter profiles it again if
+         it comes back */
+      JavaDeopt::invalidate(m);
+      _numCold++;
+      dead.push_back(cm);
+      continue;
+    } else
+      cm->idleSweeps(cm->idleSweeps() + 1);
+    _code[n++] = cm;
+  }
+  _code.resize(n);
+  _lock.unlock();
+
+  /* activations still running the code keep it alive in the kernel */
+  for (i = 0; i < dead.size(); i++) {
+    cm = dead[i];
+    if (cm->method()->compiled() == cm)
+      cm->method()->compiled(0);
+    javaAtomicAdd(&_bytesRetired, cm->size());
+    if (_ops.retire)
+      _ops.retire(cm->code());
+    delete cm;
+  }
+  if (_ops.sweep)
+    _ops.sweep();
+}
+
+void JavaCodeCache::dumpStats()
+{
+  printf("code cache: %u methods, %u sweeps, %u stale, %u cold, "
+         "%u bytes retired, %u full\n", (u4) _code.size(), _numSweeps,
+         _numStale, _numCold, _bytesRetired, _numFull);
+}
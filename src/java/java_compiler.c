@@ -0,0 +1,194 @@
+/**
+ * @file java_compiler.c
+ * @desc tiered compilation policy and the compile queue
+ *
+ * @author cjeong
+ */
+#include <stdio.h>
+#include <java/java_compiler.h>
+#include <java/java_opt.h>
+
+JavaSpinLock JavaCompiler::_lock;
+JavaCompileTask JavaCompiler::_queue[JAVA_COMPILE_QUEUE_SIZE];
+u4 JavaCompiler::_head;
+u4 JavaCompiler::_count;
+JavaVMThread *JavaCompiler::_thread;
+volatile u4 JavaCompiler::_numCompiled[JAVA_TIER_OPTIMIZED + 1];
+volatile u4 JavaCompiler::_numOsr;
+volatile u4 JavaCompiler::_numFailed;
+volatile u4 JavaCompiler::_numDropped;
+
+static const char *tier_names[] = { "interp", "baseline", "optimized" };
+
+
+u1 JavaCompiler::tierFor(JavaVMMethod *m)
+{
+  u4 inv = m->invocations(), back = m->backedges();
+
+  if (inv >= JAVA_TIER2_INVOCATIONS || back >= JAVA_TIER2_BACKEDGES)
+    return JAVA_TIER_OPTIMIZED;
+  if (inv >= JAVA_TIER1_INVOCATIONS || back >= JAVA_TIER1_BACKEDGES)
+    return JAVA_TIER_BASELINE;
+  return JAVA_TIER_INTERP;
+}
+
+bool JavaCompiler::enqueue(JavaVMMethod *m, u4 osrPc)
+{
+  JavaCompileTask *task;
+  bool ok = false;
+
+  _lock.lock();
+  if (_count < JAVA_COMPILE_QUEUE_SIZE) {
+    task = &_queue[(_head + _count) % JAVA_COMPILE_QUEUE_SIZE];
+    task->method = m;
+    task->osrPc = osrPc;
+    _count++;
+    ok = true;
+  }
+  _lock.unlock();
+  return ok;
+}
+
+bool JavaCompiler::dequeue(JavaCompileTask *task)
+{
+  bool ok = false;
+
+  _lock.lock();
+  if (_count > 0) {
+    *task = _queue[_head];
+    _head = (_head + 1) % JAVA_COMPILE_QUEUE_SIZE;
+    _count--;
+    ok = true;
+  }
+  _lock.unlock();
+  return ok;
+}
+
+/* moves '*requested' from 'queued' up to 'want' and has the compilation
+   done; only the thread that wins the CAS does so */
+void JavaCompiler::request(JavaVMMethod *m, u4 osrPc, volatile u4 *requested,
+                           u4 queued, u4 want)
+{
+  if (javaCas(requested, queued, want) != queued)
+    return;
+
+  if (!_thread) {
+    perform(m, osrPc);
+    return;
+  }
+  if (!enqueue(m, osrPc)) {
+    *requested = queued;
+    javaAtomicAdd(&_numDropped, 1);
+    return;
+  }
+  _thread->resume();
+}
+
+void JavaCompiler::perform(JavaVMMethod *m, u4 osrPc)
+{
+  if (osrPc == JAVA_NO_OSR)
+    compile(m, m->requestedTier());
+  else
+    compileOsr(m, osrPc);
+}
+
+void JavaCompiler::checkTier(JavaVMMethod *m)
+{
+  u4 want = tierFor(m), queued = m->requestedTier();
+
+  if (want <= queued || m->notCompilable())
+    return;
+  request(m, JAVA_NO_OSR, m->requestedTierAddr(), queued, want);
+}
+
+JavaOsrEntry JavaCompiler::checkOsr(JavaVMMethod *m, u4 pc)
+{
+  JavaOsrPoint *p;
+  u4 queued;
+
+  checkTier(m);
+
+  /* the baseline compiler makes the points, with its own entries; the
+     interpreter holds the lock of a synchronized method, which compiled
+     code would not know to release */
+  if (m->isSynchronized() || (p = m->osrPoint(pc)) == 0)
+    return 0;
+  queued = p->requestedTier;
+  if (tierFor(m) == JAVA_TIER_OPTIMIZED && queued < JAVA_TIER_OPTIMIZED)
+    request(m, pc, &p->requestedTier, queued, JAVA_TIER_OPTIMIZED);
+  return p->entry;
+}
+
+bool JavaCompiler::compile(JavaVMMethod *m, u1 tier)
+{
+  bool ok;
+
+  switch (tier) {
+  case JAVA_TIER_BASELINE:
+    ok = JavaTranslator::compile(m);
+    break;
+  case JAVA_TIER_OPTIMIZED:
+    /* the optimizing compiler handles a subset of the bytecode; other
+       methods stay at baseline, compiled now if they skipped tier 1 */
+    if (JavaOptimizer::compile(m)) {
+      ok = true;
+      break;
+    }
+    ok = m->tier() >= JAVA_TIER_BASELINE || JavaTranslator::compile(m);
+    tier = m->tier();
+    break;
+  default:
+    ok = false;
+    break;
+  }
+
+  if (ok)
+    javaAtomicAdd(&_numCompiled[tier], 1);
+  else
+    javaAtomicAdd(&_numFailed, 1);
+  return ok;
+}
+
+bool JavaCompiler::compileOsr(JavaVMMethod *m, u4 pc)
+{
+  bool ok = JavaOptimizer::compileOsr(m, pc);
+
+  if (ok)
+    javaAtomicAdd(&_numOsr, 1);
+  else
+    javaAtomicAdd(&_numFailed, 1);
+  return ok;
+}
+
+void JavaCompiler::run(JavaVMThread *t)
+{
+  JavaCompileTask task;
+
+  _thread = t;
+  for (;;) {
+    /* a resume() between the empty check and the pause() is remembered,
+       so a request queued meanwhile is not missed */
+    while (dequeue(&task))
+      perform(task.method, task.osrPc);
+    t->pause();
+  }
+}
+
+void JavaCompiler::drain()
+{
+  JavaCompileTask task;
+
+  while (dequeue(&task))
+    perform(task.method, task.osrPc);
+}
+
+void JavaCompiler::dumpStats()
+{
+  int i;
+
+  printf("compiler: %u queued, %u failed, %u dropped\n",
+         _count, _numFailed, _numDropped);
+  for (i = JAVA_TIER_BASELINE; i <= JAVA_TIER_OPTIMIZED; i++)
+    printf("  tier %d (%s): %u methods\n", i, tier_names[i], _numCompiled[i]);
+  printf("  osr: %u loops\n", _numOsr);
+}
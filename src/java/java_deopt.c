@@ -0,0 +1,162 @@
+/**
+ * @file java_deopt.c
+ * @desc deoptimization: interpreter frames rebuilt from the state the
+ *       optimizing compiler recorded at each trap, and the class
+ *       hierarchy dependencies of compiled code
+ *
+ * @author cjeong
+ */
+#include <stdio.h>
+#include <java/java_instr.h>
+#include <java/java_vm.h>
+#include <java/java_runtime.h>
+#include <java/java_interp.h>
+#include <java/java_trans.h>
+#include <java/java_deopt.h>
+
+JavaSpinLock JavaDeopt::_lock;
+std::vector<JavaDeopt::JavaDependency> JavaDeopt::_deps;
+volatile u4 JavaDeopt::_numTraps;
+volatile u4 JavaDeopt::_numInvalidated;
+
+/* pushad stores eax first, so register r ends up at regs[7 - r] */
+#define PUSHAD_SLOT(r)  (7 - (r))
+
+static u4 value_of(const JavaDeoptValue *v, u4 *regs)
+{
+  switch (v->kind) {
+  case JavaDeoptValue::Reg:
+    return regs[PUSHAD_SLOT(v->v)];
+  case JavaDeoptValue::Frame:
+    return *(u4 *) (uintptr) (regs[PUSHAD_SLOT(JavaEBP)] + v->v);
+  case JavaDeoptValue::Const:
+    return (u4) v->v;
+  default:
+    return 0;
+  }
+}
+
+/* rebuilds frame 'frame' of 'p' and the frames inside it, every one of
+   them before any runs, and then runs them from the inside out */
+uint64 JavaDeopt::resume(JavaDeoptPoint *p, u4 frame, u4 *regs,
+                         JavaVMFrame *prev)
+{
+  JavaDeoptFrame *d = &p->frames[frame];
+  JavaVMMethod *m = d->method;
+  JavaVMThread *t = JavaRuntime::currentThread();
+  u4 *slots, *sp, i;
+  uint64 r;
+
+  slots = (u4 *) __builtin_alloca((m->maxStack() + m->maxLocals()) *
+                                  sizeof(u4));
+  JavaVMFrame f(m, slots, prev);
+  for (i = 0; i < m->maxLocals(); i++)
+    f.locals()[-(s4) i] = i < d->numLocals ?
+      value_of(&p->values[d->first + i], regs) : 0;
+  sp = f.sp();
+  for (i = 0; i < d->numStack; i++)
+    *--sp = value_of(&p->values[d->first + d->numLocals + i], regs);
+  f.sp(sp);
+  f.pc(d->pc);
+
+  if (frame > 0) {
+    /* the invoke this frame was making returns the inner frame's
+       result; the optimizing compiler only inlines 32-bit results */
+    r = resume(p, frame - 1, regs, &f);
+    if (p->frames[frame - 1].method->retType() != 'V')
+      *--sp = (u4) r;
+    f.sp(sp);
+    f.pc(d->pc + jopLength(m->code(), d->pc));
+  }
+
+  if (t)
+    t->frameStack(&f);
+  r = JavaInterp::execute(&f);
+  if (t)
+    t->frameStack(f.prev());
+  return r;
+}
+
+uint64 JavaDeopt::deoptimize(JavaDeoptPoint *p, u4 *regs)
+{
+  JavaVMThread *t = JavaRuntime::currentThread();
+
+  javaAtomicAdd(&_numTraps, 1);
+
+  /* a speculation that keeps failing was wrong: the interpreter profiles
+     the method again, and the next compilation sees what it missed */
+  if (javaAtomicAdd(&p->traps, 1) + 1 == JAVA_DEOPT_RECOMPILE)
+    invalidate(p->method);
+
+  return resume(p, p->frames.size() - 1, regs, t ? t->frameStack() : 0);
+}
+
+void JavaDeopt::invalidate(JavaVMMethod *m)
+{
+  JavaOsrPoint *o;
+
+  /* the code cache sweeper retires the code, which stays until no
+     activation can be running it */
+  m->entry(JavaInterp::entry);
+  m->tier(JAVA_TIER_INTERP);
+  m->invocations(0);
+  m->backedges(0);
+  m->requestedTier(JAVA_TIER_INTERP);
+
+  /* baseline code tests the tier before it jumps through the entry */
+  for (o = m->osrPoints(); o; o = o->next) {
+    o->tier = JAVA_TIER_INTERP;
+    o->entry = 0;
+    o->requestedTier = JAVA_TIER_INTERP;
+  }
+  javaAtomicAdd(&_numInvalidated, 1);
+}
+
+void JavaDeopt::addDependency(JavaVMMethod *assumed, JavaVMMethod *dependent)
+{
+  JavaDependency d;
+  u4 i;
+
+  d.assumed = assumed;
+  d.dependent = dependent;
+  _lock.lock();
+  for (i = 0; i < _deps.size(); i++)
+    if (_deps[i].assumed == assumed && _deps[i].dependent == dependent)
+      break;
+  if (i == _deps.size())
+    _deps.push_back(d);
+  _lock.unlock();
+
+  /* a class loaded while the code was compiled; its guard traps until
+     the code is replaced */
+  if (assumed->isOverridden())
+    overridden(assumed);
+}
+
+void JavaDeopt::overridden(JavaVMMethod *m)
+{
+  std::vector<JavaVMMethod *> stale;
+  u4 i, n = 0;
+
+  /* compiled code tests the flag before every inlined copy */
+  m->overridden(true);
+
+  _lock.lock();
+  for (i = 0; i < _deps.size(); i++) {
+    if (_deps[i].assumed == m)
+      stale.push_back(_deps[i].dependent);
+    else
+      _deps[n++] = _deps[i];
+  }
+  _deps.resize(n);
+  _lock.unlock();
+
+  for (i = 0; i < stale.size(); i++)
+    invalidate(stale[i]);
+}
+
+void JavaDeopt::dumpStats()
+{
+  printf("deopt: %u traps, %u methods invalidated, %u dependencies\n",
+         _numTraps, _numInvalidated, (u4) _deps.size());
+}
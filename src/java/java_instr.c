@@ -0,0 +1,249 @@
+/**
+ * @file java_instr.c
+ * @desc opcode table and instruction decoding helpers
+ *
+ * @author cjeong
+ */
+#include <java/java_instr.h>
+
+const jop_info_t jop_info[256] = {
+  /* 0x00 */ { "nop", 1 },
+  /* 0x01 */ { "aconst_null", 1 },
+  /* 0x02 */ { "iconst_m1", 1 },
+  /* 0x03 */ { "iconst_0", 1 },
+  /* 0x04 */ { "iconst_1", 1 },
+  /* 0x05 */ { "iconst_2", 1 },
+  /* 0x06 */ { "iconst_3", 1 },
+  /* 0x07 */ { "iconst_4", 1 },
+  /* 0x08 */ { "iconst_5", 1 },
+  /* 0x09 */ { "lconst_0", 1 },
+  /* 0x0A */ { "lconst_1", 1 },
+  /* 0x0B */ { "fconst_0", 1 },
+  /* 0x0C */ { "fconst_1", 1 },
+  /* 0x0D */ { "fconst_2", 1 },
+  /* 0x0E */ { "dconst_0", 1 },
+  /* 0x0F */ { "dconst_1", 1 },
+  /* 0x10 */ { "bipush", 2 },
+  /* 0x11 */ { "sipush", 3 },
+  /* 0x12 */ { "ldc", 2 },
+  /* 0x13 */ { "ldc_w", 3 },
+  /* 0x14 */ { "ldc2_w", 3 },
+  /* 0x15 */ { "iload", 2 },
+  /* 0x16 */ { "lload", 2 },
+  /* 0x17 */ { "fload", 2 },
+  /* 0x18 */ { "dload", 2 },
+  /* 0x19 */ { "aload", 2 },
+  /* 0x1A */ { "iload_0", 1 },
+  /* 0x1B */ { "iload_1", 1 },
+  /* 0x1C */ { "iload_2", 1 },
+  /* 0x1D */ { "iload_3", 1 },
+  /* 0x1E */ { "lload_0", 1 },
+  /* 0x1F */ { "lload_1", 1 },
+  /* 0x20 */ { "lload_2", 1 },
+  /* 0x21 */ { "lload_3", 1 },
+  /* 0x22 */ { "fload_0", 1 },
+  /* 0x23 */ { "fload_1", 1 },
+  /* 0x24 */ { "fload_2", 1 },
+  /* 0x25 */ { "fload_3", 1 },
+  /* 0x26 */ { "dload_0", 1 },
+  /* 0x27 */ { "dload_1", 1 },
+  /* 0x28 */ { "dload_2", 1 },
+  /* 0x29 */ { "dload_3", 1 },
+  /* 0x2A */ { "aload_0", 1 },
+  /* 0x2B */ { "aload_1", 1 },
+  /* 0x2C */ { "aload_2", 1 },
+  /* 0x2D */ { "aload_3", 1 },
+  /* 0x2E */ { "iaload", 1 },
+  /* 0x2F */ { "laload", 1 },
+  /* 0x30 */ { "faload", 1 },
+  /* 0x31 */ { "daload", 1 },
+  /* 0x32 */ { "aaload", 1 },
+  /* 0x33 */ { "baload", 1 },
+  /* 0x34 */ { "caload", 1 },
+  /* 0x35 */ { "saload", 1 },
+  /* 0x36 */ { "istore", 2 },
+  /* 0x37 */ { "lstore", 2 },
+  /* 0x38 */ { "fstore", 2 },
+  /* 0x39 */ { "dstore", 2 },
+  /* 0x3A */ { "astore", 2 },
+  /* 0x3B */ { "istore_0", 1 },
+  /* 0x3C */ { "istore_1", 1 },
+  /* 0x3D */ { "istore_2", 1 },
+  /* 0x3E */ { "istore_3", 1 },
+  /* 0x3F */ { "lstore_0", 1 },
+  /* 0x40 */ { "lstore_1", 1 },
+  /* 0x41 */ { "lstore_2", 1 },
+  /* 0x42 */ { "lstore_3", 1 },
+  /* 0x43 */ { "fstore_0", 1 },
+  /* 0x44 */ { "fstore_1", 1 },
+  /* 0x45 */ { "fstore_2", 1 },
+  /* 0x46 */ { "fstore_3", 1 },
+  /* 0x47 */ { "dstore_0", 1 },
+  /* 0x48 */ { "dstore_1", 1 },
+  /* 0x49 */ { "dstore_2", 1 },
+  /* 0x4A */ { "dstore_3", 1 },
+  /* 0x4B */ { "astore_0", 1 },
+  /* 0x4C */ { "astore_1", 1 },
+  /* 0x4D */ { "astore_2", 1 },
+  /* 0x4E */ { "astore_3", 1 },
+  /* 0x4F */ { "iastore", 1 },
+  /* 0x50 */ { "lastore", 1 },
+  /* 0x51 */ { "fastore", 1 },
+  /* 0x52 */ { "dastore", 1 },
+  /* 0x53 */ { "aastore", 1 },
+  /* 0x54 */ { "bastore", 1 },
+  /* 0x55 */ { "castore", 1 },
+  /* 0x56 */ { "sastore", 1 },
+  /* 0x57 */ { "pop", 1 },
+  /* 0x58 */ { "pop2", 1 },
+  /* 0x59 */ { "dup", 1 },
+  /* 0x5A */ { "dup_x1", 1 },
+  /* 0x5B */ { "dup_x2", 1 },
+  /* 0x5C */ { "dup2", 1 },
+  /* 0x5D */ { "dup2_x1", 1 },
+  /* 0x5E */ { "dup2_x2", 1 },
+  /* 0x5F */ { "swap", 1 },
+  /* 0x60 */ { "iadd", 1 },
+  /* 0x61 */ { "ladd", 1 },
+  /* 0x62 */ { "fadd", 1 },
+  /* 0x63 */ { "dadd", 1 },
+  /* 0x64 */ { "isub", 1 },
+  /* 0x65 */ { "lsub", 1 },
+  /* 0x66 */ { "fsub", 1 },
+  /* 0x67 */ { "dsub", 1 },
+  /* 0x68 */ { "imul", 1 },
+  /* 0x69 */ { "lmul", 1 },
+  /* 0x6A */ { "fmul", 1 },
+  /* 0x6B */ { "dmul", 1 },
+  /* 0x6C */ { "idiv", 1 },
+  /* 0x6D */ { "ldiv", 1 },
+  /* 0x6E */ { "fdiv", 1 },
+  /* 0x6F */ { "ddiv", 1 },
+  /* 0x70 */ { "irem", 1 },
+  /* 0x71 */ { "lrem", 1 },
+  /* 0x72 */ { "frem", 1 },
+  /* 0x73 */ { "drem", 1 },
+  /* 0x74 */ { "ineg", 1 },
+  /* 0x75 */ { "lneg", 1 },
+  /* 0x76 */ { "fneg", 1 },
+  /* 0x77 */ { "dneg", 1 },
+  /* 0x78 */ { "ishl", 1 },
+  /* 0x79 */ { "lshl", 1 },
+  /* 0x7A */ { "ishr", 1 },
+  /* 0x7B */ { "lshr", 1 },
+  /* 0x7C */ { "iushr", 1 },
+  /* 0x7D */ { "lushr", 1 },
+  /* 0x7E */ { "iand", 1 },
+  /* 0x7F */ { "land", 1 },
+  /* 0x80 */ { "ior", 1 },
+  /* 0x81 */ { "lor", 1 },
+  /* 0x82 */ { "ixor", 1 },
+  /* 0x83 */ { "lxor", 1 },
+  /* 0x84 */ { "iinc", 3 },
+  /* 0x85 */ { "i2l", 1 },
+  /* 0x86 */ { "i2f", 1 },
+  /* 0x87 */ { "i2d", 1 },
+  /* 0x88 */ { "l2i", 1 },
+  /* 0x89 */ { "l2f", 1 },
+  /* 0x8A */ { "l2d", 1 },
+  /* 0x8B */ { "f2i", 1 },
+  /* 0x8C */ { "f2l", 1 },
+  /* 0x8D */ { "f2d", 1 },
+  /* 0x8E */ { "d2i", 1 },
+  /* 0x8F */ { "d2l", 1 },
+  /* 0x90 */ { "d2f", 1 },
+  /* 0x91 */ { "i2b", 1 },
+  /* 0x92 */ { "i2c", 1 },
+  /* 0x93 */ { "i2s", 1 },
+  /* 0x94 */ { "lcmp", 1 },
+  /* 0x95 */ { "fcmpl", 1 },
+  /* 0x96 */ { "fcmpg", 1 },
+  /* 0x97 */ { "dcmpl", 1 },
+  /* 0x98 */ { "dcmpg", 1 },
+  /* 0x99 */ { "ifeq", 3 },
+  /* 0x9A */ { "ifne", 3 },
+  /* 0x9B */ { "iflt", 3 },
+  /* 0x9C */ { "ifge", 3 },
+  /* 0x9D */ { "ifgt", 3 },
+  /* 0x9E */ { "ifle", 3 },
+  /* 0x9F */ { "if_icmpeq", 3 },
+  /* 0xA0 */ { "if_icmpne", 3 },
+  /* 0xA1 */ { "if_icmplt", 3 },
+  /* 0xA2 */ { "if_icmpge", 3 },
+  /* 0xA3 */ { "if_icmpgt", 3 },
+  /* 0xA4 */ { "if_icmple", 3 },
+  /* 0xA5 */ { "if_acmpeq", 3 },
+  /* 0xA6 */ { "if_acmpne", 3 },
+  /* 0xA7 */ { "goto", 3 },
+  /* 0xA8 */ { "jsr", 3 },
+  /* 0xA9 */ { "ret", 2 },
+  /* 0xAA */ { "tableswitch", 0 },
+  /* 0xAB */ { "lookupswitch", 0 },
+  /* 0xAC */ { "ireturn", 1 },
+  /* 0xAD */ { "lreturn", 1 },
+  /* 0xAE */ { "freturn", 1 },
+  /* 0xAF */ { "dreturn", 1 },
+  /* 0xB0 */ { "areturn", 1 },
+  /* 0xB1 */ { "return", 1 },
+  /* 0xB2 */ { "getstatic", 3 },
+  /* 0xB3 */ { "putstatic", 3 },
+  /* 0xB4 */ { "getfield", 3 },
+  /* 0xB5 */ { "putfield", 3 },
+  /* 0xB6 */ { "invokevirtual", 3 },
+  /* 0xB7 */ { "invokespecial", 3 },
+  /* 0xB8 */ { "invokestatic", 3 },
+  /* 0xB9 */ { "invokeinterface", 5 },
+  /* 0xBA */ { "unused", 1 },
+  /* 0xBB */ { "new", 3 },
+  /* 0xBC */ { "newarray", 2 },
+  /* 0xBD */ { "anewarray", 3 },
+  /* 0xBE */ { "arraylength", 1 },
+  /* 0xBF */ { "athrow", 1 },
+  /* 0xC0 */ { "checkcast", 3 },
+  /* 0xC1 */ { "instanceof", 3 },
+  /* 0xC2 */ { "monitorenter", 1 },
+  /* 0xC3 */ { "monitorexit", 1 },
+  /* 0xC4 */ { "wide", 0 },
+  /* 0xC5 */ { "multianewarray", 4 },
+  /* 0xC6 */ { "ifnull", 3 },
+  /* 0xC7 */ { "ifnonnull", 3 },
+  /* 0xC8 */ { "goto_w", 5 },
+  /* 0xC9 */ { "jsr_w", 5 },
+  /* 0xCA */ { "breakpoint", 1 },
+  /* 0xCB-0xFD unassigned */
+  { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+  { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+  { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+  { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+  { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+  { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+  { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+  { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 },
+  { 0, 0 }, { 0, 0 }, { 0, 0 },
+  /* 0xFE */ { "impdep1", 1 },
+  /* 0xFF */ { "impdep2", 1 },
+};
+
+u4 jopLength(const u1 *code, u4 pc)
+{
+  u4 p;
+
+  switch (code[pc]) {
+  case JOP_TABLESWITCH:
+    /* operands start at the next 4-byte boundary: default, low, high and
+       high - low + 1 offsets */
+    p = (pc + 4) & ~3;
+    return p - pc + 12 + 4 * (jopS4(code + p + 8) - jopS4(code + p + 4) + 1);
+
+  case JOP_LOOKUPSWITCH:
+    /* default, npairs, then npairs (match, offset) pairs */
+    p = (pc + 4) & ~3;
+    return p - pc + 8 + 8 * jopS4(code + p + 4);
+
+  case JOP_WIDE:
+    return code[pc + 1] == JOP_IINC ? 6 : 4;
+
+  default:
+    return jop_info[code[pc]].size;
+  }
+}
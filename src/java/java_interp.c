@@ -0,0 +1,873 @@
+/**
+ * @file java_interp.c
+ * @desc the bytecode interpreter
+ *
+ * @author cjeong
+ */
+#include <string.h>
+#include <java/java_vm.h>
+#include <java/java_runtime.h>
+#include <java/java_interp.h>
+#include <java/java_compiler.h>
+#include <java/java_bt.h>
+
+/* two-slot values are read and written in place on the slot array */
+typedef uint64 slot2_t __attribute__((__may_alias__));
+
+#define REF(v)     ((JavaObject *) (uintptr) (v))
+#define SLOT(p)    ((u4) (uintptr) (p))
+
+/* operand stack and locals; see JavaVMFrame for the slot order */
+#define PUSH(v)    (*--sp = (u4) (v))
+#define POP()      (*sp++)
+#define PUSH2(v)   (sp -= 2, *(slot2_t *) sp = (v))
+#define POP2()     (sp += 2, *(slot2_t *) (sp - 2))
+#define TOP2(i)    (*(slot2_t *) (sp + (i)))
+#define LOCAL(i)   (locals[-(s4) (i)])
+#define LOCAL2(i)  (*(slot2_t *) &locals[-(s4) (i) - 1])
+
+#define FLT(v)     javaBitsFloat(v)
+#define DBL(v)     javaBitsDouble(v)
+
+/* binary operations pop the right operand and replace the left one */
+#define IBINOP(op)  sp[1] = sp[1] op sp[0]; sp++; pc++; break
+#define LBINOP(op)  TOP2(2) = TOP2(2) op TOP2(0); sp += 2; pc++; break
+#define FBINOP(op)  sp[1] = javaFloatBits(FLT(sp[1]) op FLT(sp[0])); \
+                    sp++; pc++; break
+#define DBINOP(op)  TOP2(2) = javaDoubleBits(DBL(TOP2(2)) op DBL(TOP2(0))); \
+                    sp += 2; pc++; break
+
+/* conditional branches; the offset is relative to the branch itself */
+#define BRANCH(c)   pc = branch(m, code, pc, (c), &osr, &bt); \
+                    if (osr) { goto transfer; } \
+                    if (bt) { goto translated; } break
+
+/* counts a taken backward branch to 'target', which is how loops show up
+   in the profile.  once the loop is hot, sets '*osr' to compiled code
+   that can take over at the loop header; until there is some, and once
+   the loop is warm, sets '*bt' to run it as translation blocks */
+static inline void backedge(JavaVMMethod *m, u4 target, JavaOsrEntry *osr,
+                            bool *bt)
+{
+  u4 n = m->countBackedge();
+
+  if (n >= JAVA_TIER1_BACKEDGES)
+    *osr = JavaCompiler::checkOsr(m, target);
+  if (!*osr && n >= JAVA_BT_BACKEDGES && JavaBt::enabled())
+    *bt = true;
+}
+
+/* returns the pc after a conditional branch */
+static inline u4 branch(JavaVMMethod *m, const u1 *code, u4 pc, bool taken,
+                        JavaOsrEntry *osr, bool *bt)
+{
+  s4 offset;
+
+  if (!taken)
+    return pc + 3;
+  offset = jopS2(code + pc + 1);
+  if (offset <= 0)
+    backedge(m, pc + offset, osr, bt);
+  return pc + offset;
+}
+
+static inline JavaArray *array_check(u4 ref, u4 index)
+{
+  JavaArray *a = (JavaArray *) REF(ref);
+
+  if (!a)
+    JavaRuntime::throwException(JavaNullPointerException);
+  /* a negative index compares as a huge unsigned one */
+  if (index >= a->length())
+    JavaRuntime::throwException(JavaArrayIndexOutOfBoundsException);
+  return a;
+}
+
+static inline JavaObject *null_check(u4 ref)
+{
+  if (!ref)
+    JavaRuntime::throwException(JavaNullPointerException);
+  return REF(ref);
+}
+
+/* the DUP family: copies the top 'n' slots and inserts the copy 'depth'
+   slots below them */
+static inline u4 *dup_slots(u4 *sp, int n, int depth)
+{
+  int i;
+
+  sp -= n;
+  for (i = 0; i < n + depth; i++)
+    sp[i] = sp[i + n];
+  for (i = 0; i < n; i++)
+    sp[n + depth + i] = sp[i];
+  return sp;
+}
+
+/* pushes the field at 'p' whose descriptor starts with 'type' */
+static inline u4 *push_field(u4 *sp, char *p, char type)
+{
+  switch (type) {
+  case 'Z': case 'B':
+    PUSH((s4) *(s1 *) p);
+    break;
+  case 'C':
+    PUSH(*(u2 *) p);
+    break;
+  case 'S':
+    PUSH((s4) *(s2 *) p);
+    break;
+  case 'J': case 'D':
+    PUSH2(*(slot2_t *) p);
+    break;
+  default:
+    PUSH(*(u4 *) p);
+    break;
+  }
+  return sp;
+}
+
+static inline u4 *pop_field(u4 *sp, char *p, char type)
+{
+  switch (type) {
+  case 'Z': case 'B':
+    *(u1 *) p = (u1) POP();
+    break;
+  case 'C': case 'S':
+    *(u2 *) p = (u2) POP();
+    break;
+  case 'J': case 'D':
+    *(slot2_t *) p = POP2();
+    break;
+  default:
+    *(u4 *) p = POP();
+    break;
+  }
+  return sp;
+}
+
+
+uint64 JavaInterp::entry(JavaVMMethod *m, u4 *args)
+{
+  if (m->countInvocation() >= JAVA_TIER1_INVOCATIONS) {
+    JavaCompiler::checkTier(m);
+    /* compiled on this thread, or by the compiler thread meanwhile */
+    if (m->entry() != entry)
+      return m->entry()(m, args);
+  }
+  return interpret(m, args);
+}
+
+uint64 JavaInterp::interpret(JavaVMMethod *m, u4 *args)
+{
+  JavaVMThread *t = JavaRuntime::currentThread();
+  JavaObject *sync = 0;
+  u4 *slots;
+  uint64 r;
+
+  if (!m->code())
+    JavaRuntime::throwException(JavaAbstractMethodError);
+
+  slots = (u4 *) __builtin_alloca((m->maxStack() + m->maxLocals()) *
+                                  sizeof(u4));
+  JavaVMFrame f(m, slots, t ? t->frameStack() : 0);
+
+  /* the arguments become the first locals without reordering */
+  if (m->argSlots())
+    memcpy(f.locals() - m->argSlots() + 1, args, m->argSlots() * sizeof(u4));
+
+  if (m->isSynchronized()) {
+    sync = m->syncObject(m->isStatic() ? 0 : REF(args[m->argSlots() - 1]));
+    JavaRuntime::monitorEnter(sync);
+  }
+
+  if (t)
+    t->frameStack(&f);
+  r = execute(&f);
+  if (t)
+    t->frameStack(f.prev());
+
+  if (sync)
+    JavaRuntime::monitorExit(sync);
+  return r;
+}
+
+uint64 JavaInterp::execute(JavaVMFrame *f)
+{
+  JavaVMMethod *m = f->method();
+  JavaVMMethod *callee;
+  JavaVMCpEntry *cp = m->cpool(), *e;
+  JavaArray *a;
+  JavaObject *recv;
+  const u1 *code = m->code();
+  u4 *locals = f->locals();
+  u4 *sp = f->sp();
+  u4 pc = f->pc();
+  u4 v, w, i, p, len;
+  uint64 r, l;
+  s4 key, lo, hi, mid;
+  JavaOsrEntry osr = 0;
+  bool bt = false;
+
+  for (;;) {
+    switch (code[pc]) {
+    case JOP_NOP:
+      pc++;
+      break;
+
+    /* constants */
+    case JOP_ACONST_NULL:
+      PUSH(0);
+      pc++;
+      break;
+    case JOP_ICONST_M1: case JOP_ICONST_0: case JOP_ICONST_1:
+    case JOP_ICONST_2: case JOP_ICONST_3: case JOP_ICONST_4:
+    case JOP_ICONST_5:
+      PUSH(code[pc] - JOP_ICONST_0);
+      pc++;
+      break;
+    case JOP_LCONST_0: case JOP_LCONST_1:
+      PUSH2((uint64) (code[pc] - JOP_LCONST_0));
+      pc++;
+      break;
+    case JOP_FCONST_0: case JOP_FCONST_1: case JOP_FCONST_2:
+      PUSH(javaFloatBits(code[pc] - JOP_FCONST_0));
+      pc++;
+      break;
+    case JOP_DCONST_0: case JOP_DCONST_1:
+      PUSH2(javaDoubleBits(code[pc] - JOP_DCONST_0));
+      pc++;
+      break;
+    case JOP_BIPUSH:
+      PUSH((s4) (s1) code[pc + 1]);
+      pc += 2;
+      break;
+    case JOP_SIPUSH:
+      PUSH((s4) jopS2(code + pc + 1));
+      pc += 3;
+      break;
+    case JOP_LDC:
+      PUSH(cp[code[pc + 1]].value);
+      pc += 2;
+      break;
+    case JOP_LDC_W:
+      PUSH(cp[jopU2(code + pc + 1)].value);
+      pc += 3;
+      break;
+    case JOP_LDC2_W:
+      PUSH2(cp[jopU2(code + pc + 1)].wide);
+      pc += 3;
+      break;
+
+    /* locals */
+    case JOP_ILOAD: case JOP_FLOAD: case JOP_ALOAD:
+      PUSH(LOCAL(code[pc + 1]));
+      pc += 2;
+      break;
+    case JOP_LLOAD: case JOP_DLOAD:
+      PUSH2(LOCAL2(code[pc + 1]));
+      pc += 2;
+      break;
+    case JOP_ILOAD_0: case JOP_ILOAD_1: case JOP_ILOAD_2: case JOP_ILOAD_3:
+      PUSH(LOCAL(code[pc] - JOP_ILOAD_0));
+      pc++;
+      break;
+    case JOP_FLOAD_0: case JOP_FLOAD_1: case JOP_FLOAD_2: case JOP_FLOAD_3:
+      PUSH(LOCAL(code[pc] - JOP_FLOAD_0));
+      pc++;
+      break;
+    case JOP_ALOAD_0: case JOP_ALOAD_1: case JOP_ALOAD_2: case JOP_ALOAD_3:
+      PUSH(LOCAL(code[pc] - JOP_ALOAD_0));
+      pc++;
+      break;
+    case JOP_LLOAD_0: case JOP_LLOAD_1: case JOP_LLOAD_2: case JOP_LLOAD_3:
+      PUSH2(LOCAL2(code[pc] - JOP_LLOAD_0));
+      pc++;
+      break;
+    case JOP_DLOAD_0: case JOP_DLOAD_1: case JOP_DLOAD_2: case JOP_DLOAD_3:
+      PUSH2(LOCAL2(code[pc] - JOP_DLOAD_0));
+      pc++;
+      break;
+    case JOP_ISTORE: case JOP_FSTORE: case JOP_ASTORE:
+      LOCAL(code[pc + 1]) = POP();
+      pc += 2;
+      break;
+    case JOP_LSTORE: case JOP_DSTORE:
+      LOCAL2(code[pc + 1]) = POP2();
+      pc += 2;
+      break;
+    case JOP_ISTORE_0: case JOP_ISTORE_1: case JOP_ISTORE_2:
+    case JOP_ISTORE_3:
+      LOCAL(code[pc] - JOP_ISTORE_0) = POP();
+      pc++;
+      break;
+    case JOP_FSTORE_0: case JOP_FSTORE_1: case JOP_FSTORE_2:
+    case JOP_FSTORE_3:
+      LOCAL(code[pc] - JOP_FSTORE_0) = POP();
+      pc++;
+      break;
+    case JOP_ASTORE_0: case JOP_ASTORE_1: case JOP_ASTORE_2:
+    case JOP_ASTORE_3:
+      LOCAL(code[pc] - JOP_ASTORE_0) = POP();
+      pc++;
+      break;
+    case JOP_LSTORE_0: case JOP_LSTORE_1: case JOP_LSTORE_2:
+    case JOP_LSTORE_3:
+      LOCAL2(code[pc] - JOP_LSTORE_0) = POP2();
+      pc++;
+      break;
+    case JOP_DSTORE_0: case JOP_DSTORE_1: case JOP_DSTORE_2:
+    case JOP_DSTORE_3:
+      LOCAL2(code[pc] - JOP_DSTORE_0) = POP2();
+      pc++;
+      break;
+    case JOP_IINC:
+      LOCAL(code[pc + 1]) += (s4) (s1) code[pc + 2];
+      pc += 3;
+      break;
+
+    /* arrays */
+    case JOP_IALOAD: case JOP_FALOAD: case JOP_AALOAD:
+      a = array_check(sp[1], sp[0]);
+      sp[1] = ((u4 *) a->elements())[sp[0]];
+      sp++;
+      pc++;
+      break;
+    case JOP_LALOAD: case JOP_DALOAD:
+      a = array_check(sp[1], sp[0]);
+      TOP2(0) = ((slot2_t *) a->elements())[sp[0]];
+      pc++;
+      break;
+    case JOP_BALOAD:
+      a = array_check(sp[1], sp[0]);
+      sp[1] = (s4) ((s1 *) a->elements())[sp[0]];
+      sp++;
+      pc++;
+      break;
+    case JOP_CALOAD:
+      a = array_check(sp[1], sp[0]);
+      sp[1] = ((u2 *) a->elements())[sp[0]];
+      sp++;
+      pc++;
+      break;
+    case JOP_SALOAD:
+      a = array_check(sp[1], sp[0]);
+      sp[1] = (s4) ((s2 *) a->elements())[sp[0]];
+      sp++;
+      pc++;
+      break;
+    case JOP_IASTORE: case JOP_FASTORE: case JOP_AASTORE:
+      a = array_check(sp[2], sp[1]);
+      ((u4 *) a->elements())[sp[1]] = sp[0];
+      sp += 3;
+      pc++;
+      break;
+    case JOP_LASTORE: case JOP_DASTORE:
+      a = array_check(sp[3], sp[2]);
+      ((slot2_t *) a->elements())[sp[2]] = TOP2(0);
+      sp += 4;
+      pc++;
+      break;
+    case JOP_BASTORE:
+      a = array_check(sp[2], sp[1]);
+      ((u1 *) a->elements())[sp[1]] = (u1) sp[0];
+      sp += 3;
+      pc++;
+      break;
+    case JOP_CASTORE: case JOP_SASTORE:
+      a = array_check(sp[2], sp[1]);
+      ((u2 *) a->elements())[sp[1]] = (u2) sp[0];
+      sp += 3;
+      pc++;
+      break;
+    case JOP_ARRAYLENGTH:
+      sp[0] = ((JavaArray *) null_check(sp[0]))->length();
+      pc++;
+      break;
+
+    /* operand stack */
+    case JOP_POP:
+      sp++;
+      pc++;
+      break;
+    case JOP_POP2:
+      sp += 2;
+      pc++;
+      break;
+    case JOP_DUP:
+      sp = dup_slots(sp, 1, 0);
+      pc++;
+      break;
+    case JOP_DUP_X1:
+      sp = dup_slots(sp, 1, 1);
+      pc++;
+      break;
+    case JOP_DUP_X2:
+      sp = dup_slots(sp, 1, 2);
+      pc++;
+      break;
+    case JOP_DUP2:
+      sp = dup_slots(sp, 2, 0);
+      pc++;
+      break;
+    case JOP_DUP2_X1:
+      sp = dup_slots(sp, 2, 1);
+      pc++;
+      break;
+    case JOP_DUP2_X2:
+      sp = dup_slots(sp, 2, 2);
+      pc++;
+      break;
+    case JOP_SWAP:
+      v = sp[0];
+      sp[0] = sp[1];
+      sp[1] = v;
+      pc++;
+      break;
+
+    /* int arithmetic; unsigned slots give Java's wrap-around */
+    case JOP_IADD: IBINOP(+);
+    case JOP_ISUB: IBINOP(-);
+    case JOP_IMUL: IBINOP(*);
+    case JOP_IAND: IBINOP(&);
+    case JOP_IOR:  IBINOP(|);
+    case JOP_IXOR: IBINOP(^);
+    case JOP_IDIV:
+    case JOP_IREM:
+      if (sp[0] == 0)
+        JavaRuntime::throwException(JavaArithmeticException);
+      if ((s4) sp[0] == -1)
+        sp[1] = code[pc] == JOP_IDIV ? 0 - sp[1] : 0;
+      else if (code[pc] == JOP_IDIV)
+        sp[1] = (s4) sp[1] / (s4) sp[0];
+      else
+        sp[1] = (s4) sp[1] % (s4) sp[0];
+      sp++;
+      pc++;
+      break;
+    case JOP_INEG:
+      sp[0] = 0 - sp[0];
+      pc++;
+      break;
+    case JOP_ISHL:
+      sp[1] <<= sp[0] & 31;
+      sp++;
+      pc++;
+      break;
+    case JOP_ISHR:
+      sp[1] = (s4) sp[1] >> (sp[0] & 31);
+      sp++;
+      pc++;
+      break;
+    case JOP_IUSHR:
+      sp[1] >>= sp[0] & 31;
+      sp++;
+      pc++;
+      break;
+
+    /* long arithmetic */
+    case JOP_LADD: LBINOP(+);
+    case JOP_LSUB: LBINOP(-);
+    case JOP_LMUL: LBINOP(*);
+    case JOP_LAND: LBINOP(&);
+    case JOP_LOR:  LBINOP(|);
+    case JOP_LXOR: LBINOP(^);
+    case JOP_LDIV:
+      TOP2(2) = JavaRuntime::ldiv(TOP2(0), TOP2(2));
+      sp += 2;
+      pc++;
+      break;
+    case JOP_LREM:
+      TOP2(2) = JavaRuntime::lrem(TOP2(0), TOP2(2));
+      sp += 2;
+      pc++;
+      break;
+    case JOP_LNEG:
+      TOP2(0) = 0 - TOP2(0);
+      pc++;
+      break;
+    case JOP_LSHL:
+      TOP2(1) <<= sp[0] & 63;
+      sp++;
+      pc++;
+      break;
+    case JOP_LSHR:
+      TOP2(1) = (s8) TOP2(1) >> (sp[0] & 63);
+      sp++;
+      pc++;
+      break;
+    case JOP_LUSHR:
+      TOP2(1) >>= sp[0] & 63;
+      sp++;
+      pc++;
+      break;
+
+    /* float and double arithmetic */
+    case JOP_FADD: FBINOP(+);
+    case JOP_FSUB: FBINOP(-);
+    case JOP_FMUL: FBINOP(*);
+    case JOP_FDIV: FBINOP(/);
+    case JOP_DADD: DBINOP(+);
+    case JOP_DSUB: DBINOP(-);
+    case JOP_DMUL: DBINOP(*);
+    case JOP_DDIV: DBINOP(/);
+    case JOP_FREM:
+      sp[1] = JavaRuntime::frem(sp[0], sp[1]);
+      sp++;
+      pc++;
+      break;
+    case JOP_DREM:
+      TOP2(2) = JavaRuntime::drem(TOP2(0), TOP2(2));
+      sp += 2;
+      pc++;
+      break;
+    case JOP_FNEG:
+      sp[0] ^= 0x80000000;
+      pc++;
+      break;
+    case JOP_DNEG:
+      sp[1] ^= 0x80000000;
+      pc++;
+      break;
+
+    /* conversions */
+    case JOP_I2L:
+      v = POP();
+      PUSH2((s8) (s4) v);
+      pc++;
+      break;
+    case JOP_I2F:
+      sp[0] = javaFloatBits((float) (s4) sp[0]);
+      pc++;
+      break;
+    case JOP_I2D:
+      v = POP();
+      PUSH2(javaDoubleBits((s4) v));
+      pc++;
+      break;
+    case JOP_L2I:
+      l = POP2();
+      PUSH((u4) l);
+      pc++;
+      break;
+    case JOP_L2F:
+      l = POP2();
+      PUSH(javaFloatBits((float) (s8) l));
+      pc++;
+      break;
+    case JOP_L2D:
+      TOP2(0) = javaDoubleBits((double) (s8) TOP2(0));
+      pc++;
+      break;
+    case JOP_F2I:
+      sp[0] = JavaRuntime::f2i(sp[0]);
+      pc++;
+      break;
+    case JOP_F2L:
+      v = POP();
+      PUSH2(JavaRuntime::f2l(v));
+      pc++;
+      break;
+    case JOP_F2D:
+      v = POP();
+      PUSH2(javaDoubleBits(FLT(v)));
+      pc++;
+      break;
+    case JOP_D2I:
+      l = POP2();
+      PUSH(JavaRuntime::d2i(l));
+      pc++;
+      break;
+    case JOP_D2L:
+      TOP2(0) = JavaRuntime::d2l(TOP2(0));
+      pc++;
+      break;
+    case JOP_D2F:
+      l = POP2();
+      PUSH(javaFloatBits((float) DBL(l)));
+      pc++;
+      break;
+    case JOP_I2B:
+      sp[0] = (s4) (s1) sp[0];
+      pc++;
+      break;
+    case JOP_I2C:
+      sp[0] = (u2) sp[0];
+      pc++;
+      break;
+    case JOP_I2S:
+      sp[0] = (s4) (s2) sp[0];
+      pc++;
+      break;
+
+    /* comparisons */
+    case JOP_LCMP:
+      l = POP2();
+      r = POP2();
+      PUSH(JavaRuntime::lcmp(l, r));
+      pc++;
+      break;
+    case JOP_FCMPL:
+      v = POP();
+      w = POP();
+      PUSH(JavaRuntime::fcmpl(v, w));
+      pc++;
+      break;
+    case JOP_FCMPG:
+      v = POP();
+      w = POP();
+      PUSH(JavaRuntime::fcmpg(v, w));
+      pc++;
+      break;
+    case JOP_DCMPL:
+      l = POP2();
+      r = POP2();
+      PUSH(JavaRuntime::dcmpl(l, r));
+      pc++;
+      break;
+    case JOP_DCMPG:
+      l = POP2();
+      r = POP2();
+      PUSH(JavaRuntime::dcmpg(l, r));
+      pc++;
+      break;
+
+    /* branches */
+    case JOP_IFEQ: v = POP(); BRANCH((s4) v == 0);
+    case JOP_IFNE: v = POP(); BRANCH((s4) v != 0);
+    case JOP_IFLT: v = POP(); BRANCH((s4) v < 0);
+    case JOP_IFGE: v = POP(); BRANCH((s4) v >= 0);
+    case JOP_IFGT: v = POP(); BRANCH((s4) v > 0);
+    case JOP_IFLE: v = POP(); BRANCH((s4) v <= 0);
+    case JOP_IF_ICMPEQ: w = POP(); v = POP(); BRANCH((s4) v == (s4) w);
+    case JOP_IF_ICMPNE: w = POP(); v = POP(); BRANCH((s4) v != (s4) w);
+    case JOP_IF_ICMPLT: w = POP(); v = POP(); BRANCH((s4) v < (s4) w);
+    case JOP_IF_ICMPGE: w = POP(); v = POP(); BRANCH((s4) v >= (s4) w);
+    case JOP_IF_ICMPGT: w = POP(); v = POP(); BRANCH((s4) v > (s4) w);
+    case JOP_IF_ICMPLE: w = POP(); v = POP(); BRANCH((s4) v <= (s4) w);
+    case JOP_IF_ACMPEQ: w = POP(); v = POP(); BRANCH(v == w);
+    case JOP_IF_ACMPNE: w = POP(); v = POP(); BRANCH(v != w);
+    case JOP_IFNULL:    v = POP(); BRANCH(v == 0);
+    case JOP_IFNONNULL: v = POP(); BRANCH(v != 0);
+    case JOP_GOTO:
+      BRANCH(true);
+    case JOP_GOTO_W:
+      if (jopS4(code + pc + 1) <= 0)
+        backedge(m, pc + jopS4(code + pc + 1), &osr, &bt);
+      pc += jopS4(code + pc + 1);
+      if (osr)
+        goto transfer;
+      if (bt)
+        goto translated;
+      break;
+    case JOP_JSR:
+      PUSH(pc + 3);
+      pc += jopS2(code + pc + 1);
+      break;
+    case JOP_JSR_W:
+      PUSH(pc + 5);
+      pc += jopS4(code + pc + 1);
+      break;
+    case JOP_RET:
+      pc = LOCAL(code[pc + 1]);
+      break;
+    case JOP_TABLESWITCH:
+      p = (pc + 4) & ~3;
+      key = (s4) POP();
+      lo = jopS4(code + p + 4);
+      hi = jopS4(code + p + 8);
+      if (key < lo || key > hi)
+        pc += jopS4(code + p);
+      else
+        pc += jopS4(code + p + 12 + 4 * (key - lo));
+      break;
+    case JOP_LOOKUPSWITCH:
+      /* the pairs are sorted by match value */
+      p = (pc + 4) & ~3;
+      key = (s4) POP();
+      lo = 0;
+      hi = jopS4(code + p + 4) - 1;
+      len = jopS4(code + p);
+      while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        i = p + 8 + 8 * mid;
+        if (jopS4(code + i) == key) {
+          len = jopS4(code + i + 4);
+          break;
+        }
+        if (jopS4(code + i) < key)
+          lo = mid + 1;
+        else
+          hi = mid - 1;
+      }
+      pc += len;
+      break;
+
+    /* returns; the caller pops the frame */
+    case JOP_IRETURN: case JOP_FRETURN: case JOP_ARETURN:
+      return sp[0];
+    case JOP_LRETURN: case JOP_DRETURN:
+      return TOP2(0);
+    case JOP_RETURN:
+      return 0;
+
+    /* fields */
+    case JOP_GETSTATIC:
+      e = &cp[jopU2(code + pc + 1)];
+      sp = push_field(sp, e->addr, e->type);
+      pc += 3;
+      break;
+    case JOP_PUTSTATIC:
+      e = &cp[jopU2(code + pc + 1)];
+      sp = pop_field(sp, e->addr, e->type);
+      pc += 3;
+      break;
+    case JOP_GETFIELD:
+      e = &cp[jopU2(code + pc + 1)];
+      v = POP();
+      sp = push_field(sp, null_check(v)->fieldAddr(e->offset), e->type);
+      pc += 3;
+      break;
+    case JOP_PUTFIELD:
+      e = &cp[jopU2(code + pc + 1)];
+      v = (e->type == 'J' || e->type == 'D') ? sp[2] : sp[1];
+      sp = pop_field(sp, null_check(v)->fieldAddr(e->offset), e->type);
+      sp++;
+      pc += 3;
+      break;
+
+    /* invocations */
+    case JOP_INVOKEVIRTUAL:
+      callee = cp[jopU2(code + pc + 1)].method;
+      recv = REF(sp[callee->argSlots() - 1]);
+      if (recv && !callee->isFinal())
+        m->profileCall(pc, recv->javaClass());
+      callee = JavaRuntime::resolveVirtual(recv, callee);
+      len = 3;
+      goto invoke;
+    case JOP_INVOKESPECIAL:
+      callee = cp[jopU2(code + pc + 1)].method;
+      null_check(sp[callee->argSlots() - 1]);
+      len = 3;
+      goto invoke;
+    case JOP_INVOKESTATIC:
+      callee = cp[jopU2(code + pc + 1)].method;
+      len = 3;
+      goto invoke;
+    case JOP_INVOKEINTERFACE:
+      callee = cp[jopU2(code + pc + 1)].method;
+      recv = REF(sp[callee->argSlots() - 1]);
+      if (recv)
+        m->profileCall(pc, recv->javaClass());
+      callee = JavaRuntime::resolveInterface(recv, callee);
+      len = 5;
+    invoke:
+      /* the arguments are passed in place at the top of our stack */
+      f->pc(pc);
+      f->sp(sp);
+      r = callee->entry()(callee, sp);
+      sp += callee->argSlots();
+      switch (callee->retType()) {
+      case 'V':
+        break;
+      case 'J': case 'D':
+        PUSH2(r);
+        break;
+      default:
+        PUSH((u4) r);
+        break;
+      }
+      pc += len;
+      break;
+
+    /* objects */
+    case JOP_NEW:
+      PUSH(SLOT(JavaRuntime::newObject(cp[jopU2(code + pc + 1)].klass)));
+      pc += 3;
+      break;
+    case JOP_NEWARRAY:
+      sp[0] = SLOT(JavaRuntime::newArray(JavaRuntime::arrayClass(code[pc + 1]),
+                                         (s4) sp[0]));
+      pc += 2;
+      break;
+    case JOP_ANEWARRAY:
+      sp[0] = SLOT(JavaRuntime::newArray(JavaRuntime::arrayClass(0),
+                                         (s4) sp[0]));
+      pc += 3;
+      break;
+    case JOP_CHECKCAST:
+      JavaRuntime::checkCast(REF(sp[0]), cp[jopU2(code + pc + 1)].klass);
+      pc += 3;
+      break;
+    case JOP_INSTANCEOF:
+      sp[0] = JavaRuntime::instanceOf(REF(sp[0]),
+                                      cp[jopU2(code + pc + 1)].klass);
+      pc += 3;
+      break;
+    case JOP_ATHROW:
+      f->pc(pc);
+      JavaRuntime::throwObject(REF(sp[0]));
+    case JOP_MONITORENTER:
+      JavaRuntime::monitorEnter(REF(POP()));
+      pc++;
+      break;
+    case JOP_MONITOREXIT:
+      JavaRuntime::monitorExit(REF(POP()));
+      pc++;
+      break;
+
+    case JOP_WIDE:
+      i = jopU2(code + pc + 2);
+      switch (code[pc + 1]) {
+      case JOP_ILOAD: case JOP_FLOAD: case JOP_ALOAD:
+        PUSH(LOCAL(i));
+        break;
+      case JOP_LLOAD: case JOP_DLOAD:
+        PUSH2(LOCAL2(i));
+        break;
+      case JOP_ISTORE: case JOP_FSTORE: case JOP_ASTORE:
+        LOCAL(i) = POP();
+        break;
+      case JOP_LSTORE: case JOP_DSTORE:
+        LOCAL2(i) = POP2();
+        break;
+      case JOP_IINC:
+        LOCAL(i) += (s4) jopS2(code + pc + 4);
+        break;
+      case JOP_RET:
+        pc = LOCAL(i);
+        continue;
+      default:
+        JavaRuntime::throwException(JavaInternalError);
+      }
+      pc += jopLength(code, pc);
+      break;
+
+    default:
+      /* MULTIANEWARRAY needs array classes per element type, which the
+         runtime does not keep yet */
+      f->pc(pc);
+      JavaRuntime::throwException(JavaInternalError);
+    }
+    continue;
+
+  translated:
+    /* the loop at 'pc' is warm: it runs as translation blocks until they
+       leave it for an instruction they do not do, or for compiled code */
+    bt = false;
+    f->pc(pc);
+    f->sp(sp);
+    osr = JavaBt::run(f);
+    pc = f->pc();
+    sp = f->sp();
+    if (osr)
+      goto transfer;
+  }
+
+ transfer:
+  /* on-stack replacement: compiled code takes over this activation at
+     the loop header 'pc', with the locals and operand stack as they are */
+  f->pc(pc);
+  f->sp(sp);
+  return osr(m, locals, m->maxLocals() + f->stackDepth());
+}
@@ -0,0 +1,316 @@
+/**
+ * @file java_intrinsic.c
+ * @desc intrinsics for hot library methods
+ *
+ * the kernels work a word at a time rather than with SSE, since the
+ * kernel does not save the SSE registers of the threads it switches
+ *
+ * @author cjeong
+ */
+#include <string.h>
+#include <java/java_instr.h>
+#include <java/java_vm.h>
+#include <java/java_object.h>
+#include <java/java_runtime.h>
+#include <java/java_classfile.h>
+#include <java/java_intrinsic.h>
+
+/* element data is read and written a word at a time whatever its type */
+typedef u4 word_t __attribute__((__may_alias__));
+typedef uint64 dword_t __attribute__((__may_alias__));
+
+#define REF(v)     ((JavaObject *) (uintptr) (v))
+#define ARRAY(v)   ((JavaArray *) (uintptr) (v))
+#define ARG2(p)    (*(dword_t *) (p))
+
+struct JavaIntrinsicInfo {
+  const char *klass;
+  const char *name;
+  const char *desc;
+  u1 id;
+};
+
+static const JavaIntrinsicInfo intrinsics[] = {
+  { "java/lang/System", "arraycopy",
+    "(Ljava/lang/Object;ILjava/lang/Object;II)V", JavaIntrinsicArraycopy },
+  { "java/lang/String", "equals", "(Ljava/lang/Object;)Z",
+    JavaIntrinsicStringEquals },
+  { "java/lang/String", "hashCode", "()I", JavaIntrinsicStringHashCode },
+  { "java/lang/Math", "min", "(II)I", JavaIntrinsicMinI },
+  { "java/lang/Math", "max", "(II)I", JavaIntrinsicMaxI },
+  { "java/lang/Math", "abs", "(I)I", JavaIntrinsicAbsI },
+  { "java/lang/Math", "min", "(JJ)J", JavaIntrinsicMinJ },
+  { "java/lang/Math", "max", "(JJ)J", JavaIntrinsicMaxJ },
+  { "java/lang/Math", "abs", "(J)J", JavaIntrinsicAbsJ },
+  { "java/util/Arrays", "fill", "([ZZ)V", JavaIntrinsicFill },
+  { "java/util/Arrays", "fill", "([BB)V", JavaIntrinsicFill },
+  { "java/util/Arrays", "fill", "([CC)V", JavaIntrinsicFill },
+  { "java/util/Arrays", "fill", "([SS)V", JavaIntrinsicFill },
+  { "java/util/Arrays", "fill", "([II)V", JavaIntrinsicFill },
+  { "java/util/Arrays", "fill", "([FF)V", JavaIntrinsicFill },
+  { "java/util/Arrays", "fill", "([JJ)V", JavaIntrinsicFill },
+  { "java/util/Arrays", "fill", "([DD)V", JavaIntrinsicFill }
+};
+
+#define NINTRINSICS  (sizeof(intrinsics) / sizeof(intrinsics[0]))
+
+u2 JavaIntrinsic::_stringValue;
+u2 JavaIntrinsic::_stringHash;
+
+
+static JavaUtf8Info *utf8(JavaClassFile *cf, u2 i)
+{
+  JavaConstInfo *c;
+
+  if (i == 0 || i >= cf->numConsts())
+    return 0;
+  c = cf->consts()[i];
+  return c && c->tag() == JavaConstInfo::ConstUtf8 ? (JavaUtf8Info *) c : 0;
+}
+
+static bool utf8_is(JavaUtf8Info *u, const char *s)
+{
+  return u && u->length == strlen(s) && memcmp(u->bytes, s, u->length) == 0;
+}
+
+static JavaUtf8Info *class_name(JavaVMClass *c)
+{
+  JavaClassFile *cf = c ? c->classFile() : 0;
+  JavaConstInfo *ci;
+
+  if (!cf || cf->thisClass() == 0 || cf->thisClass() >= cf->numConsts())
+    return 0;
+  ci = cf->consts()[cf->thisClass()];
+  if (!ci || ci->tag() != JavaConstInfo::ConstClass)
+    return 0;
+  return utf8(cf, ((JavaClassInfo *) ci)->nameIndex);
+}
+
+/* true if the 'n' bytes at 'a' and 'b' are the same */
+static bool equal_bytes(const u1 *a, const u1 *b, u4 n)
+{
+  for (; n >= 4; n -= 4, a += 4, b += 4)
+    if (*(const word_t *) a != *(const word_t *) b)
+      return false;
+  for (; n > 0; n--)
+    if (*a++ != *b++)
+      return false;
+  return true;
+}
+
+/* s[0]*31^(n-1) + ... + s[n-1], four characters a step */
+static u4 hash_chars(const u2 *s, u4 n)
+{
+  u4 h = 0, i = 0;
+
+  for (; i + 4 <= n; i += 4)
+    h = h * 923521 + s[i] * 29791 + s[i + 1] * 961 + s[i + 2] * 31 +
+      s[i + 3];
+  for (; i < n; i++)
+    h = h * 31 + s[i];
+  return h;
+}
+
+/* fills 'n' bytes at 'd', which is word aligned, with the word 'v' */
+static void fill_words(u1 *d, u4 v, u4 n)
+{
+  for (; n >= 4; n -= 4, d += 4)
+    *(word_t *) d = v;
+  for (; n > 0; n--, v >>= 8)
+    *d++ = v;
+}
+
+
+/* String as of JDK 7: the characters are all of 'value', which has no
+   offset or count into it */
+bool JavaIntrinsic::stringLayout(JavaVMClass *c)
+{
+  JavaClassFile *cf = c->classFile();
+  std::vector<JavaFieldInfo *>& fields = cf->fields();
+  JavaUtf8Info *name, *desc;
+  int i;
+
+  _stringValue = 0;
+  _stringHash = 0;
+  for (i = 0; i < fields.size(); i++) {
+    if (fields[i]->accessFlags() & JAVA_FIELD_ACC_STATIC)
+      continue;
+    name = utf8(cf, fields[i]->nameIndex());
+    desc = utf8(cf, fields[i]->descIndex());
+    if (utf8_is(name, "value") && utf8_is(desc, "[C"))
+      _stringValue = c->fieldOffset(i);
+    else if (utf8_is(name, "hash") && utf8_is(desc, "I"))
+      _stringHash = c->fieldOffset(i);
+    else if (utf8_is(name, "offset") || utf8_is(name, "count"))
+      return false;
+  }
+  return _stringValue != 0;
+}
+
+void JavaIntrinsic::bind(JavaVMMethod *m)
+{
+  JavaUtf8Info *k = class_name(m->javaClass());
+  JavaEntry entry;
+  u4 i;
+  u1 id = JavaIntrinsicNone;
+
+  if (!k)
+    return;
+  for (i = 0; i < NINTRINSICS; i++) {
+    if (utf8_is(k, intrinsics[i].klass) &&
+        strcmp(m->name(), intrinsics[i].name) == 0 &&
+        strcmp(m->desc(), intrinsics[i].desc) == 0) {
+      id = intrinsics[i].id;
+      break;
+    }
+  }
+
+  switch (id) {
+  case JavaIntrinsicArraycopy:
+    entry = arraycopy;
+    break;
+  case JavaIntrinsicStringEquals:
+  case JavaIntrinsicStringHashCode:
+    if (!stringLayout(m->javaClass()))
+      return;
+    entry = id == JavaIntrinsicStringEquals ? stringEquals : stringHashCode;
+    break;
+  case JavaIntrinsicMinI: entry = minI; break;
+  case JavaIntrinsicMaxI: entry = maxI; break;
+  case JavaIntrinsicAbsI: entry = absI; break;
+  case JavaIntrinsicMinJ: entry = minJ; break;
+  case JavaIntrinsicMaxJ: entry = maxJ; break;
+  case JavaIntrinsicAbsJ: entry = absJ; break;
+  case JavaIntrinsicFill:
+    entry = fill;
+    break;
+  default:
+    return;
+  }
+
+  m->intrinsic(id);
+  m->notCompilable(true);
+  m->entry(entry);
+}
+
+
+/* arraycopy(src, srcPos, dest, destPos, length); reference arrays share
+   one class, so their elements are not checked against the destination */
+uint64 JavaIntrinsic::arraycopy(JavaVMMethod *m, u4 *args)
+{
+  JavaArray *src = ARRAY(args[4]), *dst = ARRAY(args[2]);
+  s4 srcPos = args[3], dstPos = args[1], n = args[0];
+  JavaVMClass *c;
+  u4 size;
+
+  if (!src || !dst)
+    JavaRuntime::throwException(JavaNullPointerException);
+  c = src->javaClass();
+  if (!c->isArray() || dst->javaClass() != c)
+    JavaRuntime::throwException(JavaArrayStoreException);
+  if (srcPos < 0 || dstPos < 0 || n < 0 ||
+      (u4) srcPos + n > src->length() || (u4) dstPos + n > dst->length())
+    JavaRuntime::throwException(JavaArrayIndexOutOfBoundsException);
+
+  size = c->elemSize();
+  memmove(dst->elements() + dstPos * size, src->elements() + srcPos * size,
+          n * size);
+  return 0;
+}
+
+uint64 JavaIntrinsic::stringEquals(JavaVMMethod *m, u4 *args)
+{
+  JavaObject *s = REF(args[1]), *t = REF(args[0]);
+  JavaArray *a, *b;
+
+  if (s == t)
+    return 1;
+  if (!t || t->javaClass() != s->javaClass())
+    return 0;
+  a = ARRAY(*(u4 *) ((char *) s + _stringValue));
+  b = ARRAY(*(u4 *) ((char *) t + _stringValue));
+  if (a == b)
+    return 1;
+  if (!a || !b || a->length() != b->length())
+    return 0;
+  return equal_bytes((const u1 *) a->elements(), (const u1 *) b->elements(),
+                     a->length() * 2);
+}
+
+/* computed once and kept in 'hash', as String itself does */
+uint64 JavaIntrinsic::stringHashCode(JavaVMMethod *m, u4 *args)
+{
+  JavaObject *s = REF(args[0]);
+  JavaArray *a;
+  u4 h;
+
+  if (_stringHash && (h = *(u4 *) ((char *) s + _stringHash)) != 0)
+    return h;
+  a = ARRAY(*(u4 *) ((char *) s + _stringValue));
+  h = a ? hash_chars((const u2 *) a->elements(), a->length()) : 0;
+  if (_stringHash)
+    *(u4 *) ((char *) s + _stringHash) = h;
+  return h;
+}
+
+uint64 JavaIntrinsic::minI(JavaVMMethod *m, u4 *args)
+{
+  return (u4) ((s4) args[1] <= (s4) args[0] ? args[1] : args[0]);
+}
+
+uint64 JavaIntrinsic::maxI(JavaVMMethod *m, u4 *args)
+{
+  return (u4) ((s4) args[1] >= (s4) args[0] ? args[1] : args[0]);
+}
+
+/* abs(MIN_VALUE) is MIN_VALUE */
+uint64 JavaIntrinsic::absI(JavaVMMethod *m, u4 *args)
+{
+  return (u4) ((s4) args[0] < 0 ? -args[0] : args[0]);
+}
+
+uint64 JavaIntrinsic::minJ(JavaVMMethod *m, u4 *args)
+{
+  return (s8) ARG2(args + 2) <= (s8) ARG2(args) ? ARG2(args + 2) : ARG2(args);
+}
+
+uint64 JavaIntrinsic::maxJ(JavaVMMethod *m, u4 *args)
+{
+  return (s8) ARG2(args + 2) >= (s8) ARG2(args) ? ARG2(args + 2) : ARG2(args);
+}
+
+uint64 JavaIntrinsic::absJ(JavaVMMethod *m, u4 *args)
+{
+  return (s8) ARG2(args) < 0 ? -ARG2(args) : ARG2(args);
+}
+
+/* fill(a, v): the element repeated to a word, stored a word at a time;
+   elements start 8-aligned, after the array header */
+uint64 JavaIntrinsic::fill(JavaVMMethod *m, u4 *args)
+{
+  JavaArray *a = ARRAY(args[m->argSlots() - 1]);
+  dword_t *p;
+  uint64 w;
+  u4 i, v = args[0];
+
+  if (!a)
+    JavaRuntime::throwException(JavaNullPointerException);
+
+  switch (a->javaClass()->elemSize()) {
+  case 8:
+    w = ARG2(args);
+    p = (dword_t *) a->elements();
+    for (i = 0; i < a->length(); i++)
+      p[i] = w;
+    return 0;
+  case 1:
+    v = (v & 0xFF) * 0x01010101;
+    break;
+  case 2:
+    v = (v & 0xFFFF) * 0x00010001;
+    break;
+  }
+  fill_words((u1 *) a->elements(), v,
+             a->length() * a->javaClass()->elemSize());
+  return 0;
+}
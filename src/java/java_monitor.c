@@ -0,0 +1,288 @@
+/**
+ * @file java_monitor.c
+ * @desc thin locks and inflated monitors; see java_monitor.h for the
+ *       locking protocol
+ *
+ * @author cjeong
+ */
+#include <assert.h>
+#include <java/java_vm.h>
+#include <java/java_monitor.h>
+
+/* header of 'h' with the thin lock payload and lock state cleared */
+static inline u4 unlocked_header(u4 h)
+{
+  return h & ~(JAVA_HDR_OWNER_MASK | JAVA_HDR_COUNT_MASK | JAVA_HDR_LOCK_MASK);
+}
+
+
+volatile u4 JavaMonitor::_numInflations;
+
+void JavaMonitor::enqueue(JavaVMThread **q, JavaVMThread *t)
+{
+  t->monitorNext(0);
+  while (*q)
+    q = (*q)->monitorNextAddr();
+  *q = t;
+}
+
+JavaVMThread *JavaMonitor::dequeue(JavaVMThread **q)
+{
+  JavaVMThread *t = *q;
+
+  if (t)
+    *q = t->monitorNext();
+  return t;
+}
+
+bool JavaMonitor::unlink(JavaVMThread **q, JavaVMThread *t)
+{
+  for (; *q; q = (*q)->monitorNextAddr()) {
+    if (*q == t) {
+      *q = t->monitorNext();
+      return true;
+    }
+  }
+  return false;
+}
+
+void JavaMonitor::enter(JavaVMThread *t)
+{
+  if (_owner == t->tid()) {
+    _recursions++;
+    return;
+  }
+
+  for (;;) {
+    if (javaCas(&_owner, 0, t->tid()) == 0)
+      return;
+
+    /* the owner is re-checked under the queue lock, so a release that
+       happens before we are queued is never missed */
+    _qlock.lock();
+    if (_owner == 0) {
+      _qlock.unlock();
+      continue;
+    }
+    enqueue(&_entryq, t);
+    _qlock.unlock();
+    t->pause();
+  }
+}
+
+void JavaMonitor::release()
+{
+  JavaVMThread *next;
+
+  _recursions = 0;
+  __asm __volatile("" ::: "memory");
+  _owner = 0;
+
+  _qlock.lock();
+  next = dequeue(&_entryq);
+  _qlock.unlock();
+
+  /* the woken thread competes for the monitor again, so a thread that
+     arrives in the meantime may take it first; that keeps the monitor
+     busy instead of idle during the hand-off */
+  if (next)
+    next->resume();
+}
+
+bool JavaMonitor::exit(JavaVMThread *t)
+{
+  if (_owner != t->tid())
+    return false;
+
+  if (_recursions > 0)
+    _recursions--;
+  else
+    release();
+  return true;
+}
+
+bool JavaMonitor::wait(JavaVMThread *t)
+{
+  u4 recursions;
+
+  if (_owner != t->tid())
+    return false;
+
+  /* queue up before releasing, so a notify() issued right after the
+     release finds us */
+  _qlock.lock();
+  enqueue(&_waitq, t);
+  _qlock.unlock();
+
+  recursions = _recursions;
+  release();
+  t->pause();
+
+  /* a stale resume() can end the pause early; Java allows such spurious
+     wakeups, but we must not stay on the wait queue */
+  _qlock.lock();
+  unlink(&_waitq, t);
+  _qlock.unlock();
+
+  enter(t);
+  _recursions = recursions;
+  return true;
+}
+
+bool JavaMonitor::notify(JavaVMThread *t, bool all)
+{
+  JavaVMThread *w;
+
+  if (_owner != t->tid())
+    return false;
+
+  /* notified threads re-enter the monitor through enter(), so they block
+     again until the notifier exits */
+  do {
+    _qlock.lock();
+    w = dequeue(&_waitq);
+    _qlock.unlock();
+    if (w)
+      w->resume();
+  } while (w && all);
+  return true;
+}
+
+
+JavaMonitor *JavaMonitor::inflate(JavaObject *o)
+{
+  JavaMonitor *m;
+  u4 h;
+
+  for (;;) {
+    h = o->header();
+    switch (JAVA_HDR_LOCK(h)) {
+    case JAVA_LOCK_INFLATED:
+      return fromHeader(h);
+
+    case JAVA_LOCK_THIN:
+      /* thin locks are only taken on unhashed objects, so the displaced
+         header has a zero hash; the thin owner keeps the lock */
+      m = new JavaMonitor(o, unlocked_header(h));
+      m->_owner = JAVA_HDR_OWNER(h);
+      m->_recursions = JAVA_HDR_COUNT(h);
+      break;
+
+    default:
+      m = new JavaMonitor(o, h);
+      break;
+    }
+
+    if (javaCas(o->headerAddr(), h, m->inflatedHeader()) == h) {
+      javaAtomicAdd(&_numInflations, 1);
+      return m;
+    }
+
+    /* the header changed while we built the monitor; start over */
+    delete m;
+  }
+}
+
+void JavaMonitor::lock(JavaObject *o, JavaVMThread *t)
+{
+  u4 tid = t->tid();
+  u4 h, spins = 0;
+
+  for (;;) {
+    h = o->header();
+    switch (JAVA_HDR_LOCK(h)) {
+    case JAVA_LOCK_UNLOCKED:
+      /* a hashed object keeps its hash in the header; its lock goes
+         straight to a monitor */
+      if (JAVA_HDR_HASH(h) != 0 || tid > JAVA_THIN_MAX_OWNER)
+        break;
+      if (javaCas(o->headerAddr(), h,
+                  h | (tid << JAVA_HDR_OWNER_SHIFT) | JAVA_LOCK_THIN) == h)
+        return;
+      continue;
+
+    case JAVA_LOCK_THIN:
+      if (JAVA_HDR_OWNER(h) == tid) {
+        if (JAVA_HDR_COUNT(h) == JAVA_THIN_MAX_COUNT)
+          break;                /* recursion overflow; move to a monitor */
+        if (javaCas(o->headerAddr(), h,
+                    h + (1 << JAVA_HDR_COUNT_SHIFT)) == h)
+          return;
+        continue;
+      }
+      if (spins++ < JAVA_THIN_SPINS) {
+        javaCpuRelax();
+        continue;
+      }
+      break;                    /* contended; inflate */
+
+    case JAVA_LOCK_INFLATED:
+      fromHeader(h)->enter(t);
+      return;
+
+    default:
+      /* forwarded objects are never seen by mutators */
+      assert(0);
+      return;
+    }
+
+    inflate(o)->enter(t);
+    return;
+  }
+}
+
+bool JavaMonitor::unlock(JavaObject *o, JavaVMThread *t)
+{
+  u4 h, nh;
+
+  for (;;) {
+    h = o->header();
+    switch (JAVA_HDR_LOCK(h)) {
+    case JAVA_LOCK_THIN:
+      if (JAVA_HDR_OWNER(h) != t->tid())
+        return false;
+      if (JAVA_HDR_COUNT(h) > 0)
+        nh = h - (1 << JAVA_HDR_COUNT_SHIFT);
+      else
+        nh = unlocked_header(h);
+      /* fails only if a contender inflated the lock meanwhile */
+      if (javaCas(o->headerAddr(), h, nh) == h)
+        return true;
+      continue;
+
+    case JAVA_LOCK_INFLATED:
+      return fromHeader(h)->exit(t);
+
+    default:
+      return false;
+    }
+  }
+}
+
+bool JavaMonitor::wait(JavaObject *o, JavaVMThread *t)
+{
+  u4 h = o->header();
+
+  /* check ownership before inflating, so a bogus wait() does not leave a
+     monitor behind */
+  if (JAVA_HDR_LOCK(h) == JAVA_LOCK_THIN && JAVA_HDR_OWNER(h) != t->tid())
+    return false;
+  if (JAVA_HDR_LOCK(h) == JAVA_LOCK_UNLOCKED)
+    return false;
+  return inflate(o)->wait(t);
+}
+
+bool JavaMonitor::notify(JavaObject *o, JavaVMThread *t, bool all)
+{
+  u4 h = o->header();
+
+  switch (JAVA_HDR_LOCK(h)) {
+  case JAVA_LOCK_THIN:
+    /* nobody can be waiting on a lock that was never inflated */
+    return JAVA_HDR_OWNER(h) == t->tid();
+  case JAVA_LOCK_INFLATED:
+    return fromHeader(h)->notify(t, all);
+  default:
+    return false;
+  }
+}
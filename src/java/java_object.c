@@ -0,0 +1,101 @@
+/**
+ * @file java_object.c
+ * @desc object header access and the indexed class table
+ *
+ * @author cjeong
+ */
+#include <assert.h>
+#include <java/java_object.h>
+#include <java/java_monitor.h>
+
+static JavaClassTable *_classTable;
+
+JavaClassTable::JavaClassTable()
+{
+  /* slot 0 stands for JAVA_CLASS_INDEX_INVALID and is never handed out */
+  _classes.push_back(0);
+}
+
+JavaClassTable *JavaClassTable::instance()
+{
+  if (!_classTable)
+    _classTable = new JavaClassTable();
+  return _classTable;
+}
+
+u2 JavaClassTable::registerClass(JavaVMClass *c)
+{
+  if (_classes.size() >= JAVA_MAX_CLASSES)
+    return JAVA_CLASS_INDEX_INVALID;
+  _classes.push_back(c);
+  return _classes.size() - 1;
+}
+
+
+u4 JavaObject::displacedHeader() const
+{
+  u4 h = _header;
+
+  if (JAVA_HDR_LOCK(h) == JAVA_LOCK_INFLATED)
+    return JavaMonitor::fromHeader(h)->displaced();
+  return h;
+}
+
+/* identity hashes only need to be well spread, not unpredictable; a 
+   xorshift generator is enough, and races on the seed are harmless */
+static u4 hash_seed = 2463534242U;
+
+static u4 next_hash()
+{
+  u4 h;
+
+  do {
+    hash_seed ^= hash_seed << 13;
+    hash_seed ^= hash_seed >> 17;
+    hash_seed ^= hash_seed << 5;
+    h = hash_seed & JAVA_MAX_HASH;
+  } while (h == 0);
+  return h;
+}
+
+u2 JavaObject::identityHash()
+{
+  u4 h, nh, hash;
+  JavaMonitor *m;
+
+  for (;;) {
+    h = _header;
+    switch (JAVA_HDR_LOCK(h)) {
+    case JAVA_LOCK_UNLOCKED:
+      if ((hash = JAVA_HDR_HASH(h)) != 0)
+        return hash;
+      hash = next_hash();
+      nh = h | (hash << JAVA_HDR_HASH_SHIFT);
+      if (javaCas(&_header, h, nh) == h)
+        return hash;
+      break;                    /* header changed under us; retry */
+
+    case JAVA_LOCK_INFLATED:
+      m = JavaMonitor::fromHeader(h);
+      h = m->displaced();
+      if ((hash = JAVA_HDR_HASH(h)) != 0)
+        return hash;
+      hash = next_hash();
+      nh = h | (hash << JAVA_HDR_HASH_SHIFT);
+      if (javaCas(m->displacedAddr(), h, nh) == h)
+        return hash;
+      break;
+
+    case JAVA_LOCK_THIN:
+      /* the thin lock owns the hash bits; move the lock to a monitor so
+         the hash can live in the displaced header */
+      JavaMonitor::inflate(this);
+      break;
+
+    default:
+      /* forwarded objects are never seen by mutators */
+      assert(0);
+      return 0;
+    }
+  }
+}
@@ -0,0 +1,251 @@
+/**
+ * @file java_runtime.c
+ * @desc runtime services shared by the interpreter and compiled code
+ *
+ * @author cjeong
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <java/java_vm.h>
+#include <java/java_monitor.h>
+#include <java/java_runtime.h>
+
+JavaVMHeap *JavaRuntime::_heap;
+JavaVMThread *(*JavaRuntime::_currentThread)();
+JavaVMClass *JavaRuntime::_arrayClasses[JavaNewInstr::JavaArrayLong + 1];
+JavaVMClass *JavaRuntime::_refArrayClass;
+
+static const char *exception_names[] = {
+  "java/lang/NullPointerException",
+  "java/lang/ArrayIndexOutOfBoundsException",
+  "java/lang/ArithmeticException",
+  "java/lang/NegativeArraySizeException",
+  "java/lang/ClassCastException",
+  "java/lang/ArrayStoreException",
+  "java/lang/IllegalMonitorStateException",
+  "java/lang/AbstractMethodError",
+  "java/lang/OutOfMemoryError",
+  "java/lang/InternalError"
+};
+
+/* element size of each NEWARRAY type */
+static const u2 array_elem_size[JavaNewInstr::JavaArrayLong + 1] = {
+  0, 0, 0, 0, 1, 2, 4, 8, 1, 2, 4, 8
+};
+
+void JavaRuntime::init(JavaVMHeap *heap, JavaVMThread *(*current)())
+{
+  int i;
+
+  _heap = heap;
+  _currentThread = current;
+
+  /* created up front so that lookups need no locking */
+  for (i = JavaNewInstr::JavaarrayBoolean; i <= JavaNewInstr::JavaArrayLong; i++)
+    _arrayClasses[i] = new JavaVMClass(array_elem_size[i]);
+  _refArrayClass = new JavaVMClass(sizeof(u4));
+}
+
+JavaVMClass *JavaRuntime::arrayClass(u1 atype)
+{
+  if (atype == 0)
+    return _refArrayClass;
+  if (atype < JavaNewInstr::JavaarrayBoolean || atype > JavaNewInstr::JavaArrayLong)
+    throwException(JavaInternalError);
+  return _arrayClasses[atype];
+}
+
+void JavaRuntime::throwException(JavaExceptionE e)
+{
+  printf("java: uncaught %s\n", exception_names[e]);
+  abort();
+}
+
+void JavaRuntime::throwObject(JavaObject *o)
+{
+  if (!o)
+    throwException(JavaNullPointerException);
+  printf("java: uncaught exception object %08x (class %u)\n",
+         (u4) (uintptr) o, o->classIndex());
+  abort();
+}
+
+JavaObject *JavaRuntime::newObject(JavaVMClass *c)
+{
+  JavaObject *o = _heap->allocObject(c);
+
+  if (!o)
+    throwException(JavaOutOfMemoryError);
+  return o;
+}
+
+JavaArray *JavaRuntime::newArray(JavaVMClass *c, s4 length)
+{
+  JavaArray *a;
+
+  if (length < 0)
+    throwException(JavaNegativeArraySizeException);
+  if ((a = _heap->allocArray(c, length)) == 0)
+    throwException(JavaOutOfMemoryError);
+  return a;
+}
+
+void JavaRuntime::monitorEnter(JavaObject *o)
+{
+  if (!o)
+    throwException(JavaNullPointerException);
+  JavaMonitor::lock(o, currentThread());
+}
+
+void JavaRuntime::monitorExit(JavaObject *o)
+{
+  if (!o)
+    throwException(JavaNullPointerException);
+  if (!JavaMonitor::unlock(o, currentThread()))
+    throwException(JavaIllegalMonitorStateException);
+}
+
+JavaVMMethod *JavaRuntime::resolveVirtual(JavaObject *recv, JavaVMMethod *m)
+{
+  JavaVMClass *c;
+
+  if (!recv)
+    throwException(JavaNullPointerException);
+  if (m->isFinal())
+    return m;
+
+  /* array classes have no vtable and inherit Object's methods as is */
+  c = recv->javaClass();
+  if (m->vtableIndex() >= c->vtableLength())
+    return m;
+  m = c->vtableAt(m->vtableIndex());
+  if (m->isAbstract())
+    throwException(JavaAbstractMethodError);
+  return m;
+}
+
+JavaVMMethod *JavaRuntime::resolveInterface(JavaObject *recv, JavaVMMethod *m)
+{
+  JavaVMMethod *t;
+
+  if (!recv)
+    throwException(JavaNullPointerException);
+  t = recv->javaClass()->lookupMethod(m->name(), m->desc());
+  if (!t || t->isAbstract())
+    throwException(JavaAbstractMethodError);
+  return t;
+}
+
+/* interfaces are not recorded for classes yet, so only the superclass
+   chain is checked */
+void JavaRuntime::checkCast(JavaObject *o, JavaVMClass *c)
+{
+  if (o && !o->javaClass()->isSubclassOf(c))
+    throwException(JavaClassCastException);
+}
+
+s4 JavaRuntime::instanceOf(JavaObject *o, JavaVMClass *c)
+{
+  return o && o->javaClass()->isSubclassOf(c);
+}
+
+
+s8 JavaRuntime::ldiv(s8 b, s8 a)
+{
+  if (b == 0)
+    throwException(JavaArithmeticException);
+  /* the one quotient that overflows wraps around, as in Java */
+  if (b == -1)
+    return (s8) (0 - (uint64) a);
+  return a / b;
+}
+
+s8 JavaRuntime::lrem(s8 b, s8 a)
+{
+  if (b == 0)
+    throwException(JavaArithmeticException);
+  if (b == -1)
+    return 0;
+  return a % b;
+}
+
+u4 JavaRuntime::frem(u4 b, u4 a)
+{
+  return javaFloatBits(fmodf(javaBitsFloat(a), javaBitsFloat(b)));
+}
+
+uint64 JavaRuntime::drem(uint64 b, uint64 a)
+{
+  return javaDoubleBits(fmod(javaBitsDouble(a), javaBitsDouble(b)));
+}
+
+s4 JavaRuntime::lcmp(s8 b, s8 a)
+{
+  return a > b ? 1 : a == b ? 0 : -1;
+}
+
+/* the l and g variants differ only in what a NaN operand gives */
+s4 JavaRuntime::fcmpl(u4 b, u4 a)
+{
+  float x = javaBitsFloat(a), y = javaBitsFloat(b);
+
+  return x > y ? 1 : x == y ? 0 : -1;
+}
+
+s4 JavaRuntime::fcmpg(u4 b, u4 a)
+{
+  float x = javaBitsFloat(a), y = javaBitsFloat(b);
+
+  return x < y ? -1 : x == y ? 0 : 1;
+}
+
+s4 JavaRuntime::dcmpl(uint64 b, uint64 a)
+{
+  double x = javaBitsDouble(a), y = javaBitsDouble(b);
+
+  return x > y ? 1 : x == y ? 0 : -1;
+}
+
+s4 JavaRuntime::dcmpg(uint64 b, uint64 a)
+{
+  double x = javaBitsDouble(a), y = javaBitsDouble(b);
+
+  return x < y ? -1 : x == y ? 0 : 1;
+}
+
+s4 JavaRuntime::f2i(u4 f)
+{
+  return d2i(javaDoubleBits(javaBitsFloat(f)));
+}
+
+s8 JavaRuntime::f2l(u4 f)
+{
+  return d2l(javaDoubleBits(javaBitsFloat(f)));
+}
+
+s4 JavaRuntime::d2i(uint64 d)
+{
+  double v = javaBitsDouble(d);
+
+  if (v != v)
+    return 0;
+  if (v >= 2147483647.0)
+    return 0x7FFFFFFF;
+  if (v <= -2147483648.0)
+    return (s4) 0x80000000;
+  return (s4) v;
+}
+
+s8 JavaRuntime::d2l(uint64 d)
+{
+  double v = javaBitsDouble(d);
+
+  if (v != v)
+    return 0;
+  if (v >= 9223372036854775807.0)
+    return 0x7FFFFFFFFFFFFFFFLL;
+  if (v <= -9223372036854775808.0)
+    return (s8) 0x8000000000000000ULL;
+  return (s8) v;
+}
@@ -0,0 +1,216 @@
+/**
+ * @file java_thread.c
+ * @desc per-CPU run queues and the work-stealing thread scheduler
+ *
+ * @author cjeong
+ */
+#include <java/java_thread.h>
+
+/* index of the most significant set bit; 'x' must be non-zero */
+static inline int highest_bit(u4 x)
+{
+  int r;
+  __asm("bsrl %1, %0" : "=r" (r) : "rm" (x));
+  return r;
+}
+
+/* priority levels map to bitmap bits, so higher priorities win the bsr */
+static inline int level_of(JavaThreadI *t)
+{
+  int p = t->getPriority();
+
+  if (p < JAVA_MIN_PRIORITY)
+    p = JAVA_MIN_PRIORITY;
+  else if (p > JAVA_MAX_PRIORITY)
+    p = JAVA_MAX_PRIORITY;
+  return p - JAVA_MIN_PRIORITY;
+}
+
+
+JavaRunQueue::JavaRunQueue() : _bitmap(0), _count(0)
+{
+  int i;
+
+  for (i = 0; i < JAVA_NUM_PRIORITIES; i++)
+    _head[i] = _tail[i] = 0;
+}
+
+void JavaRunQueue::push(JavaThreadI *t)
+{
+  JavaSchedInfo *si = t->getSchedInfo();
+  int level = level_of(t);
+
+  si->next = 0;
+  si->enqueued = javaReadTsc();
+
+  _lock.lock();
+  if (_tail[level])
+    _tail[level]->getSchedInfo()->next = t;
+  else
+    _head[level] = t;
+  _tail[level] = t;
+  _bitmap |= 1 << level;
+  _count++;
+  _lock.unlock();
+}
+
+/* called with the lock held */
+JavaThreadI *JavaRunQueue::popLevel(int level)
+{
+  JavaThreadI *t = _head[level];
+
+  _head[level] = t->getSchedInfo()->next;
+  if (!_head[level]) {
+    _tail[level] = 0;
+    _bitmap &= ~(1 << level);
+  }
+  _count--;
+  t->getSchedInfo()->next = 0;
+  return t;
+}
+
+JavaThreadI *JavaRunQueue::pop()
+{
+  JavaThreadI *t = 0;
+
+  /* unlocked peek; an idle CPU polls its queue and should not bounce the
+     lock's cache line while there is nothing to do */
+  if (_count == 0)
+    return 0;
+
+  _lock.lock();
+  if (_bitmap)
+    t = popLevel(highest_bit(_bitmap));
+  _lock.unlock();
+  return t;
+}
+
+JavaThreadI *JavaRunQueue::steal(uint64 now)
+{
+  JavaThreadI *t = 0;
+  int level;
+
+  if (_count == 0)
+    return 0;
+
+  _lock.lock();
+  if (_bitmap) {
+    level = highest_bit(_bitmap);
+    t = _head[level];
+    if (_count > 1 || now - t->getSchedInfo()->enqueued >= JAVA_SCHED_HOT_CYCLES)
+      t = popLevel(level);
+    else
+      t = 0;
+  }
+  _lock.unlock();
+  return t;
+}
+
+
+JavaStealingScheduler::JavaStealingScheduler(int ncpu, int (*cpuid)()) :
+  _ncpu(ncpu), _cpuid(cpuid), _numThreads(0), _numSteals(0)
+{
+  if (_ncpu > JAVA_MAX_CPUS)
+    _ncpu = JAVA_MAX_CPUS;
+}
+
+void JavaStealingScheduler::addThread(JavaThreadI *t)
+{
+  JavaSchedInfo *si = t->getSchedInfo();
+  int cpu, i, least;
+
+  /* prefer the CPU whose caches still hold the thread's working set */
+  cpu = si->lastCpu;
+  if (cpu < 0 || cpu >= _ncpu)
+    cpu = _cpuid();
+
+  least = cpu;
+  for (i = 0; i < _ncpu; i++)
+    if (_queues[i].count() < _queues[least].count())
+      least = i;
+  if (_queues[cpu].count() > _queues[least].count() + JAVA_SCHED_IMBALANCE)
+    cpu = least;
+
+  si->cpu = cpu;
+  _queues[cpu].push(t);
+  javaAtomicAdd(&_numThreads, 1);
+}
+
+JavaThreadI *JavaStealingScheduler::steal(int cpu)
+{
+  uint64 now = javaReadTsc();
+  JavaThreadI *t;
+  int i, victim, busiest;
+
+  /* try the busiest queue first, then the rest in order starting after
+     our own, so idle CPUs do not all gang up on the same victim */
+  busiest = -1;
+  for (i = 0; i < _ncpu; i++)
+    if (i != cpu && _queues[i].count() > 0 &&
+        (busiest < 0 || _queues[i].count() > _queues[busiest].count()))
+      busiest = i;
+  if (busiest < 0)
+    return 0;
+  if ((t = _queues[busiest].steal(now)) != 0)
+    return t;
+
+  for (i = 1; i < _ncpu; i++) {
+    victim = (cpu + i) % _ncpu;
+    if (victim != busiest && (t = _queues[victim].steal(now)) != 0)
+      return t;
+  }
+  return 0;
+}
+
+JavaThreadI *JavaStealingScheduler::pickNextThread(int cpu)
+{
+  JavaThreadI *t;
+  JavaSchedInfo *si;
+
+  if ((t = _queues[cpu].pop()) == 0) {
+    if ((t = steal(cpu)) == 0)
+      return 0;
+    javaAtomicAdd(&_numSteals, 1);
+  }
+
+  si = t->getSchedInfo();
+  si->cpu = -1;
+  si->lastCpu = cpu;
+  javaAtomicAdd(&_numThreads, (u4) -1);
+  return t;
+}
+
+
+/* the scheduler the kernel runs Java threads with */
+static JavaStealingScheduler *kernel_sched;
+
+static void kernel_enqueue(void *thread, void *handle)
+{
+  JavaThreadI *t = (JavaThreadI *) thread;
+
+  t->getSchedInfo()->handle = handle;
+  kernel_sched->addThread(t);
+}
+
+static void *kernel_pick(int cpu)
+{
+  JavaThreadI *t;
+
+  if (cpu >= kernel_sched->numCpus() ||
+      (t = kernel_sched->pickNextThread(cpu)) == 0)
+    return 0;
+  return t->getSchedInfo()->handle;
+}
+
+static u4 kernel_queued()
+{
+  return kernel_sched->getNumThreads();
+}
+
+void JavaStealingScheduler::kernelOps(JavaSchedOps *ops)
+{
+  kernel_sched = this;
+  ops->enqueue = kernel_enqueue;
+  ops->pick = kernel_pick;
+  ops->queued = kernel_queued;
+}
@@ -0,0 +1,568 @@
+/**
+ * @file java_vm.c
+ * @desc runtime classes, instance layout and the Java heap allocator
+ *
+ * @author cjeong
+ */
+#include <stdio.h>
+#include <string.h>
+#include <java/java_instr.h>
+#include <java/java_vm.h>
+#include <java/java_interp.h>
+#include <java/java_deopt.h>
+#include <java/java_intrinsic.h>
+
+static inline u4 obj_round(u4 size)
+{
+  return (size + JAVA_OBJ_ALIGN - 1) & ~(JAVA_OBJ_ALIGN - 1);
+}
+
+
+/* live threads indexed by thread id; slot 0 is never used so that a zero
+   owner field means "no owner" */
+static JavaVMThread *threads[JAVA_MAX_THREADS];
+
+JavaThreadOps JavaVMThread::_ops;
+
+void JavaVMThread::init(const JavaThreadOps *ops)
+{
+  _ops = *ops;
+}
+
+JavaVMThread *JavaVMThread::create()
+{
+  JavaVMThread *t;
+  u2 i;
+
+  /* take the lowest free id so that as many threads as possible can use
+     thin locks; the slot is claimed with a CAS so that concurrent thread
+     creation is safe, and filled in once the thread is made */
+  for (i = 1; i < JAVA_MAX_THREADS; i++)
+    if (!threads[i] && javaCas((volatile u4 *) &threads[i], 0, 1) == 0)
+      break;
+  if (i == JAVA_MAX_THREADS)
+    return 0;
+
+  t = new JavaVMThread(i);
+  threads[i] = t;
+  return t;
+}
+
+JavaVMThread::JavaVMThread(u2 tid) :
+  _pc(0), _frame_stack(0), _tid(tid), _priority(JAVA_NORM_PRIORITY),
+  _state(JavaRunnable), _location(JavaInSW), _permit(0), _monitorNext(0)
+{
+  _sched.next = 0;
+  _sched.cpu = -1;
+  _sched.lastCpu = -1;
+  _sched.enqueued = 0;
+  _sched.handle = 0;
+}
+
+JavaVMThread::~JavaVMThread()
+{
+  threads[_tid] = 0;
+}
+
+bool JavaVMThread::start(void (*fn)(void *), void *arg)
+{
+  if (!_ops.spawn)
+    return false;
+  _sched.handle = _ops.spawn((JavaThreadI *) this, fn, arg);
+  return _sched.handle != 0;
+}
+
+void JavaVMThread::pause()
+{
+  /* the permit is taken with a CAS, so a resume() racing with the pause
+     either ends it at once or wakes the parked thread */
+  while (javaCas(&_permit, 1, 0) != 1) {
+    /* resume() cannot unpark a thread whose handle start() has not stored
+       yet, so until then the permit is spun on instead */
+    if (_ops.park && _sched.handle)
+      _ops.park(&_permit);
+    else
+      javaCpuRelax();
+  }
+}
+
+void JavaVMThread::resume()
+{
+  /* locked, so the permit is visible before the handle is read */
+  javaCas(&_permit, 0, 1);
+  if (_ops.unpark && _sched.handle)
+    _ops.unpark(_sched.handle);
+}
+
+
+JavaVMClass *JavaVMClass::_mirrorClass;
+
+JavaVMClass::JavaVMClass(JavaClassFile *cf, JavaVMClass *super) :
+  _classFile(cf), _super(super), _elemSize(0), _instanceSize(0), _mirror(0)
+{
+  _classIndex = JavaClassTable::instance()->registerClass(this);
+  layout();
+  makeMirror();
+}
+
+/* array classes have no classfile; instances are a JavaArray followed by
+   'length' elements of 'elemSize' bytes */
+JavaVMClass::JavaVMClass(u2 elemSize) :
+  _classFile(0), _super(0), _elemSize(elemSize),
+  _instanceSize(sizeof(JavaArray)), _mirror(0)
+{
+  _classIndex = JavaClassTable::instance()->registerClass(this);
+  makeMirror();
+}
+
+JavaVMClass::JavaVMClass() :
+  _classFile(0), _super(0), _elemSize(0),
+  _instanceSize(sizeof(JavaClassMirror)), _mirror(0)
+{
+  _classIndex = JavaClassTable::instance()->registerClass(this);
+}
+
+/* made by the first class that needs a mirror; its own mirror is made
+   once it exists, as its instances' class */
+JavaVMClass *JavaVMClass::mirrorClass()
+{
+  if (!_mirrorClass) {
+    _mirrorClass = new JavaVMClass();
+    _mirrorClass->makeMirror();
+  }
+  return _mirrorClass;
+}
+
+void JavaVMClass::makeMirror()
+{
+  JavaVMClass *mc = mirrorClass();
+  JavaClassMirror *m;
+
+  m = (JavaClassMirror *) new uint64[obj_round(mc->instanceSize()) / 8];
+  memset(m, 0, mc->instanceSize());
+  m->header(JAVA_HDR_MAKE(mc->classIndex()));
+  m->klass(this);
+  _mirror = m;
+}
+
+/* size in bytes of a field slot, from the first character of its field
+   descriptor; references are one machine word */
+static u4 field_size(JavaClassFile *cf, JavaFieldInfo *f)
+{
+  JavaUtf8Info *desc = (JavaUtf8Info *) cf->consts()[f->descIndex()];
+
+  switch (desc->bytes[0]) {
+  case 'J': case 'D':
+    return 8;
+  case 'I': case 'F': case 'L': case '[':
+    return 4;
+  case 'S': case 'C':
+    return 2;
+  default:
+    return 1;
+  }
+}
+
+void JavaVMClass::layout()
+{
+  std::vector<JavaFieldInfo *>& fields = _classFile->fields();
+  std::vector<bool> placed(fields.size(), false);
+  u4 offset, size;
+  bool wide = false;
+  int i;
+
+  /* superclass fields come first, so a subclass instance can be used
+     wherever its superclass is expected */
+  offset = _super ? _super->instanceSize() : sizeof(JavaObject);
+  _fieldOffsets.assign(fields.size(), 0);
+
+  for (i = 0; i < fields.size(); i++) {
+    if (fields[i]->accessFlags() & JAVA_FIELD_ACC_STATIC)
+      placed[i] = true;
+    else if (field_size(_classFile, fields[i]) == 8)
+      wide = true;
+  }
+
+  /* the header is a single word, so the first 8-byte field would leave
+     a 4-byte hole; fill it with a 4-byte field if there is one */
+  if (wide && (offset & 7) == 4) {
+    for (i = 0; i < fields.size(); i++) {
+      if (!placed[i] && field_size(_classFile, fields[i]) == 4) {
+        _fieldOffsets[i] = offset;
+        placed[i] = true;
+        offset += 4;
+        break;
+      }
+    }
+  }
+
+  for (size = 8; size > 0; size >>= 1) {
+    for (i = 0; i < fields.size(); i++) {
+      if (placed[i] || field_size(_classFile, fields[i]) != size)
+        continue;
+      offset = (offset + size - 1) & ~(size - 1);
+      _fieldOffsets[i] = offset;
+      placed[i] = true;
+      offset += size;
+    }
+  }
+
+  /* left unrounded so that subclasses can pack into the tail */
+  _instanceSize = offset;
+}
+
+
+bool JavaVMClass::isSubclassOf(const JavaVMClass *c) const
+{
+  const JavaVMClass *k;
+
+  for (k = this; k; k = k->_super)
+    if (k == c)
+      return true;
+  return false;
+}
+
+void JavaVMClass::addMethod(JavaVMMethod *m)
+{
+  int i;
+
+  m->javaClass(this);
+  _methods.push_back(m);
+  JavaIntrinsic::bind(m);
+  if (m->isStatic() || (m->accessFlags() & JAVA_METHOD_ACC_PRIVATE) ||
+      strcmp(m->name(), "<init>") == 0)
+    return;
+
+  /* the table starts out as a copy of the superclass table; methods must
+     be added after the superclass has all of its own */
+  if (_vtable.empty() && _super)
+    _vtable = _super->_vtable;
+
+  for (i = 0; i < _vtable.size(); i++) {
+    if (strcmp(_vtable[i]->name(), m->name()) == 0 &&
+        strcmp(_vtable[i]->desc(), m->desc()) == 0) {
+      m->vtableIndex(i);
+      if (!_vtable[i]->isOverridden())
+        JavaDeopt::overridden(_vtable[i]);
+      _vtable[i] = m;
+      return;
+    }
+  }
+  m->vtableIndex(_vtable.size());
+  _vtable.push_back(m);
+}
+
+JavaVMMethod *JavaVMClass::lookupMethod(const char *name,
+                                        const char *desc) const
+{
+  const JavaVMClass *k;
+  int i;
+
+  for (k = this; k; k = k->_super)
+    for (i = 0; i < k->_methods.size(); i++)
+      if (strcmp(k->_methods[i]->name(), name) == 0 &&
+          strcmp(k->_methods[i]->desc(), desc) == 0)
+        return k->_methods[i];
+  return 0;
+}
+
+
+JavaVMFrame::JavaVMFrame(JavaVMMethod *m, u4 *slots, JavaVMFrame *prev) :
+  _prev(prev), _method(m), _pc(0)
+{
+  _sp = slots + m->maxStack();
+  _locals = _sp + m->maxLocals() - 1;
+}
+
+u4 *JavaVMFrame::stackBase() const
+{
+  return _locals - _method->maxLocals() + 1;
+}
+
+
+u2 JavaVMMethod::descArgSlots(const char *desc, char *ret)
+{
+  const char *p = desc + 1;
+  u2 n = 0;
+
+  while (*p && *p != ')') {
+    switch (*p) {
+    case 'J': case 'D':
+      n += 2;
+      p++;
+      break;
+    case 'L':
+      n++;
+      while (*p && *p != ';')
+        p++;
+      if (*p)
+        p++;
+      break;
+    case '[':
+      n++;
+      while (*p == '[')
+        p++;
+      if (*p == 'L')
+        while (*p && *p != ';')
+          p++;
+      if (*p)
+        p++;
+      break;
+    default:
+      n++;
+      p++;
+      break;
+    }
+  }
+  /* arrays and objects are both references to the caller */
+  if (ret)
+    *ret = *p ? (p[1] == '[' ? 'L' : p[1]) : 'V';
+  return n;
+}
+
+void JavaVMMethod::init(const char *name, const char *desc, u2 flags)
+{
+  _entry = JavaInterp::entry;
+  _accessFlags = flags;
+  _name = name;
+  _desc = desc;
+  _code = 0;
+  _codeLength = 0;
+  _maxStack = 0;
+  _maxLocals = 0;
+  _argSlots = descArgSlots(desc, &_retType) + (isStatic() ? 0 : 1);
+  _vtableIndex = 0;
+  _cpool = 0;
+  _invocations = 0;
+  _backedges = 0;
+  _tier = 0;
+  _requestedTier = 0;
+  _compiled = 0;
+  _notCompilable = false;
+  _intrinsic = 0;
+  _profiles = 0;
+  _numProfiles = 0;
+  _osrPoints = 0;
+  _overridden = 0;
+}
+
+JavaVMMethod::JavaVMMethod(JavaVMClass *c, const char *name, const char *desc,
+                           u2 flags) :
+  _class(c)
+{
+  init(name, desc, flags);
+}
+
+JavaVMMethod::JavaVMMethod(JavaVMClass *c, JavaMethodInfo *mi) :
+  _class(c)
+{
+  std::vector<JavaConstInfo *>& consts = c->classFile()->consts();
+  JavaCodeAttr *ca = mi->codeAttr();
+
+  init(((JavaUtf8Info *) consts[mi->nameIndex()])->bytes,
+       ((JavaUtf8Info *) consts[mi->descIndex()])->bytes, mi->accessFlags());
+  if (ca && !ca->code().empty())
+    setCode(&ca->code()[0], ca->code().size(), ca->maxStack(),
+            ca->maxLocals());
+}
+
+void JavaVMMethod::setCode(const u1 *code, u4 length, u2 maxStack,
+                           u2 maxLocals)
+{
+  _code = code;
+  _codeLength = length;
+  _maxStack = maxStack;
+  _maxLocals = maxLocals;
+}
+
+u4 JavaCallProfile::total() const
+{
+  u4 n = others;
+  int i;
+
+  for (i = 0; i < JAVA_PROFILE_RECEIVERS; i++)
+    n += counts[i];
+  return n;
+}
+
+void JavaCallProfile::record(JavaVMClass *c)
+{
+  int i;
+
+  for (i = 0; i < JAVA_PROFILE_RECEIVERS; i++) {
+    if (receivers[i] == c) {
+      counts[i]++;
+      return;
+    }
+    if (!receivers[i]) {
+      receivers[i] = c;
+      counts[i] = 1;
+      return;
+    }
+  }
+  others++;
+}
+
+static inline bool is_virtual_call(u1 op)
+{
+  return op == JOP_INVOKEVIRTUAL || op == JOP_INVOKEINTERFACE;
+}
+
+void JavaVMMethod::profileCall(u4 pc, JavaVMClass *c)
+{
+  JavaCallProfile *p, *table;
+  u4 n = 0, i;
+
+  if (!_profiles) {
+    for (i = 0; i < _codeLength; i += jopLength(_code, i))
+      if (is_virtual_call(_code[i]))
+        n++;
+    table = new JavaCallProfile[n];
+    memset(table, 0, n * sizeof(JavaCallProfile));
+    for (i = 0, n = 0; i < _codeLength; i += jopLength(_code, i))
+      if (is_virtual_call(_code[i]))
+        table[n++].pc = i;
+
+    /* another thread may have got there first; both tables are equal */
+    _numProfiles = n;
+    if (javaCas((volatile u4 *) &_profiles, 0, (u4) (uintptr) table) != 0)
+      delete [] table;
+  }
+
+  if ((p = callProfile(pc)) != 0)
+    p->record(c);
+}
+
+JavaCallProfile *JavaVMMethod::callProfile(u4 pc) const
+{
+  JavaCallProfile *p = _profiles;
+  int lo = 0, hi = (int) _numProfiles - 1, mid;
+
+  if (!p)
+    return 0;
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    if (p[mid].pc == pc)
+      return &p[mid];
+    if (p[mid].pc < pc)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return 0;
+}
+
+JavaOsrPoint *JavaVMMethod::osrPoint(u4 pc) const
+{
+  JavaOsrPoint *p;
+
+  for (p = _osrPoints; p; p = p->next)
+    if (p->pc == pc)
+      return p;
+  return 0;
+}
+
+JavaOsrPoint *JavaVMMethod::addOsrPoint(u4 pc)
+{
+  JavaOsrPoint *p, *q, *head;
+
+  if ((p = osrPoint(pc)) != 0)
+    return p;
+  p = new JavaOsrPoint;
+  p->pc = pc;
+  p->entry = 0;
+  p->tier = 0;
+  p->requestedTier = 0;
+
+  /* points are only ever added at the head; retry if the head moved,
+     and give up ours if another thread added the same pc meanwhile */
+  for (;;) {
+    head = p->next = _osrPoints;
+    if (javaCas((volatile u4 *) &_osrPoints, (u4) (uintptr) head,
+                (u4) (uintptr) p) == (u4) (uintptr) head)
+      return p;
+    if ((q = osrPoint(pc)) != 0) {
+      delete p;
+      return q;
+    }
+  }
+}
+
+bool JavaVMMethod::isFinal() const
+{
+  if (_accessFlags & (JAVA_METHOD_ACC_PRIVATE | JAVA_METHOD_ACC_FINAL |
+                      JAVA_METHOD_ACC_STATIC))
+    return true;
+  if (strcmp(_name, "<init>") == 0)
+    return true;
+  return _class && _class->classFile() &&
+    (_class->classFile()->accessFlags() & JAVA_CLASS_ACC_FINAL);
+}
+
+
+JavaVMHeap::JavaVMHeap(char *base, u4 size) :
+  _base(base), _top(base), _end(base + size),
+  _numObjects(0), _numBytes(0), _wideBytes(0)
+{
+}
+
+/* every thread allocates from the one heap, on any CPU, so the bump of
+   _top is a CAS and the statistics are added to atomically */
+char *JavaVMHeap::alloc(u4 size)
+{
+  u4 rounded = obj_round(size);
+  char *p;
+
+  do {
+    p = _top;
+    if (rounded > (u4) (_end - p))
+      return 0;
+  } while (javaCas((volatile u4 *) &_top, (u4) (uintptr) p,
+                   (u4) (uintptr) (p + rounded)) != (u4) (uintptr) p);
+  memset(p, 0, rounded);
+
+  javaAtomicAdd(&_numObjects, 1);
+  javaAtomicAdd(&_numBytes, rounded);
+  javaAtomicAdd(&_wideBytes, obj_round(size + sizeof(u4)));
+  return p;
+}
+
+JavaObject *JavaVMHeap::allocObject(JavaVMClass *c)
+{
+  JavaObject *o = (JavaObject *) alloc(c->instanceSize());
+
+  if (o)
+    o->header(JAVA_HDR_MAKE(c->classIndex()));
+  return o;
+}
+
+JavaArray *JavaVMHeap::allocArray(JavaVMClass *c, u4 length)
+{
+  JavaArray *a;
+
+  /* reject lengths whose byte size would wrap around */
+  if (c->elemSize() && length > (0xFFFFFFFFU - sizeof(JavaArray)) / c->elemSize())
+    return 0;
+
+  a = (JavaArray *) alloc(sizeof(JavaArray) + length * c->elemSize());
+  if (a) {
+    a->header(JAVA_HDR_MAKE(c->classIndex()));
+    a->length(length);
+  }
+  return a;
+}
+
+/* footprint of everything allocated so far, compared with a conventional
+   two-word header; JavaBench::heapFootprint() runs an object-heavy
+   workload and reports its share */
+void JavaVMHeap::dumpStats()
+{
+  u4 saved = _wideBytes - _numBytes;
+
+  printf("java heap: %u objects, %u bytes used of %u\n",
+         _numObjects, _numBytes, (u4) (_end - _base));
+  printf("  header bytes: %u (one-word header)\n",
+         _numObjects * (u4) sizeof(u4));
+  printf("  with two-word header: %u bytes (%u saved, %u%%)\n",
+         _wideBytes, saved, _wideBytes ? saved * 100 / _wideBytes : 0);
+}
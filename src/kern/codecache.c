@@ -0,0 +1,379 @@
+/**
+ * @file codecache.c
+ * @desc the code cache: executable memory for compiled Java code
+ *
+ * [CODEBASE, CODELIM) is split into one fixed range per segment; each
+ * segment hands out blocks from the bottom of its range, below a break
+ * that moves up as it runs out of free blocks, and maps pages from the
+ * page allocator under the break as it moves; the baseline and optimized
+ * segments map each 2MB of their range that is 2MB aligned with one 2MB
+ * page when they can, so that running code spread over the segment takes
+ * few TLB entries, at the cost of backing all 2MB; the kernel maps nothing
+ * no-execute, so writable kernel pages can hold code; pages stay mapped
+ * when the break moves back down, since unmapping them would take a TLB
+ * shootdown on the other CPUs
+ *
+ * every block starts with a header holding its size and the size of the
+ * block below it, so a freed block merges with free neighbours on both
+ * sides, and a free block at the top lowers the break instead; blocks are
+ * allocated first fit
+ *
+ * compiled code can not be freed as soon as the VM stops using it: a
+ * thread may be running it, or may have just loaded its address; the VM
+ * retires such code, and a sweep frees it once it has been retired for
+ * CC_GRACE_SWEEPS sweeps and no word on any kernel stack points into it;
+ * the stacks are scanned whole and conservatively, so a stale word only
+ * keeps the code longer; what the scan can not see is a thread on another
+ * CPU running the code without having called out of it, which is what the
+ * grace period is for
+ */
+#include <string.h>
+#include <assert.h>
+#include <error.h>
+#include <vmmap.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+#include <kern/sched.h>
+#include <kern/spinlock.h>
+#include <kern/codecache.h>
+
+/* values of cb_state */
+enum {
+  CB_FREE = 0,
+  CB_USED,
+  CB_ZOMBIE
+};
+
+/* precedes every block below a segment's break; CC_ALIGN bytes, so the
+   code after it stays aligned */
+struct cc_block {
+  uint32_t cb_size;               /* header included */
+  uint32_t cb_prevsize;           /* of the block below; 0 for the first */
+  uint16_t cb_seg;
+  uint16_t cb_state;              /* CB_* */
+  uint32_t cb_epoch;              /* sweep it was retired in */
+  LIST_ENTRY(cc_block) cb_link;   /* free or zombie list */
+  uint32_t cb_pad[2];
+};
+
+LIST_HEAD(cc_block_list, cc_block);
+
+struct cc_segment {
+  const char *cs_name;
+  uintptr_t cs_base;
+  uintptr_t cs_lim;
+  uintptr_t cs_brk;               /* blocks end here */
+  uintptr_t cs_mapped;            /* pages are mapped up to here */
+  int cs_large;                   /* 2MB pages wanted */
+  struct cc_block *cs_last;       /* highest block, 0 if none */
+  struct cc_block_list cs_free;
+  struct cc_block_list cs_zombies;
+};
+
+/* smallest remainder worth splitting off a free block */
+#define CC_MINSPLIT  (4 * CC_ALIGN)
+
+#define CODE_STUBS      (CODEBASE)
+#define CODE_BASELINE   (CODE_STUBS + PTSIZE)
+#define CODE_OPTIMIZED  (CODE_BASELINE + 3 * PTSIZE)
+
+static struct cc_segment cc_segs[CC_NSEG] = {
+  { "stubs", CODE_STUBS, CODE_BASELINE,
+    CODE_STUBS, CODE_STUBS, 0 },
+  { "baseline", CODE_BASELINE, CODE_OPTIMIZED,
+    CODE_BASELINE, CODE_BASELINE, 1 },
+  { "optimized", CODE_OPTIMIZED, CODELIM,
+    CODE_OPTIMIZED, CODE_OPTIMIZED, 1 }
+};
+
+/* guards the segments and the page table entries under CODEBASE */
+static struct spinlock cc_lock = SPINLOCK_INITIALIZER("cc_lock");
+
+static uint32_t cc_epoch;         /* sweeps so far */
+
+
+static inline struct cc_block *next_block(struct cc_block *b)
+{
+  return (struct cc_block *) ((uintptr_t) b + b->cb_size);
+}
+
+static inline struct cc_block *prev_block(struct cc_block *b)
+{
+  return b->cb_prevsize ?
+    (struct cc_block *) ((uintptr_t) b - b->cb_prevsize) : 0;
+}
+
+/* maps pages under 'end'; on failure the pages mapped so far stay */
+static int map_to(struct cc_segment *s, uintptr_t end)
+{
+  struct page *pp;
+
+  while (s->cs_mapped < end) {
+    if (s->cs_large && s->cs_mapped % PTSIZE == 0 &&
+        s->cs_lim - s->cs_mapped >= PTSIZE &&
+        alloc_pages(PAGE_LARGE_ORDER, &pp) == 0) {
+      if (page_insert_large(boot_pgdir, pp, (void *) s->cs_mapped,
+                            PTE_W) == 0) {
+        s->cs_mapped += PTSIZE;
+        continue;
+      }
+      free_pages(pp, PAGE_LARGE_ORDER);
+    }
+    if (page_alloc(&pp) != 0)
+      return -E_NO_MEM;
+    if (page_insert(boot_pgdir, pp, (void *) s->cs_mapped, PTE_W) != 0) {
+      page_free(pp);
+      return -E_NO_MEM;
+    }
+    s->cs_mapped += PGSIZE;
+  }
+  return 0;
+}
+
+/* carves a block of 'size' bytes off the bottom of free block 'b', which
+   is off the free list */
+static void split(struct cc_segment *s, struct cc_block *b, uint32_t size)
+{
+  struct cc_block *rest, *next;
+
+  if (b->cb_size - size < CC_MINSPLIT)
+    return;
+
+  rest = (struct cc_block *) ((uintptr_t) b + size);
+  rest->cb_size = b->cb_size - size;
+  rest->cb_prevsize = size;
+  rest->cb_seg = b->cb_seg;
+  rest->cb_state = CB_FREE;
+  b->cb_size = size;
+
+  next = next_block(rest);
+  if ((uintptr_t) next < s->cs_brk)
+    next->cb_prevsize = rest->cb_size;
+  else
+    s->cs_last = rest;
+  LIST_INSERT_HEAD(&s->cs_free, rest, cb_link);
+}
+
+/* 'b' is in use or retired and on no list; called with cc_lock held */
+static void release(struct cc_segment *s, struct cc_block *b)
+{
+  struct cc_block *next, *prev;
+
+  b->cb_state = CB_FREE;
+
+  next = next_block(b);
+  if ((uintptr_t) next < s->cs_brk && next->cb_state == CB_FREE) {
+    LIST_REMOVE(next, cb_link);
+    b->cb_size += next->cb_size;
+  }
+  prev = prev_block(b);
+  if (prev && prev->cb_state == CB_FREE) {
+    LIST_REMOVE(prev, cb_link);
+    prev->cb_size += b->cb_size;
+    b = prev;
+  }
+
+  next = next_block(b);
+  if ((uintptr_t) next < s->cs_brk) {
+    next->cb_prevsize = b->cb_size;
+    LIST_INSERT_HEAD(&s->cs_free, b, cb_link);
+    return;
+  }
+
+  /* the block below a free top block is in use, so the break stops at
+     the top of a used block or at the bottom of the segment */
+  s->cs_brk = (uintptr_t) b;
+  s->cs_last = prev_block(b);
+}
+
+void *cc_alloc(int seg, uint32_t size)
+{
+  struct cc_segment *s;
+  struct cc_block *b;
+  uint32_t need, eflags;
+
+  assert(seg >= 0 && seg < CC_NSEG);
+  s = &cc_segs[seg];
+  need = ROUNDUP(size + sizeof(struct cc_block), CC_ALIGN);
+  if (need < size)
+    return 0;
+
+  eflags = irq_save();
+  spin_lock(&cc_lock);
+  LIST_FOREACH(b, &s->cs_free, cb_link)
+    if (b->cb_size >= need)
+      break;
+
+  if (b) {
+    LIST_REMOVE(b, cb_link);
+    split(s, b, need);
+  } else {
+    if (need > s->cs_lim - s->cs_brk || map_to(s, s->cs_brk + need) != 0) {
+      spin_unlock(&cc_lock);
+      irq_restore(eflags);
+      return 0;
+    }
+    b = (struct cc_block *) s->cs_brk;
+    b->cb_size = need;
+    b->cb_prevsize = s->cs_last ? s->cs_last->cb_size : 0;
+    b->cb_seg = seg;
+    s->cs_brk += need;
+    s->cs_last = b;
+  }
+  b->cb_state = CB_USED;
+  spin_unlock(&cc_lock);
+  irq_restore(eflags);
+  return b + 1;
+}
+
+static struct cc_block *code_block(void *code)
+{
+  struct cc_block *b = (struct cc_block *) code - 1;
+
+  assert((uintptr_t) code >= CODEBASE && (uintptr_t) code < CODELIM);
+  assert(b->cb_seg < CC_NSEG && b->cb_state == CB_USED);
+  return b;
+}
+
+void cc_free(void *code)
+{
+  struct cc_block *b;
+  uint32_t eflags;
+
+  eflags = irq_save();
+  spin_lock(&cc_lock);
+  b = code_block(code);
+  release(&cc_segs[b->cb_seg], b);
+  spin_unlock(&cc_lock);
+  irq_restore(eflags);
+}
+
+void cc_retire(void *code)
+{
+  struct cc_block *b;
+  uint32_t eflags;
+
+  eflags = irq_save();
+  spin_lock(&cc_lock);
+  b = code_block(code);
+  b->cb_state = CB_ZOMBIE;
+  b->cb_epoch = cc_epoch;
+  LIST_INSERT_HEAD(&cc_segs[b->cb_seg].cs_zombies, b, cb_link);
+  spin_unlock(&cc_lock);
+  irq_restore(eflags);
+}
+
+/* nonzero if a word on a kernel stack points into [lo, hi) */
+static int stack_refs(uintptr_t lo, uintptr_t hi)
+{
+  uint32_t *w;
+  int i;
+
+  for (w = (uint32_t *) bootstack; w < (uint32_t *) bootstacktop; w++)
+    if (*w >= lo && *w < hi)
+      return 1;
+  for (i = 1; i < NCPU; i++)
+    for (w = (uint32_t *) percpu_kstacks[i];
+         w < (uint32_t *) (percpu_kstacks[i] + KSTKSIZE); w++)
+      if (*w >= lo && *w < hi)
+        return 1;
+  return kthread_stack_refs(lo, hi);
+}
+
+/* a scan of every stack is long, so it is done without cc_lock and with
+   interrupts on; the zombies past their grace period are taken off the
+   zombie lists first, so no one else touches them meanwhile, and the
+   ones still referenced go back afterwards */
+uint32_t cc_sweep(void)
+{
+  struct cc_block_list old, keep;
+  struct cc_segment *s;
+  struct cc_block *b, *next;
+  uint32_t freed = 0, eflags;
+  int i;
+
+  LIST_INIT(&old);
+  LIST_INIT(&keep);
+  eflags = irq_save();
+  spin_lock(&cc_lock);
+  cc_epoch++;
+  for (i = 0; i < CC_NSEG; i++) {
+    s = &cc_segs[i];
+    for (b = LIST_FIRST(&s->cs_zombies); b; b = next) {
+      next = LIST_NEXT(b, cb_link);
+      if (cc_epoch - b->cb_epoch < CC_GRACE_SWEEPS)
+        continue;
+      LIST_REMOVE(b, cb_link);
+      LIST_INSERT_HEAD(&old, b, cb_link);
+    }
+  }
+  spin_unlock(&cc_lock);
+  irq_restore(eflags);
+
+  /* a neighbour being released never merges with a zombie, so cb_size
+     stays put without the lock */
+  for (b = LIST_FIRST(&old); b; b = next) {
+    next = LIST_NEXT(b, cb_link);
+    if (stack_refs((uintptr_t) b, (uintptr_t) next_block(b))) {
+      LIST_REMOVE(b, cb_link);
+      LIST_INSERT_HEAD(&keep, b, cb_link);
+    }
+  }
+
+  eflags = irq_save();
+  spin_lock(&cc_lock);
+  while ((b = LIST_FIRST(&keep)) != 0) {
+    LIST_REMOVE(b, cb_link);
+    LIST_INSERT_HEAD(&cc_segs[b->cb_seg].cs_zombies, b, cb_link);
+  }
+  while ((b = LIST_FIRST(&old)) != 0) {
+    LIST_REMOVE(b, cb_link);
+    freed += b->cb_size;
+    release(&cc_segs[b->cb_seg], b);
+  }
+  spin_unlock(&cc_lock);
+  irq_restore(eflags);
+  return freed;
+}
+
+void cc_stats(int seg, struct cc_stats *st)
+{
+  struct cc_segment *s;
+  struct cc_block *b;
+  uint32_t avail, eflags;
+
+  assert(seg >= 0 && seg < CC_NSEG);
+  s = &cc_segs[seg];
+  memset(st, 0, sizeof(*st));
+  st->cs_name = s->cs_name;
+  st->cs_size = s->cs_lim - s->cs_base;
+
+  eflags = irq_save();
+  spin_lock(&cc_lock);
+  st->cs_mapped = s->cs_mapped - s->cs_base;
+  for (b = (struct cc_block *) s->cs_base; (uintptr_t) b < s->cs_brk;
+       b = next_block(b)) {
+    switch (b->cb_state) {
+    case CB_USED:
+      st->cs_used += b->cb_size;
+      st->cs_nused++;
+      break;
+    case CB_ZOMBIE:
+      st->cs_zombie += b->cb_size;
+      st->cs_nzombie++;
+      break;
+    default:
+      st->cs_free += b->cb_size;
+      st->cs_nfree++;
+      if (b->cb_size - sizeof(*b) > st->cs_largest)
+        st->cs_largest = b->cb_size - sizeof(*b);
+      break;
+    }
+  }
+  avail = s->cs_lim - s->cs_brk;
+  st->cs_free += avail;
+  if (avail >= sizeof(*b) && avail - sizeof(*b) > st->cs_largest)
+    st->cs_largest = avail - sizeof(*b);
+  spin_unlock(&cc_lock);
+  irq_restore(eflags);
+}
@@ -3,10 +3,17 @@
  * @desc kernel init code; i386_init is the beginning of all kernel
  *       code, which is loaded/executed by the bootloader
  */
+#include <x86.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <kern/pmap.h>
+#include <kern/kmalloc.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+#include <kern/trap.h>
+#include <kern/picirq.h>
+#include <kern/sched.h>
 #include <kern/kclock.h>
 #include <kern/monitor.h>
 #include <kern/console.h>
@@ -22,6 +29,10 @@ void test_backtrace(int x)
 	cprintf("Leaving test_backtrace %d\n", x);
 }
 
+static void boot_aps(void);
+static void check_smp(void);
+static void init_thread(void *arg);
+
 void i386_init(void)
 {
 	extern char edata[], end[];
@@ -43,6 +54,205 @@ void i386_init(void)
   /* memory setup */
   i386_detect_memory();
   i386_vm_init();
+  kmem_init();
+
+  /* trap and interrupt setup */
+  idt_init();
+  pic_init();
+
+  /* multiprocessor setup; find the other CPUs and start them */
+  mp_init();
+  lapic_init();
+  trap_init_percpu();
+  lapic_timer_calibrate();
+
+  /* heap_check() shoots down TLB entries, which the APs would not answer
+     while they wait in check_smp() with interrupts off */
+  heap_check();
+  boot_aps();
+  check_smp();
+
+  /* everything else runs in threads; this CPU joins the others in the
+     scheduler */
+  if (!kthread_create("init", init_thread, 0))
+    panic("cannot create the init thread");
+  sched_start();
+}
+
+
+/* top of the stack the next AP starts on; read by mpentry.S */
+void *mpentry_kstack;
+
+/* start the non-boot processors (APs), one at a time */
+static void boot_aps(void)
+{
+  extern unsigned char mpentry_start[], mpentry_end[];
+  struct cpuinfo *c;
+  void *code;
+  int us;
+
+  if (ncpu == 1)
+    return;
+
+  /* write entry code to unused memory at MPENTRY_PADDR */
+  code = KADDR(MPENTRY_PADDR);
+  memmove(code, mpentry_start, mpentry_end - mpentry_start);
+
+  /* an AP turns on paging while running at MPENTRY_PADDR, so the low 2MB
+     stay mapped, as they were for the BSP in i386_vm_init(), until all APs
+     run at their link addresses */
+  boot_pgdir[0] = boot_pgdir[PDX(KERNBASE)];
+
+  for (c = cpus; c < cpus + ncpu; c++) {
+    if (c == bootcpu)
+      continue;
+
+    mpentry_kstack = (void *) percpu_kstacktop(c - cpus);
+    lapic_startap(c->cpu_apicid, PADDR(code));
+
+    /* wait up to a second for the CPU to finish its setup in mp_main();
+       one that does not show up is left out */
+    for (us = 0; c->cpu_status != CPU_STARTED && us < 1000000; us += 10)
+      microdelay(10);
+    if (c->cpu_status != CPU_STARTED)
+      cprintf("SMP: CPU %d (APIC id %d) did not start\n",
+              c->cpu_id, c->cpu_apicid);
+  }
+
+  boot_pgdir[0] = 0;
+  lcr3(boot_cr3);
+}
+
+static void smp_worker(void);
+
+/* setup code for APs; called from mpentry.S on the AP's own stack */
+void mp_main(void)
+{
+  gdt_init_percpu();
+  lapic_init();
+  trap_init_percpu();
+  cprintf("SMP: CPU %d starting\n", cpunum());
+
+  /* tell boot_aps() we're up */
+  xchg(&thiscpu->cpu_status, CPU_STARTED);
+
+  smp_worker();
+  sched_start();
+}
+
+
+/* SMP self-test: once released, every started CPU runs smp_worker()
+   concurrently; each checks that it is on its own stack and then hammers
+   a counter under a spin lock */
+#define SMP_CHECK_ITERS 100000
+
+static volatile uint32_t smp_go;
+static volatile uint32_t smp_done;
+static volatile uint32_t smp_counter;
+static struct spinlock smp_lock = SPINLOCK_INITIALIZER("smp_lock");
+
+static void smp_worker(void)
+{
+  struct cpuinfo *c = thiscpu;
+  uintptr_t esp = read_esp();
+  uintptr_t top;
+  int i;
+
+  while (!smp_go)
+    __asm __volatile("pause");
+
+  /* the BSP runs on bootstack, at its KERNBASE address */
+  top = c == bootcpu ? (uintptr_t) bootstacktop : percpu_kstacktop(c->cpu_id);
+  if (esp > top || esp <= top - KSTKSIZE)
+    panic("CPU %d: esp %08x outside its stack", c->cpu_id, esp);
+
+  for (i = 0; i < SMP_CHECK_ITERS; i++) {
+    spin_lock(&smp_lock);
+    smp_counter++;
+    spin_unlock(&smp_lock);
+  }
+  c->cpu_nruns++;
+  __asm __volatile("lock; incl %0" : "+m" (smp_done) :: "memory");
+}
+
+static void check_smp(void)
+{
+  uint32_t nstarted = 0;
+  uint64_t start;
+  int i, us;
+
+  for (i = 0; i < ncpu; i++)
+    if (cpus[i].cpu_status == CPU_STARTED)
+      nstarted++;
+
+  start = read_tsc();
+  xchg(&smp_go, 1);
+  smp_worker();
+
+  for (us = 0; smp_done != nstarted; us += 10) {
+    if (us >= 10000000)
+      panic("check_smp: only %d of %d CPUs finished", smp_done, nstarted);
+    microdelay(10);
+  }
+  assert(smp_counter == nstarted * SMP_CHECK_ITERS);
+  for (i = 0; i < ncpu; i++)
+    assert(cpus[i].cpu_status != CPU_STARTED || cpus[i].cpu_nruns == 1);
+
+  cprintf("check_smp() succeeded! (%d CPUs, %u locked increments in %u "
+          "cycles)\n", nstarted, (uint32_t) smp_counter,
+          (uint32_t) (read_tsc() - start));
+}
+
+
+/* preemption self-test: start more threads than there are CPUs, all of
+   which spin without ever yielding; they, and this thread, only all get
+   to run if the timer takes CPUs away from them */
+static volatile uint32_t spin_counts[NKTHREAD];
+static volatile uint32_t spin_stop;
+static volatile uint32_t spin_exited;
+
+static void spinner(void *arg)
+{
+  volatile uint32_t *count = arg;
+
+  while (!spin_stop)
+    (*count)++;
+  __asm __volatile("lock; incl %0" : "+m" (spin_exited) :: "memory");
+}
+
+static void check_preempt(void)
+{
+  uint32_t npreempt = 0;
+  int i, n, nstarted = 0;
+
+  for (i = 0; i < ncpu; i++)
+    if (cpus[i].cpu_status == CPU_STARTED)
+      nstarted++;
+  n = 2 * nstarted;
+  if (n > NKTHREAD - 2)
+    n = NKTHREAD - 2;
+
+  for (i = 0; i < n; i++)
+    if (!kthread_create("spinner", spinner, (void *) &spin_counts[i]))
+      panic("check_preempt: cannot create thread %d", i);
+
+  for (i = 0; i < n; i++)
+    while (spin_counts[i] == 0)
+      kthread_yield();
+
+  spin_stop = 1;
+  while (spin_exited != n)
+    kthread_yield();
+
+  for (i = 0; i < NKTHREAD; i++)
+    npreempt += kthreads[i].kt_npreempt;
+  cprintf("check_preempt() succeeded! (%d spinners on %d CPUs, "
+          "%u preemptions)\n", n, nstarted, npreempt);
+}
+
+static void init_thread(void *arg)
+{
+  check_preempt();
 
 	/* drop into the kernel monitor */
 	while (1)
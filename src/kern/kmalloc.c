@@ -0,0 +1,643 @@
+/**
+ * @file kmalloc.c
+ * @desc the kernel's object allocator
+ *
+ * a cache hands out objects of one size from slabs: blocks of 2^order
+ * pages from alloc_pages() that start with a header and hold a whole
+ * number of objects after it; the header keeps the slab's free objects as
+ * a list of indices beside it rather than links inside the objects, so a
+ * free object keeps the state its constructor left it in; a slab is on
+ * its cache's full, partial or empty list, and partial slabs are used
+ * first so that empty ones can be given back; every page of a slab is
+ * marked PP_SLAB and holds the slab's order, and a slab is aligned on its
+ * size, so the header of any object is found from the object's address
+ *
+ * in front of the slabs each CPU keeps a stack of free objects of each
+ * cache, like the page magazines in pmap.c: kmem_cache_alloc() and
+ * kmem_cache_free() work on it with interrupts off, and take the cache's
+ * lock only to move KMEM_CPU_BATCH objects between it and the slabs
+ *
+ * kmalloc() rounds a size up to one of a set of caches, and takes a block
+ * of pages for sizes above KMEM_MAX_SIZE; the caches themselves are
+ * objects of a cache, which is set up by hand
+ */
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <error.h>
+#include <queue.h>
+#include <vmmap.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+#include <kern/kmalloc.h>
+
+/* a slab is at most 2^KMEM_MAX_ORDER pages; a cache takes the smallest
+   order that wastes no more than 1/KMEM_WASTE of a slab */
+#define KMEM_MAX_ORDER   3
+#define KMEM_WASTE       8
+
+/* empty slabs a cache keeps instead of giving them back at once */
+#define KMEM_KEEP_EMPTY  1
+
+#define KMEM_NONE        0xFFFF   /* end of a slab's free list */
+
+struct kmem_slab {
+  LIST_ENTRY(kmem_slab) sl_link;
+  struct kmem_cache *sl_cache;
+  char *sl_objs;                  /* the first object */
+  uint16_t sl_inuse;              /* objects off the free list */
+  uint16_t sl_free;               /* first free object, or KMEM_NONE */
+};
+
+LIST_HEAD(kmem_slab_list, kmem_slab);
+
+/* the header is followed by the index of the next free object after
+   each object */
+#define slab_next(s)  ((uint16_t *) ((s) + 1))
+
+/* a CPU's free objects of a cache */
+struct kmem_cpu {
+  uint32_t kc_count;
+  void *kc_objs[KMEM_CPU_SIZE];   /* most recently freed last */
+  uint32_t kc_nalloc;
+  uint32_t kc_nfree;
+  uint32_t kc_nmiss;
+};
+
+struct kmem_cache {
+  const char *c_name;
+  uint32_t c_size;
+  uint32_t c_order;
+  uint32_t c_perslab;
+  uint32_t c_offset;              /* of the first object in a slab */
+  void (*c_ctor)(void *);
+
+  struct spinlock c_lock;         /* guards the slabs and the counts below */
+  struct kmem_slab_list c_full;
+  struct kmem_slab_list c_partial;
+  struct kmem_slab_list c_empty;
+  uint32_t c_nslabs;
+  uint32_t c_nempty;
+  uint32_t c_nout;                /* objects off the slabs' free lists */
+  uint32_t c_ngrow;
+  uint32_t c_nreap;
+
+  LIST_ENTRY(kmem_cache) c_link;
+  struct kmem_cpu c_cpu[NCPU];
+};
+
+LIST_HEAD(kmem_cache_list, kmem_cache);
+
+/* guards the list of caches */
+static struct spinlock kmem_lock = SPINLOCK_INITIALIZER("kmem_lock");
+static struct kmem_cache_list kmem_caches;
+static struct kmem_cache *kmem_last;
+
+/* the cache of caches */
+static struct kmem_cache kmem_cache_cache;
+
+static const struct {
+  uint32_t size;
+  const char *name;
+} kmalloc_sizes[] = {
+  { 8, "kmalloc-8" },
+  { 16, "kmalloc-16" },
+  { 32, "kmalloc-32" },
+  { 48, "kmalloc-48" },
+  { 64, "kmalloc-64" },
+  { 96, "kmalloc-96" },
+  { 128, "kmalloc-128" },
+  { 192, "kmalloc-192" },
+  { 256, "kmalloc-256" },
+  { 384, "kmalloc-384" },
+  { 512, "kmalloc-512" },
+  { 768, "kmalloc-768" },
+  { 1024, "kmalloc-1024" },
+  { 1536, "kmalloc-1536" },
+  { 2048, "kmalloc-2048" }
+};
+
+#define NKMALLOC  (sizeof(kmalloc_sizes) / sizeof(kmalloc_sizes[0]))
+
+static struct kmem_cache *kmalloc_caches[NKMALLOC];
+
+/* the cache for each size, by (size - 1) / KMEM_ALIGN */
+static uint8_t kmalloc_index[KMEM_MAX_SIZE / KMEM_ALIGN];
+
+static void check_kmem(void);
+
+
+/* where the objects start in a slab of 'n' of them */
+static uint32_t slab_offset(uint32_t n, uint32_t align)
+{
+  return ROUNDUP(sizeof(struct kmem_slab) + n * sizeof(uint16_t), align);
+}
+
+/* objects of 'size' that fit in a slab of 'slab' bytes */
+static uint32_t slab_capacity(uint32_t slab, uint32_t size, uint32_t align)
+{
+  uint32_t n;
+
+  n = (slab - sizeof(struct kmem_slab)) / (size + sizeof(uint16_t));
+  while (n > 0 && slab_offset(n, align) + n * size > slab)
+    n--;
+  return MIN(n, KMEM_NONE);
+}
+
+static int cache_init(struct kmem_cache *c, const char *name, size_t size,
+                      size_t align, void (*ctor)(void *))
+{
+  uint32_t order, n, slab;
+
+  if (align == 0)
+    align = KMEM_ALIGN;
+  assert((align & (align - 1)) == 0 && align <= PGSIZE);
+  if (size > (PGSIZE << KMEM_MAX_ORDER))
+    return -E_INVAL;
+  size = ROUNDUP(MAX(size, 1), align);
+
+  for (order = 0; order <= KMEM_MAX_ORDER; order++) {
+    slab = PGSIZE << order;
+    n = slab_capacity(slab, size, align);
+    if (n > 0 && slab - slab_offset(n, align) - n * size <= slab / KMEM_WASTE)
+      break;
+  }
+  if (order > KMEM_MAX_ORDER) {
+    order = KMEM_MAX_ORDER;
+    if ((n = slab_capacity(PGSIZE << order, size, align)) == 0)
+      return -E_INVAL;
+  }
+
+  memset(c, 0, sizeof(*c));
+  c->c_name = name;
+  c->c_size = size;
+  c->c_order = order;
+  c->c_perslab = n;
+  c->c_offset = slab_offset(n, align);
+  c->c_ctor = ctor;
+  spin_initlock(&c->c_lock, name);
+  LIST_INIT(&c->c_full);
+  LIST_INIT(&c->c_partial);
+  LIST_INIT(&c->c_empty);
+  return 0;
+}
+
+static void cache_add(struct kmem_cache *c)
+{
+  uint32_t eflags;
+
+  eflags = irq_save();
+  spin_lock(&kmem_lock);
+  if (kmem_last)
+    LIST_INSERT_AFTER(kmem_last, c, c_link);
+  else
+    LIST_INSERT_HEAD(&kmem_caches, c, c_link);
+  kmem_last = c;
+  spin_unlock(&kmem_lock);
+  irq_restore(eflags);
+}
+
+/* a new slab of 'c', its objects constructed; 0 if out of pages */
+static struct kmem_slab *slab_create(struct kmem_cache *c)
+{
+  struct kmem_slab *s;
+  struct page *pp;
+  uint16_t *next;
+  uint32_t i;
+
+  if (alloc_pages(c->c_order, &pp) != 0)
+    return 0;
+  for (i = 0; i < (1 << c->c_order); i++) {
+    pp[i].pp_order = c->c_order;
+    pp[i].pp_flags = PP_SLAB;
+  }
+
+  s = page2kva(pp);
+  s->sl_cache = c;
+  s->sl_objs = (char *) s + c->c_offset;
+  s->sl_inuse = 0;
+  s->sl_free = 0;
+  next = slab_next(s);
+  for (i = 0; i < c->c_perslab; i++) {
+    next[i] = i + 1 < c->c_perslab ? i + 1 : KMEM_NONE;
+    if (c->c_ctor)
+      c->c_ctor(s->sl_objs + i * c->c_size);
+  }
+  return s;
+}
+
+/* gives an empty slab, on no list, back to the page allocator; the
+   caller holds the cache's lock */
+static void slab_destroy(struct kmem_cache *c, struct kmem_slab *s)
+{
+  struct page *pp = pa2page(PADDR(s));
+  uint32_t i;
+
+  assert(s->sl_inuse == 0);
+  for (i = 0; i < (1 << c->c_order); i++) {
+    pp[i].pp_order = 0;
+    pp[i].pp_flags = 0;
+  }
+  free_pages(pp, c->c_order);
+  c->c_nslabs--;
+  c->c_nreap++;
+}
+
+static struct kmem_slab *obj_slab(void *obj)
+{
+  struct page *pp = pa2page(PADDR(obj));
+
+  assert(pp->pp_flags & PP_SLAB);
+  return (struct kmem_slab *) ROUNDDOWN((uintptr_t) obj,
+                                        PGSIZE << pp->pp_order);
+}
+
+/* takes a free object off a slab; 0 if no slab has one; the caller holds
+   the cache's lock */
+static void *cache_get(struct kmem_cache *c)
+{
+  struct kmem_slab *s;
+  uint32_t i;
+
+  if ((s = LIST_FIRST(&c->c_partial)) == 0) {
+    if ((s = LIST_FIRST(&c->c_empty)) == 0)
+      return 0;
+    LIST_REMOVE(s, sl_link);
+    LIST_INSERT_HEAD(&c->c_partial, s, sl_link);
+    c->c_nempty--;
+  }
+
+  i = s->sl_free;
+  s->sl_free = slab_next(s)[i];
+  s->sl_inuse++;
+  if (s->sl_free == KMEM_NONE) {
+    LIST_REMOVE(s, sl_link);
+    LIST_INSERT_HEAD(&c->c_full, s, sl_link);
+  }
+  c->c_nout++;
+  return s->sl_objs + i * c->c_size;
+}
+
+/* puts an object back on its slab; a slab left empty goes on the empty
+   list, or back to the page allocator if the cache has enough empty
+   slabs; the caller holds the cache's lock */
+static void cache_put(struct kmem_cache *c, void *obj)
+{
+  struct kmem_slab *s = obj_slab(obj);
+  uint32_t off, i;
+
+  assert(s->sl_cache == c);
+  off = (char *) obj - s->sl_objs;
+  i = off / c->c_size;
+  assert(off % c->c_size == 0 && i < c->c_perslab);
+
+  if (s->sl_free == KMEM_NONE) {
+    LIST_REMOVE(s, sl_link);
+    LIST_INSERT_HEAD(&c->c_partial, s, sl_link);
+  }
+  slab_next(s)[i] = s->sl_free;
+  s->sl_free = i;
+  s->sl_inuse--;
+  c->c_nout--;
+
+  if (s->sl_inuse == 0) {
+    LIST_REMOVE(s, sl_link);
+    if (c->c_nempty < KMEM_KEEP_EMPTY) {
+      LIST_INSERT_HEAD(&c->c_empty, s, sl_link);
+      c->c_nempty++;
+    } else
+      slab_destroy(c, s);
+  }
+}
+
+/* fills an empty CPU cache with up to KMEM_CPU_BATCH objects, making
+   slabs as needed; the caller has interrupts off */
+static void cpu_refill(struct kmem_cache *c, struct kmem_cpu *kc)
+{
+  struct kmem_slab *s;
+  void *obj;
+
+  spin_lock(&c->c_lock);
+  while (kc->kc_count < KMEM_CPU_BATCH) {
+    if ((obj = cache_get(c)) != 0) {
+      kc->kc_objs[kc->kc_count++] = obj;
+      continue;
+    }
+
+    /* the constructors run without the lock */
+    spin_unlock(&c->c_lock);
+    s = slab_create(c);
+    spin_lock(&c->c_lock);
+    if (!s)
+      break;
+    LIST_INSERT_HEAD(&c->c_empty, s, sl_link);
+    c->c_nempty++;
+    c->c_nslabs++;
+    c->c_ngrow++;
+  }
+  spin_unlock(&c->c_lock);
+}
+
+/* gives the 'n' least recently freed objects of a CPU cache back to
+   their slabs; the caller has interrupts off */
+static void cpu_drain(struct kmem_cache *c, struct kmem_cpu *kc, uint32_t n)
+{
+  uint32_t i;
+
+  spin_lock(&c->c_lock);
+  for (i = 0; i < n; i++)
+    cache_put(c, kc->kc_objs[i]);
+  spin_unlock(&c->c_lock);
+
+  memmove(kc->kc_objs, kc->kc_objs + n,
+          (kc->kc_count - n) * sizeof(kc->kc_objs[0]));
+  kc->kc_count -= n;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct kmem_cpu *kc;
+  uint32_t eflags;
+  void *obj = 0;
+
+  eflags = irq_save();
+  kc = &c->c_cpu[cpunum()];
+  kc->kc_nalloc++;
+  if (kc->kc_count == 0) {
+    kc->kc_nmiss++;
+    cpu_refill(c, kc);
+  }
+  if (kc->kc_count > 0)
+    obj = kc->kc_objs[--kc->kc_count];
+  irq_restore(eflags);
+  return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct kmem_cpu *kc;
+  uint32_t eflags;
+
+  eflags = irq_save();
+  kc = &c->c_cpu[cpunum()];
+  if (kc->kc_count == KMEM_CPU_SIZE)
+    cpu_drain(c, kc, KMEM_CPU_BATCH);
+  kc->kc_objs[kc->kc_count++] = obj;
+  kc->kc_nfree++;
+  irq_restore(eflags);
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+                                     size_t align, void (*ctor)(void *))
+{
+  struct kmem_cache *c;
+
+  if ((c = kmem_cache_alloc(&kmem_cache_cache)) == 0)
+    return 0;
+  if (cache_init(c, name, size, align, ctor) != 0) {
+    kmem_cache_free(&kmem_cache_cache, c);
+    return 0;
+  }
+  cache_add(c);
+  return c;
+}
+
+void *kmalloc(size_t size)
+{
+  struct page *pp;
+  int order;
+
+  if (size == 0)
+    size = 1;
+  if (size <= KMEM_MAX_SIZE)
+    return kmem_cache_alloc(kmalloc_caches[kmalloc_index[(size - 1) /
+                                                         KMEM_ALIGN]]);
+
+  for (order = 0; order < PAGE_NORDER && (PGSIZE << order) < size; order++)
+    ;
+  if (order == PAGE_NORDER || alloc_pages(order, &pp) != 0)
+    return 0;
+  return page2kva(pp);
+}
+
+void kfree(void *p)
+{
+  struct page *pp;
+
+  if (!p)
+    return;
+  pp = pa2page(PADDR(p));
+  if (pp->pp_flags & PP_SLAB) {
+    kmem_cache_free(obj_slab(p)->sl_cache, p);
+    return;
+  }
+  assert(((uintptr_t) p & (PGSIZE - 1)) == 0);
+  free_pages(pp, pp->pp_order);
+}
+
+uint32_t kmem_reap(void)
+{
+  struct kmem_cache *c;
+  struct kmem_slab *s;
+  struct kmem_cpu *kc;
+  uint32_t eflags, n = 0;
+
+  /* like c_lock, kmem_lock is only held with interrupts off */
+  eflags = irq_save();
+  spin_lock(&kmem_lock);
+  LIST_FOREACH(c, &kmem_caches, c_link) {
+    kc = &c->c_cpu[cpunum()];
+    if (kc->kc_count)
+      cpu_drain(c, kc, kc->kc_count);
+    spin_lock(&c->c_lock);
+    while ((s = LIST_FIRST(&c->c_empty)) != 0) {
+      LIST_REMOVE(s, sl_link);
+      slab_destroy(c, s);
+      n += 1 << c->c_order;
+    }
+    c->c_nempty = 0;
+    spin_unlock(&c->c_lock);
+  }
+  spin_unlock(&kmem_lock);
+  irq_restore(eflags);
+  return n;
+}
+
+/* the CPU caches of other CPUs are read without their owners stopping,
+   so their counts may be off; the caller has interrupts off */
+static void cache_stats(struct kmem_cache *c, struct kmem_stats *st)
+{
+  struct kmem_cpu *kc;
+  int i;
+
+  memset(st, 0, sizeof(*st));
+  st->ks_name = c->c_name;
+  st->ks_size = c->c_size;
+  st->ks_order = c->c_order;
+  st->ks_perslab = c->c_perslab;
+  for (i = 0; i < ncpu; i++) {
+    kc = &c->c_cpu[i];
+    st->ks_ncached += kc->kc_count;
+    st->ks_nalloc += kc->kc_nalloc;
+    st->ks_nfree += kc->kc_nfree;
+    st->ks_nmiss += kc->kc_nmiss;
+  }
+
+  spin_lock(&c->c_lock);
+  st->ks_nslabs = c->c_nslabs;
+  st->ks_nempty = c->c_nempty;
+  st->ks_ninuse = c->c_nout > st->ks_ncached ? c->c_nout - st->ks_ncached : 0;
+  st->ks_ngrow = c->c_ngrow;
+  st->ks_nreap = c->c_nreap;
+  spin_unlock(&c->c_lock);
+}
+
+int kmem_stats(int i, struct kmem_stats *st)
+{
+  struct kmem_cache *c;
+  uint32_t eflags;
+
+  eflags = irq_save();
+  spin_lock(&kmem_lock);
+  LIST_FOREACH(c, &kmem_caches, c_link)
+    if (i-- == 0)
+      break;
+  if (c)
+    cache_stats(c, st);
+  spin_unlock(&kmem_lock);
+  irq_restore(eflags);
+  return c ? 0 : -E_INVAL;
+}
+
+void kmem_init(void)
+{
+  uint32_t i, j;
+
+  if (cache_init(&kmem_cache_cache, "kmem_cache", sizeof(struct kmem_cache),
+                 0, 0) != 0)
+    panic("kmem_init: cannot make the cache of caches");
+  cache_add(&kmem_cache_cache);
+
+  for (i = 0, j = 0; i < NKMALLOC; i++) {
+    kmalloc_caches[i] = kmem_cache_create(kmalloc_sizes[i].name,
+                                          kmalloc_sizes[i].size, 0, 0);
+    if (!kmalloc_caches[i])
+      panic("kmem_init: cannot make %s", kmalloc_sizes[i].name);
+    for (; j * KMEM_ALIGN < kmalloc_sizes[i].size; j++)
+      kmalloc_index[j] = i;
+  }
+  check_kmem();
+}
+
+
+/* the C++ VM's operator new and delete, under the names the compiler
+   gives them for a 32-bit size_t, so that the VM links against the kernel
+   with no C++ runtime; there is no exception to throw, so new panics
+   rather than return 0 */
+void *_Znwj(size_t size);             /* operator new(size_t) */
+void *_Znaj(size_t size);             /* operator new[](size_t) */
+void _ZdlPv(void *p);                 /* operator delete(void *) */
+void _ZdaPv(void *p);                 /* operator delete[](void *) */
+void _ZdlPvj(void *p, size_t size);   /* the sized forms of C++14 */
+void _ZdaPvj(void *p, size_t size);
+
+void *_Znwj(size_t size)
+{
+  void *p;
+
+  if ((p = kmalloc(size)) == 0)
+    panic("operator new: out of memory for %u bytes", size);
+  return p;
+}
+
+void *_Znaj(size_t size)
+{
+  return _Znwj(size);
+}
+
+void _ZdlPv(void *p)
+{
+  kfree(p);
+}
+
+void _ZdaPv(void *p)
+{
+  kfree(p);
+}
+
+void _ZdlPvj(void *p, size_t size)
+{
+  kfree(p);
+}
+
+void _ZdaPvj(void *p, size_t size)
+{
+  kfree(p);
+}
+
+
+#define CHECK_NOBJS   200
+#define CHECK_MAGIC   0xC0DEC0DE
+
+static uint32_t check_nctor;
+
+static void check_ctor(void *obj)
+{
+  *(uint32_t *) obj = CHECK_MAGIC;
+  check_nctor++;
+}
+
+/* check the caches' objects, constructor caching and kmalloc() */
+static void check_kmem(void)
+{
+  struct kmem_cache *c;
+  struct kmem_stats st;
+  uint32_t *objs[CHECK_NOBJS], *o, i, n;
+  size_t size;
+  char *p, *q;
+
+  c = kmem_cache_create("check", 40, 16, check_ctor);
+  assert(c);
+  for (i = 0; i < CHECK_NOBJS; i++) {
+    objs[i] = kmem_cache_alloc(c);
+    assert(objs[i] && ((uintptr_t) objs[i] & 15) == 0);
+    assert(objs[i][0] == CHECK_MAGIC);
+    objs[i][1] = i;
+  }
+  for (i = 0; i < CHECK_NOBJS; i++)
+    assert(objs[i][1] == i);
+  cache_stats(c, &st);
+  assert(st.ks_ninuse == CHECK_NOBJS);
+  assert(check_nctor == st.ks_ngrow * st.ks_perslab);
+
+  /* a freed object comes back as it was left, with no constructor run */
+  n = check_nctor;
+  for (i = 0; i < CHECK_NOBJS; i++)
+    kmem_cache_free(c, objs[i]);
+  o = kmem_cache_alloc(c);
+  assert(o == objs[CHECK_NOBJS - 1] && o[1] == CHECK_NOBJS - 1);
+  assert(check_nctor == n);
+  kmem_cache_free(c, o);
+
+  /* nothing is in use, so reaping leaves the cache no slabs */
+  kmem_reap();
+  cache_stats(c, &st);
+  assert(st.ks_ninuse == 0 && st.ks_ncached == 0 && st.ks_nslabs == 0);
+
+  /* each size has room for itself, apart from another of its size */
+  for (size = 1; size <= 3 * PGSIZE; size += size / 4 + 1) {
+    p = kmalloc(size);
+    q = kmalloc(size);
+    assert(p && q && p != q);
+    assert(((uintptr_t) p & (KMEM_ALIGN - 1)) == 0);
+    memset(p, 0xA5, size);
+    memset(q, 0x5A, size);
+    assert(p[0] == (char) 0xA5 && p[size - 1] == (char) 0xA5);
+    kfree(p);
+    kfree(q);
+  }
+  kmem_reap();
+
+  cprintf("check_kmem() succeeded!\n");
+}
@@ -0,0 +1,272 @@
+/**
+ * @file lapic.c
+ * @desc the local APIC manages internal (non-I/O) interrupts; see Chapter
+ *       10 of the Intel SDM, vol. 3A
+ */
+#include <x86.h>
+#include <mmu.h>
+#include <trap.h>
+#include <assert.h>
+#include <kern/cpu.h>
+#include <kern/pmap.h>
+
+/* local APIC registers, divided by 4 for use as uint32_t[] indices */
+#define ID      (0x0020/4)   /* ID */
+#define VER     (0x0030/4)   /* version */
+#define TPR     (0x0080/4)   /* task priority */
+#define EOI     (0x00B0/4)   /* EOI */
+#define SVR     (0x00F0/4)   /* spurious interrupt vector */
+#define   ENABLE     0x00000100   /* unit enable */
+#define ESR     (0x0280/4)   /* error status */
+#define ICRLO   (0x0300/4)   /* interrupt command */
+#define   INIT       0x00000500   /* INIT/RESET */
+#define   STARTUP    0x00000600   /* startup IPI */
+#define   DELIVS     0x00001000   /* delivery status */
+#define   ASSERT     0x00004000   /* assert interrupt (vs deassert) */
+#define   DEASSERT   0x00000000
+#define   LEVEL      0x00008000   /* level triggered */
+#define   BCAST      0x00080000   /* send to all APICs, including self */
+#define   OTHERS     0x000C0000   /* send to all APICs, excluding self */
+#define   FIXED      0x00000000
+#define ICRHI   (0x0310/4)   /* interrupt command [63:32] */
+#define TIMER   (0x0320/4)   /* local vector table 0 (TIMER) */
+#define   X1         0x0000000B   /* divide counts by 1 */
+#define   PERIODIC   0x00020000   /* periodic */
+#define PCINT   (0x0340/4)   /* performance counter LVT */
+#define LINT0   (0x0350/4)   /* local vector table 1 (LINT0) */
+#define LINT1   (0x0360/4)   /* local vector table 2 (LINT1) */
+#define ERROR   (0x0370/4)   /* local vector table 3 (ERROR) */
+#define   MASKED     0x00010000   /* interrupt masked */
+#define TICR    (0x0380/4)   /* timer initial count */
+#define TCCR    (0x0390/4)   /* timer current count */
+#define TDCR    (0x03E0/4)   /* timer divide configuration */
+
+/* 8253/8254 programmable interval timer; channel 2 is gated through the
+   speaker port, and its output can be read back there, which makes it
+   usable as a stopwatch without taking an interrupt */
+#define PIT_FREQ      1193182
+#define PIT_CH2       0x42
+#define PIT_MODE      0x43
+#define PIT_SPKR      0x61
+#define   SPKR_GATE2  0x01
+#define   SPKR_ON     0x02
+#define   SPKR_OUT2   0x20
+
+/* CMOS shutdown code and warm reset vector, used by the universal startup
+   algorithm on processors that still honor them */
+#define IO_RTC        0x70
+#define WRV_PADDR     0x467
+
+physaddr_t lapicaddr;        /* initialized in mpconfig.c */
+volatile uint32_t *lapic;
+
+/* set by lapic_timer_calibrate() */
+uint32_t lapic_ticks_per_ms;
+uint32_t tsc_per_ms;
+
+static void lapicw(int index, int value)
+{
+  lapic[index] = value;
+  lapic[ID];                 /* wait for write to finish, by reading */
+}
+
+void lapic_init(void)
+{
+  if (!lapicaddr)
+    return;
+
+  /* lapicaddr is the physical address of the LAPIC's 4K MMIO region;
+     map it in to virtual memory so we can access it */
+  if (!lapic)
+    lapic = mmio_map_region(lapicaddr, 4096);
+
+  /* enable local APIC; set spurious interrupt vector */
+  lapicw(SVR, ENABLE | (IRQ_OFFSET + IRQ_SPURIOUS));
+
+  /* the timer stays masked until the scheduler arms it one-shot; see
+     lapic_timer_oneshot() */
+  lapicw(TDCR, X1);
+  lapicw(TIMER, MASKED | (IRQ_OFFSET + IRQ_TIMER));
+  lapicw(TICR, 0);
+
+  /* leave LINT0 of the BSP enabled so that it can get interrupts from the
+     8259A chip; on the APs, mask them */
+  if (thiscpu != bootcpu)
+    lapicw(LINT0, MASKED);
+  lapicw(LINT1, MASKED);
+
+  /* disable performance counter overflow interrupts on machines that
+     provide that interrupt entry */
+  if (((lapic[VER] >> 16) & 0xFF) >= 4)
+    lapicw(PCINT, MASKED);
+
+  /* map error interrupt to IRQ_ERROR */
+  lapicw(ERROR, IRQ_OFFSET + IRQ_ERROR);
+
+  /* clear error status register (requires back-to-back writes) */
+  lapicw(ESR, 0);
+  lapicw(ESR, 0);
+
+  /* ack any outstanding interrupts */
+  lapicw(EOI, 0);
+
+  /* send an Init Level De-Assert to synchronize arbitration ID's */
+  lapicw(ICRHI, 0);
+  lapicw(ICRLO, BCAST | INIT | LEVEL);
+  while (lapic[ICRLO] & DELIVS)
+    ;
+
+  /* enable interrupts on the APIC (but not on the processor) */
+  lapicw(TPR, 0);
+}
+
+/* measure the LAPIC timer and TSC frequencies against 10ms of PIT
+   channel 2; the LAPIC timer runs at the bus clock, which differs from
+   machine to machine, so it cannot be programmed in real time units
+   without this; called once on the BSP, the APs share the result */
+#define CALIBRATE_MS  10
+
+void lapic_timer_calibrate(void)
+{
+  uint32_t count = PIT_FREQ * CALIBRATE_MS / 1000;
+  uint32_t ticks;
+  uint64_t tsc;
+  uint8_t v;
+
+  if (!lapic)
+    return;
+
+  /* gate channel 2 on, speaker off; mode 0 (interrupt on terminal count)
+     raises OUT2 when the count runs out */
+  v = inb(PIT_SPKR) & ~(SPKR_ON | SPKR_GATE2);
+  outb(PIT_SPKR, v);
+  outb(PIT_MODE, 0xB0);      /* channel 2, lobyte/hibyte, mode 0 */
+  outb(PIT_CH2, count & 0xFF);
+  outb(PIT_CH2, count >> 8);
+
+  lapicw(TDCR, X1);
+  lapicw(TIMER, MASKED | (IRQ_OFFSET + IRQ_TIMER));
+
+  /* raising the gate starts the count */
+  outb(PIT_SPKR, v | SPKR_GATE2);
+  lapicw(TICR, 0xFFFFFFFF);
+  tsc = read_tsc();
+  while (!(inb(PIT_SPKR) & SPKR_OUT2))
+    ;
+  ticks = 0xFFFFFFFF - lapic[TCCR];
+  tsc = read_tsc() - tsc;
+  lapicw(TICR, 0);
+  outb(PIT_SPKR, v);
+
+  lapic_ticks_per_ms = ticks / CALIBRATE_MS;
+  tsc_per_ms = (uint32_t) tsc / CALIBRATE_MS;
+  cprintf("lapic timer: %u ticks/ms, tsc: %u cycles/ms\n",
+          lapic_ticks_per_ms, tsc_per_ms);
+}
+
+/* raise a single timer interrupt on this CPU 'us' microseconds from now;
+   replaces any pending one */
+void lapic_timer_oneshot(uint32_t us)
+{
+  uint32_t ticks;
+
+  if (!lapic || !lapic_ticks_per_ms)
+    return;
+  ticks = (us / 1000) * lapic_ticks_per_ms +
+          (us % 1000) * lapic_ticks_per_ms / 1000;
+  lapicw(TIMER, IRQ_OFFSET + IRQ_TIMER);
+  lapicw(TICR, ticks ? ticks : 1);
+}
+
+/* cancel this CPU's pending timer interrupt, if any */
+void lapic_timer_stop(void)
+{
+  if (!lapic)
+    return;
+  lapicw(TIMER, MASKED | (IRQ_OFFSET + IRQ_TIMER));
+  lapicw(TICR, 0);
+}
+
+/* index of the calling CPU in cpus[]; APIC ids need not be dense, so the
+   id is looked up rather than used as the index */
+int cpunum(void)
+{
+  uint8_t id;
+  int i;
+
+  if (!lapic)
+    return 0;
+  id = lapic[ID] >> 24;
+  for (i = 0; i < ncpu; i++)
+    if (cpus[i].cpu_apicid == id)
+      return i;
+  return 0;
+}
+
+/* acknowledge interrupt */
+void lapic_eoi(void)
+{
+  if (lapic)
+    lapicw(EOI, 0);
+}
+
+/* spin for a given number of microseconds; a read of port 0x84 takes
+   about a microsecond on any PC, which is accurate enough for the AP
+   startup sequence */
+void microdelay(int us)
+{
+  while (us-- > 0)
+    inb(0x84);
+}
+
+/* start additional processor running entry code at addr; see Appendix B
+   of the MultiProcessor Specification */
+void lapic_startap(uint8_t apicid, uint32_t addr)
+{
+  uint16_t *wrv;
+  int i;
+
+  /* "the BSP must initialize CMOS shutdown code to 0AH and the warm reset
+     vector (DWORD based at 40:67) to point at the AP startup code prior
+     to the [universal startup algorithm]" */
+  outb(IO_RTC, 0xF);                        /* offset 0xF is shutdown code */
+  outb(IO_RTC+1, 0x0A);
+  wrv = (uint16_t *) KADDR(WRV_PADDR);
+  wrv[0] = 0;
+  wrv[1] = addr >> 4;
+
+  /* "universal startup algorithm"; send INIT (level-triggered) interrupt
+     to reset other CPU */
+  lapicw(ICRHI, apicid << 24);
+  lapicw(ICRLO, INIT | LEVEL | ASSERT);
+  microdelay(200);
+  lapicw(ICRLO, INIT | LEVEL);
+  microdelay(10000);
+
+  /* send startup IPI (twice!) to enter code; regular hardware is supposed
+     to only accept a STARTUP when it is in the halted state due to an
+     INIT, so the second should be ignored, but it is part of the
+     official Intel algorithm */
+  for (i = 0; i < 2; i++) {
+    lapicw(ICRHI, apicid << 24);
+    lapicw(ICRLO, STARTUP | (addr >> 12));
+    microdelay(200);
+  }
+}
+
+/* send an IPI with the given vector to all other CPUs */
+void lapic_ipi(int vector)
+{
+  lapicw(ICRLO, OTHERS | FIXED | vector);
+  while (lapic[ICRLO] & DELIVS)
+    ;
+}
+
+/* send an IPI with the given vector to one CPU */
+void lapic_ipi_one(uint8_t apicid, int vector)
+{
+  lapicw(ICRHI, apicid << 24);
+  lapicw(ICRLO, FIXED | vector);
+  while (lapic[ICRLO] & DELIVS)
+    ;
+}
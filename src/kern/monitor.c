@@ -11,6 +11,12 @@
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/cpu.h>
+#include <kern/sched.h>
+#include <kern/codecache.h>
+#include <kern/pmap.h>
+#include <kern/kmalloc.h>
+#include <kern/tlb.h>
 
 #define CMDBUF_SIZE	80	        /* enough for one VGA text line */
 
@@ -25,6 +31,12 @@ struct command {
 static struct command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
+	{ "cpus", "Display the processors and their state", mon_cpus },
+	{ "threads", "Display kernel threads and scheduler statistics", mon_threads },
+	{ "codecache", "Display code cache occupancy and fragmentation", mon_codecache },
+	{ "pages", "Display free physical memory by block size", mon_pages },
+	{ "kmem", "Display kernel object caches", mon_kmem },
+	{ "bench", "Run a benchmark; with no argument, list them", mon_bench },
 };
 
 #define NCOMMANDS (sizeof(commands)/sizeof(commands[0]))
@@ -74,6 +86,173 @@ int mon_backtrace(int argc, char **argv, struct trapframe *tf)
 	return 0;
 }
 
+int mon_cpus(int argc, char **argv, struct trapframe *tf)
+{
+	static const char *status[] = { "unused", "started", "halted" };
+	struct tlb_stats ts;
+	int i;
+
+	cprintf("%d CPU(s); LAPIC at %08llx, IOAPIC at %08llx\n",
+          ncpu, lapicaddr, ioapicaddr);
+	for (i = 0; i < ncpu; i++)
+		cprintf("  cpu %d: apic id %d, %s, kstack top %08x%s%s\n",
+            cpus[i].cpu_id, cpus[i].cpu_apicid,
+            cpus[i].cpu_status <= CPU_HALTED ? status[cpus[i].cpu_status] : "?",
+            percpu_kstacktop(i), &cpus[i] == bootcpu ? " (BSP)" : "",
+            i == cpunum() ? " (this cpu)" : "");
+	tlb_stats(&ts);
+	cprintf("TLB flushes: %u, %u of them whole, %u pages; %u shootdown IPIs\n",
+          ts.ts_nflush, ts.ts_nall, ts.ts_npages, ts.ts_nipi);
+	return 0;
+}
+
+int mon_threads(int argc, char **argv, struct trapframe *tf)
+{
+	static const char *state[] = { "free", "runnable", "running", "zombie",
+	                              "parked" };
+	struct kthread *t;
+	int i;
+
+	cprintf("id name            state     cpu       runs  preempts  Mcycles\n");
+	for (i = 0; i < NKTHREAD; i++) {
+		t = &kthreads[i];
+		if (t->kt_state == KT_FREE)
+			continue;
+		cprintf("%2d %-15s %-9s %3d %10u %9u %8u\n", t->kt_id, t->kt_name,
+            state[t->kt_state], t->kt_cpu, t->kt_nruns, t->kt_npreempt,
+            (uint32_t) (t->kt_cycles >> 20));
+	}
+	cprintf("%u thread(s) waiting for a CPU; time slice %dus\n",
+          sched_nrunnable(), SCHED_SLICE_US);
+	for (i = 0; i < ncpu; i++)
+		cprintf("  cpu %d: %s, went idle %u times, %u Mcycles halted\n", i,
+            cpus[i].cpu_thread ? cpus[i].cpu_thread->kt_name : "idle",
+            cpus[i].cpu_nidle, (uint32_t) (cpus[i].cpu_idle_cycles >> 20));
+	return 0;
+}
+
+/* fragmentation is the share of free space outside the largest free
+   block; segments are a few MB, so the products fit in 32 bits.
+   "codecache sweep" sweeps first */
+int mon_codecache(int argc, char **argv, struct trapframe *tf)
+{
+	struct cc_stats st;
+	uint32_t frag;
+	int i;
+
+	if (argc > 1 && strcmp(argv[1], "sweep") == 0)
+		cprintf("swept %uKB\n", cc_sweep() / 1024);
+	cprintf("segment       size  mapped    used  zombie    free  largest  frag\n");
+	for (i = 0; i < CC_NSEG; i++) {
+		cc_stats(i, &st);
+		frag = st.cs_free ? 100 - st.cs_largest * 100 / st.cs_free : 0;
+		cprintf("%-10s %6uK %6uK %6uK %6uK %6uK %7uK %4u%%\n", st.cs_name,
+            st.cs_size / 1024, st.cs_mapped / 1024, st.cs_used / 1024,
+            st.cs_zombie / 1024, st.cs_free / 1024, st.cs_largest / 1024,
+            frag);
+		cprintf("           %u blocks used, %u retired, %u free below the break\n",
+            st.cs_nused, st.cs_nzombie, st.cs_nfree);
+	}
+	return 0;
+}
+
+/* for each order, how much free memory is in blocks too small for a
+   request of that order: 0% means any free page could be part of such a
+   request, 100% that none can */
+int mon_pages(int argc, char **argv, struct trapframe *tf)
+{
+	struct page_stats st;
+	struct heap_stats hs;
+	struct page_magazine *m;
+	size_t below;
+	int i;
+
+	page_stats(&st);
+	cprintf("order   size   blocks    pages  unusable\n");
+	below = 0;
+	for (i = 0; i < PAGE_NORDER; i++) {
+		cprintf("%5d %5uK %8u %8u %8u%%\n", i, (PGSIZE << i) / 1024,
+            st.ps_nblocks[i], st.ps_nblocks[i] << i,
+            st.ps_nfree ? below * 100 / st.ps_nfree : 0);
+		below += st.ps_nblocks[i] << i;
+	}
+	cprintf("%uKB free of %uKB, and %uKB in CPU magazines\n",
+          st.ps_nfree * PGSIZE / 1024, npage * PGSIZE / 1024,
+          st.ps_ncached * PGSIZE / 1024);
+	if (page_ncolor > 1)
+		cprintf("%u cache colors; %uKB free sorted by color\n", page_ncolor,
+            st.ps_ncolored * PGSIZE / 1024);
+	if (st.ps_nhigh)
+		cprintf("%uKB free past the KERNBASE map, for the heap\n",
+            st.ps_nhigh * PGSIZE / 1024);
+	cprintf("%uKB cleared ahead; %u cleared allocations from there, %u not, "
+          "%u pages cleared when idle\n", st.ps_nzero * PGSIZE / 1024,
+          st.ps_zero_nhit, st.ps_zero_nmiss, st.ps_zero_nfill);
+	heap_stats(&hs);
+	cprintf("heap reservations: %uKB, %uKB committed; %u faults, %u pages "
+          "decommitted\n", hs.hs_nreserved * PGSIZE / 1024,
+          hs.hs_ncommitted * PGSIZE / 1024, hs.hs_nfault, hs.hs_ndecommit);
+	cprintf("shared heap pages: %u mapped again, %u copied on a write\n",
+          hs.hs_nshared, hs.hs_ncopy);
+	for (i = 0; i < ncpu; i++) {
+		m = &cpus[i].cpu_pages;
+		cprintf("  cpu %d: %2u pages, %u allocs %u frees, %u refills %u drains\n",
+            i, m->pm_count, m->pm_nalloc, m->pm_nfree, m->pm_nrefill,
+            m->pm_ndrain);
+	}
+	return 0;
+}
+
+int mon_kmem(int argc, char **argv, struct trapframe *tf)
+{
+	struct kmem_stats st;
+	uint32_t total = 0;
+	int i;
+
+	if (argc > 1 && strcmp(argv[1], "reap") == 0)
+		cprintf("%u pages reaped\n", kmem_reap());
+	cprintf("cache          size slab  inuse cached  slabs empty  allocs"
+          "   miss  grow  reap\n");
+	for (i = 0; kmem_stats(i, &st) == 0; i++) {
+		cprintf("%-14s %4u %3uK %6u %6u %6u %5u %7u %6u %5u %5u\n",
+            st.ks_name, st.ks_size, (PGSIZE << st.ks_order) / 1024,
+            st.ks_ninuse, st.ks_ncached, st.ks_nslabs, st.ks_nempty,
+            st.ks_nalloc, st.ks_nmiss, st.ks_ngrow, st.ks_nreap);
+		total += st.ks_nslabs << st.ks_order;
+	}
+	cprintf("%uKB in slabs\n", total * PGSIZE / 1024);
+	return 0;
+}
+
+/* benchmarks; they are too slow, or disturb the machine too much, to
+   run at every boot */
+static struct {
+	const char *name;
+	const char *desc;
+	void (*func)(void);
+} benches[] = {
+	{ "churn", "Page allocation from every CPU at once", bench_page_churn },
+	{ "large", "A heap sweep through 4KB and through 2MB pages", bench_large_pages },
+	{ "color", "A semispace scan and copy, with pages of each coloring", bench_page_coloring },
+	{ "zero", "Cleared pages from the pool and cleared on the spot", bench_zero_pool },
+};
+
+#define NBENCHES (sizeof(benches)/sizeof(benches[0]))
+
+int mon_bench(int argc, char **argv, struct trapframe *tf)
+{
+	int i;
+
+	for (i = 0; argc > 1 && i < NBENCHES; i++)
+		if (strcmp(argv[1], benches[i].name) == 0) {
+			benches[i].func();
+			return 0;
+		}
+	for (i = 0; i < NBENCHES; i++)
+		cprintf("bench %-8s - %s\n", benches[i].name, benches[i].desc);
+	return 0;
+}
+
 /* kernel monitor command interpreter */
 #define WHITESPACE "\t\r\n "
 #define MAXARGS 16
@@ -0,0 +1,366 @@
+/**
+ * @file mpconfig.c
+ * @desc discover the processors and APICs of the machine; the ACPI MADT
+ *       is tried first, and the (older) Intel MultiProcessor Specification
+ *       tables are the fallback
+ */
+#include <types.h>
+#include <string.h>
+#include <mmu.h>
+#include <x86.h>
+#include <assert.h>
+#include <kern/cpu.h>
+#include <kern/pmap.h>
+
+struct cpuinfo cpus[NCPU];
+struct cpuinfo *bootcpu;
+int ncpu;
+physaddr_t ioapicaddr;
+
+/* per-CPU kernel stacks */
+unsigned char percpu_kstacks[NCPU][KSTKSIZE]
+__attribute__ ((aligned(PGSIZE)));
+
+
+/* MP floating pointer structure; see the MultiProcessor Specification */
+struct mp {
+  uint8_t signature[4];           /* "_MP_" */
+  uint32_t physaddr;              /* phys addr of MP config table */
+  uint8_t length;                 /* 1 */
+  uint8_t specrev;                /* [14] */
+  uint8_t checksum;               /* all bytes must add up to 0 */
+  uint8_t type;                   /* MP system config type */
+  uint8_t imcrp;
+  uint8_t reserved[3];
+} __attribute__((__packed__));
+
+/* MP configuration table header */
+struct mpconf {
+  uint8_t signature[4];           /* "PCMP" */
+  uint16_t length;                /* total table length */
+  uint8_t version;                /* [14] */
+  uint8_t checksum;               /* all bytes must add up to 0 */
+  uint8_t product[20];            /* product id */
+  uint32_t oemtable;              /* OEM table pointer */
+  uint16_t oemlength;             /* OEM table length */
+  uint16_t entry;                 /* entry count */
+  uint32_t lapicaddr;             /* address of local APIC */
+  uint16_t xlength;               /* extended table length */
+  uint8_t xchecksum;              /* extended table checksum */
+  uint8_t reserved;
+  uint8_t entries[0];             /* table entries */
+} __attribute__((__packed__));
+
+struct mpproc {
+  uint8_t type;                   /* entry type (0) */
+  uint8_t apicid;                 /* local APIC id */
+  uint8_t version;                /* local APIC version */
+  uint8_t flags;                  /* CPU flags */
+  uint8_t signature[4];           /* CPU signature */
+  uint32_t feature;               /* feature flags from CPUID instruction */
+  uint8_t reserved[8];
+} __attribute__((__packed__));
+
+struct mpioapic {
+  uint8_t type;                   /* entry type (2) */
+  uint8_t apicno;                 /* I/O APIC id */
+  uint8_t version;                /* I/O APIC version */
+  uint8_t flags;                  /* I/O APIC flags */
+  uint32_t addr;                  /* I/O APIC address */
+} __attribute__((__packed__));
+
+/* mpproc flags */
+#define MPPROC_ENABLED  0x01      /* this processor is usable */
+#define MPPROC_BOOT     0x02      /* this proc is the bootstrap processor */
+
+/* table entry types */
+#define MPPROC    0x00            /* one per processor */
+#define MPBUS     0x01            /* one per bus */
+#define MPIOAPIC  0x02            /* one per I/O APIC */
+#define MPIOINTR  0x03            /* one per bus interrupt source */
+#define MPLINTR   0x04            /* one per system interrupt source */
+
+
+/* ACPI root system description pointer; see the ACPI specification,
+   section 5.2.5 */
+struct acpi_rsdp {
+  uint8_t signature[8];           /* "RSD PTR " */
+  uint8_t checksum;               /* first 20 bytes must add up to 0 */
+  uint8_t oemid[6];
+  uint8_t revision;
+  uint32_t rsdtaddr;              /* phys addr of the RSDT */
+} __attribute__((__packed__));
+
+/* header common to all ACPI system description tables */
+struct acpi_header {
+  uint8_t signature[4];
+  uint32_t length;                /* including this header */
+  uint8_t revision;
+  uint8_t checksum;               /* all bytes must add up to 0 */
+  uint8_t oemid[6];
+  uint8_t oemtableid[8];
+  uint32_t oemrevision;
+  uint32_t creatorid;
+  uint32_t creatorrevision;
+} __attribute__((__packed__));
+
+/* multiple APIC description table ("APIC") */
+struct acpi_madt {
+  struct acpi_header header;
+  uint32_t lapicaddr;             /* address of local APIC */
+  uint32_t flags;
+  uint8_t entries[0];             /* interrupt controller structures */
+} __attribute__((__packed__));
+
+/* MADT entry types */
+#define MADT_LAPIC      0x00
+#define MADT_IOAPIC     0x01
+#define MADT_LAPICADDR  0x05
+
+/* MADT local APIC entry flags */
+#define MADT_LAPIC_ENABLED 0x01
+
+
+static uint8_t sum(void *addr, int len)
+{
+  int i, sum;
+
+  sum = 0;
+  for (i = 0; i < len; i++)
+    sum += ((uint8_t *) addr)[i];
+  return sum;
+}
+
+/* kernel virtual address of physical address 'pa'; firmware tables may
+   live above the memory we manage (e.g. the ACPI tables at the top of
+   RAM), so unlike KADDR this only requires 'pa' to be in the KERNBASE
+   window; returns 0 if it is not */
+static void *fw_kaddr(physaddr_t pa, uint32_t len)
+{
+  if (pa + len < pa || pa + len > (physaddr_t) -KERNBASE)
+    return 0;
+  return (void *) (uintptr_t) (pa + KERNBASE);
+}
+
+/* look for a structure with the 'sig' signature, aligned on 16 bytes, in
+   the 'len' bytes at physical address 'a' */
+static void *fw_search1(physaddr_t a, int len, const char *sig, int siglen,
+                        int sumlen)
+{
+  uint8_t *p, *e;
+
+  p = fw_kaddr(a, len);
+  if (!p)
+    return 0;
+  for (e = p + len; p + sumlen <= e; p += 16)
+    if (memcmp(p, sig, siglen) == 0 && sum(p, sumlen) == 0)
+      return p;
+  return 0;
+}
+
+/* search the places firmware puts its root pointers in, in order:
+   1) in the first KB of the EBDA;
+   2) if there is no EBDA, in the last KB of system base memory;
+   3) in the BIOS ROM between 0xE0000 and 0xFFFFF */
+static void *fw_search(const char *sig, int siglen, int sumlen)
+{
+  uint8_t *bda;
+  uint32_t p;
+  void *r;
+
+  static_assert(sizeof(struct mp) == 16);
+
+  /* the BIOS data area lives in 16-bit segment 0x40 */
+  bda = (uint8_t *) KADDR(0x40 << 4);
+
+  /* [MP 4] the 16-bit segment of the EBDA is in the two bytes starting at
+     byte 0x0E of the BDA; 0 if not present */
+  if ((p = *(uint16_t *) (bda + 0x0E))) {
+    p <<= 4;                      /* translate from segment to PA */
+    if ((r = fw_search1(p, 1024, sig, siglen, sumlen)))
+      return r;
+  } else {
+    /* the size of base memory, in KB is in the two bytes starting at
+       0x13 of the BDA */
+    p = *(uint16_t *) (bda + 0x13) * 1024;
+    if ((r = fw_search1(p - 1024, 1024, sig, siglen, sumlen)))
+      return r;
+  }
+  return fw_search1(0xE0000, 0x20000, sig, siglen, sumlen);
+}
+
+/* add a processor; returns its cpuinfo, or 0 if there are too many */
+static struct cpuinfo *add_cpu(uint8_t apicid)
+{
+  struct cpuinfo *c;
+
+  if (ncpu >= NCPU) {
+    cprintf("SMP: too many CPUs, CPU %d disabled\n", apicid);
+    return 0;
+  }
+  c = &cpus[ncpu];
+  c->cpu_id = ncpu;
+  c->cpu_apicid = apicid;
+  ncpu++;
+  return c;
+}
+
+/* parse the ACPI MADT; returns 0 if there is none */
+static int madt_init(void)
+{
+  struct acpi_rsdp *rsdp;
+  struct acpi_header *rsdt, *h;
+  struct acpi_madt *madt;
+  uint32_t *tables;
+  uint8_t *p, *e;
+  struct cpuinfo *c;
+  int i, n;
+
+  if ((rsdp = fw_search("RSD PTR ", 8, 20)) == 0)
+    return 0;
+  rsdt = fw_kaddr(rsdp->rsdtaddr, sizeof(*rsdt));
+  if (!rsdt || memcmp(rsdt->signature, "RSDT", 4) != 0 ||
+      !fw_kaddr(rsdp->rsdtaddr, rsdt->length) || sum(rsdt, rsdt->length))
+    return 0;
+
+  /* the RSDT is followed by the physical addresses of the other tables */
+  madt = 0;
+  tables = (uint32_t *) (rsdt + 1);
+  n = (rsdt->length - sizeof(*rsdt)) / 4;
+  for (i = 0; i < n && !madt; i++) {
+    h = fw_kaddr(tables[i], sizeof(*h));
+    if (h && memcmp(h->signature, "APIC", 4) == 0 &&
+        fw_kaddr(tables[i], h->length) && sum(h, h->length) == 0)
+      madt = (struct acpi_madt *) h;
+  }
+  if (!madt)
+    return 0;
+
+  lapicaddr = madt->lapicaddr;
+  p = madt->entries;
+  e = (uint8_t *) madt + madt->header.length;
+  for (; p + 2 <= e && p[1] >= 2; p += p[1]) {
+    switch (p[0]) {
+    case MADT_LAPIC:
+      /* p[2] is the ACPI processor id, p[3] the APIC id; ACPI asks that
+         the BSP be listed first */
+      if (!(*(uint32_t *) (p + 4) & MADT_LAPIC_ENABLED))
+        break;
+      if ((c = add_cpu(p[3])) && !bootcpu)
+        bootcpu = c;
+      break;
+    case MADT_IOAPIC:
+      if (!ioapicaddr)
+        ioapicaddr = *(uint32_t *) (p + 4);
+      break;
+    case MADT_LAPICADDR:
+      /* a 64-bit override */
+      lapicaddr = *(uint64_t *) (p + 4);
+      break;
+    default:
+      break;
+    }
+  }
+  return ncpu > 0;
+}
+
+/* parse the MP configuration table; returns 0 if there is none; see the
+   MultiProcessor Specification, version 1.4 */
+static int mpconfig_init(void)
+{
+  struct mp *mp;
+  struct mpconf *conf;
+  struct mpproc *proc;
+  struct cpuinfo *c;
+  uint8_t *p;
+  int i;
+
+  if ((mp = fw_search("_MP_", 4, sizeof(struct mp))) == 0)
+    return 0;
+  if (mp->physaddr == 0 || mp->type != 0) {
+    cprintf("SMP: default configurations not implemented\n");
+    return 0;
+  }
+  conf = fw_kaddr(mp->physaddr, sizeof(*conf));
+  if (!conf || memcmp(conf, "PCMP", 4) != 0) {
+    cprintf("SMP: incorrect MP configuration table signature\n");
+    return 0;
+  }
+  if (!fw_kaddr(mp->physaddr, conf->length) || sum(conf, conf->length) != 0) {
+    cprintf("SMP: bad MP configuration checksum\n");
+    return 0;
+  }
+  if (conf->version != 1 && conf->version != 4) {
+    cprintf("SMP: unsupported MP version %d\n", conf->version);
+    return 0;
+  }
+
+  lapicaddr = conf->lapicaddr;
+  p = conf->entries;
+  for (i = 0; i < conf->entry; i++) {
+    switch (*p) {
+    case MPPROC:
+      proc = (struct mpproc *) p;
+      if ((proc->flags & MPPROC_ENABLED) && (c = add_cpu(proc->apicid)) &&
+          (proc->flags & MPPROC_BOOT))
+        bootcpu = c;
+      p += sizeof(struct mpproc);
+      continue;
+    case MPIOAPIC:
+      if (!ioapicaddr)
+        ioapicaddr = ((struct mpioapic *) p)->addr;
+      p += 8;
+      continue;
+    case MPBUS:
+    case MPIOINTR:
+    case MPLINTR:
+      p += 8;
+      continue;
+    default:
+      cprintf("SMP: unknown config type %x\n", *p);
+      ncpu = 0;
+      return 0;
+    }
+  }
+
+  if (mp->imcrp) {
+    /* [MP 3.2.6.1] if the hardware implements PIC mode, switch to getting
+       interrupts from the LAPIC */
+    cprintf("SMP: setting IMCR to switch from PIC mode to symmetric I/O mode\n");
+    outb(0x22, 0x70);             /* select IMCR */
+    outb(0x23, inb(0x23) | 1);    /* mask external interrupts */
+  }
+  return ncpu > 0;
+}
+
+void mp_init(void)
+{
+  const char *src;
+
+  if (madt_init())
+    src = "ACPI MADT";
+  else {
+    ncpu = 0;
+    bootcpu = 0;
+    lapicaddr = ioapicaddr = 0;
+    if (mpconfig_init())
+      src = "MP table";
+    else
+      src = 0;
+  }
+
+  if (!src || !bootcpu) {
+    /* didn't like what we found; fall back to no MP */
+    ncpu = 1;
+    lapicaddr = 0;
+    bootcpu = &cpus[0];
+    bootcpu->cpu_id = 0;
+    bootcpu->cpu_status = CPU_STARTED;
+    cprintf("SMP: configuration not found, SMP disabled\n");
+    return;
+  }
+
+  bootcpu->cpu_status = CPU_STARTED;
+  cprintf("SMP: %d CPU(s) from %s, BSP is CPU %d (APIC id %d)\n",
+          ncpu, src, bootcpu->cpu_id, bootcpu->cpu_apicid);
+}
@@ -7,8 +7,13 @@
 #include <error.h>
 #include <string.h>
 #include <assert.h>
+#include <e820.h>
 #include <kern/pmap.h>
 #include <kern/kclock.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+#include <kern/sched.h>
+#include <kern/tlb.h>
 
 #ifdef DEBUG
 #define PRINTMEM(a, b)                                                  \
@@ -24,15 +29,76 @@
 /* variables set by i386_detect_memory() */
 static physaddr_t maxpa;    /* maximum physical address */
 size_t npage;               /* amount of physical memory (in pages) */
+size_t nlowpage;            /* of them, the pages the KERNBASE map reaches */
 static size_t basemem;      /* amount of base memory (in bytes) */
 static size_t extmem;       /* amount of extended memory (in bytes) */
 
+/* the usable memory below PHYSLIM, as ranges of whole pages; page_init()
+   frees the pages in them and no others, so the holes stay in use */
+struct mem_range {
+  physaddr_t mr_start;
+  physaddr_t mr_end;
+};
+static struct mem_range mem_ranges[E820_MAX];
+static int nmem_ranges;
+static uint64_t mem_unused;  /* usable memory the BIOS reports past PHYSLIM */
+
 /* variables set in i386_vm_init() */
 pde_t *boot_pgdir;          /* virtual address of boot time page directory */
-physaddr_t boot_cr3;        /* physical address of boot time page directory */
+uint32_t boot_cr3;          /* physical address of its pointer table */
+uint32_t boot_cr4 = CR4_PAE; /* CR4 flags the page directory needs */
 static char *boot_freemem;  /* pointer to next byte of free mem */
 struct page *pages;         /* virtual address of physical page array */
-static struct pagelist page_free_list;   /* free list of physical pages */
+
+/* free blocks of physical pages, one list per order */
+static struct pagelist page_free_list[PAGE_NORDER];
+static size_t page_nfree;   /* free pages, in blocks of any order */
+
+/* free pages past the end of the KERNBASE map; the kernel can only reach
+   them through a mapping of its own, so they are for page_alloc_high(),
+   and the buddy allocator never sees them; guarded by page_lock */
+static struct pagelist page_high_list;
+static size_t page_nhigh;
+
+/* free pages sorted by cache color, for page_alloc_color(); a block of
+   2^page_color_order pages, taken whole from the buddy allocator, has a
+   page of each color, and they are taken back when memory runs short;
+   guarded by page_lock */
+uint32_t page_ncolor = 1;
+static uint32_t page_color_order;
+static uint32_t page_color_cache;   /* bytes of the cache the colors are of */
+static struct pagelist page_color_list[PAGE_NCOLOR_MAX];
+static size_t page_ncolored;
+
+/* guards the free lists and the order and flags of free blocks */
+static struct spinlock page_lock = SPINLOCK_INITIALIZER("page_lock");
+
+/* cleared pages for page_alloc_zeroed(); the free lists count them as
+   allocated, so they are taken back when memory runs short; zero_lock
+   guards the list and the counts */
+static struct pagelist page_zero_list;
+static size_t page_nzero;
+static uint32_t page_zero_nhit, page_zero_nmiss, page_zero_nfill;
+static struct spinlock zero_lock = SPINLOCK_INITIALIZER("zero_lock");
+static int page_zero_nt;    /* clear with non-temporal stores (SSE2) */
+
+/* the part of [HEAPBASE, HEAPLIM) handed out so far, by heap_map() and
+   heap_reserve(); heap_lock guards it, the reserved page table entries
+   and heap_counts */
+static uintptr_t heap_next = HEAPBASE;
+static struct heap_stats heap_counts;
+static struct spinlock heap_lock = SPINLOCK_INITIALIZER("heap_lock");
+
+/* the page table entry of a reserved page that has no memory yet; the
+   MMU ignores every other bit of an entry that is not present */
+#define PTE_RESERVED  0x200
+
+/* in the entry of a page of a HEAP_COLOR reservation, present or not */
+#define PTE_COLORED   0x400
+
+/* in the read-only entry of a page heap_share() mapped in more than one
+   place; the first write to it copies it, unless it is the last mapping */
+#define PTE_COW       0x800
 
 /* GDT (global descriptor table):
    the kernel and user segments are identical (except for the DPL);
@@ -54,8 +120,10 @@ struct segdesc gdt[] = {
   /* 0x20 - user data segment */
   [GD_UD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 3),
 
-  /* 0x28 - tss, initialized in idt_init() */
-  [GD_TSS >> 3] = SEG_NULL
+  /* 0x28 - per-CPU tss's, initialized in tss_init_percpu(); the last
+     initializer sizes the array */
+  [GD_TSS0 >> 3] = SEG_NULL,
+  [(GD_TSS0 >> 3) + NCPU - 1] = SEG_NULL
 };
 
 struct pseudodesc gdt_pd = {
@@ -67,28 +135,79 @@ static int nvram_read(int r)
   return mc146818_read(NULL, r) | (mc146818_read(NULL, r+1) << 8);
 }
 
+static void mem_range_add(physaddr_t start, physaddr_t end)
+{
+  start = (start + PGSIZE - 1) & ~(physaddr_t) (PGSIZE - 1);
+  end &= ~(physaddr_t) (PGSIZE - 1);
+  if (start >= end)
+    return;
+  if (end > PHYSLIM) {
+    mem_unused += end - MAX(start, (physaddr_t) PHYSLIM);
+    end = PHYSLIM;
+  }
+  if (start >= end || nmem_ranges == E820_MAX)
+    return;
+  mem_ranges[nmem_ranges].mr_start = start;
+  mem_ranges[nmem_ranges].mr_end = end;
+  nmem_ranges++;
+  maxpa = MAX(maxpa, end);
+}
+
+/* finds the usable physical memory: from the BIOS memory map that the
+   boot sector left at E820_MAP, which reports all of it, holes and all,
+   or, for a kernel booted some other way, from NVRAM, which reports the
+   base memory and at most 64MB of extended memory; memory past PHYSLIM
+   is counted but not used, since pages[] would outgrow the KERNBASE map */
 void i386_detect_memory(void)
 {
-  /* get base and extended memory size in bytes; nvram_read() returns 
-     memory size in KB */
-  basemem = ROUNDDOWN(nvram_read(NVRAM_BASELO) * 1024, PGSIZE);
-  extmem = ROUNDDOWN(nvram_read(NVRAM_EXTLO) * 1024, PGSIZE);
+  struct e820_map *map = (struct e820_map *) (KERNBASE + E820_MAP);
+  struct e820_entry *e;
+  uint32_t i;
+
+  if (map->em_magic == E820_SMAP && map->em_count > 0 &&
+      map->em_count <= E820_MAX) {
+    for (i = 0; i < map->em_count; i++) {
+      e = &map->em_entries[i];
+      cprintf("  e820: %08llx-%08llx type %u\n", e->ee_addr,
+              e->ee_addr + e->ee_len - 1, e->ee_type);
+      if (e->ee_type == E820_RAM)
+        mem_range_add(e->ee_addr, e->ee_addr + e->ee_len);
+    }
+  } else {
+    /* get base and extended memory size in bytes; nvram_read() returns
+       memory size in KB */
+    basemem = ROUNDDOWN(nvram_read(NVRAM_BASELO) * 1024, PGSIZE);
+    extmem = ROUNDDOWN(nvram_read(NVRAM_EXTLO) * 1024, PGSIZE);
+    mem_range_add(0, basemem);
+    mem_range_add(EXTPHYSMEM, EXTPHYSMEM + extmem);
+  }
+  npage = (size_t) (maxpa / PGSIZE);
+  nlowpage = MIN(npage, (size_t) (-KERNBASE / PGSIZE));
+
+  cprintf("physical memory: %lluKB available ", maxpa >> 10);
+  cprintf("(npage = %d, %d of them mapped at KERNBASE)\n", npage, nlowpage);
+  if (mem_unused)
+    cprintf("physical memory: %lluKB past %lluMB not used\n",
+            mem_unused >> 10, (physaddr_t) PHYSLIM >> 20);
+}
 
-  /* calculate the maxmium physical address */
-  if (extmem)
-    maxpa = EXTPHYSMEM + extmem;
-  else
-    maxpa = basemem;
-  npage = maxpa / PGSIZE;
+/* nonzero if the page at 'pa' is in usable memory */
+static int mem_usable(physaddr_t pa)
+{
+  int i;
 
-  cprintf("physical memory: %dKB available ", (maxpa >> 10));
-  cprintf("(base = %dKB; ext = %dKB, npage = %d)\n", 
-          (basemem >> 10), (extmem >> 10), npage);
+  for (i = 0; i < nmem_ranges; i++)
+    if (pa >= mem_ranges[i].mr_start && pa < mem_ranges[i].mr_end)
+      return 1;
+  return 0;
 }
 
 /* set up initial memory mappings and turn on MMU */
 static void check_boot_pgdir(void);
 static void check_page_alloc();
+static struct page *page_high_take(void);
+static void page_high_fill(struct page *pp, const void *src);
+static physaddr_t check_va2pa(pde_t *pgdir, uintptr_t va);
 
 /* allocate n bytes of physical memory aligned on an align-byte boundary;
    align must be a power of two; return kernel virtual address; returned 
@@ -96,7 +215,7 @@ static void check_page_alloc();
    however, it's too early to run out of memory
 
    NOTE: this function may only be used during initialization, before the 
-         page_free_list has been set up */
+         free lists have been set up */
 static void *boot_alloc(uint32_t n, uint32_t align)
 {
   extern char end[];
@@ -119,6 +238,8 @@ static void *boot_alloc(uint32_t n, uint32_t align)
 
   /* increase boot_freemem to record allocation */
   boot_freemem += n;
+  if (PADDR(boot_freemem) > nlowpage * PGSIZE)
+    panic("boot_alloc: out of memory");
 
   return v;
 }
@@ -137,7 +258,7 @@ static void *boot_alloc(uint32_t n, uint32_t align)
    by allocating new page tables as needed
  
    boot_pgdir_walk cannot fail; it's too early to fail; this function may 
-   ONLY be used during initialization, before the page_free_list has been 
+   ONLY be used during initialization, before the free lists have been 
    set up */
 pte_t *boot_pgdir_walk(pde_t *pgdir, const void *va, int create, pte_t **ppte)
 //static pte_t *pgdir_walk(pde_t *pgdir, const void *va, int create)
@@ -146,7 +267,7 @@ pte_t *boot_pgdir_walk(pde_t *pgdir, const void *va, int create, pte_t **ppte)
   pte_t *pgtab;
   struct page *pp;
   if (*pde & PTE_P)
-    pgtab = (pte_t *) PTE_ADDR(*pde);
+    pgtab = (pte_t *) (uintptr_t) PTE_ADDR(*pde);
   else {
     cprintf("create\n");
     if (!create || (pgtab = (pte_t *) page_alloc(&pp)) != 0)
@@ -159,10 +280,13 @@ pte_t *boot_pgdir_walk(pde_t *pgdir, const void *va, int create, pte_t **ppte)
 
 /* map [la, la+size) of linear address space to physical [pa, pa+size)
    in the page table rooted at pgdir; size is a multiple of PGSIZE;
-   use permission bits perm|PTE_P for the entries
+   use permission bits perm|PTE_P for the entries; with PTE_PS in perm,
+   each 2MB of the range that is 2MB aligned in both address spaces is
+   mapped by one 2MB page, with no page table
 
-   this function may ONLY be used during initialization, before the
-   page_free_list has been set up */
+   page tables come from page_alloc(), so this function may only be used
+   once the free lists have been set up; it is meant for the static
+   kernel mappings, which are never unmapped and do not touch pp_ref */
 static void boot_map_pages(pde_t *pgdir, uintptr_t la, size_t size, 
                            physaddr_t pa, int perm)
 {
@@ -170,17 +294,28 @@ static void boot_map_pages(pde_t *pgdir, uintptr_t la, size_t size,
   pte_t *pte;
 
   /* assert 'pa' is aligned at page boundary */
-  assert((pa << 20) == 0x0);
+  assert((pa & (PGSIZE - 1)) == 0x0);
 
-  addr = (char *) ROUNDDOWN(la, 1);
-  last = (char *) ROUNDDOWN(la + size - 1, 1);
+  addr = (char *) ROUNDDOWN(la, PGSIZE);
+  last = (char *) ROUNDDOWN(la + size - 1, PGSIZE);
   for (;;) {
+    if ((perm & PTE_PS) && (uintptr_t) addr % PTSIZE == 0 &&
+        pa % PTSIZE == 0 && last - addr >= PTSIZE - PGSIZE) {
+      if (pgdir[PDX(addr)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(addr)] = pa | perm | PTE_P;
+      if (last - addr == PTSIZE - PGSIZE)
+        break;
+      addr += PTSIZE;
+      pa += PTSIZE;
+      continue;
+    }
     pte = pgdir_walk(pgdir, addr, 1 /* create */);
     if (pte == 0)
       panic("pgdir_walk");
     if (*pte & PTE_P) 
       panic("remap");
-    *pte = pa | perm | PTE_P;
+    *pte = pa | (perm & ~PTE_PS) | PTE_P;
     if (addr == last)
       break;
     addr += PGSIZE;
@@ -189,9 +324,11 @@ static void boot_map_pages(pde_t *pgdir, uintptr_t la, size_t size,
 }
 
 
-/* set up a two-level page table:
-   - boot_pgdir is its linear (virtual) address of the root
-   - boot_cr3 is the physical adresss of the root
+/* set up a PAE page table:
+   - boot_pgdir is the linear (virtual) address of its page directories,
+     which are NPDPTENTRIES pages in a row, indexed by PDX() as one
+   - boot_cr3 is the physical adresss of the page directory pointer table
+     that points to them
    then, turn on paging and effectively turn off segmentation
    (i.e., the segment base addrs are set to zero).
 
@@ -201,25 +338,33 @@ static void boot_map_pages(pde_t *pgdir, uintptr_t la, size_t size,
    write; above ULIM the user cannot read (or write) */
 void i386_vm_init(void)
 {
-  pde_t *pgdir;
+  pde_t *pgdir, *pdpt;
   uint32_t cr0;
   size_t n;
+  int i;
 
-  /* create initial page directory */
-  pgdir = boot_alloc(PGSIZE, PGSIZE);
-  memset(pgdir, 0, PGSIZE);
+  /* create initial page directories, and the page directory pointer
+     table; its entries take no permission bits, and it must be 32-byte
+     aligned and below 4GB, as CR3 holds 32 bits of its address */
+  pgdir = boot_alloc(NPDPTENTRIES * PGSIZE, PGSIZE);
+  memset(pgdir, 0, NPDPTENTRIES * PGSIZE);
+  pdpt = boot_alloc(NPDPTENTRIES * sizeof(pde_t), 32);
+  for (i = 0; i < NPDPTENTRIES; i++)
+    pdpt[i] = PADDR(pgdir + i * NPTENTRIES) | PTE_P;
   boot_pgdir = pgdir;
-  boot_cr3 = PADDR(pgdir);
+  boot_cr3 = PADDR(pdpt);
   PRINTMEM("boot_pgdir", boot_pgdir);
   PRINTMEM("boot_cr3", boot_cr3);
   PRINTMEM("boot_freemem", boot_freemem);
 
-  /* recursively insert PD in itself as a page table, to form a virtual 
-     page table at virtual address VPT:
+  /* recursively insert the PDs in themselves as page tables, to form a
+     virtual page table at virtual address VPT:
      - VPT; permissions: kernel RW, user NONE
      - UVPT; permissions: kernel R, user R */
-  pgdir[PDX(VPT)] = PADDR(pgdir)|PTE_W|PTE_P;
-  pgdir[PDX(UVPT)] = PADDR(pgdir)|PTE_U|PTE_P;
+  for (i = 0; i < NPDPTENTRIES; i++) {
+    pgdir[PDX(VPT) + i] = PADDR(pgdir + i * NPTENTRIES)|PTE_W|PTE_P;
+    pgdir[PDX(UVPT) + i] = PADDR(pgdir + i * NPTENTRIES)|PTE_U|PTE_P;
+  }
   PRINTMEM("VPT", VPT);
   PRINTMEM("PDX(VPT)", PDX(VPT));
   PRINTMEM("PADDR(pgdir)", PADDR(pgdir));
@@ -251,29 +396,44 @@ void i386_vm_init(void)
   /* map 'pages' read-only by the user at linear address UPAGES;
      permissions:
        - the new image at UPAGES: kernel R, user R (i.e. perm = PTE_U|PTE_P)
-       - pages itself: kernel RW, user NONE */
-  //boot_map_pages(pgdir, UPAGES, PADDR(), PTE_U);
-
-	/* use the physical memory that 'bootstack' refers to as the kernel
-     stack; the kernel stack grows down from virtual address KSTACKTOP;
-     we consider the entire range from [KSTACKTOP-PTSIZE, KSTACKTOP) 
-     to be the kernel stack, but break this into two pieces:
-
-     - [KSTACKTOP-KSTKSIZE, KSTACKTOP): backed by physical memory
-     - [KSTACKTOP-PTSIZE, KSTACKTOP-KSTKSIZE): not backed; so if
-       the kernel overflows its stack, it will fault rather than
-       overwrite memory.  Known as a "guard page".
+       - pages itself: kernel RW, user NONE
+     with more than about 680MB of memory, the array outgrows the 2MB at
+     UPAGES, and only its start is mapped there */
+  n = MIN(ROUNDUP(npage * sizeof(struct page), PGSIZE), (size_t) PTSIZE);
+  boot_map_pages(pgdir, UPAGES, n, PADDR(pages), PTE_U);
+
+	/* each CPU gets a kernel stack; they grow down from KSTACKTOP, one
+     below the other; CPU i's stack occupies
+     [KSTACKTOP - i * (KSTKSIZE + KSTKGAP) - KSTKSIZE, ...) and is
+     broken into two pieces:
+
+     - KSTKSIZE bytes backed by physical memory; 'bootstack' for the
+       BSP and percpu_kstacks[i] for the others
+     - KSTKGAP bytes below it, not backed; so if the kernel overflows
+       its stack, it will fault rather than overwrite the next CPU's
+       stack.  Known as a "guard page".
 
      permissions: kernel RW, user NONE */
-  boot_map_pages(pgdir, KSTACKTOP-KSTKSIZE, KSTKSIZE, 0, PTE_W);
-  boot_map_pages(pgdir, KSTACKTOP-PTSIZE, PTSIZE-KSTKSIZE, 0, PTE_W);
+  for (i = 0; i < NCPU; i++)
+    boot_map_pages(pgdir, percpu_kstacktop(i) - KSTKSIZE, KSTKSIZE,
+                   i == 0 ? PADDR(bootstack) : PADDR(percpu_kstacks[i]),
+                   PTE_W);
+
+  /* each CPU has a page at KMAPBASE through which page_alloc_high()
+     clears pages past the KERNBASE map; the page table for the windows
+     is made now, so that using one never allocates */
+  static_assert(NCPU * PGSIZE <= KMAPSIZE);
+  if (!pgdir_walk(pgdir, (void *) KMAPBASE, 1))
+    panic("i386_vm_init: no page table for KMAPBASE");
 
 	/* map all of physical memory at KERNBASE; i.e. the VA range 
      [KERNBASE, 2^32) should map to the PA range [0, 2^32 - KERNBASE);
      we might not have (2^32 - KERNBASE) bytes of physical memory, but
-     we just set up the mapping anyway;
+     we just set up the mapping anyway; with 2MB pages, which PAE paging
+     always has, the mapping needs no page tables and the TLB covers 2MB
+     of it with each entry;
      permissions: kernel RW, user NONE */
-  boot_map_pages(pgdir, KERNBASE, (2^32)-KERNBASE, 0, PTE_W);
+  boot_map_pages(pgdir, KERNBASE, -KERNBASE, 0, PTE_W | PTE_PS);
 
 	/* check that the initial page directory has been set up correctly */
 	check_boot_pgdir();
@@ -291,11 +451,14 @@ void i386_vm_init(void)
      mapping, even though we are turning on paging and reconfiguring
      segmentation */
 
-	/* map VA 0:4MB same as VA KERNBASE, i.e. to PA 0:4MB; 
-     (limits our kernel to < 4MB) */
+	/* map VA 0:4MB same as VA KERNBASE, i.e. to PA 0:4MB, with the first
+     two page directory entries; (limits our kernel to < 4MB) */
 	pgdir[0] = pgdir[PDX(KERNBASE)];
+	pgdir[1] = pgdir[PDX(KERNBASE) + 1];
 
-	/* install page table */
+	/* install page table; entry.S turned on CR4_PAE already, and the APs
+     load boot_cr4 the same way, in mpentry.S */
+	lcr4(rcr4() | boot_cr4);
 	lcr3(boot_cr3);
 
 	/* turn on paging */
@@ -305,9 +468,25 @@ void i386_vm_init(void)
 	lcr0(cr0);
 
 	/* CURRENT MAPPING: KERNBASE + x => x => x;
-     (x < 4MB so uses paging pgdir[0]) */
+     (x < 4MB so uses paging pgdir[0] and pgdir[1]) */
+
+	/* reload all segment registers */
+  gdt_init_percpu();
 
-	// Reload all segment registers.
+	/* FINAL MAPPING: KERNBASE + x => KERNBASE + x => x;
+     this mapping was only used after paging was turned on but before 
+     the segment registers were reloaded */
+	pgdir[0] = 0;
+	pgdir[1] = 0;
+
+	/* flush the TLB for good measure, to kill the pgdir[0] mapping */
+	lcr3(boot_cr3);
+}
+
+/* load the GDT and reload all segment registers; called by every CPU once
+   paging is on */
+void gdt_init_percpu(void)
+{
 	asm volatile("lgdt gdt_pd");
 	asm volatile("movw %%ax,%%gs" :: "a" (GD_UD|3));
 	asm volatile("movw %%ax,%%fs" :: "a" (GD_UD|3));
@@ -316,36 +495,616 @@ void i386_vm_init(void)
 	asm volatile("movw %%ax,%%ss" :: "a" (GD_KD));
 	asm volatile("ljmp %0,$1f\n 1:\n" :: "i" (GD_KT));  // reload cs
 	asm volatile("lldt %%ax" :: "a" (0));
+}
 
-	/* FINAL MAPPING: KERNBASE + x => KERNBASE + x => x;
-     this mapping was only used after paging was turned on but before 
-     the segment registers were reloaded */
-	pgdir[0] = 0;
+/* reserve 'size' bytes in the MMIO region and map [pa, pa+size) there,
+   uncached; device registers must not be cached, and writes must reach
+   the device in order; returns the virtual address of 'pa'
 
-	/* flush the TLB for good measure, to kill the pgdir[0] mapping */
-	lcr3(boot_cr3);
+   the mappings are permanent; there is no way to unmap them */
+void *mmio_map_region(physaddr_t pa, size_t size)
+{
+  static uintptr_t base = MMIOBASE;
+  uintptr_t va;
+  uint32_t off = pa & (PGSIZE - 1);
+
+  size = ROUNDUP(size + off, PGSIZE);
+  if (base + size > KMAPBASE || base + size < base)
+    panic("mmio_map_region: out of MMIO space mapping %08llx", pa);
+
+  va = base;
+  boot_map_pages(boot_pgdir, va, size, pa - off, PTE_PCD | PTE_PWT | PTE_W);
+  base += size;
+  return (void *) (va + off);
+}
+
+/* takes 'size' bytes of the heap range, rounded up to pages, starting on
+   an 'align' boundary; returns 0 if the range runs out.  ranges are taken
+   from the top and only go back when they are the last one taken, so the
+   range is used like a stack; both are called with heap_lock held */
+static uintptr_t heap_take(size_t size, uintptr_t align)
+{
+  uintptr_t start;
+
+  start = ROUNDUP(heap_next, align);
+  size = ROUNDUP(size, PGSIZE);
+  if (start < heap_next || start + size > HEAPLIM || start + size < start)
+    return 0;
+  heap_next = start + size;
+  return start;
+}
+
+/* gives back a range from heap_take(), which must be unmapped; it can be
+   taken again only if nothing was taken after it */
+static void heap_give(uintptr_t va, size_t size)
+{
+  if (va + ROUNDUP(size, PGSIZE) == heap_next)
+    heap_next = va;
+}
 
+/* reserves 'size' bytes of [HEAPBASE, HEAPLIM) for the Java heap and
+   maps zeroed memory there; with 'large', the reservation starts 2MB
+   aligned and each 2MB of it is one 2MB page while free 2MB blocks are
+   left, so that a heap scan takes a TLB entry per 2MB rather than per
+   page; the rest is 4KB pages
+
+   returns 0 if the range or memory runs out, and the memory mapped so
+   far stays mapped; heap_unmap() gives the memory and the range back */
+void *heap_map(size_t size, int large)
+{
+  struct page *pp;
+  uintptr_t start, end, va;
+  uint32_t eflags;
+
+  size = ROUNDUP(size, PGSIZE);
+  eflags = irq_save();
+  spin_lock(&heap_lock);
+  start = heap_take(size, large ? PTSIZE : PGSIZE);
+  spin_unlock(&heap_lock);
+  irq_restore(eflags);
+  if (start == 0)
+    return 0;
+  end = start + size;
+
+  for (va = start; va < end; ) {
+    if (large && va % PTSIZE == 0 && end - va >= PTSIZE &&
+        alloc_pages(PAGE_LARGE_ORDER, &pp) == 0) {
+      memset(page2kva(pp), 0, PTSIZE);
+      if (page_insert_large(boot_pgdir, pp, (void *) va, PTE_W) != 0)
+        panic("heap_map: remap at %08x", va);
+      va += PTSIZE;
+      continue;
+    }
+    if (page_alloc_high(&pp) != 0)
+      return 0;
+    if (page_insert(boot_pgdir, pp, (void *) va, PTE_W) != 0) {
+      page_free(pp);
+      return 0;
+    }
+    va += PGSIZE;
+  }
+  return (void *) start;
 }
 
+/* unmaps and frees the memory of a heap_map() range, 2MB pages included,
+   and gives the range back; the memory is freed only once no CPU's TLB
+   still maps it */
+void heap_unmap(void *va, size_t size)
+{
+  uintptr_t start = (uintptr_t) va, end, a;
+  struct pagelist dead, dead_large;
+  struct tlb_batch b;
+  struct page *pp;
+  uint32_t eflags;
+  pde_t *pde;
+  pte_t *pte;
+
+  size = ROUNDUP(size, PGSIZE);
+  end = start + size;
+  assert(start >= HEAPBASE && end <= HEAPLIM && start % PGSIZE == 0);
+  tlb_batch_init(&b);
+  LIST_INIT(&dead);
+  LIST_INIT(&dead_large);
+  for (a = start; a < end; ) {
+    pde = &boot_pgdir[PDX(a)];
+    if (*pde & PTE_PS) {
+      pp = pa2page(PTE_ADDR(*pde));
+      pte_write(pde, 0);
+      tlb_batch_add(&b, a, PTSIZE);
+      if (--pp->pp_ref == 0)
+        LIST_INSERT_HEAD(&dead_large, pp, pp_link);
+      a += PTSIZE;
+      continue;
+    }
+    if ((pp = page_lookup(boot_pgdir, (void *) a, &pte)) != 0) {
+      pte_write(pte, 0);
+      tlb_batch_add(&b, a, PGSIZE);
+      if (--pp->pp_ref == 0)
+        LIST_INSERT_HEAD(&dead, pp, pp_link);
+    }
+    a += PGSIZE;
+  }
+  tlb_batch_flush(&b);
+
+  while ((pp = LIST_FIRST(&dead)) != 0) {
+    LIST_REMOVE(pp, pp_link);
+    page_free(pp);
+  }
+  while ((pp = LIST_FIRST(&dead_large)) != 0) {
+    LIST_REMOVE(pp, pp_link);
+    free_pages(pp, PAGE_LARGE_ORDER);
+  }
+  eflags = irq_save();
+  spin_lock(&heap_lock);
+  heap_give(start, size);
+  spin_unlock(&heap_lock);
+  irq_restore(eflags);
+}
+
+/* reserves 'size' bytes of [HEAPBASE, HEAPLIM) without memory behind
+   them: each page is backed by a zeroed page the first time it is
+   touched, by heap_fault(), so a large reservation costs only its page
+   tables until it is used; for the Java heap, TLABs and Java thread
+   stacks, but not kernel stacks, since a trap runs on the stack it
+   interrupts and a fault there could not be handled.  an unreserved
+   page is left below the reservation, so that a stack running off its
+   bottom faults rather than growing into its neighbour
+
+   with HEAP_COLOR in 'flags', each page is backed by one of the cache
+   color of its address, so that the reservation spreads evenly over the
+   sets of a physically indexed cache, as a virtually indexed one would;
+   a scan of as much of it as the cache holds then has no conflict misses
+
+   heap_decommit() gives the memory of a reservation back, and
+   heap_release() ends it; returns 0 if the range runs out or there is
+   no memory for the page tables */
+void *heap_reserve(size_t size, int flags)
+{
+  uintptr_t start, end, va;
+  uint32_t eflags;
+  pte_t *pte;
+
+  size = ROUNDUP(size, PGSIZE);
+  if (size == 0)
+    return 0;
+  eflags = irq_save();
+  spin_lock(&heap_lock);
+  /* the page below the range stays unmapped as a guard */
+  if ((start = heap_take(size + PGSIZE, PGSIZE)) == 0)
+    goto fail;
+  start += PGSIZE;
+  end = start + size;
+  for (va = start; va < end; va += PGSIZE) {
+    if ((pte = pgdir_walk(boot_pgdir, (void *) va, 1)) == 0) {
+      /* the page tables made so far stay, empty */
+      while ((va -= PGSIZE) >= start)
+        *pgdir_walk(boot_pgdir, (void *) va, 0) = 0;
+      heap_give(start - PGSIZE, size + PGSIZE);
+      goto fail;
+    }
+    assert(*pte == 0);
+    *pte = PTE_RESERVED | ((flags & HEAP_COLOR) ? PTE_COLORED : 0);
+  }
+  heap_counts.hs_nreserved += size / PGSIZE;
+  spin_unlock(&heap_lock);
+  irq_restore(eflags);
+  return (void *) start;
+
+ fail:
+  spin_unlock(&heap_lock);
+  irq_restore(eflags);
+  return 0;
+}
+
+/* maps the pages of [va, va + size), which lie in heap_reserve()
+   reservations, a second time, in a new reservation of the same size,
+   and returns it; for class metadata, shared archives and compiled code
+   that each isolate would otherwise hold its own copy of.  the pages
+   that have memory are shared by both ranges, read-only, and reference
+   counted; a write to one of them in either range faults, and
+   heap_fault() gives the writer a copy of its own, or the page itself if
+   no other mapping is left.  pages with no memory yet stay private to
+   each range, and read as zero when touched.  the source range must not
+   be written until heap_share() returns, since another CPU may write it
+   through its TLB until the flush that makes it read-only; returns 0 if
+   the heap range or memory for its page tables runs out, or if a page of
+   the source range is neither reserved nor mapped with a 4KB page, as
+   the 2MB pages of heap_map() are not */
+void *heap_share(void *va, size_t size)
+{
+  struct tlb_batch b;
+  struct page *pp;
+  uintptr_t src, dst, start;
+  uint32_t eflags, n = 0;
+  pte_t *spte, *dpte;
+
+  assert((uintptr_t) va % PGSIZE == 0);
+  size = ROUNDUP(size, PGSIZE);
+  assert((uintptr_t) va >= HEAPBASE && (uintptr_t) va + size <= HEAPLIM);
+
+  /* the caller keeps the source range reserved or mapped while it is
+     shared, so a range that can be shared now still can be once the
+     copy is reserved */
+  eflags = irq_save();
+  spin_lock(&heap_lock);
+  for (src = (uintptr_t) va; src < (uintptr_t) va + size; src += PGSIZE)
+    if ((spte = pgdir_walk(boot_pgdir, (void *) src, 0)) == 0 || *spte == 0)
+      break;
+  spin_unlock(&heap_lock);
+  irq_restore(eflags);
+  if (src < (uintptr_t) va + size)
+    return 0;
+  if ((start = (uintptr_t) heap_reserve(size, 0)) == 0)
+    return 0;
+
+  tlb_batch_init(&b);
+  eflags = irq_save();
+  spin_lock(&heap_lock);
+  for (src = (uintptr_t) va, dst = start; dst < start + size;
+       src += PGSIZE, dst += PGSIZE) {
+    spte = pgdir_walk(boot_pgdir, (void *) src, 0);
+    dpte = pgdir_walk(boot_pgdir, (void *) dst, 0);
+    assert(spte && *spte != 0);
+    /* a copy of the page takes the color of its own address */
+    pte_write(dpte, *dpte | (*spte & PTE_COLORED));
+    if ((pp = page_lookup(boot_pgdir, (void *) src, 0)) == 0)
+      continue;
+    assert(pp->pp_ref < 0xFFFF);
+    if (*spte & PTE_W) {
+      pte_write(spte, (*spte & ~PTE_W) | PTE_COW);
+      tlb_batch_add(&b, src, PGSIZE);
+    }
+    /* the page tables are there, so this does not allocate */
+    if (page_insert(boot_pgdir, pp, (void *) dst,
+                    PTE_COW | (*dpte & PTE_COLORED)) != 0)
+      panic("heap_share: no page table at %08x", dst);
+    n++;
+  }
+  heap_counts.hs_ncommitted += n;
+  heap_counts.hs_nshared += n;
+  spin_unlock(&heap_lock);
+  irq_restore(eflags);
+
+  /* not under heap_lock, as in heap_decommit() */
+  tlb_batch_flush(&b);
+  return (void *) start;
+}
+
+/* backs the reserved page at 'va' with a zeroed page, or gives a write
+   to a page heap_share() shared a page of its own; from the page fault
+   handler, with interrupts off, and 'err' the fault's error code.
+   returns 0 if the faulting access can be retried, -E_FAULT if 'va' is
+   not reserved or shared, and -E_NO_MEM if there is no page for it */
+int heap_fault(uintptr_t va, uint32_t err)
+{
+  struct tlb_batch b;
+  struct page *pp, *old = 0;
+  pte_t *pte;
+  int perm, r = -E_FAULT;
+
+  if (va < HEAPBASE || va >= HEAPLIM)
+    return -E_FAULT;
+  if ((err & FEC_PR) && !(err & FEC_WR))
+    return -E_FAULT;
+  va = ROUNDDOWN(va, PGSIZE);
+
+  spin_lock(&heap_lock);
+  pte = pgdir_walk(boot_pgdir, (void *) va, 0);
+  if (pte && (*pte & PTE_P) && ((*pte & PTE_W) || !(err & FEC_PR))) {
+    /* another CPU touched it or copied it first */
+    r = 0;
+  } else if (pte && (*pte & PTE_P) && (*pte & PTE_COW)) {
+    pp = pa2page(PTE_ADDR(*pte));
+    perm = PTE_W | (*pte & PTE_COLORED);
+    if (pp->pp_ref == 1) {
+      /* the other mappings are gone; other CPUs may still hold the
+         read-only entry, and fault on it once more to no effect */
+      pte_write(pte, page2pa(pp) | perm | PTE_P);
+      invlpg((void *) va);
+      r = 0;
+    } else {
+      if (perm & PTE_COLORED) {
+        if ((r = page_alloc_color(PPN(va), &pp)) == 0)
+          memmove(page2kva(pp), (void *) va, PGSIZE);
+      } else if ((pp = page_high_take()) != 0) {
+        page_high_fill(pp, (void *) va);
+        r = 0;
+      } else if ((r = page_alloc(&pp)) == 0)
+        memmove(page2kva(pp), (void *) va, PGSIZE);
+      if (r == 0) {
+        /* the shared page loses this mapping's reference only once no
+           CPU can reach it through this address */
+        old = pa2page(PTE_ADDR(*pte));
+        pp->pp_ref = 1;
+        pte_write(pte, page2pa(pp) | perm | PTE_P);
+        heap_counts.hs_ncopy++;
+      }
+    }
+  } else if (pte && !(*pte & PTE_P) &&
+             (*pte & ~PTE_COLORED) == PTE_RESERVED) {
+    perm = PTE_W | (*pte & PTE_COLORED);
+    if (perm & PTE_COLORED) {
+      /* colored pages come from the KERNBASE map, and are cleared there */
+      if ((r = page_alloc_color(PPN(va), &pp)) == 0)
+        memset(page2kva(pp), 0, PGSIZE);
+    } else
+      r = page_alloc_high(&pp);
+    if (r == 0 && (r = page_insert(boot_pgdir, pp, (void *) va, perm)) != 0)
+      page_free(pp);
+    if (r == 0) {
+      heap_counts.hs_ncommitted++;
+      heap_counts.hs_nfault++;
+    }
+  }
+  spin_unlock(&heap_lock);
+
+  if (old) {
+    tlb_batch_init(&b);
+    tlb_batch_add(&b, va, PGSIZE);
+    tlb_batch_flush(&b);
+    spin_lock(&heap_lock);
+    if (--old->pp_ref != 0)
+      old = 0;
+    spin_unlock(&heap_lock);
+    if (old)
+      page_free(old);
+  }
+  return r;
+}
+
+/* gives back the memory behind the whole pages of [va, va + size), which
+   lie in heap_reserve() reservations; they stay reserved, and read as
+   zero when next touched.  for a collector to return the idle part of the
+   heap, or a thread stack that is no longer used, so the range must not be
+   in use meanwhile; the pages are freed after one TLB flush for all of
+   them, as page_remove_range() does; a page heap_share() mapped in more
+   than one place is only freed with its last mapping; returns the pages
+   unmapped */
+uint32_t heap_decommit(void *va, size_t size)
+{
+  struct tlb_batch b;
+  struct pagelist dead;
+  struct page *pp;
+  uintptr_t start, end, a;
+  uint32_t eflags, n = 0;
+  pte_t *pte;
+
+  start = ROUNDUP((uintptr_t) va, PGSIZE);
+  end = ROUNDDOWN((uintptr_t) va + size, PGSIZE);
+  if (start >= end)
+    return 0;
+  assert(start >= HEAPBASE && end <= HEAPLIM);
+
+  tlb_batch_init(&b);
+  LIST_INIT(&dead);
+  eflags = irq_save();
+  spin_lock(&heap_lock);
+  for (a = start; a < end; a += PGSIZE) {
+    pte = pgdir_walk(boot_pgdir, (void *) a, 0);
+    if (!pte || !(*pte & PTE_P))
+      continue;
+    pp = pa2page(PTE_ADDR(*pte));
+    pte_write(pte, PTE_RESERVED | (*pte & PTE_COLORED));
+    tlb_batch_add(&b, a, PGSIZE);
+    if (--pp->pp_ref == 0)
+      LIST_INSERT_HEAD(&dead, pp, pp_link);
+    n++;
+  }
+  heap_counts.hs_ncommitted -= n;
+  heap_counts.hs_ndecommit += n;
+  spin_unlock(&heap_lock);
+  irq_restore(eflags);
+
+  /* not under heap_lock: a CPU faulting on the heap spins for it with
+     interrupts off, and would not take the shootdown IPI */
+  tlb_batch_flush(&b);
+  while ((pp = LIST_FIRST(&dead)) != 0) {
+    LIST_REMOVE(pp, pp_link);
+    page_free(pp);
+  }
+  return n;
+}
+
+/* ends a heap_reserve() reservation: its memory is freed and the range,
+   with its guard page, goes back to the heap range; 'va' and 'size' are
+   as given to and returned by heap_reserve() */
+void heap_release(void *va, size_t size)
+{
+  uintptr_t start, end, a;
+  uint32_t eflags;
+  pte_t *pte;
+
+  start = (uintptr_t) va;
+  size = ROUNDUP(size, PGSIZE);
+  end = start + size;
+  assert(start % PGSIZE == 0 && start > HEAPBASE && end <= HEAPLIM);
+
+  heap_decommit(va, size);
+  eflags = irq_save();
+  spin_lock(&heap_lock);
+  /* nothing of the range is present now, so no TLB holds it */
+  for (a = start; a < end; a += PGSIZE) {
+    pte = pgdir_walk(boot_pgdir, (void *) a, 0);
+    assert(pte && (*pte & ~PTE_COLORED) == PTE_RESERVED);
+    *pte = 0;
+  }
+  heap_counts.hs_nreserved -= size / PGSIZE;
+  heap_give(start - PGSIZE, size + PGSIZE);
+  spin_unlock(&heap_lock);
+  irq_restore(eflags);
+}
+
+void heap_stats(struct heap_stats *st)
+{
+  *st = heap_counts;
+}
+
+/* a reservation has no memory until it is touched, reads as zero, and
+   reads as zero again after it is decommitted; needs the page fault
+   handler */
+void heap_check(void)
+{
+  struct heap_stats st0, st;
+  physaddr_t pa;
+  char *p, *q, *m;
+  pte_t *pte;
+  int i;
+
+  heap_stats(&st0);
+  assert((p = heap_reserve(3 * PGSIZE, 0)) != 0);
+  assert((pte = pgdir_walk(boot_pgdir, p - PGSIZE, 0)) == 0 || *pte == 0);
+  for (i = 0; i < 3; i++)
+    assert(check_va2pa(boot_pgdir, (uintptr_t) p + i * PGSIZE) == ~0);
+
+  for (i = 0; i < PGSIZE; i += 64)
+    assert(p[PGSIZE + i] == 0);
+  memset(p + PGSIZE, 0xAB, PGSIZE);
+  p[2 * PGSIZE] = 1;
+  heap_stats(&st);
+  assert(st.hs_ncommitted == st0.hs_ncommitted + 2);
+  assert(check_va2pa(boot_pgdir, (uintptr_t) p) == ~0);
+
+  /* only the whole pages of the range go */
+  assert(heap_decommit(p + 1, 2 * PGSIZE) == 1);
+  assert(check_va2pa(boot_pgdir, (uintptr_t) p + PGSIZE) == ~0);
+  assert(p[2 * PGSIZE] == 1);
+  assert(p[PGSIZE] == 0);
+  assert(heap_decommit(p, 3 * PGSIZE) == 2);
+  heap_stats(&st);
+  assert(st.hs_ncommitted == st0.hs_ncommitted);
+  assert(st.hs_nreserved == st0.hs_nreserved + 3);
+
+  /* a colored reservation takes pages of the colors of their addresses */
+  assert((q = heap_reserve(2 * PGSIZE, HEAP_COLOR)) != 0);
+  q[0] = q[PGSIZE] = 1;
+  for (i = 0; i < 2; i++) {
+    pa = check_va2pa(boot_pgdir, (uintptr_t) q + i * PGSIZE);
+    assert(PPN(pa) % page_ncolor == VPN(q + i * PGSIZE) % page_ncolor);
+  }
+  assert(heap_decommit(q, 2 * PGSIZE) == 2);
+  assert((pgdir_walk(boot_pgdir, q, 0)[0] & PTE_COLORED) != 0);
+  heap_release(q, 2 * PGSIZE);
+
+  heap_release(p, 3 * PGSIZE);
+  heap_stats(&st);
+  assert(st.hs_nreserved == st0.hs_nreserved);
+  assert(heap_reserve(3 * PGSIZE, 0) == p);
+  heap_release(p, 3 * PGSIZE);
+
+  /* a shared page is the same memory in both ranges until one writes
+     it; the writer gets a copy, and the last mapping keeps the page */
+  assert((p = heap_reserve(2 * PGSIZE, 0)) != 0);
+  p[0] = 7;
+  assert((q = heap_share(p, 2 * PGSIZE)) != 0);
+  pa = check_va2pa(boot_pgdir, (uintptr_t) p);
+  assert(check_va2pa(boot_pgdir, (uintptr_t) q) == pa);
+  assert(pa2page(pa)->pp_ref == 2);
+  assert(check_va2pa(boot_pgdir, (uintptr_t) q + PGSIZE) == ~0);
+  assert(q[0] == 7);
+  q[0] = 8;
+  assert(check_va2pa(boot_pgdir, (uintptr_t) q) != pa);
+  assert(p[0] == 7 && pa2page(pa)->pp_ref == 1);
+  p[0] = 9;
+  assert(check_va2pa(boot_pgdir, (uintptr_t) p) == pa && q[0] == 8);
+  q[PGSIZE] = 1;
+  assert(p[PGSIZE] == 0);
+  assert(heap_decommit(p, 2 * PGSIZE) == 2);
+  assert(heap_decommit(q, 2 * PGSIZE) == 2);
+  heap_stats(&st);
+  assert(st.hs_ncopy == st0.hs_ncopy + 1);
+
+  /* neither unreserved pages nor a 2MB page can be shared, and a range
+     that can not be is refused before anything is reserved for it */
+  assert(heap_share(p - PGSIZE, 2 * PGSIZE) == 0);
+  if ((m = heap_map(PTSIZE, 1)) != 0) {
+    if (boot_pgdir[PDX(m)] & PTE_PS)
+      assert(heap_share(m + PGSIZE, PGSIZE) == 0);
+    heap_unmap(m, PTSIZE);
+  }
+  heap_stats(&st);
+  assert(st.hs_nreserved == st0.hs_nreserved + 4);
+
+  heap_release(q, 2 * PGSIZE);
+  heap_release(p, 2 * PGSIZE);
+  heap_stats(&st);
+  assert(st.hs_nreserved == st0.hs_nreserved);
+
+  cprintf("heap_check() succeeded!\n");
+}
+
+
+static void magazine_flush(void);
+static void page_zero_drain(void);
+static size_t page_color_drain(void);
+
+/* takes every free block, so that the checks can run out of memory;
+   the blocks are allocated rather than taken off the lists, so the pages
+   the checks free can not merge with them */
+static void steal_free_pages(struct pagelist *stolen)
+{
+	struct page *pp;
+	int order;
+
+	LIST_INIT(stolen);
+	magazine_flush();
+	page_zero_drain();
+	page_color_drain();
+	for (order = PAGE_NORDER - 1; order >= 0; order--)
+		while (alloc_pages(order, &pp) == 0)
+			LIST_INSERT_HEAD(stolen, pp, pp_link);
+}
+
+static void return_free_pages(struct pagelist *stolen)
+{
+	struct page *pp;
+
+	while ((pp = LIST_FIRST(stolen)) != 0) {
+		LIST_REMOVE(pp, pp_link);
+		free_pages(pp, pp->pp_order);
+	}
+}
 
 /* check the physical page allocator: page_alloc(), page_free(), page_init() */
 static void check_page_alloc()
 {
 	struct page *pp, *pp0, *pp1, *pp2;
 	struct pagelist fl;
+	struct page_stats st0, st1;
+	size_t nfree;
+	int order;
 
-	/* if there's a page that shouldn't be on the free list, try to make 
+	/* if there's a page that shouldn't be on the free lists, try to make 
      sure it eventually causes trouble */
-	LIST_FOREACH(pp0, &page_free_list, pp_link) {
-		/* check that we didn't corrupt the free list itself */
-		assert((pages <= pp0) && (pp0 < pages + npage));
-
-		/* check a few pages that shouldn't be on the free list */
-		assert(page2pa(pp0) != 0);
-		assert(page2pa(pp0) != IOPHYSMEM);
-		assert(page2pa(pp0) != EXTPHYSMEM - PGSIZE);
-		//assert(page2kva(pp0) != ROUNDDOWN(boot_freemem - 1, PGSIZE));
+	nfree = 0;
+	for (order = 0; order < PAGE_NORDER; order++) {
+		LIST_FOREACH(pp0, &page_free_list[order], pp_link) {
+			/* check that we didn't corrupt the free list itself */
+			assert((pages <= pp0) && (pp0 + (1 << order) <= pages + npage));
+			assert(pp0->pp_order == order && (pp0->pp_flags & PP_FREE));
+			assert(page2ppn(pp0) % (1 << order) == 0);
+
+			/* check a few pages that shouldn't be in a free block */
+			for (pp = pp0; pp < pp0 + (1 << order); pp++) {
+				assert(page2pa(pp) != 0);
+				assert(page2pa(pp) != IOPHYSMEM);
+				assert(page2pa(pp) != EXTPHYSMEM - PGSIZE);
+			}
+			nfree += 1 << order;
+		}
 	}
+	assert(nfree == page_nfree);
+
+	/* blocks of each order come out aligned and contiguous, and free
+     blocks merge back with their buddies */
+	page_stats(&st0);
+	assert(alloc_pages(3, &pp0) == 0 && page2ppn(pp0) % 8 == 0);
+	assert(alloc_pages(0, &pp1) == 0);
+	assert(pp1 < pp0 || pp1 >= pp0 + 8);
+	assert(alloc_pages(PAGE_NORDER, &pp) == -E_INVAL);
+	free_pages(pp1, 0);
+	free_pages(pp0, 3);
+	page_stats(&st1);
+	assert(memcmp(&st0, &st1, sizeof(st0)) == 0);
 
 	/* should be able to allocate three pages */
 	pp0 = pp1 = pp2 = 0;
@@ -361,8 +1120,7 @@ static void check_page_alloc()
 	assert(page2pa(pp2) < npage*PGSIZE);
 
 	/* temporarily steal the rest of the free pages */
-	fl = page_free_list;
-	LIST_INIT(&page_free_list);
+	steal_free_pages(&fl);
 
 	/* should be no free memory*/
 	assert(page_alloc(&pp) == -E_NO_MEM);
@@ -381,7 +1139,7 @@ static void check_page_alloc()
 	assert(page_alloc(&pp) == -E_NO_MEM);
 
 	/* give free list back*/
-	page_free_list = fl;
+	return_free_pages(&fl);
 
 	/* free the pages we took */
 	page_free(pp0);
@@ -404,7 +1162,7 @@ static void check_boot_pgdir(void)
   pgdir = boot_pgdir;
 
   /* check pages array */
-  n = ROUNDUP(npage * sizeof(struct page), PGSIZE);
+  n = MIN(ROUNDUP(npage * sizeof(struct page), PGSIZE), (size_t) PTSIZE);
   for (i = 0; i < n; i += PGSIZE)
     assert(check_va2pa(pgdir, UPAGES + i) == PADDR(pages) + i);
   
@@ -412,24 +1170,40 @@ static void check_boot_pgdir(void)
   for (i = 0; KERNBASE + i != 0; i += PGSIZE)
     assert(check_va2pa(pgdir, KERNBASE + i) == i);
 
-  /* check kernel stack */
+  /* check kernel stacks */
   for (i = 0; i < KSTKSIZE; i += PGSIZE)
     assert(check_va2pa(pgdir, KSTACKTOP-KSTKSIZE+i) == PADDR(bootstack) + i);
+  for (n = 1; n < NCPU; n++) {
+    uintptr_t base = percpu_kstacktop(n) - KSTKSIZE;
+    for (i = 0; i < KSTKSIZE; i += PGSIZE)
+      assert(check_va2pa(pgdir, base + i) == PADDR(percpu_kstacks[n]) + i);
+    for (i = 0; i < KSTKGAP; i += PGSIZE)
+      assert(check_va2pa(pgdir, base - KSTKGAP + i) == ~0);
+  }
 
 	assert(check_va2pa(pgdir, KSTACKTOP - PTSIZE) == ~0);
 
   /* check for zero/non-zero in PDEs */
   for (i = 0; i < NPDENTRIES; i++) {
     switch (i) {
-    case PDX(VPT):
-    case PDX(UVPT):
+    case PDX(VPT) ... PDX(VPT + VPTSIZE - 1):
+    case PDX(UVPT) ... PDX(UVPT + VPTSIZE - 1):
     case PDX(KSTACKTOP-1):
     case PDX(UPAGES):
       assert(pgdir[i]);
       break;
+    case PDX(MMIOBASE):
+      /* mapped on demand by mmio_map_region() */
+      break;
+    case PDX(CODEBASE) ... PDX(CODELIM - 1):
+      /* mapped on demand by the code cache */
+      break;
+    case PDX(HEAPBASE) ... PDX(HEAPLIM - 1):
+      /* mapped by heap_map() */
+      break;
     default:
       if (i >= PDX(KERNBASE))
-        assert(pgdir[i]);
+        assert(pgdir[i] & PTE_PS);
       else
         assert(pgdir[i] == 0);
       break;
@@ -449,6 +1223,8 @@ static physaddr_t check_va2pa(pde_t *pgdir, uintptr_t va)
   pgdir = &pgdir[PDX(va)];
   if (!(*pgdir & PTE_P))
     return ~0;
+  if (*pgdir & PTE_PS)
+    return PTE_ADDR(*pgdir) + (PTX(va) << PTXSHIFT);
 
   p = (pte_t*) KADDR(PTE_ADDR(*pgdir));
   if (!(p[PTX(va)] & PTE_P))
@@ -456,37 +1232,323 @@ static physaddr_t check_va2pa(pde_t *pgdir, uintptr_t va)
 
   return PTE_ADDR(p[PTX(va)]);
 }
-    
+
+/* blocks of 2MB the large-page benchmark scans, and its passes */
+#define BENCH_BLOCKS  4
+#define BENCH_PASSES  8
+
+/* a heap sweep: one load from every page of 'n' 2MB blocks, at another
+   offset each pass; returns TSC cycles */
+static uint32_t bench_scan(char **blocks, int n)
+{
+  volatile char *p;
+  uint64_t start;
+  uint32_t pass, off;
+  int i;
+
+  start = read_tsc();
+  for (pass = 0; pass < BENCH_PASSES; pass++)
+    for (i = 0; i < n; i++)
+      for (off = pass * 64 % PGSIZE; off < PTSIZE; off += PGSIZE) {
+        p = blocks[i] + off;
+        (void) *p;
+      }
+  return read_tsc() - start;
+}
+
+/* times the same sweep through the 2MB pages of the KERNBASE mapping and
+   through 4KB pages mapped over the same memory in a heap range of its
+   own; each touch is a TLB miss with 4KB pages once the blocks outgrow
+   the TLB's reach.  interrupts are off while the aliases are mapped, so
+   that no other CPU runs this thread and caches them */
+void bench_large_pages(void)
+{
+  struct page *pp[BENCH_BLOCKS], *pgtab;
+  char *direct[BENCH_BLOCKS], *alias[BENCH_BLOCKS];
+  uint32_t small, large, off, touches, eflags;
+  uintptr_t win;
+  pte_t *pte;
+  int i, n;
+
+  for (n = 0; n < BENCH_BLOCKS; n++)
+    if (alloc_pages(PAGE_LARGE_ORDER, &pp[n]) != 0)
+      break;
+  if (n == 0) {
+    cprintf("bench_large_pages: no free 2MB blocks\n");
+    return;
+  }
+  eflags = irq_save();
+  spin_lock(&heap_lock);
+  win = heap_take(n * PTSIZE, PTSIZE);
+  spin_unlock(&heap_lock);
+  if (win == 0) {
+    irq_restore(eflags);
+    cprintf("bench_large_pages: no heap range left\n");
+    for (i = 0; i < n; i++)
+      free_pages(pp[i], PAGE_LARGE_ORDER);
+    return;
+  }
+
+  for (i = 0; i < n; i++) {
+    direct[i] = page2kva(pp[i]);
+    alias[i] = (char *) win + i * PTSIZE;
+    for (off = 0; off < PTSIZE; off += PGSIZE) {
+      if ((pte = pgdir_walk(boot_pgdir, alias[i] + off, 1)) == 0)
+        panic("bench_large_pages: out of page tables");
+      *pte = (page2pa(pp[i]) + off) | PTE_W | PTE_P;
+    }
+  }
+
+  /* a first pass of each warms the caches the second one is timed on */
+  bench_scan(alias, n);
+  small = bench_scan(alias, n);
+  bench_scan(direct, n);
+  large = bench_scan(direct, n);
+  touches = BENCH_PASSES * n * NPTENTRIES;
+  cprintf("bench_large_pages: %uMB sweep, %u cycles/page with 4KB pages, "
+          "%u with 2MB pages\n", n * PTSIZE >> 20, small / touches,
+          large / touches);
+
+  for (i = 0; i < n; i++) {
+    pgtab = pa2page(PTE_ADDR(boot_pgdir[PDX(alias[i])]));
+    boot_pgdir[PDX(alias[i])] = 0;
+    page_decref(pgtab);
+  }
+  lcr3(boot_cr3);
+  spin_lock(&heap_lock);
+  heap_give(win, n * PTSIZE);
+  spin_unlock(&heap_lock);
+  irq_restore(eflags);
+  for (i = 0; i < n; i++)
+    free_pages(pp[i], PAGE_LARGE_ORDER);
+}
+
+/* passes of the coloring benchmark */
+#define COLOR_PASSES  16
+
+/* one load from each cache line of the 'n' bytes at 'p', each pass, as
+   a heap scan does; returns TSC cycles */
+static uint32_t bench_stream(volatile char *p, uint32_t n)
+{
+  uint64_t start;
+  uint32_t pass, off;
+
+  start = read_tsc();
+  for (pass = 0; pass < COLOR_PASSES; pass++)
+    for (off = 0; off < n; off += 64)
+      (void) p[off];
+  return read_tsc() - start;
+}
+
+/* copies the 'n' bytes at 'src' to 'dst' each pass, as a copying
+   collector moves a semispace; returns TSC cycles */
+static uint32_t bench_copy(char *dst, char *src, uint32_t n)
+{
+  uint64_t start;
+  uint32_t pass;
+
+  start = read_tsc();
+  for (pass = 0; pass < COLOR_PASSES; pass++)
+    memmove(dst, src, n);
+  return read_tsc() - start;
+}
+
+/* times a scan of one semispace and a copy of it to another, each half
+   the size of the cache the colors are of, so that both fit it at once
+   if nothing else is there; the semispaces are mapped in a heap range of
+   their own with pages of one color, which is the worst an allocator can
+   do, as page_alloc() hands them out, and colored by their addresses;
+   the cache holds all of it only when colored */
+void bench_page_coloring(void)
+{
+  static const char *how[] = {
+    "one color", "page_alloc() order", "colored"
+  };
+  struct page *pp, *pgtab;
+  struct tlb_batch b;
+  char *src, *dst;
+  uint32_t n, i, k, lines, stream, copy, eflags;
+  pte_t *pte;
+  int r;
+
+  if (page_ncolor == 1) {
+    cprintf("bench_page_coloring: one cache color\n");
+    return;
+  }
+
+  /* taking pages of one color sorts page_ncolor pages for each, so that
+     stays within a quarter of free memory */
+  n = MIN(page_color_cache / 2, (uint32_t) PTSIZE / 2);
+  n = MIN(n, (uint32_t) (page_nfree / 4 / page_ncolor / 2) * PGSIZE);
+  n = ROUNDDOWN(n, PGSIZE);
+  if (n < 16 * PGSIZE) {
+    cprintf("bench_page_coloring: out of memory\n");
+    return;
+  }
+  eflags = irq_save();
+  spin_lock(&heap_lock);
+  src = (char *) heap_take(PTSIZE, PTSIZE);
+  spin_unlock(&heap_lock);
+  irq_restore(eflags);
+  if (src == 0) {
+    cprintf("bench_page_coloring: no heap range left\n");
+    return;
+  }
+  dst = src + n;
+
+  for (k = 0; k < 3; k++) {
+    for (i = 0; i < 2 * n / PGSIZE; i++) {
+      if (k == 0)
+        r = page_alloc_color(0, &pp);
+      else if (k == 1)
+        r = page_alloc(&pp);
+      else
+        r = page_alloc_color(VPN(src) + i, &pp);
+      if (r != 0 || (pte = pgdir_walk(boot_pgdir, src + i * PGSIZE, 1)) == 0)
+        panic("bench_page_coloring: out of memory");
+      pp->pp_ref = 1;
+      pte_write(pte, page2pa(pp) | PTE_W | PTE_P);
+    }
+
+    /* a first pass of each warms the caches the second one is timed on */
+    memset(src, 1, 2 * n);
+    bench_stream(src, n);
+    stream = bench_stream(src, n);
+    bench_copy(dst, src, n);
+    copy = bench_copy(dst, src, n);
+    lines = COLOR_PASSES * n / 64;
+    cprintf("bench_page_coloring: %uKB scan %u, copy %u cycles/line (%s)\n",
+            n / 1024, stream / lines, copy / lines, how[k]);
+
+    page_remove_range(boot_pgdir, (uintptr_t) src, 2 * n);
+  }
+
+  /* the page table goes only once no CPU can walk it */
+  pgtab = pa2page(PTE_ADDR(boot_pgdir[PDX(src)]));
+  pte_write(&boot_pgdir[PDX(src)], 0);
+  tlb_batch_init(&b);
+  tlb_batch_add(&b, (uintptr_t) src, PTSIZE);
+  tlb_batch_flush(&b);
+  page_decref(pgtab);
+  eflags = irq_save();
+  spin_lock(&heap_lock);
+  heap_give((uintptr_t) src, PTSIZE);
+  spin_unlock(&heap_lock);
+  irq_restore(eflags);
+  page_color_drain();
+}
+
 /* tracking of physical pages:
    the 'pages' array has one 'struct page' entry per physical page;
-   pages are reference counted, and free pages are kept on a linked list */
+   pages are reference counted, and free pages are kept by a binary buddy
+   allocator: free memory is a set of blocks of 2^order pages, each
+   aligned on its size and on the free list of its order; a block is
+   allocated by splitting the smallest free block that is large enough
+   in halves, and a freed block merges with its buddy -- the other half
+   of the block it was split from -- for as long as the buddy is free
+   too, so both take at most PAGE_NORDER steps */
+
+/* the ways of the L2 cache for AMD's 4-bit associativity codes; 0 for
+   fully associative or unknown */
+static const uint8_t amd_l2_ways[16] = {
+  0, 1, 2, 0, 4, 0, 8, 0, 16, 0, 32, 48, 64, 96, 128, 0
+};
 
-/* initialize page structure and memory free list; after this point, ONLY 
+/* pages whose addresses are equal modulo the span of one way of a
+   physically indexed cache compete for the same sets of it, and a page's
+   color is its page number modulo the pages in the span; the span is
+   that of the L2 cache, from CPUID leaf 4, or leaf 0x80000006 where the
+   first has nothing; a cache one page wide or none found leaves page
+   coloring off, with one color */
+static void page_color_init(void)
+{
+  uint32_t eax, ebx, ecx, max, i, ways, span = 0, size = 0;
+
+  cpuid(0, &max, 0, 0, 0);
+  for (i = 0; max >= 4 && i < 8; i++) {
+    cpuid_count(4, i, &eax, &ebx, &ecx, 0);
+    if ((eax & 0x1F) == 0)
+      break;
+    /* a data or unified cache, at level 2 */
+    if ((eax & 0x1F) != 2 && ((eax >> 5) & 0x7) == 2) {
+      ways = (ebx >> 22) + 1;
+      span = ((ebx & 0xFFF) + 1) * (((ebx >> 12) & 0x3FF) + 1) * (ecx + 1);
+      size = span * ways;
+    }
+  }
+  if (span == 0) {
+    cpuid(0x80000000, &max, 0, 0, 0);
+    if (max >= 0x80000006) {
+      cpuid(0x80000006, 0, 0, &ecx, 0);
+      size = (ecx >> 16) * 1024;
+      if ((ways = amd_l2_ways[(ecx >> 12) & 0xF]) != 0)
+        span = size / ways;
+    }
+  }
+
+  page_ncolor = 1;
+  page_color_order = 0;
+  while (page_ncolor * 2 * PGSIZE <= span && page_ncolor < PAGE_NCOLOR_MAX) {
+    page_ncolor *= 2;
+    page_color_order++;
+  }
+  page_color_cache = size;
+  for (i = 0; i < PAGE_NCOLOR_MAX; i++)
+    LIST_INIT(&page_color_list[i]);
+  page_ncolored = 0;
+  cprintf("page coloring: %u colors, for a %uKB L2 cache\n", page_ncolor,
+          size / 1024);
+}
+
+/* initialize page structure and memory free lists; after this point, ONLY 
    use the functions below to allocate and deallocate physical memory via 
-   the page_free_list, and NEVER use boot_alloc() or the related boot-time 
+   the free lists, and NEVER use boot_alloc() or the related boot-time 
    functions above */
 void page_init(void)
 {
-  struct page *pp0;
-
   int i;
   physaddr_t page_addr = 0;
-  LIST_INIT(&page_free_list);
+  uint32_t edx;
+
+  for (i = 0; i < PAGE_NORDER; i++)
+    LIST_INIT(&page_free_list[i]);
+  page_nfree = 0;
+  LIST_INIT(&page_high_list);
+  page_nhigh = 0;
+  LIST_INIT(&page_zero_list);
+  page_nzero = 0;
+  cpuid(1, 0, 0, 0, &edx);
+  page_zero_nt = (edx & CPUID_FEAT_SSE2) != 0;
+  page_color_init();
   for (i = 0; i < npage; i++, page_addr += PGSIZE) {
     pages[i].pp_ref = 0;
+    pages[i].pp_order = 0;
+    pages[i].pp_flags = 0;
 
     /* mark physical page 0 as in use; this way we preserve the real-mode IDT 
        and BIOS structures in case we ever need them (currently we don't) */
     if (page_addr == 0) continue;
  
+    /* the page the APs start up in; see boot_aps() */
+    if (page_addr == MPENTRY_PADDR) continue;
+
     /* mark IO hole [IOPHYSMEM, EXTPHYSMEM); mark it as in use so that it 
        can never be allocated */
     if (page_addr >= IOPHYSMEM && page_addr < EXTPHYSMEM) continue;
 
-    /* pages from ULIM and above, don't add them to free list */
-    if (page_addr >= ULIM) continue;
+    /* the kernel image and everything boot_alloc() handed out follow the
+       IO hole; they are in use for good */
+    if (page_addr >= EXTPHYSMEM && page_addr < PADDR(boot_freemem)) continue;
+
+    /* the holes in the memory map, and what the BIOS keeps for itself */
+    if (!mem_usable(page_addr)) continue;
 
-    LIST_INSERT_HEAD(&page_free_list, &pages[i], pp_link);
+    /* freed one at a time, the pages merge into the largest blocks the
+       holes between them allow */
+    if (i < nlowpage)
+      free_pages(&pages[i], 0);
+    else
+      page_free(&pages[i]);
   }
 }
 
@@ -496,6 +1558,389 @@ static void page_clear(struct page *pp)
   memset(pp, 0, sizeof(*pp));
 }
 
+/* the buddy of the block of 2^order pages at 'pp' */
+static inline struct page *page_buddy(struct page *pp, int order)
+{
+  return &pages[page2ppn(pp) ^ (1 << order)];
+}
+
+static void free_list_insert(struct page *pp, int order)
+{
+  pp->pp_order = order;
+  pp->pp_flags |= PP_FREE;
+  LIST_INSERT_HEAD(&page_free_list[order], pp, pp_link);
+}
+
+static void free_list_remove(struct page *pp)
+{
+  pp->pp_flags &= ~PP_FREE;
+  LIST_REMOVE(pp, pp_link);
+}
+
+/* takes a block of 2^order pages off the free lists, splitting a larger
+   one if need be; 0 if there is none; the caller holds page_lock */
+static struct page *buddy_alloc(int order)
+{
+  struct page *pp;
+  int o;
+
+  for (o = order; o < PAGE_NORDER; o++)
+    if (!LIST_EMPTY(&page_free_list[o]))
+      break;
+  if (o == PAGE_NORDER)
+    return 0;
+
+  /* split it down to size, freeing the upper halves */
+  pp = LIST_FIRST(&page_free_list[o]);
+  free_list_remove(pp);
+  while (o > order) {
+    o--;
+    free_list_insert(pp + (1 << o), o);
+  }
+  page_nfree -= 1 << order;
+
+  page_clear(pp);
+  pp->pp_order = order;
+  return pp;
+}
+
+/* puts a block on the free lists, merging it with its buddy while the
+   buddy is a free block of the same order; the caller holds page_lock */
+static void buddy_free(struct page *pp, int order)
+{
+  struct page *buddy;
+
+  page_nfree += 1 << order;
+  for (; order < PAGE_NORDER - 1; order++) {
+    buddy = page_buddy(pp, order);
+    if (buddy >= pages + nlowpage || !(buddy->pp_flags & PP_FREE) ||
+        buddy->pp_order != order)
+      break;
+    free_list_remove(buddy);
+    if (buddy < pp)
+      pp = buddy;
+  }
+  free_list_insert(pp, order);
+}
+
+/* per-CPU page magazines: page_alloc() and page_free() work on the
+   calling CPU's magazine, and take page_lock only to move PAGE_MAG_BATCH
+   pages between it and the free lists at once; interrupts are off while
+   they use it, so the thread can not be moved to another CPU halfway
+   through; pages in magazines are not on the free lists, so they can
+   not merge into larger blocks until they are drained */
+
+/* gives the 'n' least recently freed pages of 'm' back to the free lists;
+   the caller has interrupts off, since 'm' is its CPU's, and they stay
+   off while page_lock is held whoever the caller is */
+static void magazine_drain(struct page_magazine *m, uint32_t n)
+{
+  uint32_t i, eflags;
+
+  eflags = irq_save();
+  spin_lock(&page_lock);
+  for (i = 0; i < n; i++) {
+    m->pm_pages[i]->pp_flags &= ~PP_CACHED;
+    buddy_free(m->pm_pages[i], 0);
+  }
+  spin_unlock(&page_lock);
+  irq_restore(eflags);
+
+  memmove(m->pm_pages, m->pm_pages + n,
+          (m->pm_count - n) * sizeof(m->pm_pages[0]));
+  m->pm_count -= n;
+  m->pm_ndrain++;
+}
+
+/* empties this CPU's magazine */
+static void magazine_flush(void)
+{
+  struct page_magazine *m;
+  uint32_t eflags;
+
+  eflags = irq_save();
+  m = &thiscpu->cpu_pages;
+  if (m->pm_count)
+    magazine_drain(m, m->pm_count);
+  irq_restore(eflags);
+}
+
+/* allocates a block of 2^order physically contiguous pages, aligned on
+   its size; like page_alloc(), does not clear the pages or take a
+   reference; only the first page's struct is initialized, and it is the
+   one to pass to free_pages(); the block always comes from the free
+   lists, never from a magazine
+
+   on success, returns 0 and *pp_store is set to the first page of the
+   block; returns -E_NO_MEM if no free block is large enough, and -E_INVAL
+   for an order of PAGE_NORDER or more */
+int alloc_pages(int order, struct page **pp_store)
+{
+  struct page *pp;
+  uint32_t eflags;
+
+  if (order < 0 || order >= PAGE_NORDER)
+    return -E_INVAL;
+
+  /* interrupts are off while page_lock is held, as in page_alloc(), so
+     a thread is never preempted holding it */
+  eflags = irq_save();
+  spin_lock(&page_lock);
+  pp = buddy_alloc(order);
+  spin_unlock(&page_lock);
+  irq_restore(eflags);
+
+  /* the pages this CPU has cached, or the cleared or colored ones, may
+     complete a block */
+  if (!pp && order > 0) {
+    magazine_flush();
+    page_zero_drain();
+    page_color_drain();
+    eflags = irq_save();
+    spin_lock(&page_lock);
+    pp = buddy_alloc(order);
+    spin_unlock(&page_lock);
+    irq_restore(eflags);
+  }
+  if (!pp)
+    return -E_NO_MEM;
+  *pp_store = pp;
+  return 0;
+}
+
+/* returns a block from alloc_pages() to the free lists */
+void free_pages(struct page *pp, int order)
+{
+  uint32_t eflags;
+
+  assert(pp->pp_ref == 0 && !(pp->pp_flags & (PP_FREE | PP_CACHED)));
+  assert(order >= 0 && order < PAGE_NORDER);
+  assert(page2ppn(pp) % (1 << order) == 0);
+  page_clear(pp);
+
+  eflags = irq_save();
+  spin_lock(&page_lock);
+  buddy_free(pp, order);
+  spin_unlock(&page_lock);
+  irq_restore(eflags);
+}
+
+/* a page off the pool of cleared pages, or 0 if it is empty; 'want' says
+   the caller wants it for being cleared, and counts a hit or a miss */
+static struct page *page_zero_take(int want)
+{
+  struct page *pp;
+  uint32_t eflags;
+
+  eflags = irq_save();
+  spin_lock(&zero_lock);
+  if ((pp = LIST_FIRST(&page_zero_list)) != 0) {
+    LIST_REMOVE(pp, pp_link);
+    page_nzero--;
+    pp->pp_flags = 0;
+  }
+  if (want) {
+    if (pp)
+      page_zero_nhit++;
+    else
+      page_zero_nmiss++;
+  }
+  spin_unlock(&zero_lock);
+  irq_restore(eflags);
+  return pp;
+}
+
+/* gives the cleared pages back to the free lists, so they can merge */
+static void page_zero_drain(void)
+{
+  struct page *pp;
+
+  while ((pp = page_zero_take(0)) != 0)
+    free_pages(pp, 0);
+}
+
+/* clears a page with stores that go around the caches where the CPU has
+   them, so that filling the pool does not evict what the idle CPU's next
+   thread, or its neighbours on a shared cache, will want; the sfence makes
+   the stores visible before the page is put in the pool */
+static void page_zero_clear(void *va)
+{
+  uint32_t *p = va, *end = p + PGSIZE / sizeof(*p);
+
+  if (!page_zero_nt) {
+    memset(p, 0, PGSIZE);
+    return;
+  }
+  for (; p < end; p += 8)
+    __asm __volatile("movnti %1, 0(%0); movnti %1, 4(%0); "
+                     "movnti %1, 8(%0); movnti %1, 12(%0); "
+                     "movnti %1, 16(%0); movnti %1, 20(%0); "
+                     "movnti %1, 24(%0); movnti %1, 28(%0)"
+                     : : "r" (p), "r" (0) : "memory");
+  __asm __volatile("sfence" ::: "memory");
+}
+
+/* nonzero if the pool is short and there is memory enough to fill it;
+   read without zero_lock, so it is only a hint */
+int page_zero_wanted(void)
+{
+  return page_nzero < PAGE_ZERO_POOL && page_nfree > PAGE_ZERO_MINFREE;
+}
+
+/* clears one page for the pool, if it wants one; the scheduler runs it on
+   an idle CPU, with interrupts off, between looks at the run queue */
+void page_zero_idle(void)
+{
+  struct page *pp;
+  uint32_t eflags;
+
+  if (!page_zero_wanted() || page_alloc(&pp) != 0)
+    return;
+  page_zero_clear(page2kva(pp));
+
+  eflags = irq_save();
+  spin_lock(&zero_lock);
+  pp->pp_flags = PP_ZERO;
+  LIST_INSERT_HEAD(&page_zero_list, pp, pp_link);
+  page_nzero++;
+  page_zero_nfill++;
+  spin_unlock(&zero_lock);
+  irq_restore(eflags);
+}
+
+/* page_alloc(), but the page is cleared: it comes from the pool if it
+   can, and is cleared here otherwise; for page tables and memory that
+   must read as zero, so the clearing is mostly done before it is asked
+   for, by a CPU that had nothing else to do */
+int page_alloc_zeroed(struct page **pp_store)
+{
+  struct page *pp;
+  int r;
+
+  if ((pp = page_zero_take(1)) == 0) {
+    if ((r = page_alloc(&pp)) != 0)
+      return r;
+    memset(page2kva(pp), 0, PGSIZE);
+  }
+  *pp_store = pp;
+  return 0;
+}
+
+/* allocates a page of cache color 'color', modulo page_ncolor, like
+   page_alloc() does any page; when there is no free block to sort into
+   colors, it settles for a page of any color rather than fail */
+int page_alloc_color(uint32_t color, struct page **pp_store)
+{
+  struct page *pp, *blk;
+  uint32_t eflags, i;
+
+  if (page_ncolor == 1)
+    return page_alloc(pp_store);
+  color &= page_ncolor - 1;
+
+  eflags = irq_save();
+  spin_lock(&page_lock);
+  if (LIST_EMPTY(&page_color_list[color]) &&
+      (blk = buddy_alloc(page_color_order)) != 0) {
+    /* the block is aligned on its size, so page i is of color i */
+    for (i = 0; i < page_ncolor; i++) {
+      blk[i].pp_flags = PP_COLOR;
+      LIST_INSERT_HEAD(&page_color_list[i], &blk[i], pp_link);
+    }
+    page_ncolored += page_ncolor;
+  }
+  if ((pp = LIST_FIRST(&page_color_list[color])) != 0) {
+    LIST_REMOVE(pp, pp_link);
+    page_ncolored--;
+    page_clear(pp);
+  }
+  spin_unlock(&page_lock);
+  irq_restore(eflags);
+
+  if (!pp)
+    return page_alloc(pp_store);
+  *pp_store = pp;
+  return 0;
+}
+
+/* gives the sorted pages back to the free lists, so they can merge;
+   returns how many there were */
+static size_t page_color_drain(void)
+{
+  struct page *pp;
+  size_t n;
+  uint32_t eflags, i;
+
+  eflags = irq_save();
+  spin_lock(&page_lock);
+  n = page_ncolored;
+  for (i = 0; i < page_ncolor; i++)
+    while ((pp = LIST_FIRST(&page_color_list[i])) != 0) {
+      LIST_REMOVE(pp, pp_link);
+      page_clear(pp);
+      buddy_free(pp, 0);
+    }
+  page_ncolored = 0;
+  spin_unlock(&page_lock);
+  irq_restore(eflags);
+  return n;
+}
+
+/* a cleared page for memory the kernel reaches only through a mapping of
+   its own, such as the Java heap: from past the end of the KERNBASE map
+   while there are pages there, and from page_alloc_zeroed() otherwise;
+   a page from past the map is cleared through this CPU's window at
+   KMAPBASE, with interrupts off so that the thread stays on the CPU */
+int page_alloc_high(struct page **pp_store)
+{
+  struct page *pp;
+
+  if ((pp = page_high_take()) == 0)
+    return page_alloc_zeroed(pp_store);
+  page_high_fill(pp, 0);
+  *pp_store = pp;
+  return 0;
+}
+
+/* a page from past the end of the KERNBASE map, or 0 if there is none */
+static struct page *page_high_take(void)
+{
+  struct page *pp;
+  uint32_t eflags;
+
+  eflags = irq_save();
+  spin_lock(&page_lock);
+  if ((pp = LIST_FIRST(&page_high_list)) != 0) {
+    LIST_REMOVE(pp, pp_link);
+    page_nhigh--;
+    pp->pp_flags = 0;
+  }
+  spin_unlock(&page_lock);
+  irq_restore(eflags);
+  return pp;
+}
+
+/* fills the page 'pp' from past the KERNBASE map with a copy of the page
+   at 'src', or with zeros if 'src' is 0, through this CPU's window */
+static void page_high_fill(struct page *pp, const void *src)
+{
+  uint32_t eflags;
+  uintptr_t va;
+  pte_t *pte;
+
+  eflags = irq_save();
+  va = KMAPBASE + cpunum() * PGSIZE;
+  pte = pgdir_walk(boot_pgdir, (void *) va, 0);
+  pte_write(pte, page2pa(pp) | PTE_W | PTE_P);
+  if (src)
+    memmove((void *) va, src, PGSIZE);
+  else
+    memset((void *) va, 0, PGSIZE);
+  pte_write(pte, 0);
+  invlpg((void *) va);
+  irq_restore(eflags);
+}
+
 /* allocates a physical page; does NOT clear the contents of the page 
    to zero NOR increase the ref count -- the caller must do that if 
    necessary
@@ -504,12 +1949,34 @@ static void page_clear(struct page *pp)
    newly allocated page; otherwise, returns E_NO_MEM */
 int page_alloc(struct page **pp)
 {
-  *pp = LIST_FIRST(&page_free_list);
-  if (!*pp)
-    return -E_NO_MEM;
+  struct page_magazine *m;
+  uint32_t eflags, n;
+
+  eflags = irq_save();
+  m = &thiscpu->cpu_pages;
+  if (m->pm_count == 0) {
+    spin_lock(&page_lock);
+    for (n = 0; n < PAGE_MAG_BATCH; n++)
+      if ((m->pm_pages[n] = buddy_alloc(0)) == 0)
+        break;
+    spin_unlock(&page_lock);
+    if (n == 0) {
+      irq_restore(eflags);
+      /* the colored and the cleared pages are the last memory there is */
+      if (page_color_drain() > 0)
+        return page_alloc(pp);
+      if ((*pp = page_zero_take(0)) != 0)
+        return 0;
+      return -E_NO_MEM;
+    }
+    m->pm_count = n;
+    m->pm_nrefill++;
+  }
+  *pp = m->pm_pages[--m->pm_count];
+  m->pm_nalloc++;
+  irq_restore(eflags);
 
-  LIST_REMOVE(*pp, pp_link);
-  page_clear(*pp);
+  (*pp)->pp_flags = 0;
   return 0;
 }
 
@@ -517,9 +1984,187 @@ int page_alloc(struct page **pp)
    when pp->pp_ref reaches 0 */
 void page_free(struct page *pp)
 {
-  assert(pp->pp_ref == 0);
+  struct page_magazine *m;
+  uint32_t eflags;
+
+  assert(pp->pp_ref == 0 && !(pp->pp_flags & (PP_FREE | PP_CACHED)));
   page_clear(pp);
-  LIST_INSERT_HEAD(&page_free_list, pp, pp_link);
+
+  /* a page past the KERNBASE map goes back where only page_alloc_high()
+     looks for it */
+  if (page2ppn(pp) >= nlowpage) {
+    pp->pp_flags = PP_FREE;
+    eflags = irq_save();
+    spin_lock(&page_lock);
+    LIST_INSERT_HEAD(&page_high_list, pp, pp_link);
+    page_nhigh++;
+    spin_unlock(&page_lock);
+    irq_restore(eflags);
+    return;
+  }
+  pp->pp_flags = PP_CACHED;
+
+  eflags = irq_save();
+  m = &thiscpu->cpu_pages;
+  if (m->pm_count == PAGE_MAG_SIZE)
+    magazine_drain(m, PAGE_MAG_BATCH);
+  m->pm_pages[m->pm_count++] = pp;
+  m->pm_nfree++;
+  irq_restore(eflags);
+}
+
+/* counts the free blocks of each order; the magazines of other CPUs are
+   read without their owners stopping, so their count may be off */
+void page_stats(struct page_stats *st)
+{
+  struct page *pp;
+  uint32_t eflags;
+  int order, i;
+
+  memset(st, 0, sizeof(*st));
+  eflags = irq_save();
+  spin_lock(&page_lock);
+  st->ps_nfree = page_nfree;
+  st->ps_nhigh = page_nhigh;
+  st->ps_ncolored = page_ncolored;
+  for (order = 0; order < PAGE_NORDER; order++)
+    LIST_FOREACH(pp, &page_free_list[order], pp_link)
+      st->ps_nblocks[order]++;
+  spin_unlock(&page_lock);
+  irq_restore(eflags);
+  for (i = 0; i < ncpu; i++)
+    st->ps_ncached += cpus[i].cpu_pages.pm_count;
+  eflags = irq_save();
+  spin_lock(&zero_lock);
+  st->ps_nzero = page_nzero;
+  st->ps_zero_nhit = page_zero_nhit;
+  st->ps_zero_nmiss = page_zero_nmiss;
+  st->ps_zero_nfill = page_zero_nfill;
+  spin_unlock(&zero_lock);
+  irq_restore(eflags);
+}
+
+
+/* page-churn benchmark: a thread per started CPU allocates and frees
+   batches of pages at the same time, first straight from the free lists
+   and then through the page magazines; the cycles per page show what the
+   lock on the free lists costs once the CPUs contend for it ("make qemu
+   CPUS=4", then "bench churn").  the threads run with interrupts on like
+   any other, so a preemption or a move to another CPU shows up in their
+   cycles */
+#define CHURN_ITERS  2000
+#define CHURN_BATCH  32
+
+static int churn_phase;                   /* 1 through the magazines */
+static volatile uint32_t churn_ready;
+static volatile uint32_t churn_go;
+static volatile uint32_t churn_done;
+static uint32_t churn_cycles[NCPU];       /* per page, by thread */
+
+static void churn(void *arg)
+{
+  struct page *batch[CHURN_BATCH];
+  uint32_t me = (uint32_t) arg;
+  uint64_t start;
+  int i, j;
+
+  __asm __volatile("lock; incl %0" : "+m" (churn_ready) :: "memory");
+  while (!churn_go)
+    kthread_yield();
+
+  start = read_tsc();
+  for (i = 0; i < CHURN_ITERS; i++) {
+    for (j = 0; j < CHURN_BATCH; j++)
+      if ((churn_phase ? page_alloc(&batch[j])
+                       : alloc_pages(0, &batch[j])) != 0)
+        panic("churn: out of memory");
+    for (j = 0; j < CHURN_BATCH; j++) {
+      if (churn_phase)
+        page_free(batch[j]);
+      else
+        free_pages(batch[j], 0);
+    }
+  }
+  churn_cycles[me] =
+    (uint32_t) (read_tsc() - start) / (CHURN_ITERS * CHURN_BATCH);
+  __asm __volatile("lock; incl %0" : "+m" (churn_done) :: "memory");
+}
+
+void bench_page_churn(void)
+{
+  static const char *how[] = { "free lists", "magazines" };
+  uint32_t n = 0, i, sum;
+  int phase;
+
+  for (i = 0; i < ncpu; i++)
+    if (cpus[i].cpu_status == CPU_STARTED)
+      n++;
+
+  for (phase = 0; phase < 2; phase++) {
+    churn_phase = phase;
+    churn_ready = churn_done = 0;
+    xchg(&churn_go, 0);
+    for (i = 0; i < n; i++)
+      if (!kthread_create("churn", churn, (void *) i))
+        break;
+    if ((n = i) == 0) {
+      cprintf("bench_page_churn: no threads\n");
+      return;
+    }
+
+    /* start them together, once each has had a CPU */
+    while (churn_ready != n)
+      kthread_yield();
+    xchg(&churn_go, 1);
+    while (churn_done != n)
+      kthread_yield();
+
+    sum = 0;
+    for (i = 0; i < n; i++)
+      sum += churn_cycles[i];
+    cprintf("page churn through the %s: %u cycles per page and thread "
+            "(%d threads)\n", how[phase], sum / n, n);
+  }
+}
+
+/* times taking a cleared page from the pool against clearing one on the
+   spot, as page tables and the first touch of a heap reservation need;
+   the pool is filled here first, as idle CPUs would fill it */
+#define ZERO_BENCH_PAGES  64
+
+void bench_zero_pool(void)
+{
+  static struct page *pp[ZERO_BENCH_PAGES];
+  uint64_t start;
+  uint32_t pooled, cleared;
+  int i, n;
+
+  for (i = 0; i < ZERO_BENCH_PAGES; i++)
+    page_zero_idle();
+
+  start = read_tsc();
+  for (n = 0; n < ZERO_BENCH_PAGES; n++)
+    if (page_alloc_zeroed(&pp[n]) != 0)
+      break;
+  pooled = read_tsc() - start;
+  for (i = 0; i < n; i++)
+    page_free(pp[i]);
+  if (n == 0) {
+    cprintf("bench_zero_pool: out of memory\n");
+    return;
+  }
+
+  start = read_tsc();
+  for (i = 0; i < n; i++) {
+    assert(page_alloc(&pp[i]) == 0);
+    memset(page2kva(pp[i]), 0, PGSIZE);
+  }
+  cleared = read_tsc() - start;
+  for (i = 0; i < n; i++)
+    page_free(pp[i]);
+
+  cprintf("cleared page: %u cycles from the pool, %u clearing it then\n",
+          pooled / n, cleared / n);
 }
 
 /* decrement the reference count on a page, freeing it if there are no 
@@ -555,26 +2200,23 @@ static pte_t *pgdir_walk(pde_t *pgdir, const void *va, int create)
   pde_t *pde = &pgdir[PDX(va)];
   pte_t *pgtab;
   struct page *pp;
-  if (*pde & PTE_P) {
-    cprintf("pgdir_walk ==> present");
-    pgtab = (pte_t *) PTE_ADDR(*pde);
+
+  /* a 2MB page has no page table; what is mapped with them is never
+     looked up or remapped a page at a time */
+  if (*pde & PTE_PS) {
+    assert(!create);
+    return 0;
   }
+
+  if (*pde & PTE_P)
+    pgtab = (pte_t *) KADDR(PTE_ADDR(*pde));
   else {
-    cprintf("pgdir_walk ==> create\n");
-    if (!create || page_alloc(&pp) != 0) {
-      cprintf("pgdir_walk ==> not created (error)\n");
+    if (!create || page_alloc_zeroed(&pp) != 0)
       return 0;
-    }
-    pgtab = (pte_t *) page2pa(pp);
-    memset(pgtab, 0, PGSIZE);
+    pgtab = (pte_t *) page2kva(pp);
     pp->pp_ref = 1;
-    *pde = ((uintptr_t) pgtab << 12) | PTE_P | PTE_W | PTE_U;
+    *pde = page2pa(pp) | PTE_P | PTE_W | PTE_U;
   }
-  PRINTMEM("pgdir", pgdir);
-  PRINTMEM("PDX(va)", PDX(va));
-  PRINTMEM("pde", pde);
-  PRINTMEM("*pde", *pde);
-  PRINTMEM("pgtab", pgtab);
   return &pgtab[PTX(va)];
 }
 
@@ -590,19 +2232,37 @@ static pte_t *pgdir_walk(pde_t *pgdir, const void *va, int create)
    returns -E_NO_MEM, if page table couldn't be allocated */
 int page_insert(pde_t *pgdir, struct page *pp, void *va, int perm) 
 {
-  pde_t *pte;
-  cprintf("*** page_insert\n");
-  if (pgdir_walk(pgdir, va, 0 /* create */)) {
-    cprintf("*** page_remove\n");
-    page_remove(pgdir, va);
-  }
-  cprintf("*** page_insert: pgdir_walk #2\n");
+  pte_t *pte;
+
   pte = pgdir_walk(pgdir, va, 1 /* create */);
-  if (!pte) {
-    cprintf("*** page_insert: NO_MEM #2\n");
+  if (!pte)
     return -E_NO_MEM;
-  }
-  *pte = (page2pa(pp) << 12) | perm | PTE_P;
+
+  /* take the reference before removing the old mapping, so re-inserting
+     the page already mapped at 'va' does not free it */
+  pp->pp_ref++;
+  if (*pte & PTE_P)
+    page_remove(pgdir, va);
+  pte_write(pte, page2pa(pp) | perm | PTE_P);
+  return 0;
+}
+
+/* maps the block of 2^PAGE_LARGE_ORDER pages at 'pp' with one 2MB page
+   at 'va', which is 2MB aligned and has no page table yet; permissions
+   are 'perm|PTE_P|PTE_PS', and pp->pp_ref is incremented; such mappings
+   are for good, since page_remove() works a page at a time
+
+   returns 0 on success, and -E_INVAL if something is mapped at 'va'
+   already */
+int page_insert_large(pde_t *pgdir, struct page *pp, void *va, int perm)
+{
+  pde_t *pde = &pgdir[PDX(va)];
+
+  assert((uintptr_t) va % PTSIZE == 0 && page2pa(pp) % PTSIZE == 0);
+  if (*pde & PTE_P)
+    return -E_INVAL;
+  pp->pp_ref++;
+  pte_write(pde, page2pa(pp) | perm | PTE_P | PTE_PS);
   return 0;
 }
 
@@ -615,12 +2275,12 @@ int page_insert(pde_t *pgdir, struct page *pp, void *va, int perm)
 struct page *page_lookup(pde_t *pgdir, void *va, pte_t **ppte)
 {
   pte_t *pte = pgdir_walk(pgdir, va, 0 /* create */);
-  if (pte) {
-    *ppte = pte;
-    return pa2page(*pte >> 12);
-  }
-  else 
+
+  if (!pte || !(*pte & PTE_P))
     return 0;
+  if (ppte)
+    *ppte = pte;
+  return pa2page(PTE_ADDR(*pte));
 }
 
 /* unmaps the physical page at virtual address 'va'
@@ -635,21 +2295,58 @@ void page_remove(pde_t *pgdir, void *va)
   pte_t *pte;
   struct page *pp = page_lookup(pgdir, va, &pte);
   if (pp) {
-    *pte = 0;  
-    page_decref(pp);
+    pte_write(pte, 0);
     tlb_invalidate(pgdir, va);
+    page_decref(pp);
+  }
+}
+
+/* page_remove() for every page in [va, va + size), with one TLB flush
+   for all of them; the pages that lose their last reference are freed
+   after the flush, since until then another CPU may still reach them */
+void page_remove_range(pde_t *pgdir, uintptr_t va, size_t size)
+{
+  struct tlb_batch b;
+  struct pagelist dead;
+  struct page *pp;
+  uintptr_t end = va + size;
+  pte_t *pte;
+
+  tlb_batch_init(&b);
+  LIST_INIT(&dead);
+  for (va = ROUNDDOWN(va, PGSIZE); va < end; va += PGSIZE) {
+    /* skip the rest of a page table that is not there */
+    if (!(pgdir[PDX(va)] & PTE_P)) {
+      va = ROUNDDOWN(va, PTSIZE) + PTSIZE - PGSIZE;
+      continue;
+    }
+    if ((pp = page_lookup(pgdir, (void *) va, &pte)) == 0)
+      continue;
+    pte_write(pte, 0);
+    tlb_batch_add(&b, va, PGSIZE);
+    if (--pp->pp_ref == 0)
+      LIST_INSERT_HEAD(&dead, pp, pp_link);
+  }
+  tlb_batch_flush(&b);
+
+  while ((pp = LIST_FIRST(&dead)) != 0) {
+    LIST_REMOVE(pp, pp_link);
+    page_free(pp);
   }
-  else 
-    assert(0);
 }
 
 /* invalidate a TLB entry, but only if the page tables being edited are 
    the ones currently in use by the processor */
 void tlb_invalidate(pde_t *pgdir, void *va)
 {
+  struct tlb_batch b;
+
   /* flush the entry only if we're modifying the current address space;
-     for now, there is only one address space, so always invalidate */
-  invlpg(va);
+     for now, there is only one address space, so always invalidate, on
+     every CPU */
+  tlb_batch_init(&b);
+  tlb_batch_add(&b, (uintptr_t) va, PGSIZE);
+  tlb_batch_flush(&b);
 }
 
 void page_check(void)
@@ -675,8 +2372,7 @@ void page_check(void)
   assert(pp2 && pp2 != pp1 && pp2 != pp0);
 
   /* temporarily steal the rest of the free pages */
-  fl = page_free_list;
-  LIST_INIT(&page_free_list);
+  steal_free_pages(&fl);
 
   /* should be no free memory */
   assert(page_alloc(&pp) == -E_NO_MEM);
@@ -781,8 +2477,25 @@ void page_check(void)
 	boot_pgdir[0] = 0;
 	pp0->pp_ref = 0;
 
+  /* removing a range unmaps all of it with one flush, and frees the
+     pages it held the last references to, but not the page table */
+  page_free(pp0);
+  assert(page_insert(boot_pgdir, pp1, 0x0, 0) == 0);
+  assert(page_insert(boot_pgdir, pp1, (void *) PGSIZE, 0) == 0);
+  assert(page_insert(boot_pgdir, pp2, (void *) (3 * PGSIZE), 0) == 0);
+  assert(PTE_ADDR(boot_pgdir[0]) == page2pa(pp0) && pp1->pp_ref == 2);
+  page_remove_range(boot_pgdir, 0x0, 4 * PGSIZE);
+  for (i = 0; i < 4; i++)
+    assert(check_va2pa(boot_pgdir, i * PGSIZE) == ~0);
+  assert(pp0->pp_ref == 1 && pp1->pp_ref == 0 && pp2->pp_ref == 0);
+  assert(page_alloc(&pp) == 0 && (pp == pp1 || pp == pp2));
+  assert(page_alloc(&pp) == 0 && (pp == pp1 || pp == pp2));
+  assert(page_alloc(&pp) == -E_NO_MEM);
+  boot_pgdir[0] = 0;
+  pp0->pp_ref = 0;
+
   /* give free list back*/
-  page_free_list = fl;
+  return_free_pages(&fl);
 
   /* free the pages we took */
   page_free(pp0);
@@ -0,0 +1,402 @@
+/**
+ * @file sched.c
+ * @desc kernel threads and the preemptive round-robin scheduler
+ *
+ * every CPU runs sched_start() on its boot stack; it picks a thread off
+ * the shared run queue and swtch()es to it; the thread swtch()es back when
+ * it yields, exits or is preempted, always with sched_lock held and
+ * interrupts off
+ *
+ * the scheduler is tickless: the LAPIC timer is armed one-shot for a time
+ * slice only while some other thread is waiting for a CPU, so a thread
+ * that has a CPU to itself and an idle CPU sleeping in hlt take no timer
+ * interrupts at all; a thread made runnable wakes an idle CPU, or makes a
+ * busy CPU arm its timer, with a reschedule IPI
+ *
+ * threads that carry Java threads wait on the Java VM's run queues
+ * instead, once sched_set_java() installed them; a free CPU takes turns
+ * between the two, and the timer preempts a Java thread as it does any
+ * other, so a Java thread that spins can not keep the others off its CPU
+ */
+#include <x86.h>
+#include <string.h>
+#include <assert.h>
+#include <trap.h>
+#include <kern/cpu.h>
+#include <kern/pmap.h>
+#include <kern/sched.h>
+#include <kern/spinlock.h>
+
+struct kthread kthreads[NKTHREAD];
+static unsigned char kthread_stacks[NKTHREAD][KTHREAD_STKSIZE]
+__attribute__ ((aligned(PGSIZE)));
+
+/* guards everything below and the kthreads[] states */
+static struct spinlock sched_lock = SPINLOCK_INITIALIZER("sched_lock");
+
+static struct kthread *runq_head, *runq_tail;
+static uint32_t nrunnable;
+static uint32_t idle_cpus;      /* bitmask of CPUs halted in sched_start() */
+static struct sched_java java_sched;
+static int java_on;             /* java_sched is installed */
+
+void swtch(struct context **old, struct context *new);
+
+static void runq_push(struct kthread *t)
+{
+  if (t->kt_java && java_on) {
+    java_sched.sj_enqueue(t->kt_java, t);
+    return;
+  }
+  t->kt_next = 0;
+  if (runq_tail)
+    runq_tail->kt_next = t;
+  else
+    runq_head = t;
+  runq_tail = t;
+  nrunnable++;
+}
+
+static struct kthread *runq_pop(void)
+{
+  struct kthread *t = runq_head;
+
+  if (t) {
+    runq_head = t->kt_next;
+    if (!runq_head)
+      runq_tail = 0;
+    t->kt_next = 0;
+    nrunnable--;
+  }
+  return t;
+}
+
+/* nonzero if some thread waits for a CPU, in either run queue */
+static int runq_waiting(void)
+{
+  return runq_head || (java_on && java_sched.sj_nqueued() > 0);
+}
+
+/* the next thread for CPU 'c'; when both run queues hold threads, they
+   take turns, so that neither kind keeps the other off the CPU */
+static struct kthread *runq_next(struct cpuinfo *c)
+{
+  struct kthread *t = 0;
+
+  if (!java_on)
+    return runq_pop();
+  c->cpu_java_turn = !c->cpu_java_turn;
+  if (c->cpu_java_turn)
+    t = java_sched.sj_pick(c->cpu_id);
+  if (!t)
+    t = runq_pop();
+  if (!t && !c->cpu_java_turn)
+    t = java_sched.sj_pick(c->cpu_id);
+  return t;
+}
+
+/* a thread was just queued; get a CPU to pick it up: an idle CPU if there
+   is one, otherwise a busy CPU that is running without a time slice,
+   which then arms its timer; called with sched_lock held */
+static void runq_kick(void)
+{
+  struct cpuinfo *self = thiscpu;
+  uint32_t idle = idle_cpus & ~(1 << self->cpu_id);
+  int i;
+
+  if (idle) {
+    for (i = 0; !(idle & (1 << i)); i++)
+      ;
+    lapic_ipi_one(cpus[i].cpu_apicid, IRQ_OFFSET + IRQ_RESCHED);
+    return;
+  }
+
+  if (self->cpu_thread && !self->cpu_timer_armed) {
+    self->cpu_timer_armed = 1;
+    lapic_timer_oneshot(SCHED_SLICE_US);
+    return;
+  }
+
+  for (i = 0; i < ncpu; i++) {
+    if (&cpus[i] != self && cpus[i].cpu_thread && !cpus[i].cpu_timer_armed) {
+      lapic_ipi_one(cpus[i].cpu_apicid, IRQ_OFFSET + IRQ_RESCHED);
+      return;
+    }
+  }
+}
+
+/* switch from the current thread back to this CPU's scheduler loop; the
+   caller holds sched_lock, has interrupts off and has already changed
+   the thread's state */
+static void sched(void)
+{
+  struct kthread *t = thiscpu->cpu_thread;
+
+  assert(spin_holding(&sched_lock));
+  assert(!(read_eflags() & EFLAGS_IF));
+  assert(t->kt_state != KT_RUNNING);
+
+  t->kt_cycles += read_tsc() - t->kt_start;
+  swtch(&t->kt_context, thiscpu->cpu_scheduler);
+}
+
+/* a new thread's first swtch() lands here, with sched_lock held */
+static void kthread_entry(void)
+{
+  struct kthread *t = thiscpu->cpu_thread;
+
+  spin_unlock(&sched_lock);
+  __asm __volatile("sti" ::: "memory");
+
+  t->kt_fn(t->kt_arg);
+  kthread_exit();
+}
+
+struct kthread *kthread_create(const char *name, void (*fn)(void *),
+                               void *arg)
+{
+  return kthread_create_java(name, fn, arg, 0);
+}
+
+struct kthread *kthread_create_java(const char *name, void (*fn)(void *),
+                                    void *arg, void *java)
+{
+  struct kthread *t;
+  struct context *ctx;
+  uint32_t *sp, eflags;
+  int i;
+
+  eflags = irq_save();
+  spin_lock(&sched_lock);
+
+  for (i = 0; i < NKTHREAD && kthreads[i].kt_state != KT_FREE; i++)
+    ;
+  if (i == NKTHREAD) {
+    spin_unlock(&sched_lock);
+    irq_restore(eflags);
+    return 0;
+  }
+
+  t = &kthreads[i];
+  memset(t, 0, sizeof(*t));
+  t->kt_id = i;
+  t->kt_cpu = -1;
+  strncpy(t->kt_name, name, sizeof(t->kt_name) - 1);
+  t->kt_fn = fn;
+  t->kt_arg = arg;
+  t->kt_java = java;
+
+  /* build a stack that swtch() "returns" into kthread_entry() from; the
+     zero above the context is a fake return address for kthread_entry(),
+     which never returns */
+  sp = (uint32_t *) (kthread_stacks[i] + KTHREAD_STKSIZE);
+  *--sp = 0;
+  ctx = (struct context *) sp - 1;
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->eip = (uint32_t) kthread_entry;
+  t->kt_context = ctx;
+
+  t->kt_state = KT_RUNNABLE;
+  runq_push(t);
+  runq_kick();
+
+  spin_unlock(&sched_lock);
+  irq_restore(eflags);
+  return t;
+}
+
+struct kthread *kthread_current(void)
+{
+  struct kthread *t;
+  uint32_t eflags;
+
+  /* the thread may migrate between reading cpunum() and cpu_thread */
+  eflags = irq_save();
+  t = thiscpu->cpu_thread;
+  irq_restore(eflags);
+  return t;
+}
+
+/* give up the CPU to the next runnable thread, if there is one */
+void kthread_yield(void)
+{
+  struct kthread *t;
+  uint32_t eflags;
+
+  eflags = irq_save();
+  spin_lock(&sched_lock);
+  if (runq_waiting()) {
+    t = thiscpu->cpu_thread;
+    t->kt_state = KT_RUNNABLE;
+    runq_push(t);
+    sched();
+  }
+  spin_unlock(&sched_lock);
+  irq_restore(eflags);
+}
+
+void kthread_exit(void)
+{
+  irq_save();
+  spin_lock(&sched_lock);
+  thiscpu->cpu_thread->kt_state = KT_ZOMBIE;
+  sched();
+  panic("zombie thread resumed");
+}
+
+void kthread_park(volatile uint32_t *permit)
+{
+  uint32_t eflags;
+
+  eflags = irq_save();
+  spin_lock(&sched_lock);
+  if (*permit == 0) {
+    thiscpu->cpu_thread->kt_state = KT_PARKED;
+    sched();
+  }
+  spin_unlock(&sched_lock);
+  irq_restore(eflags);
+}
+
+void kthread_unpark(struct kthread *t)
+{
+  uint32_t eflags;
+
+  eflags = irq_save();
+  spin_lock(&sched_lock);
+  if (t->kt_state == KT_PARKED) {
+    t->kt_state = KT_RUNNABLE;
+    runq_push(t);
+    runq_kick();
+  }
+  spin_unlock(&sched_lock);
+  irq_restore(eflags);
+}
+
+void sched_set_java(const struct sched_java *sj)
+{
+  uint32_t eflags;
+
+  eflags = irq_save();
+  spin_lock(&sched_lock);
+  java_sched = *sj;
+  java_on = 1;
+  spin_unlock(&sched_lock);
+  irq_restore(eflags);
+}
+
+/* the time slice of the thread running on this CPU is over; called from
+   trap() with interrupts off */
+void sched_tick(void)
+{
+  struct cpuinfo *c = thiscpu;
+  struct kthread *t = c->cpu_thread;
+
+  c->cpu_timer_armed = 0;
+  if (!t)
+    return;
+
+  spin_lock(&sched_lock);
+  if (runq_waiting()) {
+    t->kt_npreempt++;
+    t->kt_state = KT_RUNNABLE;
+    runq_push(t);
+    sched();
+  }
+  /* otherwise nobody is waiting, and the thread keeps its CPU with no
+     timer until runq_kick() asks for a slice again */
+  spin_unlock(&sched_lock);
+}
+
+/* a reschedule IPI; an idle CPU just returns to its scheduler loop, a
+   busy one starts timing the current thread's slice */
+void sched_ipi(void)
+{
+  struct cpuinfo *c = thiscpu;
+
+  if (c->cpu_thread && !c->cpu_timer_armed) {
+    c->cpu_timer_armed = 1;
+    lapic_timer_oneshot(SCHED_SLICE_US);
+  }
+}
+
+uint32_t sched_nrunnable(void)
+{
+  return nrunnable + (java_on ? java_sched.sj_nqueued() : 0);
+}
+
+/* the whole stack of every thread that has one, not just the part in use,
+   and without sched_lock: words may go stale while they are scanned, so
+   callers must not rely on a miss alone */
+int kthread_stack_refs(uintptr_t lo, uintptr_t hi)
+{
+  uint32_t *w, *end;
+  int i;
+
+  for (i = 0; i < NKTHREAD; i++) {
+    if (kthreads[i].kt_state == KT_FREE)
+      continue;
+    w = (uint32_t *) kthread_stacks[i];
+    end = (uint32_t *) (kthread_stacks[i] + KTHREAD_STKSIZE);
+    for (; w < end; w++)
+      if (*w >= lo && *w < hi)
+        return 1;
+  }
+  return 0;
+}
+
+void sched_start(void)
+{
+  struct cpuinfo *c = thiscpu;
+  struct kthread *t;
+  uint64_t start;
+
+  __asm __volatile("cli" ::: "memory");
+  for (;;) {
+    spin_lock(&sched_lock);
+    idle_cpus &= ~(1 << c->cpu_id);
+
+    if ((t = runq_next(c)) == 0) {
+      /* nothing to run; clear pages for page_alloc_zeroed() while its
+         pool is short, one at a time so a new thread waits for at most
+         one, and then sleep until an interrupt, with the timer off;
+         "sti; hlt" cannot be interrupted in between, so a reschedule
+         IPI sent after we marked ourselves idle still wakes us up */
+      if (page_zero_wanted()) {
+        spin_unlock(&sched_lock);
+        page_zero_idle();
+        continue;
+      }
+      idle_cpus |= 1 << c->cpu_id;
+      spin_unlock(&sched_lock);
+      c->cpu_timer_armed = 0;
+      lapic_timer_stop();
+      c->cpu_nidle++;
+      start = read_tsc();
+      __asm __volatile("sti; hlt; cli" ::: "memory");
+      c->cpu_idle_cycles += read_tsc() - start;
+      continue;
+    }
+
+    t->kt_state = KT_RUNNING;
+    t->kt_cpu = c->cpu_id;
+    t->kt_nruns++;
+    c->cpu_thread = t;
+
+    /* only time the slice if someone else is waiting for a CPU */
+    c->cpu_timer_armed = runq_waiting();
+    if (c->cpu_timer_armed)
+      lapic_timer_oneshot(SCHED_SLICE_US);
+    else
+      lapic_timer_stop();
+
+    t->kt_start = read_tsc();
+    swtch(&c->cpu_scheduler, t->kt_context);
+
+    /* the thread yielded, was preempted or exited */
+    c->cpu_thread = 0;
+    if (t->kt_state == KT_ZOMBIE)
+      t->kt_state = KT_FREE;
+    spin_unlock(&sched_lock);
+  }
+}
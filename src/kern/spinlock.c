@@ -0,0 +1,50 @@
+/**
+ * @file spinlock.c
+ * @desc mutual exclusion spin locks
+ */
+#include <x86.h>
+#include <assert.h>
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+
+void spin_initlock(struct spinlock *lk, const char *name)
+{
+  lk->locked = 0;
+  lk->name = name;
+  lk->cpu = 0;
+}
+
+/* check whether this CPU is holding the lock */
+int spin_holding(struct spinlock *lk)
+{
+  return lk->locked && lk->cpu == thiscpu;
+}
+
+/* acquire the lock; loops (spins) until the lock is acquired; holding a
+   lock for a long time may cause other CPUs to waste time spinning */
+void spin_lock(struct spinlock *lk)
+{
+  if (spin_holding(lk))
+    panic("CPU %d cannot acquire %s: already holding", cpunum(), lk->name);
+
+  /* the xchg is atomic; spin on a plain read in between, so that waiting
+     CPUs do not keep stealing the lock's cache line from each other */
+  while (xchg(&lk->locked, 1) != 0)
+    while (lk->locked)
+      __asm __volatile("pause");
+
+  lk->cpu = thiscpu;
+}
+
+/* release the lock */
+void spin_unlock(struct spinlock *lk)
+{
+  if (!spin_holding(lk))
+    panic("CPU %d cannot release %s: not holding", cpunum(), lk->name);
+
+  lk->cpu = 0;
+
+  /* the xchg serializes, so the stores in the critical section are
+     visible to other CPUs before the lock is released */
+  xchg(&lk->locked, 0);
+}
@@ -0,0 +1,146 @@
+/**
+ * @file tlb.c
+ * @desc batched TLB invalidation and cross-CPU shootdown
+ *
+ * there is one address space, so any CPU may hold a stale entry for a
+ * kernel mapping that changes; a flush invalidates on this CPU, then asks
+ * every other started CPU to do the same with one broadcast IPI, and
+ * waits until each has; one shootdown runs at a time, under tlb_locked:
+ * the batch is published in tlb_req and numbered by tlb_gen, and a CPU
+ * is done with it once its cpu_tlb_gen has caught up
+ *
+ * a CPU waits for tlb_locked with interrupts off, so while it waits it
+ * does any shootdown asked of it itself; otherwise two CPUs flushing at
+ * once would each wait for the other to take its IPI
+ */
+#include <x86.h>
+#include <trap.h>
+#include <vmmap.h>
+#include <kern/cpu.h>
+#include <kern/tlb.h>
+
+static volatile uint32_t tlb_locked;
+static struct tlb_batch tlb_req;          /* the shootdown under way */
+static volatile uint32_t tlb_gen;         /* shootdowns asked for so far */
+static struct tlb_stats tlb_counts;       /* guarded by tlb_locked */
+
+
+void tlb_batch_init(struct tlb_batch *b)
+{
+  b->tb_nranges = 0;
+  b->tb_npages = 0;
+  b->tb_all = 0;
+}
+
+void tlb_batch_add(struct tlb_batch *b, uintptr_t va, size_t size)
+{
+  struct tlb_range *r;
+  uintptr_t start, end;
+
+  if (b->tb_all || size == 0)
+    return;
+  start = ROUNDDOWN(va, PGSIZE);
+  end = ROUNDUP(va + size, PGSIZE);
+  b->tb_npages += (end - start) / PGSIZE;
+  if (end <= start || b->tb_npages > TLB_FLUSH_PAGES) {
+    b->tb_all = 1;
+    return;
+  }
+
+  /* ranges mostly come in address order, so only the last one is tried */
+  if (b->tb_nranges > 0) {
+    r = &b->tb_ranges[b->tb_nranges - 1];
+    if (start <= r->tr_end && end >= r->tr_start) {
+      r->tr_start = MIN(r->tr_start, start);
+      r->tr_end = MAX(r->tr_end, end);
+      return;
+    }
+  }
+  if (b->tb_nranges == TLB_BATCH_RANGES) {
+    b->tb_all = 1;
+    return;
+  }
+  r = &b->tb_ranges[b->tb_nranges++];
+  r->tr_start = start;
+  r->tr_end = end;
+}
+
+/* invalidates the batch on this CPU; returns the pages done with invlpg,
+   0 after a CR3 reload */
+static uint32_t tlb_apply(const struct tlb_batch *b)
+{
+  uintptr_t va;
+  uint32_t i, n = 0;
+
+  if (b->tb_all) {
+    lcr3(rcr3());
+    return 0;
+  }
+  for (i = 0; i < b->tb_nranges; i++)
+    for (va = b->tb_ranges[i].tr_start; va < b->tb_ranges[i].tr_end;
+         va += PGSIZE, n++)
+      invlpg((void *) va);
+  return n;
+}
+
+void tlb_shootdown(void)
+{
+  struct cpuinfo *c = thiscpu;
+  uint32_t gen = tlb_gen;
+
+  /* tlb_req was written before tlb_gen moved, and stays as it is until
+     this CPU catches up */
+  __asm __volatile("" ::: "memory");
+  if (c->cpu_tlb_gen == gen)
+    return;
+  tlb_apply(&tlb_req);
+  c->cpu_tlb_gen = gen;
+}
+
+void tlb_batch_flush(struct tlb_batch *b)
+{
+  uint32_t eflags, gen, wait = 0, n;
+  int i, me;
+
+  if (!b->tb_all && b->tb_nranges == 0)
+    return;
+
+  eflags = irq_save();
+  while (xchg(&tlb_locked, 1) != 0) {
+    tlb_shootdown();
+    __asm __volatile("pause");
+  }
+
+  n = tlb_apply(b);
+  tlb_counts.ts_nflush++;
+  if (b->tb_all)
+    tlb_counts.ts_nall++;
+  tlb_counts.ts_npages += n;
+
+  /* CPUs started later begin with an empty TLB */
+  me = cpunum();
+  for (i = 0; i < ncpu; i++)
+    if (i != me && cpus[i].cpu_status == CPU_STARTED)
+      wait |= 1 << i;
+  if (wait) {
+    tlb_req = *b;
+    __asm __volatile("" ::: "memory");
+    gen = ++tlb_gen;
+    cpus[me].cpu_tlb_gen = gen;
+    lapic_ipi(IRQ_OFFSET + IRQ_TLB);
+    tlb_counts.ts_nipi++;
+    for (i = 0; i < ncpu; i++)
+      if (wait & (1 << i))
+        while (cpus[i].cpu_tlb_gen != gen)
+          __asm __volatile("pause");
+  }
+
+  xchg(&tlb_locked, 0);
+  irq_restore(eflags);
+  tlb_batch_init(b);
+}
+
+void tlb_stats(struct tlb_stats *st)
+{
+  *st = tlb_counts;
+}
@@ -0,0 +1,170 @@
+/**
+ * @file trap.c
+ * @desc interrupt descriptor table and trap dispatch; everything runs in
+ *       the kernel, so a trap never changes stacks and trap() returns to
+ *       resume the interrupted context
+ */
+#include <x86.h>
+#include <mmu.h>
+#include <assert.h>
+#include <kern/trap.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+#include <kern/sched.h>
+#include <kern/tlb.h>
+#include <kern/monitor.h>
+
+/* interrupt descriptor table; must be built at run time because shifted
+   function addresses can't be represented in relocation records */
+struct gatedesc idt[256] = { { 0 } };
+struct pseudodesc idt_pd = {
+  sizeof(idt) - 1, (uint32_t) idt
+};
+
+static const char *trapname(int trapno)
+{
+  static const char * const excnames[] = {
+    "Divide error",
+    "Debug",
+    "Non-Maskable Interrupt",
+    "Breakpoint",
+    "Overflow",
+    "BOUND Range Exceeded",
+    "Invalid Opcode",
+    "Device Not Available",
+    "Double Fault",
+    "Coprocessor Segment Overrun",
+    "Invalid TSS",
+    "Segment Not Present",
+    "Stack Fault",
+    "General Protection",
+    "Page Fault",
+    "(unknown trap)",
+    "x87 FPU Floating-Point Error",
+    "Alignment Check",
+    "Machine-Check",
+    "SIMD Floating-Point Exception"
+  };
+
+  if (trapno < sizeof(excnames)/sizeof(excnames[0]))
+    return excnames[trapno];
+  if (trapno == IRQ_OFFSET + IRQ_TIMER)
+    return "Timer";
+  if (trapno == IRQ_OFFSET + IRQ_RESCHED)
+    return "Reschedule IPI";
+  if (trapno == IRQ_OFFSET + IRQ_TLB)
+    return "TLB shootdown IPI";
+  if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + 16)
+    return "Hardware Interrupt";
+  return "(unknown trap)";
+}
+
+/* fill in the IDT from the (trap number, handler) pairs that trapentry.S
+   collects in trap_handlers; all gates are interrupt gates, so handlers
+   run with interrupts off until they return */
+void idt_init(void)
+{
+  extern uint32_t trap_handlers[];
+  uint32_t *p;
+
+  for (p = trap_handlers; p[1] != 0; p += 2)
+    SETGATE(idt[p[0]], 0, GD_KT, p[1], p[0] == T_BRKPT ? DPL_USER : 0);
+}
+
+/* per-CPU part of trap setup: load the IDT, and set up this CPU's task
+   state segment, so that the processor finds its kernel stack when it
+   enters the kernel from user mode */
+void trap_init_percpu(void)
+{
+  struct taskstate *ts = &thiscpu->cpu_ts;
+  int i = cpunum();
+
+  ts->ts_esp0 = percpu_kstacktop(i);
+  ts->ts_ss0 = GD_KD;
+  ts->ts_iomb = sizeof(struct taskstate);
+
+  gdt[(GD_TSS0 >> 3) + i] = SEG16(STS_T32A, (uint32_t) ts,
+                                  sizeof(struct taskstate) - 1, 0);
+  gdt[(GD_TSS0 >> 3) + i].s = 0;
+  ltr(GD_TSS0 + (i << 3));
+
+  lidt(&idt_pd);
+}
+
+void print_regs(struct pushregs *regs)
+{
+  cprintf("  edi  0x%08x\n", regs->reg_edi);
+  cprintf("  esi  0x%08x\n", regs->reg_esi);
+  cprintf("  ebp  0x%08x\n", regs->reg_ebp);
+  cprintf("  oesp 0x%08x\n", regs->reg_oesp);
+  cprintf("  ebx  0x%08x\n", regs->reg_ebx);
+  cprintf("  edx  0x%08x\n", regs->reg_edx);
+  cprintf("  ecx  0x%08x\n", regs->reg_ecx);
+  cprintf("  eax  0x%08x\n", regs->reg_eax);
+}
+
+void print_trapframe(struct trapframe *tf)
+{
+  cprintf("TRAP frame at %p from CPU %d\n", tf, cpunum());
+  print_regs(&tf->tf_regs);
+  cprintf("  es   0x----%04x\n", tf->tf_es);
+  cprintf("  ds   0x----%04x\n", tf->tf_ds);
+  cprintf("  trap 0x%08x %s\n", tf->tf_trapno, trapname(tf->tf_trapno));
+  if (tf->tf_trapno == T_PGFLT)
+    cprintf("  cr2  0x%08x\n", rcr2());
+  cprintf("  err  0x%08x\n", tf->tf_err);
+  cprintf("  eip  0x%08x\n", tf->tf_eip);
+  cprintf("  cs   0x----%04x\n", tf->tf_cs);
+  cprintf("  flag 0x%08x\n", tf->tf_eflags);
+}
+
+void trap(struct trapframe *tf)
+{
+  switch (tf->tf_trapno) {
+  case T_BRKPT:
+    monitor(tf);
+    return;
+
+  case T_PGFLT:
+    /* a first touch of a heap reservation, or a write to a page it
+       shares; anything else is a bug */
+    if (heap_fault(rcr2(), tf->tf_err) == 0)
+      return;
+    break;
+
+  case IRQ_OFFSET + IRQ_TIMER:
+    lapic_eoi();
+    sched_tick();
+    return;
+
+  case IRQ_OFFSET + IRQ_RESCHED:
+    /* wakes an idle CPU out of hlt, and its scheduler loop notices the
+       new work when the interrupt returns; a busy CPU starts timing its
+       thread's slice */
+    lapic_eoi();
+    sched_ipi();
+    return;
+
+  case IRQ_OFFSET + IRQ_TLB:
+    lapic_eoi();
+    tlb_shootdown();
+    return;
+
+  case IRQ_OFFSET + IRQ_SPURIOUS:
+    /* spurious interrupts are not acknowledged */
+    cprintf("spurious interrupt on irq 7\n");
+    return;
+
+  case IRQ_OFFSET + IRQ_ERROR:
+    cprintf("APIC error on CPU %d\n", cpunum());
+    lapic_eoi();
+    return;
+
+  default:
+    break;
+  }
+
+  print_trapframe(tf);
+  panic("unhandled trap %d (%s) in kernel", tf->tf_trapno,
+        trapname(tf->tf_trapno));
+}
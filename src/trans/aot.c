@@ -0,0 +1,325 @@
+/**
+ * @file aot.c
+ * @desc ahead-of-time compilation: baseline code saved as an image
+ *
+ * the baseline compiler's code refers to the VM objects it uses by their
+ * addresses, which it records as relocations; the image names each of them
+ * instead, by looking through the bytecode for what the code may refer to,
+ * so a relocation whose address is in none of those stops the method from
+ * going into the image
+ *
+ * @author cjeong
+ */
+#include <string.h>
+#include <java/java_instr.h>
+#include <java/java_vm.h>
+#include <java/java_runtime.h>
+#include <java/java_trans.h>
+#include <java/java_aot.h>
+
+static JavaConstInfo *cp_const(JavaClassFile *cf, u2 i,
+                               JavaConstInfo::JavaConstE tag)
+{
+  JavaConstInfo *c;
+
+  if (!cf || i == 0 || i >= cf->numConsts())
+    return 0;
+  c = cf->consts()[i];
+  return c && c->tag() == tag ? c : 0;
+}
+
+/* the name of the class entry 'i' of 'cf'; 0 if there is none */
+static JavaUtf8Info *cp_class_name(JavaClassFile *cf, u2 i)
+{
+  JavaClassInfo *ci;
+
+  ci = (JavaClassInfo *) cp_const(cf, i, JavaConstInfo::ConstClass);
+  if (!ci)
+    return 0;
+  return (JavaUtf8Info *) cp_const(cf, ci->nameIndex,
+                                   JavaConstInfo::ConstUtf8);
+}
+
+template <class T>
+static void append(std::vector<u1> &image, const std::vector<T> &v)
+{
+  const u1 *p = v.empty() ? 0 : (const u1 *) &v[0];
+
+  image.insert(image.end(), p, p + v.size() * sizeof(T));
+}
+
+
+JavaAotCompiler::JavaAotCompiler() : _numRejected(0)
+{
+  _strings.push_back('\0');
+}
+
+/* images are built offline, so the tables are searched linearly */
+u4 JavaAotCompiler::string(const char *s, u4 length)
+{
+  u4 i = 0, n;
+
+  while (i < _strings.size()) {
+    n = strlen(&_strings[i]);
+    if (n == length && memcmp(&_strings[i], s, length) == 0)
+      return i;
+    i += n + 1;
+  }
+  _strings.insert(_strings.end(), s, s + length);
+  _strings.push_back('\0');
+  return i;
+}
+
+u4 JavaAotCompiler::symbol(u2 kind, u2 arg, u4 owner, u4 name, u4 desc)
+{
+  JavaAotSymbol s;
+  u4 i;
+
+  for (i = 0; i < _symbols.size(); i++)
+    if (_symbols[i].kind == kind && _symbols[i].arg == arg &&
+        _symbols[i].owner == owner && _symbols[i].name == name &&
+        _symbols[i].desc == desc)
+      return i;
+  s.kind = kind;
+  s.arg = arg;
+  s.owner = owner;
+  s.name = name;
+  s.desc = desc;
+  _symbols.push_back(s);
+  return i;
+}
+
+/* array classes and classes made by hand have no classfile, and so no
+   name */
+bool JavaAotCompiler::className(JavaVMClass *c, u4 *name)
+{
+  JavaClassFile *cf = c ? c->classFile() : 0;
+  JavaUtf8Info *u;
+
+  if (!cf || (u = cp_class_name(cf, cf->thisClass())) == 0)
+    return false;
+  *name = string(u->bytes, u->length);
+  return true;
+}
+
+bool JavaAotCompiler::methodSymbol(JavaVMMethod *m, u2 kind, u2 arg, u4 *sym)
+{
+  u4 owner;
+
+  if (!m->name() || !m->desc() || !className(m->javaClass(), &owner))
+    return false;
+  *sym = symbol(kind, arg, owner, string(m->name(), strlen(m->name())),
+                string(m->desc(), strlen(m->desc())));
+  return true;
+}
+
+void JavaAotCompiler::target(const void *p, u4 size, u4 sym)
+{
+  JavaAotTarget t;
+
+  t.lo = (u4) (uintptr) p;
+  t.size = size;
+  t.symbol = sym;
+  _targets.push_back(t);
+}
+
+/* what the code of 'm' may refer to: the method, its OSR points, the
+   methods it calls, and the classes and static fields its instructions
+   name */
+bool JavaAotCompiler::collect(JavaVMMethod *m, JavaTranslator &t)
+{
+  JavaClassFile *cf = m->javaClass()->classFile();
+  JavaVMCpEntry *cp = m->cpool();
+  const u1 *code = m->code();
+  JavaFieldrefInfo *f;
+  JavaNameAndTypeInfo *nt;
+  JavaUtf8Info *u, *n;
+  JavaVMMethod *callee;
+  u4 pc, i, sym, owner;
+  u2 idx;
+  u1 op;
+
+  _targets.clear();
+  if (!methodSymbol(m, JavaAotMethodSym, 0, &sym))
+    return false;
+  target(m, sizeof(*m), sym);
+  for (i = 0; i < t.osrLabels().size(); i++) {
+    pc = t.osrLabels()[i].first;
+    methodSymbol(m, JavaAotOsrSym, pc, &sym);
+    target(m->osrPoint(pc), sizeof(JavaOsrPoint), sym);
+  }
+  if (m->isSynchronized() && m->isStatic()) {
+    className(m->javaClass(), &owner);
+    target(m->syncObject(0), 1, symbol(JavaAotMirrorSym, 0, owner, 0, 0));
+  }
+
+  for (pc = 0; pc < m->codeLength(); pc += jopLength(code, pc)) {
+    op = code[pc];
+    switch (op) {
+    case JOP_LDC: case JOP_LDC_W:
+      /* a string is pushed as its address, which has no name */
+      idx = op == JOP_LDC ? code[pc + 1] : jopU2(code + pc + 1);
+      if (!cp_const(cf, idx, JavaConstInfo::ConstInteger) &&
+          !cp_const(cf, idx, JavaConstInfo::ConstFloat))
+        return false;
+      break;
+    case JOP_INVOKEVIRTUAL: case JOP_INVOKESPECIAL:
+    case JOP_INVOKESTATIC: case JOP_INVOKEINTERFACE:
+      callee = cp[jopU2(code + pc + 1)].method;
+      if (!methodSymbol(callee, JavaAotMethodSym, 0, &sym))
+        return false;
+      target(callee, sizeof(*callee), sym);
+      break;
+    case JOP_NEW: case JOP_CHECKCAST: case JOP_INSTANCEOF:
+      idx = jopU2(code + pc + 1);
+      if ((u = cp_class_name(cf, idx)) == 0)
+        return false;
+      target(cp[idx].klass, 1, symbol(JavaAotClassSym, 0,
+                                      string(u->bytes, u->length), 0, 0));
+      break;
+    case JOP_NEWARRAY: case JOP_ANEWARRAY:
+      i = op == JOP_NEWARRAY ? code[pc + 1] : 0;
+      target(JavaRuntime::arrayClass(i), 1,
+             symbol(JavaAotArrayClassSym, i, 0, 0, 0));
+      break;
+    case JOP_GETSTATIC: case JOP_PUTSTATIC:
+      idx = jopU2(code + pc + 1);
+      f = (JavaFieldrefInfo *) cp_const(cf, idx, JavaConstInfo::ConstFieldref);
+      if (!f || (u = cp_class_name(cf, f->classIndex)) == 0)
+        return false;
+      nt = (JavaNameAndTypeInfo *)
+        cp_const(cf, f->nameAndTypeIndex, JavaConstInfo::ConstNameAndType);
+      if (!nt ||
+          !(n = (JavaUtf8Info *) cp_const(cf, nt->nameIndex,
+                                          JavaConstInfo::ConstUtf8)))
+        return false;
+      sym = symbol(JavaAotStaticSym, 0, string(u->bytes, u->length),
+                   string(n->bytes, n->length), 0);
+      target(cp[idx].addr,
+             cp[idx].type == 'J' || cp[idx].type == 'D' ? 8 : 4, sym);
+      break;
+    }
+  }
+  return true;
+}
+
+/* the buffer's relocations in the image's terms; an address is matched to
+   the target that starts there before one that only covers it, since a
+   static field may sit right after another */
+bool JavaAotCompiler::relocate(JavaCodeBuffer &buf,
+                               std::vector<JavaAotReloc> &relocs)
+{
+  JavaAotReloc ar;
+  const JavaAotTarget *t;
+  const char *name;
+  u4 i, j;
+
+  for (i = 0; i < buf.relocs().size(); i++) {
+    const JavaReloc &r = buf.relocs()[i];
+
+    ar.offset = r.offset;
+    switch (r.kind) {
+    case JavaRelocCall:
+      if ((name = JavaAot::routineName(JAVA_FN(r.target))) == 0)
+        return false;
+      ar.info = JAVA_AOT_RELOC(JavaAotRel,
+                               symbol(JavaAotRuntimeSym, 0, 0,
+                                      string(name, strlen(name)), 0));
+      ar.addend = 0;
+      break;
+    case JavaRelocLabel:
+      ar.info = JAVA_AOT_RELOC(JavaAotCode, 0);
+      ar.addend = buf.labelOffset(r.target);
+      break;
+    default:
+      t = 0;
+      for (j = 0; j < _targets.size(); j++) {
+        if (_targets[j].lo == r.target) {
+          t = &_targets[j];
+          break;
+        }
+        if (!t && r.target - _targets[j].lo < _targets[j].size)
+          t = &_targets[j];
+      }
+      if (!t)
+        return false;
+      ar.info = JAVA_AOT_RELOC(JavaAotAbs, t->symbol);
+      ar.addend = r.target - t->lo;
+      break;
+    }
+    relocs.push_back(ar);
+  }
+  return true;
+}
+
+bool JavaAotCompiler::add(JavaVMMethod *m)
+{
+  JavaTranslator t(m);
+  std::vector<JavaAotReloc> relocs;
+  u4 numSymbols = _symbols.size(), stringsSize = _strings.size();
+  JavaAotMethod am;
+  JavaAotOsr o;
+  u4 i;
+
+  if (!m->code() || m->notCompilable() || !t.translate() ||
+      !collect(m, t) || !relocate(t.buffer(), relocs) ||
+      _symbols.size() > JAVA_AOT_SYMBOL(~0U)) {
+    /* the loader would resolve what only this method needed for nothing */
+    _symbols.resize(numSymbols);
+    _strings.resize(stringsSize);
+    _numRejected++;
+    return false;
+  }
+
+  /* the gaps between methods trap */
+  _code.resize((_code.size() + 15) & ~15, 0xCC);
+  am.symbol = _targets[0].symbol;
+  am.code = _code.size();
+  am.size = t.buffer().size();
+  am.firstOsr = _osr.size();
+  am.numOsr = t.osrLabels().size();
+  am.firstReloc = _relocs.size();
+  am.numRelocs = relocs.size();
+  for (i = 0; i < t.osrLabels().size(); i++) {
+    o.pc = t.osrLabels()[i].first;
+    o.entry = t.buffer().labelOffset(t.osrLabels()[i].second);
+    _osr.push_back(o);
+  }
+  _relocs.insert(_relocs.end(), relocs.begin(), relocs.end());
+  _code.insert(_code.end(), t.buffer().bytes(),
+               t.buffer().bytes() + t.buffer().size());
+  _methods.push_back(am);
+  return true;
+}
+
+u4 JavaAotCompiler::add(JavaVMClass *c)
+{
+  u4 i, n = 0;
+
+  for (i = 0; i < c->methods().size(); i++)
+    if (c->methods()[i]->code() && add(c->methods()[i]))
+      n++;
+  return n;
+}
+
+void JavaAotCompiler::write(std::vector<u1> &image) const
+{
+  JavaAotHeader h;
+
+  h.magic = JAVA_AOT_MAGIC;
+  h.version = JAVA_AOT_VERSION;
+  h.numMethods = _methods.size();
+  h.numOsr = _osr.size();
+  h.numSymbols = _symbols.size();
+  h.numRelocs = _relocs.size();
+  h.stringsSize = _strings.size();
+  h.codeSize = _code.size();
+
+  image.assign((const u1 *) &h, (const u1 *) (&h + 1));
+  append(image, _methods);
+  append(image, _osr);
+  append(image, _symbols);
+  append(image, _relocs);
+  append(image, _strings);
+  append(image, _code);
+}
@@ -0,0 +1,221 @@
+/**
+ * @file asm.c
+ * @desc x86-32 code buffer and instruction encoding for the compilers
+ *
+ * @author cjeong
+ */
+#include <string.h>
+#include <java/java_trans.h>
+
+static inline bool is_s8(s4 v)
+{
+  return v >= -128 && v <= 127;
+}
+
+static inline int scale_bits(u1 scale)
+{
+  return scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+}
+
+void JavaCodeBuffer::modrm(int reg, const JavaMem &m)
+{
+  int mod;
+
+  reg <<= 3;
+  if (m.base == JavaNoReg) {
+    if (m.index == JavaNoReg) {
+      /* mod 00, rm 101: disp32 alone, which is an address */
+      emit1(0x05 | reg);
+      abs32((const void *) (uintptr) m.disp);
+      return;
+    }
+    /* SIB with base 101 and mod 00: index * scale + disp32 */
+    emit1(0x04 | reg);
+    emit1(scale_bits(m.scale) << 6 | m.index << 3 | 5);
+    emit4(m.disp);
+    return;
+  }
+
+  /* ebp as a base always needs a displacement */
+  if (m.disp == 0 && m.base != JavaEBP)
+    mod = 0;
+  else if (is_s8(m.disp))
+    mod = 1;
+  else
+    mod = 2;
+
+  if (m.index == JavaNoReg && m.base != JavaESP) {
+    emit1(mod << 6 | reg | m.base);
+  } else {
+    /* esp as a base needs a SIB byte; index 100 means none */
+    emit1(mod << 6 | reg | 4);
+    emit1(scale_bits(m.scale) << 6 |
+          (m.index == JavaNoReg ? 4 : m.index) << 3 | m.base);
+  }
+  if (mod == 1)
+    emit1(m.disp);
+  else if (mod == 2)
+    emit4(m.disp);
+}
+
+void JavaCodeBuffer::rel32(int label)
+{
+  JavaFixup f;
+
+  f.offset = _code.size();
+  f.label = label;
+  _fixups.push_back(f);
+  emit4(0);
+}
+
+void JavaCodeBuffer::abs32(const void *p)
+{
+  JavaReloc r;
+
+  r.offset = _code.size();
+  r.kind = JavaRelocAbs;
+  r.target = (u4) (uintptr) p;
+  _relocs.push_back(r);
+  emit4(r.target);
+}
+
+void JavaCodeBuffer::patch4(u4 offset, u4 d)
+{
+  _code[offset] = d;
+  _code[offset + 1] = d >> 8;
+  _code[offset + 2] = d >> 16;
+  _code[offset + 3] = d >> 24;
+}
+
+int JavaCodeBuffer::newLabel()
+{
+  _labels.push_back(-1);
+  return _labels.size() - 1;
+}
+
+void JavaCodeBuffer::bind(int label)
+{
+  _labels[label] = _code.size();
+}
+
+void JavaCodeBuffer::align(u4 n)
+{
+  while (_code.size() % n)
+    emit1(0x90);
+}
+
+void JavaCodeBuffer::pushImm(s4 v)
+{
+  if (is_s8(v)) {
+    emit1(0x6A);
+    emit1(v);
+  } else {
+    emit1(0x68);
+    emit4(v);
+  }
+}
+
+void JavaCodeBuffer::aluImm(JavaAluE op, JavaRegE d, s4 v)
+{
+  if (is_s8(v)) {
+    emit1(0x83);
+    modrmReg(op, d);
+    emit1(v);
+  } else {
+    emit1(0x81);
+    modrmReg(op, d);
+    emit4(v);
+  }
+}
+
+void JavaCodeBuffer::aluImm(JavaAluE op, const JavaMem &m, s4 v)
+{
+  if (is_s8(v)) {
+    emit1(0x83);
+    modrm(op, m);
+    emit1(v);
+  } else {
+    emit1(0x81);
+    modrm(op, m);
+    emit4(v);
+  }
+}
+
+void JavaCodeBuffer::imulImm(JavaRegE d, JavaRegE s, s4 v)
+{
+  if (is_s8(v)) {
+    emit1(0x6B);
+    modrmReg(d, s);
+    emit1(v);
+  } else {
+    emit1(0x69);
+    modrmReg(d, s);
+    emit4(v);
+  }
+}
+
+void JavaCodeBuffer::call(const void *target)
+{
+  JavaReloc r;
+
+  emit1(0xE8);
+  r.offset = _code.size();
+  r.kind = JavaRelocCall;
+  r.target = (u4) (uintptr) target;
+  _relocs.push_back(r);
+  emit4(0);
+}
+
+void JavaCodeBuffer::labelAddr(int label)
+{
+  JavaReloc r;
+
+  r.offset = _code.size();
+  r.kind = JavaRelocLabel;
+  r.target = label;
+  _relocs.push_back(r);
+  emit4(0);
+}
+
+bool JavaCodeBuffer::finish()
+{
+  int i;
+
+  /* jumps within the code are position independent */
+  for (i = 0; i < _fixups.size(); i++) {
+    if (!isBound(_fixups[i].label))
+      return false;
+    patch4(_fixups[i].offset,
+           _labels[_fixups[i].label] - (_fixups[i].offset + 4));
+  }
+  for (i = 0; i < _relocs.size(); i++)
+    if (_relocs[i].kind == JavaRelocLabel && !isBound(_relocs[i].target))
+      return false;
+  return true;
+}
+
+void JavaCodeBuffer::install(u1 *mem) const
+{
+  u4 base = (u4) (uintptr) mem, v = 0;
+  int i;
+
+  memcpy(mem, &_code[0], _code.size());
+  for (i = 0; i < _relocs.size(); i++) {
+    const JavaReloc &r = _relocs[i];
+
+    switch (r.kind) {
+    case JavaRelocCall:
+      v = r.target - (base + r.offset + 4);
+      break;
+    case JavaRelocLabel:
+      v = base + _labels[r.target];
+      break;
+    default:
+      continue;
+    }
+    mem[r.offset] = v;
+    mem[r.offset + 1] = v >> 8;
+    mem[r.offset + 2] = v >> 16;
+    mem[r.offset + 3] = v >> 24;
+  }
+}
@@ -0,0 +1,371 @@
+/**
+ * @file inline.c
+ * @desc inlining for the optimizing compiler: a call is replaced with a copy
+ *       of the callee's IR.  a virtual call to a method no loaded class
+ *       overrides gets one copy, guarded by the method's overridden flag;
+ *       other virtual and interface call sites get copies for the receiver
+ *       classes the interpreter profiled, guarded by a test of the
+ *       receiver's header.  where no guard matches, the code either makes
+ *       the call or, if the profile saw nothing else, deoptimizes
+ *
+ * @author cjeong
+ */
+#include <stdio.h>
+#include <algorithm>
+#include <java/java_object.h>
+#include <java/java_vm.h>
+#include <java/java_opt.h>
+#include <java/java_deopt.h>
+#include <java/java_intrinsic.h>
+
+/* the header bits a guard compares: the class index, and the lock bit that
+   inflated and forwarded headers set; unlocked and thin-locked objects of
+   the class match, the rest take the path for unmatched receivers */
+#define GUARD_MASK  (JAVA_HDR_CLASS_MASK | JAVA_LOCK_INFLATED)
+
+u4 JavaOptimizer::_maxInlineSize = JAVA_INLINE_MAX_SIZE;
+u4 JavaOptimizer::_maxInlineDepth = JAVA_INLINE_MAX_DEPTH;
+u4 JavaOptimizer::_inlineBudget = JAVA_INLINE_BUDGET;
+bool JavaOptimizer::_trace = false;
+
+void JavaOptimizer::inlineLimits(u4 size, u4 depth, u4 budget)
+{
+  _maxInlineSize = size;
+  _maxInlineDepth = depth;
+  _inlineBudget = budget;
+}
+
+/* the method 'call' reaches for a receiver of class 'k', as
+   JavaRuntime::resolveVirtual and resolveInterface pick it */
+static JavaVMMethod *target_of(JavaIrInstr *call, JavaVMClass *k)
+{
+  JavaVMMethod *m = call->method;
+
+  if (call->imm == JavaIrCallInterface)
+    return k->lookupMethod(m->name(), m->desc());
+  if (m->vtableIndex() >= k->vtableLength())
+    return m;
+  return k->vtableAt(m->vtableIndex());
+}
+
+/* why 'target' cannot be inlined here, or 0 */
+const char *JavaOptimizer::checkInline(JavaVMMethod *target)
+{
+  JavaOptimizer *o;
+
+  if (!target || target->isAbstract())
+    return "abstract";
+  if (!target->code())
+    return "no bytecode";
+  if (target->isSynchronized())
+    return "synchronized";
+  if (target->intrinsic() && !JavaIntrinsic::isArithmetic(target->intrinsic()))
+    return "intrinsic";
+  if (target->codeLength() > _maxInlineSize)
+    return "too large";
+  if (_depth + 1 > _maxInlineDepth)
+    return "too deep";
+  if (root()->_inlinedBytes + target->codeLength() > _inlineBudget)
+    return "over budget";
+  for (o = this; o; o = o->_parent)
+    if (o->_method == target)
+      return "recursive";
+  return 0;
+}
+
+u4 JavaOptimizer::decide(JavaIrInstr *call, JavaVMMethod *target,
+                         JavaVMClass *k, const char *reason)
+{
+  JavaInlineDecision d;
+
+  d.depth = _depth;
+  d.pc = call->pc;
+  d.caller = _method;
+  d.callee = target ? target : call->method;
+  d.receiver = k;
+  d.hierarchy = false;
+  d.reason = reason;
+  root()->_decisions.push_back(d);
+  return root()->_decisions.size() - 1;
+}
+
+void JavaOptimizer::inlineCalls()
+{
+  std::vector<JavaIrInstr *> calls;
+  bool changed = false;
+  u4 i, j;
+
+  for (i = 0; i < _order.size(); i++)
+    for (j = 0; j < _order[i]->code.size(); j++)
+      if (_order[i]->code[j]->op == JavaIrCall)
+        calls.push_back(_order[i]->code[j]);
+  for (i = 0; i < calls.size(); i++)
+    if (inlineCall(calls[i]))
+      changed = true;
+  if (!changed)
+    return;
+
+  computeOrder();
+  removeTrivialPhis();
+  computeDominators();
+  findLoops();
+}
+
+void JavaOptimizer::replaceUses(JavaIrInstr *v, JavaIrInstr *with)
+{
+  JavaIrState *s;
+  u4 i, j;
+
+  for (i = 0; i < _instrs.size(); i++)
+    if (_instrs[i] != with)
+      for (j = 0; j < _instrs[i]->args.size(); j++)
+        if (_instrs[i]->args[j] == v)
+          _instrs[i]->args[j] = with;
+
+  /* for deopts made at calls inlined later */
+  for (i = 0; i < _states.size(); i++) {
+    s = _states[i];
+    std::replace(s->locals.begin(), s->locals.end(), v, with);
+    std::replace(s->stack.begin(), s->stack.end(), v, with);
+  }
+}
+
+/* moves the blocks and values of the inlinee 'o' into this IR; its
+   parameters become the arguments of 'call' and its returns jump to 'join',
+   adding the value each one returns to 'results' */
+void JavaOptimizer::absorb(JavaOptimizer *o, JavaIrInstr *call,
+                           JavaIrBlock *join,
+                           std::vector<JavaIrInstr *> &results)
+{
+  JavaIrBlock *b;
+  JavaIrInstr *v;
+  u4 i, n = 0;
+
+  for (i = 0; i < o->_entry->code.size(); i++) {
+    v = o->_entry->code[i];
+    if (v->op == JavaIrParam)
+      v->forward = call->args[n++];
+  }
+
+  for (i = 0; i < o->_blocks.size(); i++) {
+    b = o->_blocks[i];
+    b->id = _blocks.size();
+    _blocks.push_back(b);
+    v = b->last();
+    if (b->rpo >= 0 && v && v->op == JavaIrReturn) {
+      results.push_back(v->args.empty() ? 0 : v->args[0]);
+      v->op = JavaIrGoto;
+      v->args.clear();
+      b->addSucc(join);
+    }
+  }
+  for (i = 0; i < o->_instrs.size(); i++) {
+    v = o->_instrs[i];
+    v->id = _instrs.size();
+    _instrs.push_back(v);
+  }
+  _states.insert(_states.end(), o->_states.begin(), o->_states.end());
+  o->_blocks.clear();
+  o->_instrs.clear();
+  o->_states.clear();
+}
+
+/* ends 'b' by leaving for the interpreter at 'call': the arguments are
+   the live values of its frame and of the frames it was inlined into */
+JavaIrInstr *JavaOptimizer::appendDeopt(JavaIrBlock *b, JavaIrInstr *call,
+                                        JavaIrDeoptE reason)
+{
+  JavaIrInstr *d = append(b, JavaIrDeopt, 'V');
+  JavaIrState *s;
+  u4 i, n;
+
+  d->imm = reason;
+  d->state = call->state;
+  for (s = call->state; s; s = s->caller) {
+    for (i = 0; i < s->locals.size(); i++)
+      if (s->locals[i])
+        d->args.push_back(resolve(s->locals[i]));
+    /* an enclosing frame resumes after its call, its arguments gone */
+    n = s == call->state ? s->stack.size() : s->stack.size() - s->args;
+    for (i = 0; i < n; i++)
+      d->args.push_back(resolve(s->stack[i]));
+  }
+  return d;
+}
+
+/* once the code is in place: its deopt points live as long as it does,
+   and a class that overrides a method it assumed is not overridden
+   invalidates it */
+void JavaOptimizer::installed(JavaVMMethod *m)
+{
+  u4 i;
+
+  for (i = 0; i < _assumed.size(); i++)
+    JavaDeopt::addDependency(_assumed[i], m);
+  _deoptPoints.clear();
+}
+
+bool JavaOptimizer::inlineCall(JavaIrInstr *v)
+{
+  std::vector<std::pair<JavaVMClass *, JavaOptimizer *> > copies;
+  std::vector<JavaIrInstr *> results;
+  JavaCallProfile *p = 0;
+  JavaVMClass *k;
+  JavaVMMethod *t;
+  JavaOptimizer *o;
+  JavaIrBlock *b = v->block, *join, *next;
+  JavaIrInstr *g, *phi;
+  const char *why;
+  bool hierarchy = false, uncommon;
+  u4 i, total, at, seen = 0;
+
+  _pc = v->pc;
+  if (v->imm == JavaIrCallDirect) {
+    copies.push_back(std::make_pair((JavaVMClass *) 0, (JavaOptimizer *) 0));
+  } else if (v->imm == JavaIrCallVirtual && !v->method->isOverridden() &&
+             !v->method->isAbstract()) {
+    /* every receiver gets this method, as long as no class overrides it */
+    copies.push_back(std::make_pair((JavaVMClass *) 0, (JavaOptimizer *) 0));
+    hierarchy = true;
+  } else {
+    p = _method->callProfile(v->pc);
+    total = p ? p->total() : 0;
+    if (total == 0) {
+      decide(v, 0, 0, "no profile");
+      return false;
+    }
+    for (i = 0; i < JAVA_PROFILE_RECEIVERS; i++) {
+      if (p->receivers[i])
+        seen++;
+      if (p->receivers[i] &&
+          p->counts[i] * 100 >= total * JAVA_INLINE_MIN_PERCENT)
+        copies.push_back(std::make_pair(p->receivers[i],
+                                        (JavaOptimizer *) 0));
+    }
+    if (copies.empty()) {
+      decide(v, 0, 0, "megamorphic");
+      return false;
+    }
+  }
+
+  /* build the inlinees; each records its own decisions after ours */
+  for (i = 0; i < copies.size(); i++) {
+    k = copies[i].first;
+    t = k ? target_of(v, k) : v->method;
+    at = decide(v, t, k, 0);
+    root()->_decisions[at].hierarchy = hierarchy;
+    if ((why = checkInline(t)) == 0) {
+      o = new JavaOptimizer(t, this);
+      o->_callerState = v->state;
+      root()->_inlinedBytes += t->codeLength();
+      if (!o->buildIr()) {
+        why = "not handled";
+        root()->_inlinedBytes -= t->codeLength();
+        delete o;
+      } else {
+        copies[i].second = o;
+      }
+    }
+    root()->_decisions[at].reason = why;
+  }
+  for (i = at = 0; i < copies.size(); i++)
+    if (copies[i].second)
+      copies[at++] = copies[i];
+  copies.resize(at);
+  if (copies.empty())
+    return false;
+
+  /* a receiver no guard matches is rare enough to leave compiled code
+     for if the profile saw no class without a copy */
+  uncommon = hierarchy || (p && p->others == 0 && copies.size() == seen);
+  if (hierarchy)
+    root()->_assumed.push_back(v->method);
+
+  /* everything after the call moves to a block of its own */
+  join = newBlock(~0U);
+  for (at = 0; b->code[at] != v; at++)
+    ;
+  join->code.assign(b->code.begin() + at + 1, b->code.end());
+  for (i = 0; i < join->code.size(); i++)
+    join->code[i]->block = join;
+  b->code.resize(at);
+  join->succs = b->succs;
+  for (i = 0; i < join->succs.size(); i++)
+    std::replace(join->succs[i]->preds.begin(), join->succs[i]->preds.end(),
+                 b, join);
+  b->succs.clear();
+
+  for (i = 0; i < copies.size(); i++) {
+    k = copies[i].first;
+    o = copies[i].second;
+    if (k) {
+      g = append(b, JavaIrLoad, 'I', v->args[0]);
+      g->elem = 'I';
+      g = append(b, JavaIrAnd, 'I', g, newConst(b, GUARD_MASK));
+      g = append(b, JavaIrIf, 'V', g,
+                 newConst(b, JAVA_HDR_MAKE(k->classIndex())));
+      g->imm = JavaCondE;
+      next = newBlock(~0U);
+      b->addSucc(o->_entry);
+      b->addSucc(next);
+    } else if (hierarchy) {
+      /* a load every time: a class loaded meanwhile sets the flag */
+      g = append(b, JavaIrLoad, 'I');
+      g->imm = (s4) (uintptr) v->method->overriddenAddr();
+      g->elem = 'I';
+      g = append(b, JavaIrIf, 'V', g, newConst(b, 0));
+      g->imm = JavaCondE;
+      next = newBlock(~0U);
+      b->addSucc(o->_entry);
+      b->addSucc(next);
+    } else {
+      append(b, JavaIrGoto, 'V');
+      b->addSucc(o->_entry);
+      next = 0;
+    }
+    absorb(o, v, join, results);
+    delete o;
+    b = next;
+  }
+
+  /* no guard matched: the call as it was, or the interpreter */
+  if (b && uncommon) {
+    appendDeopt(b, v, hierarchy ? JavaIrDeoptHierarchy : JavaIrDeoptClass);
+    v->removed = true;
+  } else if (b) {
+    v->block = b;
+    b->code.push_back(v);
+    append(b, JavaIrGoto, 'V');
+    b->addSucc(join);
+    results.push_back(v);
+  } else {
+    v->removed = true;
+  }
+
+  if (v->hasValue()) {
+    phi = newInstr(JavaIrPhi, join, v->type);
+    phi->args = results;
+    join->phis.push_back(phi);
+    replaceUses(v, phi);
+  }
+  return true;
+}
+
+void JavaOptimizer::dumpInlining()
+{
+  JavaInlineDecision *d;
+  u4 i;
+
+  printf("inlining in %s%s, %u bytes:\n", _method->name(), _method->desc(),
+         _inlinedBytes);
+  for (i = 0; i < _decisions.size(); i++) {
+    d = &_decisions[i];
+    printf("  %*s%s@%u -> %s%s", 2 * d->depth, "", d->caller->name(), d->pc,
+           d->callee->name(), d->callee->desc());
+    if (d->receiver)
+      printf(" if class %u", d->receiver->classIndex());
+    else if (d->hierarchy)
+      printf(" if not overridden");
+    printf(": %s\n", d->reason ? d->reason : "inlined");
+  }
+}
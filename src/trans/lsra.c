@@ -0,0 +1,891 @@
+/**
+ * @file lsra.c
+ * @desc linear-scan register allocation and x86-32 code generation for
+ *       the optimizing compiler
+ *
+ * @author cjeong
+ */
+#include <algorithm>
+#include <java/java_object.h>
+#include <java/java_vm.h>
+#include <java/java_runtime.h>
+#include <java/java_opt.h>
+#include <java/java_deopt.h>
+
+#define LEN   JAVA_ARRAY_LENGTH_OFFSET
+#define DATA  JAVA_ARRAY_DATA_OFFSET
+
+/* eax and edx are scratch for the code generator; ecx is not preserved
+   across calls, the rest are saved in the prologue */
+static const JavaRegE alloc_regs[] = { JavaECX, JavaEBX, JavaESI, JavaEDI };
+#define NUM_ALLOC_REGS  4
+
+/* frame: saved ebx, esi and edi below ebp, then the spill slots */
+#define SPILL_BASE  (-16)
+
+/* constants are immediates and never take a register */
+static inline bool needs_loc(JavaIrInstr *v)
+{
+  return v->hasValue() && v->op != JavaIrConst;
+}
+
+/* ranges are added block by block, so a range that continues the last
+   one extends it */
+static void add_range(JavaIrInstr *v, int from, int to)
+{
+  if (!v->ranges.empty() && v->ranges.back().second + 2 >= from &&
+      v->ranges.back().first <= from) {
+    v->ranges.back().second = std::max(v->ranges.back().second, to);
+  } else {
+    v->ranges.push_back(std::make_pair(from, to));
+  }
+  if (v->from < 0 || from < v->from)
+    v->from = from;
+  if (to > v->to)
+    v->to = to;
+}
+
+/* a value may take the register of one whose last use is where it is
+   defined: operands are read before the result is written */
+static bool overlaps(JavaIrInstr *a, JavaIrInstr *b)
+{
+  u4 i = 0, j = 0;
+
+  while (i < a->ranges.size() && j < b->ranges.size()) {
+    if (a->ranges[i].first < b->ranges[j].second &&
+        b->ranges[j].first < a->ranges[i].second)
+      return true;
+    if (a->ranges[i].second < b->ranges[j].second)
+      i++;
+    else
+      j++;
+  }
+  return false;
+}
+
+static inline u4 depth_weight(int depth)
+{
+  return 1U << 3 * std::min(depth, 5);
+}
+
+static bool by_start(JavaIrInstr *a, JavaIrInstr *b)
+{
+  return a->from < b->from || (a->from == b->from && a->id < b->id);
+}
+
+
+/* positions: a block's phis are defined at its 'from', each instruction
+   takes the next even position, and the block ends at 'to', where the
+   operands of the successor's phis are used.  a value's ranges cover the
+   positions where it is live, with holes where it is not */
+void JavaOptimizer::computeIntervals()
+{
+  std::vector<std::vector<bool> > liveIn;
+  std::vector<int> pos(_instrs.size(), -1), end;
+  std::vector<bool> live;
+  JavaIrBlock *b, *s;
+  JavaIrInstr *v, *a;
+  bool changed = true, final = false;
+  int p = 0, i, j, k, idx;
+
+  splitCriticalEdges();
+
+  for (i = 0; i < (int) _instrs.size(); i++) {
+    _instrs[i]->ranges.clear();
+    _instrs[i]->from = _instrs[i]->to = -1;
+    _instrs[i]->weight = 0;
+  }
+  _calls.clear();
+  for (i = 0; i < (int) _order.size(); i++) {
+    b = _order[i];
+    b->from = p;
+    for (j = 0; j < (int) b->phis.size(); j++)
+      pos[b->phis[j]->id] = p;
+    p += 2;
+    for (j = 0; j < (int) b->code.size(); j++) {
+      pos[b->code[j]->id] = p;
+      if (b->code[j]->op == JavaIrCall)
+        _calls.push_back(p);
+      p += 2;
+    }
+    b->to = p;
+    p += 2;
+  }
+
+  /* liveness to a fixpoint in reverse order; one more pass in layout
+     order then records the ranges */
+  liveIn.assign(_blocks.size(), std::vector<bool>(_instrs.size(), false));
+  while (changed || !final) {
+    final = !changed;
+    changed = false;
+    for (i = final ? 0 : _order.size() - 1;
+         final ? i < (int) _order.size() : i >= 0; final ? i++ : i--) {
+      b = _order[i];
+      live.assign(_instrs.size(), false);
+      for (j = 0; j < (int) b->succs.size(); j++) {
+        s = b->succs[j];
+        for (k = 0; k < (int) _instrs.size(); k++)
+          if (liveIn[s->id][k])
+            live[k] = true;
+        for (idx = 0; s->preds[idx] != b; idx++)
+          ;
+        for (k = 0; k < (int) s->phis.size(); k++)
+          if (needs_loc(s->phis[k]->args[idx]))
+            live[s->phis[k]->args[idx]->id] = true;
+      }
+      end.assign(_instrs.size(), -1);
+      for (k = 0; k < (int) _instrs.size(); k++)
+        if (live[k])
+          end[k] = b->to;
+
+      for (j = b->code.size() - 1; j >= 0; j--) {
+        v = b->code[j];
+        if (final && needs_loc(v))
+          add_range(v, pos[v->id], live[v->id] ? end[v->id] : pos[v->id]);
+        live[v->id] = false;
+        for (k = 0; k < (int) v->args.size(); k++) {
+          a = v->args[k];
+          if (!needs_loc(a))
+            continue;
+          if (!live[a->id]) {
+            live[a->id] = true;
+            end[a->id] = pos[v->id];
+          }
+          if (final)
+            a->weight += depth_weight(b->loopDepth);
+        }
+      }
+      for (j = 0; j < (int) b->phis.size(); j++) {
+        v = b->phis[j];
+        if (final)
+          add_range(v, b->from, live[v->id] ? end[v->id] : b->from);
+        live[v->id] = false;
+      }
+      for (k = 0; k < (int) _instrs.size(); k++) {
+        if (!live[k])
+          continue;
+        if (final)
+          add_range(_instrs[k], b->from, end[k]);
+        if (!liveIn[b->id][k])
+          changed = true;
+        liveIn[b->id][k] = true;
+      }
+    }
+  }
+
+  /* ranges were added from the end of each block backwards */
+  for (i = 0; i < (int) _instrs.size(); i++) {
+    v = _instrs[i];
+    if (v->ranges.size() < 2)
+      continue;
+    std::sort(v->ranges.begin(), v->ranges.end());
+    for (j = 1, k = 0; j < (int) v->ranges.size(); j++) {
+      if (v->ranges[j].first <= v->ranges[k].second + 2)
+        v->ranges[k].second = std::max(v->ranges[k].second,
+                                       v->ranges[j].second);
+      else
+        v->ranges[++k] = v->ranges[j];
+    }
+    v->ranges.resize(k + 1);
+  }
+
+  /* phi operands are used at the end of their predecessor */
+  for (i = 0; i < (int) _order.size(); i++) {
+    b = _order[i];
+    for (j = 0; j < (int) b->phis.size(); j++) {
+      for (k = 0; k < (int) b->preds.size(); k++) {
+        v = b->phis[j]->args[k];
+        if (needs_loc(v))
+          v->weight += depth_weight(b->preds[k]->loopDepth);
+      }
+    }
+  }
+}
+
+/* linear scan over interval starts.  a register is free for an interval
+   if none of the intervals already in it overlap, holes included; when
+   none is, the cheapest register's conflicting intervals are spilled if
+   they are used less than the new one, and the new one otherwise */
+void JavaOptimizer::allocateRegisters()
+{
+  std::vector<JavaIrInstr *> sorted, assigned[NUM_ALLOC_REGS];
+  JavaIrInstr *cur;
+  u4 i, j, k, r, best, cost, bestCost;
+  bool crosses;
+
+  computeIntervals();
+
+  for (i = 0; i < _order.size(); i++) {
+    for (j = 0; j < _order[i]->phis.size(); j++)
+      if (_order[i]->phis[j]->from >= 0)
+        sorted.push_back(_order[i]->phis[j]);
+    for (j = 0; j < _order[i]->code.size(); j++)
+      if (needs_loc(_order[i]->code[j]) && _order[i]->code[j]->from >= 0)
+        sorted.push_back(_order[i]->code[j]);
+  }
+  std::sort(sorted.begin(), sorted.end(), by_start);
+
+  for (i = 0; i < sorted.size(); i++) {
+    cur = sorted[i];
+    cur->reg = JavaNoReg;
+    cur->spill = 0;
+
+    /* a value live across a call cannot stay in ecx */
+    crosses = false;
+    for (j = 0; j < _calls.size() && !crosses; j++)
+      for (k = 0; k < cur->ranges.size() && !crosses; k++)
+        crosses = cur->ranges[k].first < _calls[j] &&
+          _calls[j] < cur->ranges[k].second;
+
+    best = NUM_ALLOC_REGS;
+    bestCost = ~0U;
+    for (r = crosses ? 1 : 0; r < NUM_ALLOC_REGS; r++) {
+      cost = 0;
+      for (j = 0; j < assigned[r].size(); j++)
+        if (overlaps(cur, assigned[r][j]))
+          cost += assigned[r][j]->weight + 1;
+      if (cost < bestCost) {
+        best = r;
+        bestCost = cost;
+      }
+      if (cost == 0)
+        break;
+    }
+
+    if (bestCost > 0 && bestCost > cur->weight) {
+      cur->spill = SPILL_BASE - 4 * (s4) _numSpills++;
+      continue;
+    }
+    for (j = 0; j < assigned[best].size(); ) {
+      if (overlaps(cur, assigned[best][j])) {
+        assigned[best][j]->reg = JavaNoReg;
+        assigned[best][j]->spill = SPILL_BASE - 4 * (s4) _numSpills++;
+        assigned[best].erase(assigned[best].begin() + j);
+      } else {
+        j++;
+      }
+    }
+    cur->reg = alloc_regs[best];
+    assigned[best].push_back(cur);
+  }
+}
+
+JavaIrLoc JavaOptimizer::loc(JavaIrInstr *v) const
+{
+  JavaIrLoc l;
+
+  if (v->op == JavaIrConst) {
+    l.kind = JavaIrLoc::Imm;
+    l.v = v->imm;
+  } else if (v->reg != JavaNoReg) {
+    l.kind = JavaIrLoc::Reg;
+    l.v = v->reg;
+  } else {
+    l.kind = JavaIrLoc::Mem;
+    l.v = v->spill;
+  }
+  return l;
+}
+
+void JavaOptimizer::load(JavaRegE r, JavaIrInstr *v)
+{
+  JavaIrLoc l;
+
+  l.kind = JavaIrLoc::Reg;
+  l.v = r;
+  move(l, loc(v));
+}
+
+void JavaOptimizer::store(JavaIrInstr *v, JavaRegE r)
+{
+  JavaIrLoc l;
+
+  /* a result nobody reads has no place to go */
+  if (v->from < 0)
+    return;
+  l.kind = JavaIrLoc::Reg;
+  l.v = r;
+  move(loc(v), l);
+}
+
+void JavaOptimizer::aluOp(JavaAluE op, JavaRegE d, JavaIrInstr *v)
+{
+  JavaIrLoc l = loc(v);
+
+  if (l.kind == JavaIrLoc::Imm)
+    _buf.aluImm(op, d, l.v);
+  else if (l.kind == JavaIrLoc::Reg)
+    _buf.alu(op, d, (JavaRegE) l.v);
+  else
+    _buf.alu(op, d, mem(l));
+}
+
+/* the register 'v' is in, or 'scratch' with 'v' loaded into it */
+JavaRegE JavaOptimizer::inReg(JavaIrInstr *v, JavaRegE scratch)
+{
+  if (v->op != JavaIrConst && v->reg != JavaNoReg)
+    return v->reg;
+  load(scratch, v);
+  return scratch;
+}
+
+void JavaOptimizer::move(const JavaIrLoc &d, const JavaIrLoc &s)
+{
+  if (d == s)
+    return;
+  if (d.kind == JavaIrLoc::Reg) {
+    if (s.kind == JavaIrLoc::Imm && s.v == 0)
+      _buf.alu(JavaAluXor, (JavaRegE) d.v, (JavaRegE) d.v);
+    else if (s.kind == JavaIrLoc::Imm)
+      _buf.movImm((JavaRegE) d.v, s.v);
+    else if (s.kind == JavaIrLoc::Reg)
+      _buf.mov((JavaRegE) d.v, (JavaRegE) s.v);
+    else
+      _buf.mov((JavaRegE) d.v, mem(s));
+  } else if (s.kind == JavaIrLoc::Imm) {
+    _buf.movImm(mem(d), s.v);
+  } else if (s.kind == JavaIrLoc::Reg) {
+    _buf.mov(mem(d), (JavaRegE) s.v);
+  } else {
+    _buf.mov(JavaEAX, mem(s));
+    _buf.mov(mem(d), JavaEAX);
+  }
+}
+
+/* the phi moves on the edge from 'b' to its only successor, done as one
+   parallel copy: a move goes first once no other pending move reads its
+   destination, and a cycle is broken by going through the stack */
+void JavaOptimizer::phiMoves(JavaIrBlock *b)
+{
+  std::vector<std::pair<JavaIrLoc, JavaIrLoc> > moves;
+  JavaIrBlock *s = b->succs[0];
+  JavaIrLoc d, l;
+  bool blocked;
+  u4 i, j, idx;
+
+  for (idx = 0; s->preds[idx] != b; idx++)
+    ;
+  for (i = 0; i < s->phis.size(); i++) {
+    /* an unused phi may share its place with a live one */
+    if (s->phis[i]->from == s->phis[i]->to)
+      continue;
+    d = loc(s->phis[i]);
+    l = loc(s->phis[i]->args[idx]);
+    if (!(d == l))
+      moves.push_back(std::make_pair(d, l));
+  }
+
+  while (!moves.empty()) {
+    for (i = 0; i < moves.size(); i++) {
+      blocked = false;
+      for (j = 0; j < moves.size() && !blocked; j++)
+        blocked = j != i && moves[j].second == moves[i].first;
+      if (!blocked)
+        break;
+    }
+    if (i < moves.size()) {
+      move(moves[i].first, moves[i].second);
+      moves.erase(moves.begin() + i);
+      continue;
+    }
+
+    for (i = 0; i < moves.size(); i++) {
+      l = moves[i].second;
+      if (l.kind == JavaIrLoc::Imm)
+        _buf.pushImm(l.v);
+      else if (l.kind == JavaIrLoc::Reg)
+        _buf.push((JavaRegE) l.v);
+      else
+        _buf.push(mem(l));
+    }
+    for (i = moves.size(); i-- > 0; ) {
+      d = moves[i].first;
+      if (d.kind == JavaIrLoc::Reg)
+        _buf.pop((JavaRegE) d.v);
+      else
+        _buf.pop(mem(d));
+    }
+    moves.clear();
+  }
+}
+
+/* Java division: x / 0 throws, and MIN_VALUE / -1 is MIN_VALUE, which
+   idiv would fault on */
+void JavaOptimizer::emitDivide(JavaIrInstr *v)
+{
+  JavaIrLoc b = loc(v->args[1]);
+  JavaRegE result = v->op == JavaIrDiv ? JavaEAX : JavaEDX;
+  int minus1, done;
+
+  if (b.kind == JavaIrLoc::Imm) {
+    if (b.v == 0) {
+      _buf.jmp(_arithLabel);
+    } else if (b.v == -1) {
+      load(JavaEAX, v->args[0]);
+      if (v->op == JavaIrDiv)
+        _buf.neg(JavaEAX);
+      else
+        _buf.alu(JavaAluXor, JavaEAX, JavaEAX);
+      store(v, JavaEAX);
+    } else {
+      load(JavaEAX, v->args[0]);
+      _buf.cdq();
+      _buf.pushImm(b.v);
+      _buf.idiv(JavaMem(JavaESP, 0));
+      _buf.lea(JavaESP, JavaMem(JavaESP, 4));
+      store(v, result);
+    }
+    return;
+  }
+
+  minus1 = _buf.newLabel();
+  done = _buf.newLabel();
+  if (b.kind == JavaIrLoc::Reg) {
+    _buf.test((JavaRegE) b.v, (JavaRegE) b.v);
+    _buf.jcc(JavaCondE, _arithLabel);
+    _buf.aluImm(JavaAluCmp, (JavaRegE) b.v, -1);
+  } else {
+    _buf.aluImm(JavaAluCmp, mem(b), 0);
+    _buf.jcc(JavaCondE, _arithLabel);
+    _buf.aluImm(JavaAluCmp, mem(b), -1);
+  }
+  _buf.jcc(JavaCondE, minus1);
+  load(JavaEAX, v->args[0]);
+  _buf.cdq();
+  if (b.kind == JavaIrLoc::Reg)
+    _buf.idiv((JavaRegE) b.v);
+  else
+    _buf.idiv(mem(b));
+  store(v, result);
+  _buf.jmp(done);
+
+  _buf.bind(minus1);
+  load(JavaEAX, v->args[0]);
+  if (v->op == JavaIrDiv)
+    _buf.neg(JavaEAX);
+  else
+    _buf.alu(JavaAluXor, JavaEAX, JavaEAX);
+  store(v, JavaEAX);
+  _buf.bind(done);
+}
+
+void JavaOptimizer::emitShift(JavaIrInstr *v)
+{
+  JavaShiftE op = v->op == JavaIrShl ? JavaShiftShl :
+    v->op == JavaIrShr ? JavaShiftSar : JavaShiftShr;
+  JavaIrInstr *n = v->args[1];
+  JavaRegE d = target(v);
+
+  if (n->op == JavaIrConst) {
+    load(d, v->args[0]);
+    _buf.shiftImm(op, d, n->imm & 31);
+    store(v, d);
+    return;
+  }
+
+  /* the count must be in cl; ecx may hold another value, so it is kept
+     in edx meanwhile.  x86 masks the count to 5 bits as Java does */
+  load(JavaEAX, v->args[0]);
+  _buf.mov(JavaEDX, JavaECX);
+  if (n->reg != JavaECX)
+    load(JavaECX, n);
+  _buf.shift(op, JavaEAX);
+  _buf.mov(JavaECX, JavaEDX);
+  store(v, JavaEAX);
+}
+
+void JavaOptimizer::emitEpilogue()
+{
+  _buf.lea(JavaESP, JavaMem(JavaEBP, -12));
+  _buf.pop(JavaEDI);
+  _buf.pop(JavaESI);
+  _buf.pop(JavaEBX);
+  _buf.pop(JavaEBP);
+  _buf.ret();
+}
+
+/* the operand of a memory access of type 'elem' at 'm' */
+static void load_elem(JavaCodeBuffer &b, JavaRegE d, const JavaMem &m,
+                      char elem)
+{
+  switch (elem) {
+  case 'B':
+    b.movsx8(d, m);
+    break;
+  case 'C':
+    b.movzx16(d, m);
+    break;
+  case 'S':
+    b.movsx16(d, m);
+    break;
+  default:
+    b.mov(d, m);
+    break;
+  }
+}
+
+static void store_elem(JavaCodeBuffer &b, const JavaMem &m, JavaRegE s,
+                       char elem)
+{
+  switch (elem) {
+  case 'B':
+    b.mov8(m, s);
+    break;
+  case 'C': case 'S':
+    b.mov16(m, s);
+    break;
+  default:
+    b.mov(m, s);
+    break;
+  }
+}
+
+static u1 elem_size(char elem)
+{
+  return elem == 'B' ? 1 : elem == 'C' || elem == 'S' ? 2 : 4;
+}
+
+/* stores 'x' to 'm', which may use eax and edx as base and index */
+void JavaOptimizer::storeValue(const JavaMem &m, JavaIrInstr *x, char elem)
+{
+  JavaIrLoc l = loc(x);
+
+  if (l.kind == JavaIrLoc::Imm && elem_size(elem) == 4) {
+    _buf.movImm(m, l.v);
+  } else if (l.kind == JavaIrLoc::Reg &&
+             (elem_size(elem) > 1 || l.v <= JavaEBX)) {
+    /* only eax to ebx have byte registers */
+    store_elem(_buf, m, (JavaRegE) l.v, elem);
+  } else if (m.base != JavaEDX && m.index != JavaEDX) {
+    load(JavaEDX, x);
+    store_elem(_buf, m, JavaEDX, elem);
+  } else {
+    _buf.lea(JavaEAX, m);
+    load(JavaEDX, x);
+    store_elem(_buf, JavaMem(JavaEAX, 0), JavaEDX, elem);
+  }
+}
+
+static JavaCondCodeE swap_cond(s4 c)
+{
+  switch (c) {
+  case JavaCondL:  return JavaCondG;
+  case JavaCondG:  return JavaCondL;
+  case JavaCondLE: return JavaCondGE;
+  case JavaCondGE: return JavaCondLE;
+  default:         return (JavaCondCodeE) c;
+  }
+}
+
+void JavaOptimizer::emit(JavaIrInstr *v, JavaIrBlock *next)
+{
+  JavaIrBlock *b = v->block;
+  JavaIrInstr *x, *y;
+  JavaIrLoc l;
+  JavaCondCodeE c;
+  JavaRegE d, r, base;
+  JavaMem m(JavaNoReg, 0);
+  u4 i, n;
+
+  switch (v->op) {
+  case JavaIrConst:
+  case JavaIrPhi:
+    break;
+
+  case JavaIrParam:
+    /* an argument, or for an OSR entry a local of the frame it takes
+       over, laid out as JavaVMFrame's */
+    d = target(v);
+    _buf.mov(JavaEAX, JavaMem(JavaEBP, 12));
+    if (_osrPc == JAVA_NO_OSR)
+      m = JavaMem(JavaEAX, 4 * (_method->argSlots() - 1 - v->imm));
+    else
+      m = JavaMem(JavaEAX, -4 * v->imm);
+    _buf.mov(d, m);
+    store(v, d);
+    break;
+
+  case JavaIrAdd: case JavaIrSub: case JavaIrAnd: case JavaIrOr:
+  case JavaIrXor: case JavaIrMul:
+    d = target(v);
+    x = v->args[0];
+    y = v->args[1];
+    if (y->op != JavaIrConst && y->reg == d && x->reg != d) {
+      /* the result register holds the right operand */
+      if (v->op == JavaIrSub)
+        d = JavaEAX;
+      else
+        std::swap(x, y);
+    }
+    load(d, x);
+    l = loc(y);
+    if (v->op != JavaIrMul)
+      aluOp(v->op == JavaIrAdd ? JavaAluAdd : v->op == JavaIrSub ? JavaAluSub :
+            v->op == JavaIrAnd ? JavaAluAnd : v->op == JavaIrOr ? JavaAluOr :
+            JavaAluXor, d, y);
+    else if (l.kind == JavaIrLoc::Imm)
+      _buf.imulImm(d, d, l.v);
+    else if (l.kind == JavaIrLoc::Reg)
+      _buf.imul(d, (JavaRegE) l.v);
+    else
+      _buf.imul(d, mem(l));
+    store(v, d);
+    break;
+
+  case JavaIrNeg:
+    d = target(v);
+    load(d, v->args[0]);
+    _buf.neg(d);
+    store(v, d);
+    break;
+
+  case JavaIrDiv: case JavaIrRem:
+    emitDivide(v);
+    break;
+
+  case JavaIrShl: case JavaIrShr: case JavaIrUshr:
+    emitShift(v);
+    break;
+
+  case JavaIrNullCheck:
+    l = loc(v->args[0]);
+    if (l.kind == JavaIrLoc::Imm) {
+      _buf.jmp(_npeLabel);
+      break;
+    }
+    if (l.kind == JavaIrLoc::Reg)
+      _buf.test((JavaRegE) l.v, (JavaRegE) l.v);
+    else
+      _buf.aluImm(JavaAluCmp, mem(l), 0);
+    _buf.jcc(JavaCondE, _npeLabel);
+    break;
+
+  case JavaIrBoundsCheck:
+    /* unsigned, so a negative index is out of range too */
+    r = inReg(v->args[0], JavaEAX);
+    aluOp(JavaAluCmp, r, v->args[1]);
+    _buf.jcc(JavaCondAE, _rangeLabel);
+    break;
+
+  case JavaIrArrayLength:
+    d = target(v);
+    base = inReg(v->args[0], JavaEAX);
+    _buf.mov(d, JavaMem(base, LEN));
+    store(v, d);
+    break;
+
+  case JavaIrArrayLoad:
+  case JavaIrArrayStore:
+    n = elem_size(v->elem);
+    base = inReg(v->args[0], JavaEAX);
+    if (v->args[1]->op == JavaIrConst)
+      m = JavaMem(base, DATA + n * v->args[1]->imm);
+    else
+      m = JavaMem(base, inReg(v->args[1], JavaEDX), n, DATA);
+    if (v->op == JavaIrArrayLoad) {
+      d = target(v);
+      load_elem(_buf, d, m, v->elem);
+      store(v, d);
+    } else {
+      storeValue(m, v->args[2], v->elem);
+    }
+    break;
+
+  case JavaIrLoad:
+    d = target(v);
+    if (v->args.empty())
+      m = JavaMem(JavaNoReg, v->imm);
+    else
+      m = JavaMem(inReg(v->args[0], JavaEAX), v->imm);
+    load_elem(_buf, d, m, v->elem);
+    store(v, d);
+    break;
+
+  case JavaIrStore:
+    if (v->args.size() == 1) {
+      m = JavaMem(JavaNoReg, v->imm);
+      x = v->args[0];
+    } else {
+      m = JavaMem(inReg(v->args[0], JavaEAX), v->imm);
+      x = v->args[1];
+    }
+    storeValue(m, x, v->elem);
+    break;
+
+  case JavaIrCall:
+    /* the same convention as the baseline compiler: arguments pushed in
+       order, then a pointer to them and the method, through its entry */
+    for (i = 0; i < v->args.size(); i++) {
+      l = loc(v->args[i]);
+      if (l.kind == JavaIrLoc::Imm)
+        _buf.pushImm(l.v);
+      else if (l.kind == JavaIrLoc::Reg)
+        _buf.push((JavaRegE) l.v);
+      else
+        _buf.push(mem(l));
+    }
+    if (v->imm == JavaIrCallDirect) {
+      _buf.mov(JavaEAX, JavaESP);
+      _buf.push(JavaEAX);
+      _buf.pushImm((u4) (uintptr) v->method);
+      _buf.call(javaAbs(v->method));
+    } else {
+      /* the receiver was pushed first; the resolver returns the method */
+      _buf.mov(JavaEAX, JavaMem(JavaESP, 4 * (v->args.size() - 1)));
+      _buf.pushImm((u4) (uintptr) v->method);
+      _buf.push(JavaEAX);
+      _buf.call(v->imm == JavaIrCallVirtual ?
+                JAVA_FN(&JavaRuntime::resolveVirtual) :
+                JAVA_FN(&JavaRuntime::resolveInterface));
+      _buf.aluImm(JavaAluAdd, JavaESP, 8);
+      _buf.mov(JavaECX, JavaESP);
+      _buf.push(JavaECX);
+      _buf.push(JavaEAX);
+      _buf.call(JavaMem(JavaEAX, 0));
+    }
+    _buf.aluImm(JavaAluAdd, JavaESP, 8 + 4 * v->args.size());
+    if (v->hasValue())
+      store(v, JavaEAX);
+    break;
+
+  case JavaIrIf:
+    x = v->args[0];
+    y = v->args[1];
+    c = (JavaCondCodeE) v->imm;
+    if (x->op == JavaIrConst && y->op != JavaIrConst) {
+      std::swap(x, y);
+      c = swap_cond(c);
+    }
+    r = inReg(x, JavaEAX);
+    if (y->op == JavaIrConst && y->imm == 0)
+      _buf.test(r, r);
+    else
+      aluOp(JavaAluCmp, r, y);
+    /* conditions come in pairs that differ in the low bit */
+    if (b->succs[0] == next) {
+      _buf.jcc((JavaCondCodeE) (c ^ 1), b->succs[1]->label);
+    } else {
+      _buf.jcc(c, b->succs[0]->label);
+      if (b->succs[1] != next)
+        _buf.jmp(b->succs[1]->label);
+    }
+    break;
+
+  case JavaIrGoto:
+    phiMoves(b);
+    if (b->succs[0] != next)
+      _buf.jmp(b->succs[0]->label);
+    break;
+
+  case JavaIrReturn:
+    if (!v->args.empty())
+      load(JavaEAX, v->args[0]);
+    emitEpilogue();
+    break;
+
+  case JavaIrDeopt:
+    /* the runtime finds the values in the saved registers and the spill
+       slots, finishes the method in the interpreter and returns what it
+       returns */
+    _buf.pushad();
+    _buf.push(JavaESP);
+    _buf.pushImm((u4) (uintptr) deoptPoint(v));
+    _buf.call(JAVA_FN(&JavaDeopt::deoptimize));
+    emitEpilogue();
+    break;
+  }
+}
+
+/* where the arguments of the deopt 'v' are, frame by frame */
+JavaDeoptPoint *JavaOptimizer::deoptPoint(JavaIrInstr *v)
+{
+  JavaDeoptPoint *p = new JavaDeoptPoint;
+  JavaDeoptFrame f;
+  JavaDeoptValue d;
+  JavaIrState *s;
+  JavaIrLoc l;
+  u4 i, n, next = 0;
+
+  p->method = _method;
+  p->reason = v->imm == JavaIrDeoptClass ? "class check" : "class hierarchy";
+  p->traps = 0;
+  for (s = v->state; s; s = s->caller) {
+    n = s == v->state ? s->stack.size() : s->stack.size() - s->args;
+    f.method = s->method;
+    f.pc = s->pc;
+    f.first = p->values.size();
+    f.numLocals = s->locals.size();
+    f.numStack = n;
+    for (i = 0; i < f.numLocals + n; i++) {
+      if (i < f.numLocals && !s->locals[i]) {
+        d.kind = JavaDeoptValue::Dead;
+        d.v = 0;
+      } else {
+        l = loc(v->args[next++]);
+        d.kind = l.kind == JavaIrLoc::Reg ? JavaDeoptValue::Reg :
+          l.kind == JavaIrLoc::Mem ? JavaDeoptValue::Frame :
+          JavaDeoptValue::Const;
+        d.v = l.v;
+      }
+      p->values.push_back(d);
+    }
+    p->frames.push_back(f);
+  }
+  _deoptPoints.push_back(p);
+  return p;
+}
+
+/* frame:
+
+     [ebp + 12]         args, as passed to the JavaEntry
+     [ebp + 8]          the JavaVMMethod
+     [ebp - 4 .. - 12]  saved ebx, esi, edi
+     [ebp - 16 - 4k]    spill slot k */
+bool JavaOptimizer::generate()
+{
+  JavaIrBlock *b, *next;
+  u4 i, j;
+
+  allocateRegisters();
+
+  _npeLabel = _buf.newLabel();
+  _rangeLabel = _buf.newLabel();
+  _arithLabel = _buf.newLabel();
+  for (i = 0; i < _order.size(); i++)
+    _order[i]->label = _buf.newLabel();
+
+  _buf.push(JavaEBP);
+  _buf.mov(JavaEBP, JavaESP);
+  _buf.push(JavaEBX);
+  _buf.push(JavaESI);
+  _buf.push(JavaEDI);
+  if (_numSpills)
+    _buf.aluImm(JavaAluSub, JavaESP, 4 * _numSpills);
+
+  /* there is no tier above this one, but the code cache sweeper takes a
+     method whose counters stand still for cold; calls are enough, since
+     code that is still running when it goes cold is only retired */
+  _buf.aluImm(JavaAluAdd, javaAbs((const void *) _method->invocationsAddr()),
+              1);
+
+  for (i = 0; i < _order.size(); i++) {
+    b = _order[i];
+    next = i + 1 < _order.size() ? _order[i + 1] : 0;
+    _buf.bind(b->label);
+    for (j = 0; j < b->code.size(); j++)
+      emit(b->code[j], next);
+  }
+
+  /* out-of-line exception paths shared by the whole method */
+  _buf.bind(_npeLabel);
+  _buf.pushImm(JavaNullPointerException);
+  _buf.call(JAVA_FN(&JavaRuntime::throwException));
+  _buf.bind(_rangeLabel);
+  _buf.pushImm(JavaArrayIndexOutOfBoundsException);
+  _buf.call(JAVA_FN(&JavaRuntime::throwException));
+  _buf.bind(_arithLabel);
+  _buf.pushImm(JavaArithmeticException);
+  _buf.call(JAVA_FN(&JavaRuntime::throwException));
+
+  return _buf.finish();
+}
@@ -0,0 +1,1816 @@
+/**
+ * @file opt.c
+ * @desc the optimizing compiler's IR: construction of SSA form from the
+ *       bytecode and the scalar optimizations on it
+ *
+ * @author cjeong
+ */
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <java/java_instr.h>
+#include <java/java_vm.h>
+#include <java/java_runtime.h>
+#include <java/java_opt.h>
+#include <java/java_deopt.h>
+#include <java/java_codecache.h>
+
+static const char *op_names[] = {
+  "const", "param", "phi", "add", "sub", "mul", "div", "rem",
+  "and", "or", "xor", "shl", "shr", "ushr", "neg",
+  "nullcheck", "boundscheck", "arraylength", "arrayload", "arraystore",
+  "load", "store", "call", "if", "goto", "return", "deopt"
+};
+
+/* true for instructions that neither trap nor touch memory, which may be
+   computed anywhere their operands are available */
+static bool is_pure(JavaIrInstr *v)
+{
+  switch (v->op) {
+  case JavaIrConst:
+  case JavaIrAdd: case JavaIrSub: case JavaIrMul:
+  case JavaIrAnd: case JavaIrOr: case JavaIrXor:
+  case JavaIrShl: case JavaIrShr: case JavaIrUshr:
+  case JavaIrNeg:
+    return true;
+  case JavaIrDiv: case JavaIrRem:
+    /* only a division by a constant other than 0 and -1 cannot trap */
+    return v->args[1]->op == JavaIrConst && v->args[1]->imm != 0 &&
+      v->args[1]->imm != -1;
+  default:
+    return false;
+  }
+}
+
+static bool is_commutative(JavaIrOpE op)
+{
+  return op == JavaIrAdd || op == JavaIrMul || op == JavaIrAnd ||
+    op == JavaIrOr || op == JavaIrXor;
+}
+
+/* Java semantics; false for a division by zero, which must trap */
+static bool fold(JavaIrOpE op, s4 a, s4 b, s4 *r)
+{
+  switch (op) {
+  case JavaIrAdd: *r = (s4) ((u4) a + (u4) b); return true;
+  case JavaIrSub: *r = (s4) ((u4) a - (u4) b); return true;
+  case JavaIrMul: *r = (s4) ((u4) a * (u4) b); return true;
+  case JavaIrAnd: *r = a & b; return true;
+  case JavaIrOr:  *r = a | b; return true;
+  case JavaIrXor: *r = a ^ b; return true;
+  case JavaIrShl: *r = (s4) ((u4) a << (b & 31)); return true;
+  case JavaIrShr: *r = a >> (b & 31); return true;
+  case JavaIrUshr: *r = (s4) ((u4) a >> (b & 31)); return true;
+  case JavaIrDiv: case JavaIrRem:
+    if (b == 0)
+      return false;
+    if (b == -1)
+      *r = op == JavaIrDiv ? (s4) (0 - (u4) a) : 0;
+    else
+      *r = op == JavaIrDiv ? a / b : a % b;
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool test_cond(s4 cond, s4 a, s4 b)
+{
+  switch (cond) {
+  case JavaCondE:  return a == b;
+  case JavaCondNE: return a != b;
+  case JavaCondL:  return a < b;
+  case JavaCondGE: return a >= b;
+  case JavaCondG:  return a > b;
+  case JavaCondLE: return a <= b;
+  default:         return false;
+  }
+}
+
+static int log2_exact(s4 v)
+{
+  int n;
+
+  if (v <= 0 || (v & (v - 1)) != 0)
+    return -1;
+  for (n = 0; (1 << n) != v; n++)
+    ;
+  return n;
+}
+
+/* true if a method descriptor has a long or double parameter */
+static bool has_wide_args(const char *desc)
+{
+  const char *p;
+
+  for (p = desc + 1; *p && *p != ')'; p++) {
+    if (*p == 'J' || *p == 'D')
+      return true;
+    if (*p == 'L')
+      while (*p && *p != ';')
+        p++;
+    else if (*p == '[') {
+      while (p[1] == '[')
+        p++;
+      if (p[1] == 'L')
+        while (*p && *p != ';')
+          p++;
+      else
+        p++;
+    }
+  }
+  return false;
+}
+
+/* the type of a field access, or 0 if the compiler does not handle it */
+static char field_type(char t)
+{
+  switch (t) {
+  case 'Z': case 'B':
+    return 'B';
+  case 'C': case 'S': case 'I':
+    return t;
+  case 'L': case '[':
+    return 'L';
+  default:
+    return 0;
+  }
+}
+
+JavaOptimizer::JavaOptimizer(JavaVMMethod *m, JavaOptimizer *parent) :
+  _method(m), _parent(parent), _depth(parent ? parent->_depth + 1 : 0),
+  _osrPc(JAVA_NO_OSR), _callerState(0), _entry(0), _pc(0), _folded(0),
+  _numbered(0), _hoisted(0), _checks(0), _inlinedBytes(0), _numSpills(0),
+  _npeLabel(-1), _rangeLabel(-1), _arithLabel(-1)
+{
+}
+
+JavaOptimizer::~JavaOptimizer()
+{
+  u4 i;
+
+  for (i = 0; i < _instrs.size(); i++)
+    delete _instrs[i];
+  for (i = 0; i < _blocks.size(); i++)
+    delete _blocks[i];
+  for (i = 0; i < _loops.size(); i++)
+    delete _loops[i];
+  for (i = 0; i < _states.size(); i++)
+    delete _states[i];
+  for (i = 0; i < _deoptPoints.size(); i++)
+    delete _deoptPoints[i];
+}
+
+JavaIrInstr *JavaOptimizer::newInstr(JavaIrOpE op, JavaIrBlock *b, char type)
+{
+  JavaIrInstr *v = new JavaIrInstr;
+
+  v->op = op;
+  v->id = _instrs.size();
+  v->imm = 0;
+  v->type = type;
+  v->elem = 0;
+  v->pc = _pc;
+  v->method = 0;
+  v->state = 0;
+  v->block = b;
+  v->forward = 0;
+  v->removed = false;
+  v->from = v->to = -1;
+  v->weight = 0;
+  v->reg = JavaNoReg;
+  v->spill = 0;
+  _instrs.push_back(v);
+  return v;
+}
+
+JavaIrInstr *JavaOptimizer::append(JavaIrBlock *b, JavaIrOpE op, char type,
+                                   JavaIrInstr *a0, JavaIrInstr *a1,
+                                   JavaIrInstr *a2)
+{
+  JavaIrInstr *v = newInstr(op, b, type);
+
+  if (a0)
+    v->args.push_back(a0);
+  if (a1)
+    v->args.push_back(a1);
+  if (a2)
+    v->args.push_back(a2);
+  b->code.push_back(v);
+  return v;
+}
+
+JavaIrInstr *JavaOptimizer::newConst(JavaIrBlock *b, s4 c)
+{
+  JavaIrInstr *v = append(b, JavaIrConst, 'I');
+
+  v->imm = c;
+  return v;
+}
+
+JavaIrBlock *JavaOptimizer::newBlock(u4 pc)
+{
+  JavaIrBlock *b = new JavaIrBlock;
+
+  b->id = _blocks.size();
+  b->pc = pc;
+  b->endPc = pc;
+  b->idom = 0;
+  b->rpo = -1;
+  b->loopDepth = 0;
+  b->sealed = false;
+  b->filled = false;
+  b->label = -1;
+  b->from = b->to = 0;
+  _blocks.push_back(b);
+  return b;
+}
+
+JavaIrInstr *JavaOptimizer::resolve(JavaIrInstr *v)
+{
+  while (v->forward)
+    v = v->forward;
+  return v;
+}
+
+
+bool JavaOptimizer::buildCfg()
+{
+  const u1 *code = _method->code();
+  u4 len = _method->codeLength();
+  std::vector<bool> leader(len + 1, false);
+  std::vector<JavaIrBlock *> at(len + 1, (JavaIrBlock *) 0);
+  JavaIrBlock *b, *prev = 0;
+  u4 pc, n, last, target;
+  u1 op;
+  int i;
+
+  /* block boundaries */
+  leader[0] = true;
+  for (pc = 0; pc < len; pc += n) {
+    op = code[pc];
+    n = jopLength(code, pc);
+    if (n == 0 || pc + n > len)
+      return false;
+    if ((op >= JOP_IFEQ && op <= JOP_GOTO) || op == JOP_IFNULL ||
+        op == JOP_IFNONNULL || op == JOP_GOTO_W) {
+      target = pc + (op == JOP_GOTO_W ? jopS4(code + pc + 1) :
+                     jopS2(code + pc + 1));
+      if (target >= len)
+        return false;
+      leader[target] = true;
+      leader[pc + n] = true;
+    } else if ((op >= JOP_IRETURN && op <= JOP_RETURN) || op == JOP_ATHROW) {
+      leader[pc + n] = true;
+    } else if (op == JOP_JSR || op == JOP_JSR_W || op == JOP_RET ||
+               op == JOP_TABLESWITCH || op == JOP_LOOKUPSWITCH) {
+      return false;
+    }
+  }
+
+  _entry = newBlock(~0U);
+  for (pc = 0; pc < len; pc += jopLength(code, pc)) {
+    if (!leader[pc])
+      continue;
+    if (prev)
+      prev->endPc = pc;
+    prev = at[pc] = newBlock(pc);
+  }
+  prev->endPc = len;
+  for (pc = 0; pc < len; pc++)
+    if (leader[pc] && !at[pc])
+      return false;             /* a jump into the middle of an opcode */
+
+  /* edges; a taken branch is always the first successor */
+  if (_osrPc == JAVA_NO_OSR)
+    _entry->addSucc(at[0]);
+  else if (_osrPc < len && at[_osrPc])
+    _entry->addSucc(at[_osrPc]);
+  else
+    return false;
+  for (i = 1; i < (int) _blocks.size(); i++) {
+    b = _blocks[i];
+    for (pc = last = b->pc; pc < b->endPc; pc += jopLength(code, pc))
+      last = pc;
+    op = code[last];
+    if ((op >= JOP_IFEQ && op <= JOP_IF_ACMPNE) || op == JOP_IFNULL ||
+        op == JOP_IFNONNULL) {
+      if (b->endPc >= len)
+        return false;
+      target = last + jopS2(code + last + 1);
+      b->addSucc(at[target]);
+      /* a branch to the next instruction has one edge only */
+      if (at[target] != at[b->endPc])
+        b->addSucc(at[b->endPc]);
+    } else if (op == JOP_GOTO || op == JOP_GOTO_W) {
+      target = last + (op == JOP_GOTO_W ? jopS4(code + last + 1) :
+                       jopS2(code + last + 1));
+      b->addSucc(at[target]);
+    } else if (!(op >= JOP_IRETURN && op <= JOP_RETURN) && op != JOP_ATHROW) {
+      if (b->endPc >= len)
+        return false;
+      b->addSucc(at[b->endPc]);
+    }
+  }
+  return true;
+}
+
+void JavaOptimizer::computeOrder()
+{
+  std::vector<std::pair<JavaIrBlock *, u4> > stack;
+  std::vector<JavaIrBlock *> post;
+  std::vector<bool> seen(_blocks.size(), false);
+  JavaIrBlock *b, *s;
+  int i, n;
+
+  for (i = 0; i < (int) _blocks.size(); i++)
+    _blocks[i]->rpo = -1;
+
+  stack.push_back(std::make_pair(_entry, 0U));
+  seen[_entry->id] = true;
+  while (!stack.empty()) {
+    b = stack.back().first;
+    /* the last successor first, which puts the first one, the taken
+       branch, right after its block: loop bodies follow their header */
+    if (stack.back().second < b->succs.size()) {
+      s = b->succs[b->succs.size() - 1 - stack.back().second++];
+      if (!seen[s->id]) {
+        seen[s->id] = true;
+        stack.push_back(std::make_pair(s, 0U));
+      }
+    } else {
+      post.push_back(b);
+      stack.pop_back();
+    }
+  }
+
+  n = post.size();
+  _order.resize(n);
+  for (i = 0; i < n; i++) {
+    _order[i] = post[n - 1 - i];
+    _order[i]->rpo = i;
+  }
+}
+
+static JavaIrBlock *intersect(JavaIrBlock *a, JavaIrBlock *b)
+{
+  while (a != b) {
+    while (a->rpo > b->rpo)
+      a = a->idom;
+    while (b->rpo > a->rpo)
+      b = b->idom;
+  }
+  return a;
+}
+
+/* Cooper, Harvey and Kennedy's iterative algorithm */
+void JavaOptimizer::computeDominators()
+{
+  JavaIrBlock *b, *idom;
+  bool changed = true;
+  u4 i, j;
+
+  for (i = 0; i < _order.size(); i++) {
+    _order[i]->idom = 0;
+    _order[i]->children.clear();
+  }
+  _entry->idom = _entry;
+
+  while (changed) {
+    changed = false;
+    for (i = 1; i < _order.size(); i++) {
+      b = _order[i];
+      idom = 0;
+      for (j = 0; j < b->preds.size(); j++) {
+        if (!b->preds[j]->idom)
+          continue;
+        idom = idom ? intersect(b->preds[j], idom) : b->preds[j];
+      }
+      if (b->idom != idom) {
+        b->idom = idom;
+        changed = true;
+      }
+    }
+  }
+
+  _entry->idom = 0;
+  for (i = 1; i < _order.size(); i++)
+    _order[i]->idom->children.push_back(_order[i]);
+}
+
+bool JavaOptimizer::dominates(JavaIrBlock *a, JavaIrBlock *b) const
+{
+  while (b && b != a)
+    b = b->idom;
+  return b == a;
+}
+
+static bool loop_smaller(JavaIrLoop *a, JavaIrLoop *b)
+{
+  return a->size < b->size;
+}
+
+void JavaOptimizer::findLoops()
+{
+  std::map<JavaIrBlock *, JavaIrLoop *> byHeader;
+  std::vector<JavaIrBlock *> work;
+  JavaIrLoop *l;
+  JavaIrBlock *b, *h, *p;
+  u4 i, j, k;
+
+  for (i = 0; i < _loops.size(); i++)
+    delete _loops[i];
+  _loops.clear();
+
+  /* a back edge goes to a block that dominates its source */
+  for (i = 0; i < _order.size(); i++) {
+    b = _order[i];
+    for (j = 0; j < b->succs.size(); j++) {
+      h = b->succs[j];
+      if (!dominates(h, b))
+        continue;
+      l = byHeader[h];
+      if (!l) {
+        l = byHeader[h] = new JavaIrLoop;
+        l->header = h;
+        l->preheader = 0;
+        l->blocks.assign(_blocks.size(), false);
+        l->blocks[h->id] = true;
+        l->size = 1;
+        _loops.push_back(l);
+      }
+      work.push_back(b);
+      while (!work.empty()) {
+        p = work.back();
+        work.pop_back();
+        if (l->blocks[p->id])
+          continue;
+        l->blocks[p->id] = true;
+        l->size++;
+        for (k = 0; k < p->preds.size(); k++)
+          work.push_back(p->preds[k]);
+      }
+    }
+  }
+  std::stable_sort(_loops.begin(), _loops.end(), loop_smaller);
+
+  for (i = 0; i < _order.size(); i++)
+    _order[i]->loopDepth = 0;
+  for (i = 0; i < _loops.size(); i++) {
+    l = _loops[i];
+    for (j = 0; j < _order.size(); j++)
+      if (l->contains(_order[j]))
+        _order[j]->loopDepth++;
+
+    /* the preheader is the only way in, and leads nowhere else */
+    h = l->header;
+    for (j = 0; j < h->preds.size(); j++) {
+      if (l->contains(h->preds[j]))
+        continue;
+      if (l->preheader || h->preds[j]->succs.size() != 1) {
+        l->preheader = 0;
+        break;
+      }
+      l->preheader = h->preds[j];
+    }
+  }
+}
+
+/* runs before SSA construction, so edges can be moved freely */
+void JavaOptimizer::insertPreheaders()
+{
+  std::vector<JavaIrBlock *> outside;
+  JavaIrBlock *h, *p;
+  bool changed = false;
+  u4 i, j, k;
+
+  for (i = 0; i < _loops.size(); i++) {
+    if (_loops[i]->preheader)
+      continue;
+    h = _loops[i]->header;
+    outside.clear();
+    for (j = 0; j < h->preds.size(); j++)
+      if (!_loops[i]->contains(h->preds[j]))
+        outside.push_back(h->preds[j]);
+
+    p = newBlock(~0U);
+    for (j = 0; j < outside.size(); j++) {
+      for (k = 0; k < outside[j]->succs.size(); k++)
+        if (outside[j]->succs[k] == h)
+          outside[j]->succs[k] = p;
+      for (k = 0; k < h->preds.size(); k++) {
+        if (h->preds[k] == outside[j]) {
+          h->preds.erase(h->preds.begin() + k);
+          break;
+        }
+      }
+      p->preds.push_back(outside[j]);
+    }
+    p->addSucc(h);
+    changed = true;
+  }
+
+  if (changed) {
+    computeOrder();
+    computeDominators();
+    findLoops();
+  }
+}
+
+/* drops one edge; the phis of 'to' lose the matching operand */
+void JavaOptimizer::removeEdge(JavaIrBlock *from, JavaIrBlock *to)
+{
+  u4 i, j;
+
+  for (i = 0; i < to->preds.size(); i++) {
+    if (to->preds[i] != from)
+      continue;
+    to->preds.erase(to->preds.begin() + i);
+    for (j = 0; j < to->phis.size(); j++)
+      to->phis[j]->args.erase(to->phis[j]->args.begin() + i);
+    break;
+  }
+  for (i = 0; i < from->succs.size(); i++) {
+    if (from->succs[i] == to) {
+      from->succs.erase(from->succs.begin() + i);
+      break;
+    }
+  }
+}
+
+/* after edges were removed: drops unreachable blocks and brings the
+   analyses up to date */
+void JavaOptimizer::cleanCfg()
+{
+  JavaIrBlock *b;
+  u4 i, j;
+
+  computeOrder();
+  for (i = 0; i < _blocks.size(); i++) {
+    b = _blocks[i];
+    if (b->rpo >= 0)
+      continue;
+    while (!b->succs.empty())
+      removeEdge(b, b->succs.back());
+    for (j = 0; j < b->phis.size(); j++)
+      b->phis[j]->removed = true;
+    for (j = 0; j < b->code.size(); j++)
+      b->code[j]->removed = true;
+    b->phis.clear();
+    b->code.clear();
+  }
+  removeTrivialPhis();
+  computeDominators();
+  findLoops();
+}
+
+void JavaOptimizer::splitCriticalEdges()
+{
+  JavaIrBlock *b, *s, *n;
+  u4 i, j, k, count = _order.size();
+
+  for (i = 0; i < count; i++) {
+    b = _order[i];
+    if (b->succs.size() < 2)
+      continue;
+    for (j = 0; j < b->succs.size(); j++) {
+      s = b->succs[j];
+      if (s->preds.size() < 2)
+        continue;
+      /* same predecessor slot, so the phi operands stay in place */
+      n = newBlock(~0U);
+      for (k = 0; k < s->preds.size(); k++) {
+        if (s->preds[k] == b) {
+          s->preds[k] = n;
+          break;
+        }
+      }
+      b->succs[j] = n;
+      n->preds.push_back(b);
+      n->succs.push_back(s);
+      append(n, JavaIrGoto, 'V');
+    }
+  }
+  computeOrder();
+}
+
+
+void JavaOptimizer::writeLocal(JavaIrBlock *b, u4 local, JavaIrInstr *v)
+{
+  _defs[b->id][local] = v;
+}
+
+JavaIrInstr *JavaOptimizer::readLocal(JavaIrBlock *b, u4 local)
+{
+  JavaIrInstr *v = _defs[b->id][local];
+
+  if (v)
+    return resolve(v);
+
+  if (!b->sealed) {
+    /* operands are added once all predecessors are known */
+    v = newInstr(JavaIrPhi, b, 'I');
+    b->phis.push_back(v);
+    _incomplete[b->id][local] = v;
+  } else if (b->preds.size() == 1) {
+    v = readLocal(b->preds[0], local);
+  } else if (b->preds.empty()) {
+    /* never assigned on this path; the verifier rules out a use */
+    v = newConst(_entry, 0);
+    _entry->code.pop_back();
+    _entry->code.insert(_entry->code.begin(), v);
+  } else {
+    /* the phi goes in first, which ends the recursion around loops */
+    v = newInstr(JavaIrPhi, b, 'I');
+    b->phis.push_back(v);
+    writeLocal(b, local, v);
+    v = addPhiOperands(local, v);
+  }
+  writeLocal(b, local, v);
+  return v;
+}
+
+JavaIrInstr *JavaOptimizer::addPhiOperands(u4 local, JavaIrInstr *phi)
+{
+  u4 i;
+
+  for (i = 0; i < phi->block->preds.size(); i++)
+    phi->args.push_back(readLocal(phi->block->preds[i], local));
+  return phi;
+}
+
+void JavaOptimizer::sealBlock(JavaIrBlock *b)
+{
+  u4 i;
+
+  for (i = 0; i < _incomplete[b->id].size(); i++)
+    if (_incomplete[b->id][i])
+      addPhiOperands(i, _incomplete[b->id][i]);
+  b->sealed = true;
+}
+
+/* a phi whose operands are all the same value, or itself, is that value */
+bool JavaOptimizer::removeTrivialPhis()
+{
+  JavaIrInstr *phi, *same, *a;
+  bool changed = true, any = false, trivial;
+  u4 i, j, k;
+
+  while (changed) {
+    changed = false;
+    for (i = 0; i < _order.size(); i++) {
+      for (j = 0; j < _order[i]->phis.size(); j++) {
+        phi = _order[i]->phis[j];
+        if (phi->forward || phi->removed)
+          continue;
+        same = 0;
+        trivial = true;
+        for (k = 0; k < phi->args.size(); k++) {
+          a = resolve(phi->args[k]);
+          if (a == same || a == phi)
+            continue;
+          if (same) {
+            trivial = false;
+            break;
+          }
+          same = a;
+        }
+        if (!trivial)
+          continue;
+        if (!same) {
+          same = newConst(_entry, 0);
+          _entry->code.pop_back();
+          _entry->code.insert(_entry->code.begin(), same);
+        }
+        phi->forward = same;
+        changed = any = true;
+      }
+    }
+  }
+  resolveArgs();
+  compact();
+  return any;
+}
+
+void JavaOptimizer::resolveArgs()
+{
+  JavaIrBlock *b;
+  u4 i, j, k;
+
+  for (i = 0; i < _order.size(); i++) {
+    b = _order[i];
+    for (j = 0; j < b->phis.size(); j++)
+      for (k = 0; k < b->phis[j]->args.size(); k++)
+        b->phis[j]->args[k] = resolve(b->phis[j]->args[k]);
+    for (j = 0; j < b->code.size(); j++)
+      for (k = 0; k < b->code[j]->args.size(); k++)
+        b->code[j]->args[k] = resolve(b->code[j]->args[k]);
+  }
+}
+
+static void compact_list(std::vector<JavaIrInstr *> &list)
+{
+  u4 i, n = 0;
+
+  for (i = 0; i < list.size(); i++)
+    if (!list[i]->forward && !list[i]->removed)
+      list[n++] = list[i];
+  list.resize(n);
+}
+
+void JavaOptimizer::compact()
+{
+  u4 i;
+
+  for (i = 0; i < _order.size(); i++) {
+    compact_list(_order[i]->phis);
+    compact_list(_order[i]->code);
+  }
+}
+
+/* the local an instruction reads ('u'), writes ('d') or both ('b'), for
+   the opcodes fillBlock() translates; 0 if none */
+static char local_access(const u1 *code, u4 pc, u4 *local)
+{
+  u1 op = code[pc];
+
+  switch (op) {
+  case JOP_ILOAD: case JOP_ALOAD:
+    *local = code[pc + 1];
+    return 'u';
+  case JOP_ILOAD_0: case JOP_ILOAD_1: case JOP_ILOAD_2: case JOP_ILOAD_3:
+    *local = op - JOP_ILOAD_0;
+    return 'u';
+  case JOP_ALOAD_0: case JOP_ALOAD_1: case JOP_ALOAD_2: case JOP_ALOAD_3:
+    *local = op - JOP_ALOAD_0;
+    return 'u';
+  case JOP_ISTORE: case JOP_ASTORE:
+    *local = code[pc + 1];
+    return 'd';
+  case JOP_ISTORE_0: case JOP_ISTORE_1: case JOP_ISTORE_2: case JOP_ISTORE_3:
+    *local = op - JOP_ISTORE_0;
+    return 'd';
+  case JOP_ASTORE_0: case JOP_ASTORE_1: case JOP_ASTORE_2: case JOP_ASTORE_3:
+    *local = op - JOP_ASTORE_0;
+    return 'd';
+  case JOP_IINC:
+    *local = code[pc + 1];
+    return 'b';
+  case JOP_WIDE:
+    *local = jopU2(code + pc + 2);
+    op = code[pc + 1];
+    return op == JOP_IINC ? 'b' : op == JOP_ISTORE || op == JOP_ASTORE ?
+      'd' : 'u';
+  default:
+    return 0;
+  }
+}
+
+/* backward liveness of the locals over the bytecode blocks, to a
+   fixpoint; the sets at the invokes are what a deoptimized frame needs */
+void JavaOptimizer::computeLiveLocals()
+{
+  const u1 *code = _method->code();
+  std::vector<std::vector<bool> > liveIn(_blocks.size(),
+    std::vector<bool>(_method->maxLocals(), false));
+  std::vector<bool> live;
+  std::vector<u4> pcs;
+  JavaIrBlock *b;
+  bool changed = true;
+  u4 pc, local, j, k;
+  int i;
+  u1 op;
+
+  while (changed) {
+    changed = false;
+    for (i = _order.size() - 1; i >= 0; i--) {
+      b = _order[i];
+      if (b->pc == ~0U)
+        continue;
+      live.assign(_method->maxLocals(), false);
+      for (j = 0; j < b->succs.size(); j++)
+        for (k = 0; k < live.size(); k++)
+          if (liveIn[b->succs[j]->id][k])
+            live[k] = true;
+
+      pcs.clear();
+      for (pc = b->pc; pc < b->endPc; pc += jopLength(code, pc))
+        pcs.push_back(pc);
+      for (j = pcs.size(); j-- > 0; ) {
+        pc = pcs[j];
+        op = code[pc];
+        if (op == JOP_INVOKESTATIC || op == JOP_INVOKESPECIAL ||
+            op == JOP_INVOKEVIRTUAL || op == JOP_INVOKEINTERFACE)
+          _liveLocals[pc] = live;
+        switch (local_access(code, pc, &local)) {
+        case 'u': case 'b':
+          live[local] = true;
+          break;
+        case 'd':
+          live[local] = false;
+          break;
+        }
+      }
+      if (live != liveIn[b->id]) {
+        liveIn[b->id] = live;
+        changed = true;
+      }
+    }
+  }
+}
+
+/* the frame state at a call in 'b', with its 'args' argument slots on
+   top of 'st' */
+JavaIrState *JavaOptimizer::newState(JavaIrBlock *b,
+                                     std::vector<JavaIrInstr *> &st, u4 args)
+{
+  JavaIrState *s = new JavaIrState;
+  std::vector<bool> &live = _liveLocals[_pc];
+  u4 i;
+
+  s->method = _method;
+  s->pc = _pc;
+  s->args = args;
+  s->locals.assign(_method->maxLocals(), (JavaIrInstr *) 0);
+  for (i = 0; i < live.size(); i++)
+    if (live[i])
+      s->locals[i] = readLocal(b, i);
+  s->stack = st;
+  s->caller = _callerState;
+  _states.push_back(s);
+  return s;
+}
+
+bool JavaOptimizer::buildSsa()
+{
+  u4 i, j, k;
+  bool ready;
+
+  computeLiveLocals();
+  _defs.assign(_blocks.size(),
+               std::vector<JavaIrInstr *>(_method->maxLocals(),
+                                          (JavaIrInstr *) 0));
+  _incomplete = _defs;
+
+  _entry->sealed = true;
+  for (i = 0; i < _order.size(); i++) {
+    if (!fillBlock(_order[i]))
+      return false;
+    _order[i]->filled = true;
+
+    /* a block is sealed once all of its predecessors are filled */
+    for (j = 0; j < _order.size(); j++) {
+      if (_order[j]->sealed)
+        continue;
+      ready = true;
+      for (k = 0; k < _order[j]->preds.size(); k++)
+        if (!_order[j]->preds[k]->filled)
+          ready = false;
+      if (ready)
+        sealBlock(_order[j]);
+    }
+  }
+
+  removeTrivialPhis();
+  return true;
+}
+
+#define PUSH(v)   st.push_back(v)
+#define POP(v)    do { if (st.empty()) return false;                  \
+                       v = st.back(); st.pop_back(); } while (0)
+
+bool JavaOptimizer::fillBlock(JavaIrBlock *b)
+{
+  const u1 *code = _method->code();
+  JavaVMCpEntry *cp = _method->cpool(), *e;
+  std::vector<JavaIrInstr *> st;
+  JavaIrInstr *v, *w, *x, *y, *r;
+  JavaVMMethod *callee;
+  const char *p;
+  u4 pc, n, local;
+  char t;
+  u1 op;
+
+  /* an OSR entry takes every local of the running frame; no value is
+     carried on the operand stack into a block */
+  if (b == _entry && _osrPc != JAVA_NO_OSR) {
+    for (local = 0; local < _method->maxLocals(); local++) {
+      v = append(b, JavaIrParam, 'I');
+      v->imm = local;
+      writeLocal(b, local, v);
+    }
+    append(b, JavaIrGoto, 'V');
+    return true;
+  }
+
+  /* the incoming arguments; local i is args[argSlots - 1 - i] */
+  if (b == _entry) {
+    local = 0;
+    if (!_method->isStatic()) {
+      v = append(b, JavaIrParam, 'L');
+      writeLocal(b, local++, v);
+    }
+    for (p = _method->desc() + 1; *p && *p != ')'; p++) {
+      if (*p == 'J' || *p == 'D')
+        return false;
+      v = append(b, JavaIrParam, *p == 'L' || *p == '[' ? 'L' : 'I');
+      v->imm = local;
+      writeLocal(b, local++, v);
+      while (*p == '[')
+        p++;
+      if (*p == 'L')
+        while (*p && *p != ';')
+          p++;
+    }
+    append(b, JavaIrGoto, 'V');
+    return true;
+  }
+  if (b->pc == ~0U) {
+    append(b, JavaIrGoto, 'V');
+    return true;
+  }
+
+  for (pc = b->pc; pc < b->endPc; pc += jopLength(code, pc)) {
+    op = code[pc];
+    _pc = pc;
+    switch (op) {
+    case JOP_NOP:
+      break;
+
+    case JOP_ACONST_NULL:
+      PUSH(newConst(b, 0));
+      break;
+    case JOP_ICONST_M1: case JOP_ICONST_0: case JOP_ICONST_1:
+    case JOP_ICONST_2: case JOP_ICONST_3: case JOP_ICONST_4:
+    case JOP_ICONST_5:
+      PUSH(newConst(b, op - JOP_ICONST_0));
+      break;
+    case JOP_BIPUSH:
+      PUSH(newConst(b, (s1) code[pc + 1]));
+      break;
+    case JOP_SIPUSH:
+      PUSH(newConst(b, jopS2(code + pc + 1)));
+      break;
+    case JOP_LDC:
+      PUSH(newConst(b, cp[code[pc + 1]].value));
+      break;
+    case JOP_LDC_W:
+      PUSH(newConst(b, cp[jopU2(code + pc + 1)].value));
+      break;
+
+    case JOP_ILOAD: case JOP_ALOAD:
+      PUSH(readLocal(b, code[pc + 1]));
+      break;
+    case JOP_ILOAD_0: case JOP_ILOAD_1: case JOP_ILOAD_2: case JOP_ILOAD_3:
+      PUSH(readLocal(b, op - JOP_ILOAD_0));
+      break;
+    case JOP_ALOAD_0: case JOP_ALOAD_1: case JOP_ALOAD_2: case JOP_ALOAD_3:
+      PUSH(readLocal(b, op - JOP_ALOAD_0));
+      break;
+    case JOP_ISTORE: case JOP_ASTORE:
+      POP(v);
+      writeLocal(b, code[pc + 1], v);
+      break;
+    case JOP_ISTORE_0: case JOP_ISTORE_1: case JOP_ISTORE_2: case JOP_ISTORE_3:
+      POP(v);
+      writeLocal(b, op - JOP_ISTORE_0, v);
+      break;
+    case JOP_ASTORE_0: case JOP_ASTORE_1: case JOP_ASTORE_2: case JOP_ASTORE_3:
+      POP(v);
+      writeLocal(b, op - JOP_ASTORE_0, v);
+      break;
+    case JOP_IINC:
+      local = code[pc + 1];
+      v = append(b, JavaIrAdd, 'I', readLocal(b, local),
+                 newConst(b, (s1) code[pc + 2]));
+      writeLocal(b, local, v);
+      break;
+    case JOP_WIDE:
+      local = jopU2(code + pc + 2);
+      switch (code[pc + 1]) {
+      case JOP_ILOAD: case JOP_ALOAD:
+        PUSH(readLocal(b, local));
+        break;
+      case JOP_ISTORE: case JOP_ASTORE:
+        POP(v);
+        writeLocal(b, local, v);
+        break;
+      case JOP_IINC:
+        v = append(b, JavaIrAdd, 'I', readLocal(b, local),
+                   newConst(b, jopS2(code + pc + 4)));
+        writeLocal(b, local, v);
+        break;
+      default:
+        return false;
+      }
+      break;
+
+    case JOP_IADD: case JOP_ISUB: case JOP_IMUL: case JOP_IDIV:
+    case JOP_IREM: case JOP_ISHL: case JOP_ISHR: case JOP_IUSHR:
+    case JOP_IAND: case JOP_IOR: case JOP_IXOR:
+      POP(w);
+      POP(v);
+      PUSH(append(b, op == JOP_IADD ? JavaIrAdd : op == JOP_ISUB ? JavaIrSub :
+                  op == JOP_IMUL ? JavaIrMul : op == JOP_IDIV ? JavaIrDiv :
+                  op == JOP_IREM ? JavaIrRem : op == JOP_ISHL ? JavaIrShl :
+                  op == JOP_ISHR ? JavaIrShr : op == JOP_IUSHR ? JavaIrUshr :
+                  op == JOP_IAND ? JavaIrAnd : op == JOP_IOR ? JavaIrOr :
+                  JavaIrXor, 'I', v, w));
+      break;
+    case JOP_INEG:
+      POP(v);
+      PUSH(append(b, JavaIrNeg, 'I', v));
+      break;
+    case JOP_I2B: case JOP_I2S:
+      POP(v);
+      n = op == JOP_I2B ? 24 : 16;
+      v = append(b, JavaIrShl, 'I', v, newConst(b, n));
+      PUSH(append(b, JavaIrShr, 'I', v, newConst(b, n)));
+      break;
+    case JOP_I2C:
+      POP(v);
+      PUSH(append(b, JavaIrAnd, 'I', v, newConst(b, 0xFFFF)));
+      break;
+
+    case JOP_IALOAD: case JOP_AALOAD: case JOP_BALOAD:
+    case JOP_CALOAD: case JOP_SALOAD:
+      POP(w);
+      POP(v);
+      append(b, JavaIrNullCheck, 'V', v);
+      x = append(b, JavaIrArrayLength, 'I', v);
+      append(b, JavaIrBoundsCheck, 'V', w, x);
+      r = append(b, JavaIrArrayLoad, 'I', v, w);
+      r->elem = op == JOP_IALOAD ? 'I' : op == JOP_AALOAD ? 'L' :
+        op == JOP_BALOAD ? 'B' : op == JOP_CALOAD ? 'C' : 'S';
+      r->type = r->elem == 'L' ? 'L' : 'I';
+      PUSH(r);
+      break;
+    case JOP_IASTORE: case JOP_AASTORE: case JOP_BASTORE:
+    case JOP_CASTORE: case JOP_SASTORE:
+      POP(y);
+      POP(w);
+      POP(v);
+      append(b, JavaIrNullCheck, 'V', v);
+      x = append(b, JavaIrArrayLength, 'I', v);
+      append(b, JavaIrBoundsCheck, 'V', w, x);
+      r = append(b, JavaIrArrayStore, 'V', v, w, y);
+      r->elem = op == JOP_IASTORE ? 'I' : op == JOP_AASTORE ? 'L' :
+        op == JOP_BASTORE ? 'B' : op == JOP_CASTORE ? 'C' : 'S';
+      break;
+    case JOP_ARRAYLENGTH:
+      POP(v);
+      append(b, JavaIrNullCheck, 'V', v);
+      PUSH(append(b, JavaIrArrayLength, 'I', v));
+      break;
+
+    /* every value takes one slot here, so the two-slot forms simply
+       work on two values */
+    case JOP_POP:
+      POP(v);
+      break;
+    case JOP_POP2:
+      POP(v);
+      POP(v);
+      break;
+    case JOP_DUP:
+      POP(v);
+      PUSH(v);
+      PUSH(v);
+      break;
+    case JOP_DUP_X1:
+      POP(v);
+      POP(w);
+      PUSH(v);
+      PUSH(w);
+      PUSH(v);
+      break;
+    case JOP_DUP_X2:
+      POP(v);
+      POP(w);
+      POP(x);
+      PUSH(v);
+      PUSH(x);
+      PUSH(w);
+      PUSH(v);
+      break;
+    case JOP_DUP2:
+      POP(v);
+      POP(w);
+      PUSH(w);
+      PUSH(v);
+      PUSH(w);
+      PUSH(v);
+      break;
+    case JOP_DUP2_X1:
+      POP(v);
+      POP(w);
+      POP(x);
+      PUSH(w);
+      PUSH(v);
+      PUSH(x);
+      PUSH(w);
+      PUSH(v);
+      break;
+    case JOP_DUP2_X2:
+      POP(v);
+      POP(w);
+      POP(x);
+      POP(y);
+      PUSH(w);
+      PUSH(v);
+      PUSH(y);
+      PUSH(x);
+      PUSH(w);
+      PUSH(v);
+      break;
+    case JOP_SWAP:
+      POP(v);
+      POP(w);
+      PUSH(v);
+      PUSH(w);
+      break;
+
+    /* block ends; values are not carried across blocks on the stack */
+    case JOP_IFEQ: case JOP_IFNE: case JOP_IFLT:
+    case JOP_IFGE: case JOP_IFGT: case JOP_IFLE:
+    case JOP_IFNULL: case JOP_IFNONNULL:
+    case JOP_IF_ICMPEQ: case JOP_IF_ICMPNE: case JOP_IF_ICMPLT:
+    case JOP_IF_ICMPGE: case JOP_IF_ICMPGT: case JOP_IF_ICMPLE:
+    case JOP_IF_ACMPEQ: case JOP_IF_ACMPNE:
+      if ((op >= JOP_IFEQ && op <= JOP_IFLE) || op == JOP_IFNULL ||
+          op == JOP_IFNONNULL)
+        w = newConst(b, 0);
+      else
+        POP(w);
+      POP(v);
+      if (!st.empty())
+        return false;
+      if (b->succs.size() == 1) {
+        append(b, JavaIrGoto, 'V');
+        return true;
+      }
+      r = append(b, JavaIrIf, 'V', v, w);
+      switch (op) {
+      case JOP_IFEQ: case JOP_IFNULL: case JOP_IF_ICMPEQ: case JOP_IF_ACMPEQ:
+        r->imm = JavaCondE;
+        break;
+      case JOP_IFNE: case JOP_IFNONNULL: case JOP_IF_ICMPNE:
+      case JOP_IF_ACMPNE:
+        r->imm = JavaCondNE;
+        break;
+      case JOP_IFLT: case JOP_IF_ICMPLT:
+        r->imm = JavaCondL;
+        break;
+      case JOP_IFGE: case JOP_IF_ICMPGE:
+        r->imm = JavaCondGE;
+        break;
+      case JOP_IFGT: case JOP_IF_ICMPGT:
+        r->imm = JavaCondG;
+        break;
+      default:
+        r->imm = JavaCondLE;
+        break;
+      }
+      return true;
+    case JOP_GOTO: case JOP_GOTO_W:
+      if (!st.empty())
+        return false;
+      append(b, JavaIrGoto, 'V');
+      return true;
+    case JOP_IRETURN: case JOP_ARETURN:
+      POP(v);
+      append(b, JavaIrReturn, 'V', v);
+      return true;
+    case JOP_RETURN:
+      append(b, JavaIrReturn, 'V');
+      return true;
+
+    case JOP_GETSTATIC: case JOP_PUTSTATIC:
+    case JOP_GETFIELD: case JOP_PUTFIELD:
+      e = &cp[jopU2(code + pc + 1)];
+      if (!(t = field_type(e->type)))
+        return false;
+      if (op == JOP_GETSTATIC) {
+        r = append(b, JavaIrLoad, t == 'L' ? 'L' : 'I');
+        r->imm = (s4) (uintptr) e->addr;
+        PUSH(r);
+      } else if (op == JOP_PUTSTATIC) {
+        POP(v);
+        r = append(b, JavaIrStore, 'V', v);
+        r->imm = (s4) (uintptr) e->addr;
+      } else if (op == JOP_GETFIELD) {
+        POP(v);
+        append(b, JavaIrNullCheck, 'V', v);
+        r = append(b, JavaIrLoad, t == 'L' ? 'L' : 'I', v);
+        r->imm = e->offset;
+        PUSH(r);
+      } else {
+        POP(w);
+        POP(v);
+        append(b, JavaIrNullCheck, 'V', v);
+        r = append(b, JavaIrStore, 'V', v, w);
+        r->imm = e->offset;
+      }
+      r->elem = t;
+      break;
+
+    case JOP_INVOKESTATIC: case JOP_INVOKESPECIAL: case JOP_INVOKEVIRTUAL:
+    case JOP_INVOKEINTERFACE:
+      callee = cp[jopU2(code + pc + 1)].method;
+      if (has_wide_args(callee->desc()) || callee->retType() == 'J' ||
+          callee->retType() == 'D')
+        return false;
+      n = callee->argSlots();
+      if (st.size() < n)
+        return false;
+      r = newInstr(JavaIrCall, b, callee->retType() == 'V' ? 'V' :
+                   callee->retType() == 'L' ? 'L' : 'I');
+      r->method = callee;
+      r->state = newState(b, st, n);
+      if (op == JOP_INVOKEINTERFACE)
+        r->imm = JavaIrCallInterface;
+      else if (op == JOP_INVOKEVIRTUAL && !callee->isFinal())
+        r->imm = JavaIrCallVirtual;
+      else
+        r->imm = JavaIrCallDirect;
+      r->args.assign(st.end() - n, st.end());
+      st.resize(st.size() - n);
+      if (!callee->isStatic())
+        append(b, JavaIrNullCheck, 'V', r->args[0]);
+      b->code.push_back(r);
+      if (r->hasValue())
+        PUSH(r);
+      break;
+
+    default:
+      return false;
+    }
+  }
+
+  if (!st.empty())
+    return false;
+  append(b, JavaIrGoto, 'V');
+  return true;
+}
+
+#undef PUSH
+#undef POP
+
+
+/* inserts a constant into 'b' just before position 'at' */
+static JavaIrInstr *const_before(JavaIrBlock *b, u4 at, JavaIrInstr *c)
+{
+  b->code.pop_back();
+  b->code.insert(b->code.begin() + at, c);
+  return c;
+}
+
+void JavaOptimizer::foldConstants()
+{
+  JavaIrInstr *v, *a, *c;
+  JavaIrBlock *b;
+  bool changed = true, cfg;
+  s4 r;
+  int k;
+  u4 i, j;
+
+  while (changed) {
+    changed = cfg = false;
+    for (i = 0; i < _order.size(); i++) {
+      b = _order[i];
+
+      /* a phi of one constant is that constant */
+      for (j = 0; j < b->phis.size(); j++) {
+        v = b->phis[j];
+        a = resolve(v->args[0]);
+        if (a->op != JavaIrConst)
+          continue;
+        for (k = 1; k < (int) v->args.size(); k++) {
+          c = resolve(v->args[k]);
+          if (c->op != JavaIrConst || c->imm != a->imm)
+            break;
+        }
+        if (k < (int) v->args.size())
+          continue;
+        c = const_before(b, 0, newConst(b, a->imm));
+        v->forward = c;
+        _folded++;
+        changed = true;
+      }
+
+      for (j = 0; j < b->code.size(); j++) {
+        v = b->code[j];
+        if (v->forward || v->removed)
+          continue;
+        for (k = 0; k < (int) v->args.size(); k++)
+          v->args[k] = resolve(v->args[k]);
+
+        switch (v->op) {
+        case JavaIrAdd: case JavaIrSub: case JavaIrMul: case JavaIrDiv:
+        case JavaIrRem: case JavaIrAnd: case JavaIrOr: case JavaIrXor:
+        case JavaIrShl: case JavaIrShr: case JavaIrUshr:
+          a = v->args[0];
+          c = v->args[1];
+          if (a->op == JavaIrConst && c->op == JavaIrConst) {
+            if (!fold(v->op, a->imm, c->imm, &r))
+              break;
+            v->op = JavaIrConst;
+            v->imm = r;
+            v->args.clear();
+          } else if (is_commutative(v->op) && a->op == JavaIrConst) {
+            /* constants go second, where the code generator wants them */
+            v->args[0] = c;
+            v->args[1] = a;
+            changed = true;
+            j--;
+            continue;
+          } else if (c->op == JavaIrConst && c->imm == 0 &&
+                     v->op != JavaIrMul && v->op != JavaIrAnd &&
+                     v->op != JavaIrDiv && v->op != JavaIrRem) {
+            v->forward = a;
+          } else if (c->op == JavaIrConst && c->imm == 1 &&
+                     (v->op == JavaIrMul || v->op == JavaIrDiv)) {
+            v->forward = a;
+          } else if (c->op == JavaIrConst && c->imm == 0 &&
+                     (v->op == JavaIrMul || v->op == JavaIrAnd)) {
+            v->forward = c;
+          } else if (c->op == JavaIrConst && v->op == JavaIrMul &&
+                     log2_exact(c->imm) > 0) {
+            v->op = JavaIrShl;
+            v->args[1] = const_before(b, j++, newConst(b, log2_exact(c->imm)));
+          } else if (a == c && (v->op == JavaIrSub || v->op == JavaIrXor)) {
+            v->op = JavaIrConst;
+            v->imm = 0;
+            v->args.clear();
+          } else if (a == c && (v->op == JavaIrAnd || v->op == JavaIrOr)) {
+            v->forward = a;
+          } else {
+            break;
+          }
+          _folded++;
+          changed = true;
+          break;
+
+        case JavaIrNeg:
+          if (v->args[0]->op != JavaIrConst)
+            break;
+          v->op = JavaIrConst;
+          v->imm = (s4) (0 - (u4) v->args[0]->imm);
+          v->args.clear();
+          _folded++;
+          changed = true;
+          break;
+
+        case JavaIrNullCheck:
+          /* a non-zero constant is a string or a class mirror, and the
+             receiver of an instance method is never null; an OSR entry
+             takes local 0 as it is */
+          a = v->args[0];
+          if ((a->op == JavaIrConst && a->imm != 0) ||
+              (a->op == JavaIrParam && a->imm == 0 &&
+               !_method->isStatic() && _osrPc == JAVA_NO_OSR)) {
+            v->removed = true;
+            _folded++;
+            changed = true;
+          }
+          break;
+
+        case JavaIrIf:
+          a = v->args[0];
+          c = v->args[1];
+          if (a->op != JavaIrConst || c->op != JavaIrConst)
+            break;
+          removeEdge(b, test_cond(v->imm, a->imm, c->imm) ?
+                     b->succs[1] : b->succs[0]);
+          v->op = JavaIrGoto;
+          v->args.clear();
+          _folded++;
+          changed = cfg = true;
+          break;
+
+        default:
+          break;
+        }
+      }
+    }
+    resolveArgs();
+    compact();
+    if (cfg)
+      cleanCfg();
+  }
+}
+
+/* dominator-based value numbering: an expression already computed on
+   every path to this one is replaced with the earlier result, and a check
+   of the same operands as a dominating check is dropped */
+static void number_block(JavaIrBlock *b,
+                         std::map<std::vector<s4>, JavaIrInstr *> &table,
+                         u4 *count)
+{
+  std::vector<std::vector<s4> > added;
+  std::vector<s4> key;
+  std::map<std::vector<s4>, JavaIrInstr *>::iterator it;
+  JavaIrInstr *v;
+  u4 i, k;
+
+  for (i = 0; i < b->code.size(); i++) {
+    v = b->code[i];
+    for (k = 0; k < v->args.size(); k++)
+      while (v->args[k]->forward)
+        v->args[k] = v->args[k]->forward;
+    if (!is_pure(v) && v->op != JavaIrDiv && v->op != JavaIrRem &&
+        v->op != JavaIrNullCheck && v->op != JavaIrBoundsCheck &&
+        v->op != JavaIrArrayLength)
+      continue;
+
+    key.clear();
+    key.push_back(v->op);
+    key.push_back(v->op == JavaIrConst ? v->imm : 0);
+    for (k = 0; k < v->args.size(); k++)
+      key.push_back(v->args[k]->id);
+    if (is_commutative(v->op) && key[2] > key[3])
+      std::swap(key[2], key[3]);
+
+    it = table.find(key);
+    if (it == table.end()) {
+      table[key] = v;
+      added.push_back(key);
+    } else {
+      if (v->hasValue())
+        v->forward = it->second;
+      else
+        v->removed = true;
+      (*count)++;
+    }
+  }
+
+  for (i = 0; i < b->children.size(); i++)
+    number_block(b->children[i], table, count);
+  for (i = 0; i < added.size(); i++)
+    table.erase(added[i]);
+}
+
+void JavaOptimizer::numberValues()
+{
+  std::map<std::vector<s4>, JavaIrInstr *> table;
+
+  number_block(_entry, table, &_numbered);
+  resolveArgs();
+  compact();
+}
+
+/* moves loop-invariant computations to the preheader: pure expressions
+   from anywhere in the loop, array lengths once the array is known to be
+   non-null there, and checks from the start of the header, which runs
+   first on every entry to the loop */
+void JavaOptimizer::hoistInvariants()
+{
+  std::vector<JavaIrInstr *> keep;
+  JavaIrLoop *l;
+  JavaIrBlock *b, *p;
+  JavaIrInstr *v, *w;
+  bool changed, invariant, prefix;
+  u4 i, j, k, n;
+
+  for (i = 0; i < _loops.size(); i++) {
+    l = _loops[i];
+    if (!(p = l->preheader))
+      continue;
+
+    changed = true;
+    while (changed) {
+      changed = false;
+      for (j = 0; j < _order.size(); j++) {
+        b = _order[j];
+        if (!l->contains(b))
+          continue;
+        prefix = b == l->header;
+        keep.clear();
+        for (k = 0; k < b->code.size(); k++) {
+          v = b->code[k];
+          invariant = true;
+          for (n = 0; n < v->args.size(); n++)
+            if (l->contains(v->args[n]->block))
+              invariant = false;
+
+          if (invariant && v->op == JavaIrArrayLength) {
+            /* only behind a null check that already runs before the loop */
+            invariant = false;
+            for (n = 0; n < _instrs.size() && !invariant; n++) {
+              w = _instrs[n];
+              invariant = w->op == JavaIrNullCheck && !w->removed &&
+                w->args[0] == v->args[0] && w->block->rpo >= 0 &&
+                dominates(w->block, p);
+            }
+          } else if (v->op == JavaIrNullCheck || v->op == JavaIrBoundsCheck) {
+            invariant = invariant && prefix;
+          } else if (!is_pure(v)) {
+            invariant = false;
+          }
+
+          if (invariant && v != b->last()) {
+            v->block = p;
+            p->code.insert(p->code.end() - 1, v);
+            _hoisted++;
+            changed = true;
+          } else {
+            keep.push_back(v);
+            /* anything after a trap or a side effect may not run */
+            if (!is_pure(v) && v->op != JavaIrArrayLength)
+              prefix = false;
+          }
+        }
+        b->code = keep;
+      }
+    }
+  }
+}
+
+/* drops the bounds checks of a[i] inside a loop 'for (i = c; i < n; i++)'
+   with c >= 0 and n invariant: the test at the header proves i < n on
+   every path into the body, and since i only steps by one from a
+   non-negative start after such a test, it cannot wrap around */
+void JavaOptimizer::eliminateChecks()
+{
+  JavaIrLoop *l;
+  JavaIrBlock *h, *in, *out, *d;
+  JavaIrInstr *cond, *iv, *init, *step, *len, *v;
+  u4 i, j, k, n, outside;
+
+  for (i = 0; i < _loops.size(); i++) {
+    l = _loops[i];
+    h = l->header;
+    cond = h->last();
+    if (h->preds.size() != 2 || !cond || cond->op != JavaIrIf)
+      continue;
+    outside = l->contains(h->preds[0]) ? 1 : 0;
+    if (l->contains(h->preds[outside]) || !l->contains(h->preds[1 - outside]))
+      continue;
+
+    for (j = 0; j < h->phis.size(); j++) {
+      iv = h->phis[j];
+      init = iv->args[outside];
+      step = iv->args[1 - outside];
+      if (init->op != JavaIrConst || init->imm < 0 || step->op != JavaIrAdd ||
+          step->args[0] != iv || step->args[1]->op != JavaIrConst ||
+          step->args[1]->imm != 1)
+        continue;
+
+      /* i < n or n > i branches into the loop; i >= n or n <= i out */
+      if (cond->args[0] == iv &&
+          (cond->imm == JavaCondL || cond->imm == JavaCondGE))
+        len = cond->args[1];
+      else if (cond->args[1] == iv &&
+               (cond->imm == JavaCondG || cond->imm == JavaCondLE))
+        len = cond->args[0];
+      else
+        continue;
+      if (cond->imm == JavaCondL || cond->imm == JavaCondG) {
+        in = h->succs[0];
+        out = h->succs[1];
+      } else {
+        in = h->succs[1];
+        out = h->succs[0];
+      }
+      if (l->contains(len->block) || !l->contains(in) || l->contains(out) ||
+          in->preds.size() != 1)
+        continue;
+
+      for (k = 0; k < _order.size(); k++) {
+        d = _order[k];
+        if (!l->contains(d) || !dominates(in, d))
+          continue;
+        for (n = 0; n < d->code.size(); n++) {
+          v = d->code[n];
+          if (v->op == JavaIrBoundsCheck && v->args[0] == iv &&
+              v->args[1] == len) {
+            v->removed = true;
+            _checks++;
+          }
+        }
+      }
+    }
+  }
+  compact();
+}
+
+static bool removable(JavaIrInstr *v)
+{
+  switch (v->op) {
+  case JavaIrParam: case JavaIrPhi: case JavaIrArrayLength:
+  case JavaIrArrayLoad: case JavaIrLoad:
+    return true;
+  default:
+    return is_pure(v);
+  }
+}
+
+void JavaOptimizer::eliminateDeadCode()
+{
+  std::vector<u4> uses(_instrs.size(), 0);
+  std::vector<JavaIrInstr *> work;
+  JavaIrBlock *b;
+  JavaIrInstr *v;
+  u4 i, j, k;
+
+  for (i = 0; i < _order.size(); i++) {
+    b = _order[i];
+    for (j = 0; j < b->phis.size(); j++)
+      for (k = 0; k < b->phis[j]->args.size(); k++)
+        uses[b->phis[j]->args[k]->id]++;
+    for (j = 0; j < b->code.size(); j++)
+      for (k = 0; k < b->code[j]->args.size(); k++)
+        uses[b->code[j]->args[k]->id]++;
+  }
+  for (i = 0; i < _order.size(); i++) {
+    b = _order[i];
+    for (j = 0; j < b->phis.size(); j++)
+      if (!uses[b->phis[j]->id])
+        work.push_back(b->phis[j]);
+    for (j = 0; j < b->code.size(); j++)
+      if (!uses[b->code[j]->id] && removable(b->code[j]))
+        work.push_back(b->code[j]);
+  }
+
+  while (!work.empty()) {
+    v = work.back();
+    work.pop_back();
+    if (v->removed)
+      continue;
+    v->removed = true;
+    for (k = 0; k < v->args.size(); k++)
+      if (--uses[v->args[k]->id] == 0 && removable(v->args[k]))
+        work.push_back(v->args[k]);
+  }
+  compact();
+}
+
+
+/* the SSA form of the method with its calls inlined, before any
+   optimization; also how an inlinee is built */
+bool JavaOptimizer::buildIr()
+{
+  if (!_method->code() || _method->isSynchronized() ||
+      _method->retType() == 'J' || _method->retType() == 'D' ||
+      has_wide_args(_method->desc()))
+    return false;
+
+  if (!buildCfg())
+    return false;
+  cleanCfg();
+  insertPreheaders();
+  if (!buildSsa())
+    return false;
+  inlineCalls();
+  return true;
+}
+
+bool JavaOptimizer::optimize()
+{
+  u4 i;
+
+  if (!buildIr())
+    return false;
+
+  foldConstants();
+  numberValues();
+  hoistInvariants();
+  eliminateChecks();
+  eliminateDeadCode();
+
+  /* every block must still end in a jump or a return */
+  for (i = 0; i < _order.size(); i++)
+    if (!_order[i]->last())
+      return false;
+  return true;
+}
+
+static const char *reg_names[] = {
+  "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi"
+};
+
+static const char *cond_names[] = {
+  "o", "no", "b", "ae", "e", "ne", "be", "a",
+  "s", "ns", "p", "np", "l", "ge", "le", "g"
+};
+
+static void dump_instr(JavaIrInstr *v)
+{
+  u4 i;
+
+  printf("    ");
+  if (v->hasValue())
+    printf("v%d = ", v->id);
+  printf("%s", op_names[v->op]);
+  if (v->op == JavaIrConst || v->op == JavaIrParam)
+    printf(" %d", v->imm);
+  else if (v->op == JavaIrIf)
+    printf(".%s", cond_names[v->imm]);
+  else if (v->op == JavaIrLoad || v->op == JavaIrStore)
+    printf(".%c +0x%x", v->elem, v->imm);
+  else if (v->elem)
+    printf(".%c", v->elem);
+  else if (v->op == JavaIrCall)
+    printf("%s %s%s", v->imm == JavaIrCallVirtual ? ".virtual" :
+           v->imm == JavaIrCallInterface ? ".interface" : "",
+           v->method->name(), v->method->desc());
+  else if (v->op == JavaIrDeopt)
+    printf(".%s %s@%u", v->imm == JavaIrDeoptClass ? "class" : "hierarchy",
+           v->state->method->name(), v->state->pc);
+  for (i = 0; i < v->args.size(); i++)
+    printf("%s v%d", i ? "," : "", v->args[i]->id);
+  if (v->hasValue() && v->from >= 0) {
+    if (v->reg != JavaNoReg)
+      printf("  [%s]", reg_names[v->reg]);
+    else if (v->spill)
+      printf("  [ebp%d]", v->spill);
+  }
+  printf("\n");
+}
+
+void JavaOptimizer::dump()
+{
+  JavaIrBlock *b;
+  u4 i, j;
+
+  printf("%s%s: %u blocks, %u loops", _method->name(), _method->desc(),
+         (u4) _order.size(), (u4) _loops.size());
+  if (_osrPc != JAVA_NO_OSR)
+    printf(", osr entry at %u", _osrPc);
+  printf("\n");
+  printf("  folded %u, numbered %u, hoisted %u, checks removed %u, "
+         "spills %u\n", _folded, _numbered, _hoisted, _checks, _numSpills);
+  for (i = 0; i < _order.size(); i++) {
+    b = _order[i];
+    printf("  B%d", b->id);
+    if (b->pc != ~0U)
+      printf(" pc %u", b->pc);
+    if (b->loopDepth)
+      printf(" depth %d", b->loopDepth);
+    printf(" preds");
+    for (j = 0; j < b->preds.size(); j++)
+      printf(" B%d", b->preds[j]->id);
+    printf(" succs");
+    for (j = 0; j < b->succs.size(); j++)
+      printf(" B%d", b->succs[j]->id);
+    printf("\n");
+    for (j = 0; j < b->phis.size(); j++)
+      dump_instr(b->phis[j]);
+    for (j = 0; j < b->code.size(); j++)
+      dump_instr(b->code[j]);
+  }
+  dumpInlining();
+}
+
+bool JavaOptimizer::compile(JavaVMMethod *m)
+{
+  JavaOptimizer o(m);
+  JavaCompiledMethod *cm;
+  u1 *code;
+
+  if (!o.optimize() || !o.generate())
+    return false;
+  if (_trace)
+    o.dumpInlining();
+
+  code = JavaCodeCache::alloc(JAVA_TIER_OPTIMIZED, o.buffer().size());
+  if (!code)
+    return false;
+  o.buffer().install(code);
+  cm = new JavaCompiledMethod(m, code, o.buffer().size(), JAVA_TIER_OPTIMIZED);
+  m->compiled(cm);
+  o.installed(m);
+
+  /* callers pick up the new entry on their next call */
+  m->tier(JAVA_TIER_OPTIMIZED);
+  m->entry((JavaEntry) (uintptr) code);
+  JavaCodeCache::add(cm);
+  return true;
+}
+
+bool JavaOptimizer::compileOsr(JavaVMMethod *m, u4 pc)
+{
+  JavaOptimizer o(m);
+  JavaOsrPoint *p = m->osrPoint(pc);
+  u1 *code;
+
+  o._osrPc = pc;
+  if (!p || !o.optimize() || !o.generate())
+    return false;
+  if (_trace)
+    o.dumpInlining();
+
+  code = JavaCodeCache::alloc(JAVA_TIER_OPTIMIZED, o.buffer().size());
+  if (!code)
+    return false;
+  o.buffer().install(code);
+  o.installed(m);
+
+  /* the entry first: baseline code jumps through it once it sees the
+     new tier */
+  p->entry = (JavaOsrEntry) (uintptr) code;
+  p->tier = JAVA_TIER_OPTIMIZED;
+  JavaCodeCache::add(new JavaCompiledMethod(m, code, o.buffer().size(),
+                                            JAVA_TIER_OPTIMIZED));
+  return true;
+}
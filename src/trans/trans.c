@@ -5,6 +5,1113 @@
  * @author cjeong
  */
 #include <java/java_instr.h>
+#include <java/java_vm.h>
+#include <java/java_runtime.h>
+#include <java/java_trans.h>
+#include <java/java_compiler.h>
+#include <java/java_codecache.h>
+#include <java/java_intrinsic.h>
 
+#define LEN   JAVA_ARRAY_LENGTH_OFFSET
+#define DATA  JAVA_ARRAY_DATA_OFFSET
 
+/* the stack slot 'i' slots below the top */
+static inline JavaMem top(int i)
+{
+  return JavaMem(JavaESP, 4 * i);
+}
 
+static inline bool is_wide(char type)
+{
+  return type == 'J' || type == 'D';
+}
+
+/* true for branches that can close a loop */
+static bool is_backedge(const u1 *code, u4 pc)
+{
+  switch (code[pc]) {
+  case JOP_IFEQ: case JOP_IFNE: case JOP_IFLT:
+  case JOP_IFGE: case JOP_IFGT: case JOP_IFLE:
+  case JOP_IF_ICMPEQ: case JOP_IF_ICMPNE: case JOP_IF_ICMPLT:
+  case JOP_IF_ICMPGE: case JOP_IF_ICMPGT: case JOP_IF_ICMPLE:
+  case JOP_IF_ACMPEQ: case JOP_IF_ACMPNE:
+  case JOP_IFNULL: case JOP_IFNONNULL: case JOP_GOTO:
+    return jopS2(code + pc + 1) <= 0;
+  case JOP_GOTO_W:
+    return jopS4(code + pc + 1) <= 0;
+  default:
+    return false;
+  }
+}
+
+static inline u4 branch_target(const u1 *code, u4 pc)
+{
+  return pc + (code[pc] == JOP_GOTO_W ? jopS4(code + pc + 1) :
+               jopS2(code + pc + 1));
+}
+
+
+JavaTranslator::JavaTranslator(JavaVMMethod *m) :
+  _method(m), _pcLabels(m->codeLength(), -1), _syncSlot(0)
+{
+  _npeLabel = _buf.newLabel();
+  _rangeLabel = _buf.newLabel();
+  _arithLabel = _buf.newLabel();
+}
+
+int JavaTranslator::pcLabel(u4 pc)
+{
+  /* a target outside the code gets a label that is never bound, which
+     makes finish() fail */
+  if (pc >= _pcLabels.size())
+    return _buf.newLabel();
+  if (_pcLabels[pc] < 0)
+    _pcLabels[pc] = _buf.newLabel();
+  return _pcLabels[pc];
+}
+
+void JavaTranslator::prologue()
+{
+  JavaVMMethod *m = _method;
+  u4 frame = m->maxLocals() + (m->isSynchronized() ? 1 : 0);
+  u4 n = m->argSlots(), j;
+
+  tierCheck(m->invocationsAddr(), JAVA_TIER2_INVOCATIONS, JAVA_NO_OSR);
+
+  _buf.push(JavaEBP);
+  _buf.mov(JavaEBP, JavaESP);
+  if (frame)
+    _buf.aluImm(JavaAluSub, JavaESP, 4 * frame);
+
+  /* the arguments become locals 0..n-1 without reordering */
+  if (n) {
+    _buf.mov(JavaECX, JavaMem(JavaEBP, 12));
+    for (j = 0; j < n; j++) {
+      _buf.mov(JavaEAX, JavaMem(JavaECX, 4 * j));
+      _buf.mov(JavaMem(JavaEBP, -4 * (s4) n + 4 * (s4) j), JavaEAX);
+    }
+  }
+
+  /* the locked object gets a slot of its own, since the method may
+     overwrite local 0 */
+  if (m->isSynchronized()) {
+    _syncSlot = -4 * (s4) frame;
+    if (m->isStatic())
+      _buf.movAddr(JavaEAX, m->syncObject(0));
+    else
+      _buf.mov(JavaEAX, local(0));
+    _buf.mov(JavaMem(JavaEBP, _syncSlot), JavaEAX);
+    _buf.push(JavaEAX);
+    _buf.call(JAVA_FN(&JavaRuntime::monitorEnter));
+    _buf.aluImm(JavaAluAdd, JavaESP, 4);
+  }
+}
+
+/* bumps a profile counter and calls the compilation policy when it hits
+   'threshold'.  only exactly at the threshold, which keeps the fast path
+   to an add and a compare; a request the policy drops is retried through
+   the other counter.  a backedge passes the loop header it jumps to, so
+   the policy can also ask for OSR code there.  emitted where no values
+   are held in registers */
+void JavaTranslator::tierCheck(volatile u4 *counter, u4 threshold, u4 osrPc)
+{
+  int done = _buf.newLabel();
+
+  _buf.aluImm(JavaAluAdd, javaAbs((const void *) counter), 1);
+  _buf.aluImm(JavaAluCmp, javaAbs((const void *) counter), threshold);
+  _buf.jcc(JavaCondNE, done);
+  if (osrPc == JAVA_NO_OSR) {
+    _buf.pushAddr(_method);
+    _buf.call(JAVA_FN(&JavaCompiler::checkTier));
+    _buf.aluImm(JavaAluAdd, JavaESP, 4);
+  } else {
+    _buf.pushImm(osrPc);
+    _buf.pushAddr(_method);
+    _buf.call(JAVA_FN(&JavaCompiler::checkOsr));
+    _buf.aluImm(JavaAluAdd, JavaESP, 8);
+  }
+  _buf.bind(done);
+}
+
+/* the targets of backward branches; only they get OSR entries.  the
+   interpreter holds the lock of a synchronized method, which compiled
+   code would not know to release, so those get none */
+void JavaTranslator::findLoopHeaders()
+{
+  const u1 *code = _method->code();
+  u4 pc, target;
+
+  _loopHeaders.assign(_method->codeLength(), false);
+  if (_method->isSynchronized())
+    return;
+  for (pc = 0; pc < _method->codeLength(); pc += jopLength(code, pc)) {
+    if (!is_backedge(code, pc))
+      continue;
+    target = branch_target(code, pc);
+    if (target < _method->codeLength())
+      _loopHeaders[target] = true;
+  }
+}
+
+/* at a loop header: once optimized OSR code is in place for it, hands
+   the frame over to it and returns what it returns */
+void JavaTranslator::osrCheck(u4 pc)
+{
+  JavaOsrPoint *p = _method->addOsrPoint(pc);
+  int done = _buf.newLabel();
+
+  _buf.aluImm(JavaAluCmp, javaAbs((const void *) &p->tier),
+              JAVA_TIER_BASELINE);
+  _buf.jcc(JavaCondBE, done);
+  /* slots from local 0 down to the top of the operand stack */
+  _buf.lea(JavaECX, JavaMem(JavaEBP, -4));
+  _buf.mov(JavaEDX, JavaECX);
+  _buf.alu(JavaAluSub, JavaEDX, JavaESP);
+  _buf.shiftImm(JavaShiftSar, JavaEDX, 2);
+  _buf.aluImm(JavaAluAdd, JavaEDX, 1);
+  _buf.push(JavaEDX);
+  _buf.push(JavaECX);
+  _buf.push(JavaMem(JavaEBP, 8));
+  _buf.call(javaAbs((const void *) &p->entry));
+  epilogue(_method->retType());
+  _buf.bind(done);
+}
+
+/* the JavaOsrEntry of the loop header at 'pc': builds the frame from the
+   slots it is given, which are in the same order, and continues at the
+   header */
+void JavaTranslator::osrEntry(u4 pc)
+{
+  int entry = _buf.newLabel(), loop = _buf.newLabel();
+
+  _buf.bind(entry);
+  _buf.push(JavaEBP);
+  _buf.mov(JavaEBP, JavaESP);
+  _buf.mov(JavaECX, JavaMem(JavaEBP, 12));
+  _buf.mov(JavaEDX, JavaMem(JavaEBP, 16));
+  _buf.test(JavaEDX, JavaEDX);
+  _buf.jcc(JavaCondE, pcLabel(pc));
+  _buf.bind(loop);
+  _buf.push(JavaMem(JavaECX, 0));
+  _buf.aluImm(JavaAluSub, JavaECX, 4);
+  _buf.aluImm(JavaAluSub, JavaEDX, 1);
+  _buf.jcc(JavaCondNE, loop);
+  _buf.jmp(pcLabel(pc));
+  _osrLabels.push_back(std::make_pair(pc, entry));
+}
+
+/* the result, if any, is in eax or edx:eax */
+void JavaTranslator::epilogue(char type)
+{
+  if (_method->isSynchronized()) {
+    _buf.push(JavaEDX);
+    _buf.push(JavaEAX);
+    _buf.push(JavaMem(JavaEBP, _syncSlot));
+    _buf.call(JAVA_FN(&JavaRuntime::monitorExit));
+    _buf.aluImm(JavaAluAdd, JavaESP, 4);
+    _buf.pop(JavaEAX);
+    _buf.pop(JavaEDX);
+  }
+  _buf.leave();
+  _buf.ret();
+}
+
+void JavaTranslator::nullCheck(JavaRegE r)
+{
+  _buf.test(r, r);
+  _buf.jcc(JavaCondE, _npeLabel);
+}
+
+void JavaTranslator::indexCheck(JavaRegE array, JavaRegE index)
+{
+  nullCheck(array);
+  /* unsigned, so a negative index fails too */
+  _buf.alu(JavaAluCmp, index, JavaMem(array, LEN));
+  _buf.jcc(JavaCondAE, _rangeLabel);
+}
+
+void JavaTranslator::branch(JavaCondCodeE c, u4 pc, s4 offset)
+{
+  _buf.jcc(c, pcLabel(pc + offset));
+}
+
+void JavaTranslator::pushResult(char type)
+{
+  if (type == 'V')
+    return;
+  if (is_wide(type))
+    _buf.push(JavaEDX);
+  _buf.push(JavaEAX);
+}
+
+/* calls 'callee' with the arguments on top of our stack; 'resolver', if
+   given, picks the method to run from the receiver at run time */
+void JavaTranslator::invoke(JavaVMMethod *callee, const void *resolver)
+{
+  u4 n = callee->argSlots();
+
+  if (resolver) {
+    _buf.mov(JavaEAX, top(n - 1));
+    _buf.pushAddr(callee);
+    _buf.push(JavaEAX);
+    _buf.call(resolver);
+    _buf.aluImm(JavaAluAdd, JavaESP, 8);
+    _buf.mov(JavaECX, JavaESP);
+    _buf.push(JavaECX);
+    _buf.push(JavaEAX);
+    _buf.call(JavaMem(JavaEAX, 0));
+  } else {
+    if (!callee->isStatic()) {
+      _buf.mov(JavaEAX, top(n - 1));
+      nullCheck(JavaEAX);
+    }
+    /* through the entry pointer, so the call follows the callee when it
+       gets compiled */
+    _buf.mov(JavaECX, JavaESP);
+    _buf.push(JavaECX);
+    _buf.pushAddr(callee);
+    _buf.call(javaAbs(callee));
+  }
+  _buf.aluImm(JavaAluAdd, JavaESP, 8 + 4 * n);
+  pushResult(callee->retType());
+}
+
+/* Math.min, max and abs of int in line; other intrinsics are called
+   through the entry like any method */
+bool JavaTranslator::intrinsic(JavaVMMethod *callee)
+{
+  int done;
+
+  switch (callee->intrinsic()) {
+  case JavaIntrinsicMinI: case JavaIntrinsicMaxI:
+    done = _buf.newLabel();
+    _buf.pop(JavaECX);
+    _buf.pop(JavaEAX);
+    _buf.alu(JavaAluCmp, JavaEAX, JavaECX);
+    _buf.jcc(callee->intrinsic() == JavaIntrinsicMinI ? JavaCondLE :
+             JavaCondGE, done);
+    _buf.mov(JavaEAX, JavaECX);
+    _buf.bind(done);
+    _buf.push(JavaEAX);
+    return true;
+  case JavaIntrinsicAbsI:
+    _buf.pop(JavaEAX);
+    _buf.cdq();
+    _buf.alu(JavaAluXor, JavaEAX, JavaEDX);
+    _buf.alu(JavaAluSub, JavaEAX, JavaEDX);
+    _buf.push(JavaEAX);
+    return true;
+  default:
+    return false;
+  }
+}
+
+/* pushes the field at 'm' whose descriptor starts with 'type' */
+static void push_field(JavaCodeBuffer &b, const JavaMem &m, char type)
+{
+  switch (type) {
+  case 'Z': case 'B':
+    b.movsx8(JavaEDX, m);
+    b.push(JavaEDX);
+    break;
+  case 'C':
+    b.movzx16(JavaEDX, m);
+    b.push(JavaEDX);
+    break;
+  case 'S':
+    b.movsx16(JavaEDX, m);
+    b.push(JavaEDX);
+    break;
+  case 'J': case 'D':
+    b.push(JavaMem(m.base, m.index, m.scale, m.disp + 4));
+    b.push(m);
+    break;
+  default:
+    b.push(m);
+    break;
+  }
+}
+
+static void pop_field(JavaCodeBuffer &b, const JavaMem &m, char type)
+{
+  switch (type) {
+  case 'Z': case 'B':
+    b.pop(JavaEDX);
+    b.mov8(m, JavaEDX);
+    break;
+  case 'C': case 'S':
+    b.pop(JavaEDX);
+    b.mov16(m, JavaEDX);
+    break;
+  case 'J': case 'D':
+    b.pop(m);
+    b.pop(JavaMem(m.base, m.index, m.scale, m.disp + 4));
+    break;
+  default:
+    b.pop(m);
+    break;
+  }
+}
+
+/* the DUP family: copies the top 'n' slots and inserts the copy 'depth'
+   slots below them */
+static void dup_slots(JavaCodeBuffer &b, int n, int depth)
+{
+  int j;
+
+  if (depth == 0) {
+    for (j = 0; j < n; j++)
+      b.push(top(n - 1));
+    return;
+  }
+  b.aluImm(JavaAluSub, JavaESP, 4 * n);
+  for (j = 0; j < n + depth; j++) {
+    b.mov(JavaEAX, top(n + j));
+    b.mov(top(j), JavaEAX);
+  }
+  for (j = 0; j < n; j++) {
+    b.mov(JavaEAX, top(j));
+    b.mov(top(n + depth + j), JavaEAX);
+  }
+}
+
+bool JavaTranslator::translate(u4 pc)
+{
+  const u1 *code = _method->code();
+  JavaVMCpEntry *cp = _method->cpool(), *e;
+  JavaVMMethod *callee;
+  u1 op = code[pc];
+  u4 i, p, n, j;
+  s4 lo, hi;
+  uint64 w;
+  int l1, l2;
+
+  if (_loopHeaders[pc])
+    osrCheck(pc);
+
+  /* counted before the branch template, whose flags must survive up to
+     its jcc */
+  if (is_backedge(code, pc))
+    tierCheck(_method->backedgesAddr(), JAVA_TIER2_BACKEDGES,
+              branch_target(code, pc));
+
+  switch (op) {
+  case JOP_NOP:
+    break;
+
+  /* constants */
+  case JOP_ACONST_NULL:
+    _buf.pushImm(0);
+    break;
+  case JOP_ICONST_M1: case JOP_ICONST_0: case JOP_ICONST_1:
+  case JOP_ICONST_2: case JOP_ICONST_3: case JOP_ICONST_4:
+  case JOP_ICONST_5:
+    _buf.pushImm(op - JOP_ICONST_0);
+    break;
+  case JOP_LCONST_0: case JOP_LCONST_1:
+    _buf.pushImm(0);
+    _buf.pushImm(op - JOP_LCONST_0);
+    break;
+  case JOP_FCONST_0: case JOP_FCONST_1: case JOP_FCONST_2:
+    _buf.pushImm(javaFloatBits(op - JOP_FCONST_0));
+    break;
+  case JOP_DCONST_0: case JOP_DCONST_1:
+    w = javaDoubleBits(op - JOP_DCONST_0);
+    _buf.pushImm(w >> 32);
+    _buf.pushImm(w);
+    break;
+  case JOP_BIPUSH:
+    _buf.pushImm((s1) code[pc + 1]);
+    break;
+  case JOP_SIPUSH:
+    _buf.pushImm(jopS2(code + pc + 1));
+    break;
+  case JOP_LDC:
+    _buf.pushImm(cp[code[pc + 1]].value);
+    break;
+  case JOP_LDC_W:
+    _buf.pushImm(cp[jopU2(code + pc + 1)].value);
+    break;
+  case JOP_LDC2_W:
+    w = cp[jopU2(code + pc + 1)].wide;
+    _buf.pushImm(w >> 32);
+    _buf.pushImm(w);
+    break;
+
+  /* locals; a two-slot local i has its high word in slot i */
+  case JOP_ILOAD: case JOP_FLOAD: case JOP_ALOAD:
+    _buf.push(local(code[pc + 1]));
+    break;
+  case JOP_LLOAD: case JOP_DLOAD:
+    i = code[pc + 1];
+    _buf.push(local(i));
+    _buf.push(local(i + 1));
+    break;
+  case JOP_ILOAD_0: case JOP_ILOAD_1: case JOP_ILOAD_2: case JOP_ILOAD_3:
+    _buf.push(local(op - JOP_ILOAD_0));
+    break;
+  case JOP_FLOAD_0: case JOP_FLOAD_1: case JOP_FLOAD_2: case JOP_FLOAD_3:
+    _buf.push(local(op - JOP_FLOAD_0));
+    break;
+  case JOP_ALOAD_0: case JOP_ALOAD_1: case JOP_ALOAD_2: case JOP_ALOAD_3:
+    _buf.push(local(op - JOP_ALOAD_0));
+    break;
+  case JOP_LLOAD_0: case JOP_LLOAD_1: case JOP_LLOAD_2: case JOP_LLOAD_3:
+    i = op - JOP_LLOAD_0;
+    _buf.push(local(i));
+    _buf.push(local(i + 1));
+    break;
+  case JOP_DLOAD_0: case JOP_DLOAD_1: case JOP_DLOAD_2: case JOP_DLOAD_3:
+    i = op - JOP_DLOAD_0;
+    _buf.push(local(i));
+    _buf.push(local(i + 1));
+    break;
+  case JOP_ISTORE: case JOP_FSTORE: case JOP_ASTORE:
+    _buf.pop(local(code[pc + 1]));
+    break;
+  case JOP_LSTORE: case JOP_DSTORE:
+    i = code[pc + 1];
+    _buf.pop(local(i + 1));
+    _buf.pop(local(i));
+    break;
+  case JOP_ISTORE_0: case JOP_ISTORE_1: case JOP_ISTORE_2: case JOP_ISTORE_3:
+    _buf.pop(local(op - JOP_ISTORE_0));
+    break;
+  case JOP_FSTORE_0: case JOP_FSTORE_1: case JOP_FSTORE_2: case JOP_FSTORE_3:
+    _buf.pop(local(op - JOP_FSTORE_0));
+    break;
+  case JOP_ASTORE_0: case JOP_ASTORE_1: case JOP_ASTORE_2: case JOP_ASTORE_3:
+    _buf.pop(local(op - JOP_ASTORE_0));
+    break;
+  case JOP_LSTORE_0: case JOP_LSTORE_1: case JOP_LSTORE_2: case JOP_LSTORE_3:
+    i = op - JOP_LSTORE_0;
+    _buf.pop(local(i + 1));
+    _buf.pop(local(i));
+    break;
+  case JOP_DSTORE_0: case JOP_DSTORE_1: case JOP_DSTORE_2: case JOP_DSTORE_3:
+    i = op - JOP_DSTORE_0;
+    _buf.pop(local(i + 1));
+    _buf.pop(local(i));
+    break;
+  case JOP_IINC:
+    _buf.aluImm(JavaAluAdd, local(code[pc + 1]), (s1) code[pc + 2]);
+    break;
+
+  /* arrays: index in ecx, array in eax */
+  case JOP_IALOAD: case JOP_FALOAD: case JOP_AALOAD:
+    _buf.pop(JavaECX);
+    _buf.pop(JavaEAX);
+    indexCheck(JavaEAX, JavaECX);
+    _buf.push(JavaMem(JavaEAX, JavaECX, 4, DATA));
+    break;
+  case JOP_LALOAD: case JOP_DALOAD:
+    _buf.pop(JavaECX);
+    _buf.pop(JavaEAX);
+    indexCheck(JavaEAX, JavaECX);
+    _buf.push(JavaMem(JavaEAX, JavaECX, 8, DATA + 4));
+    _buf.push(JavaMem(JavaEAX, JavaECX, 8, DATA));
+    break;
+  case JOP_BALOAD:
+    _buf.pop(JavaECX);
+    _buf.pop(JavaEAX);
+    indexCheck(JavaEAX, JavaECX);
+    _buf.movsx8(JavaEDX, JavaMem(JavaEAX, JavaECX, 1, DATA));
+    _buf.push(JavaEDX);
+    break;
+  case JOP_CALOAD:
+    _buf.pop(JavaECX);
+    _buf.pop(JavaEAX);
+    indexCheck(JavaEAX, JavaECX);
+    _buf.movzx16(JavaEDX, JavaMem(JavaEAX, JavaECX, 2, DATA));
+    _buf.push(JavaEDX);
+    break;
+  case JOP_SALOAD:
+    _buf.pop(JavaECX);
+    _buf.pop(JavaEAX);
+    indexCheck(JavaEAX, JavaECX);
+    _buf.movsx16(JavaEDX, JavaMem(JavaEAX, JavaECX, 2, DATA));
+    _buf.push(JavaEDX);
+    break;
+  case JOP_IASTORE: case JOP_FASTORE: case JOP_AASTORE:
+    _buf.pop(JavaEDX);
+    _buf.pop(JavaECX);
+    _buf.pop(JavaEAX);
+    indexCheck(JavaEAX, JavaECX);
+    _buf.mov(JavaMem(JavaEAX, JavaECX, 4, DATA), JavaEDX);
+    break;
+  case JOP_LASTORE: case JOP_DASTORE:
+    _buf.mov(JavaECX, top(2));
+    _buf.mov(JavaEAX, top(3));
+    indexCheck(JavaEAX, JavaECX);
+    _buf.pop(JavaEDX);
+    _buf.mov(JavaMem(JavaEAX, JavaECX, 8, DATA), JavaEDX);
+    _buf.pop(JavaEDX);
+    _buf.mov(JavaMem(JavaEAX, JavaECX, 8, DATA + 4), JavaEDX);
+    _buf.aluImm(JavaAluAdd, JavaESP, 8);
+    break;
+  case JOP_BASTORE:
+    _buf.pop(JavaEDX);
+    _buf.pop(JavaECX);
+    _buf.pop(JavaEAX);
+    indexCheck(JavaEAX, JavaECX);
+    _buf.mov8(JavaMem(JavaEAX, JavaECX, 1, DATA), JavaEDX);
+    break;
+  case JOP_CASTORE: case JOP_SASTORE:
+    _buf.pop(JavaEDX);
+    _buf.pop(JavaECX);
+    _buf.pop(JavaEAX);
+    indexCheck(JavaEAX, JavaECX);
+    _buf.mov16(JavaMem(JavaEAX, JavaECX, 2, DATA), JavaEDX);
+    break;
+  case JOP_ARRAYLENGTH:
+    _buf.pop(JavaEAX);
+    nullCheck(JavaEAX);
+    _buf.push(JavaMem(JavaEAX, LEN));
+    break;
+
+  /* operand stack */
+  case JOP_POP:
+    _buf.aluImm(JavaAluAdd, JavaESP, 4);
+    break;
+  case JOP_POP2:
+    _buf.aluImm(JavaAluAdd, JavaESP, 8);
+    break;
+  case JOP_DUP:
+    dup_slots(_buf, 1, 0);
+    break;
+  case JOP_DUP_X1:
+    dup_slots(_buf, 1, 1);
+    break;
+  case JOP_DUP_X2:
+    dup_slots(_buf, 1, 2);
+    break;
+  case JOP_DUP2:
+    dup_slots(_buf, 2, 0);
+    break;
+  case JOP_DUP2_X1:
+    dup_slots(_buf, 2, 1);
+    break;
+  case JOP_DUP2_X2:
+    dup_slots(_buf, 2, 2);
+    break;
+  case JOP_SWAP:
+    _buf.pop(JavaEAX);
+    _buf.pop(JavaECX);
+    _buf.push(JavaEAX);
+    _buf.push(JavaECX);
+    break;
+
+  /* int arithmetic works on the left operand in place */
+  case JOP_IADD:
+    _buf.pop(JavaEAX);
+    _buf.alu(JavaAluAdd, top(0), JavaEAX);
+    break;
+  case JOP_ISUB:
+    _buf.pop(JavaEAX);
+    _buf.alu(JavaAluSub, top(0), JavaEAX);
+    break;
+  case JOP_IAND:
+    _buf.pop(JavaEAX);
+    _buf.alu(JavaAluAnd, top(0), JavaEAX);
+    break;
+  case JOP_IOR:
+    _buf.pop(JavaEAX);
+    _buf.alu(JavaAluOr, top(0), JavaEAX);
+    break;
+  case JOP_IXOR:
+    _buf.pop(JavaEAX);
+    _buf.alu(JavaAluXor, top(0), JavaEAX);
+    break;
+  case JOP_IMUL:
+    _buf.pop(JavaEAX);
+    _buf.imul(JavaEAX, top(0));
+    _buf.mov(top(0), JavaEAX);
+    break;
+  case JOP_IDIV: case JOP_IREM:
+    /* idiv faults on MIN_VALUE / -1, where Java wraps around */
+    l1 = _buf.newLabel();
+    l2 = _buf.newLabel();
+    _buf.pop(JavaECX);
+    _buf.pop(JavaEAX);
+    _buf.test(JavaECX, JavaECX);
+    _buf.jcc(JavaCondE, _arithLabel);
+    _buf.aluImm(JavaAluCmp, JavaECX, -1);
+    _buf.jcc(JavaCondNE, l1);
+    if (op == JOP_IDIV)
+      _buf.neg(JavaEAX);
+    else
+      _buf.alu(JavaAluXor, JavaEAX, JavaEAX);
+    _buf.jmp(l2);
+    _buf.bind(l1);
+    _buf.cdq();
+    _buf.idiv(JavaECX);
+    if (op == JOP_IREM)
+      _buf.mov(JavaEAX, JavaEDX);
+    _buf.bind(l2);
+    _buf.push(JavaEAX);
+    break;
+  case JOP_INEG:
+    _buf.neg(top(0));
+    break;
+  case JOP_ISHL: case JOP_ISHR: case JOP_IUSHR:
+    /* the shift count is masked to 5 bits, as Java requires */
+    _buf.pop(JavaECX);
+    _buf.shift(op == JOP_ISHL ? JavaShiftShl :
+               op == JOP_ISHR ? JavaShiftSar : JavaShiftShr, top(0));
+    break;
+
+  /* long arithmetic; the low word is on top */
+  case JOP_LADD: case JOP_LSUB: case JOP_LAND: case JOP_LOR: case JOP_LXOR:
+    _buf.pop(JavaEAX);
+    _buf.pop(JavaEDX);
+    switch (op) {
+    case JOP_LADD:
+      _buf.alu(JavaAluAdd, top(0), JavaEAX);
+      _buf.alu(JavaAluAdc, top(1), JavaEDX);
+      break;
+    case JOP_LSUB:
+      _buf.alu(JavaAluSub, top(0), JavaEAX);
+      _buf.alu(JavaAluSbb, top(1), JavaEDX);
+      break;
+    case JOP_LAND:
+      _buf.alu(JavaAluAnd, top(0), JavaEAX);
+      _buf.alu(JavaAluAnd, top(1), JavaEDX);
+      break;
+    case JOP_LOR:
+      _buf.alu(JavaAluOr, top(0), JavaEAX);
+      _buf.alu(JavaAluOr, top(1), JavaEDX);
+      break;
+    default:
+      _buf.alu(JavaAluXor, top(0), JavaEAX);
+      _buf.alu(JavaAluXor, top(1), JavaEDX);
+      break;
+    }
+    break;
+  case JOP_LMUL:
+    /* lo(a) * lo(b) in full, plus the two cross products in the high
+       word */
+    _buf.mov(JavaEAX, top(2));
+    _buf.mul(top(0));
+    _buf.mov(JavaECX, top(2));
+    _buf.imul(JavaECX, top(1));
+    _buf.alu(JavaAluAdd, JavaEDX, JavaECX);
+    _buf.mov(JavaECX, top(3));
+    _buf.imul(JavaECX, top(0));
+    _buf.alu(JavaAluAdd, JavaEDX, JavaECX);
+    _buf.aluImm(JavaAluAdd, JavaESP, 8);
+    _buf.mov(top(0), JavaEAX);
+    _buf.mov(top(1), JavaEDX);
+    break;
+  case JOP_LDIV: case JOP_LREM:
+    _buf.call(op == JOP_LDIV ? JAVA_FN(&JavaRuntime::ldiv) :
+              JAVA_FN(&JavaRuntime::lrem));
+    _buf.aluImm(JavaAluAdd, JavaESP, 16);
+    _buf.push(JavaEDX);
+    _buf.push(JavaEAX);
+    break;
+  case JOP_LNEG:
+    _buf.neg(top(0));
+    _buf.aluImm(JavaAluAdc, top(1), 0);
+    _buf.neg(top(1));
+    break;
+  case JOP_LSHL: case JOP_LSHR: case JOP_LUSHR:
+    /* the double shifts only look at 5 bits of the count; counts of 32
+       and more move one word into the other */
+    l1 = _buf.newLabel();
+    _buf.pop(JavaECX);
+    _buf.mov(JavaEAX, top(0));
+    _buf.mov(JavaEDX, top(1));
+    if (op == JOP_LSHL) {
+      _buf.shld(JavaEDX, JavaEAX);
+      _buf.shift(JavaShiftShl, JavaEAX);
+      _buf.testImm8(JavaECX, 32);
+      _buf.jcc(JavaCondE, l1);
+      _buf.mov(JavaEDX, JavaEAX);
+      _buf.alu(JavaAluXor, JavaEAX, JavaEAX);
+    } else {
+      _buf.shrd(JavaEAX, JavaEDX);
+      _buf.shift(op == JOP_LSHR ? JavaShiftSar : JavaShiftShr, JavaEDX);
+      _buf.testImm8(JavaECX, 32);
+      _buf.jcc(JavaCondE, l1);
+      _buf.mov(JavaEAX, JavaEDX);
+      if (op == JOP_LSHR)
+        _buf.shiftImm(JavaShiftSar, JavaEDX, 31);
+      else
+        _buf.alu(JavaAluXor, JavaEDX, JavaEDX);
+    }
+    _buf.bind(l1);
+    _buf.mov(top(0), JavaEAX);
+    _buf.mov(top(1), JavaEDX);
+    break;
+
+  /* float and double arithmetic on the x87 */
+  case JOP_FADD: case JOP_FSUB: case JOP_FMUL: case JOP_FDIV:
+    _buf.fld32(top(1));
+    _buf.fop32(op == JOP_FADD ? JavaFpuAdd : op == JOP_FSUB ? JavaFpuSub :
+               op == JOP_FMUL ? JavaFpuMul : JavaFpuDiv, top(0));
+    _buf.aluImm(JavaAluAdd, JavaESP, 4);
+    _buf.fstp32(top(0));
+    break;
+  case JOP_DADD: case JOP_DSUB: case JOP_DMUL: case JOP_DDIV:
+    _buf.fld64(top(2));
+    _buf.fop64(op == JOP_DADD ? JavaFpuAdd : op == JOP_DSUB ? JavaFpuSub :
+               op == JOP_DMUL ? JavaFpuMul : JavaFpuDiv, top(0));
+    _buf.aluImm(JavaAluAdd, JavaESP, 8);
+    _buf.fstp64(top(0));
+    break;
+  case JOP_FREM:
+    _buf.call(JAVA_FN(&JavaRuntime::frem));
+    _buf.aluImm(JavaAluAdd, JavaESP, 8);
+    _buf.push(JavaEAX);
+    break;
+  case JOP_DREM:
+    _buf.call(JAVA_FN(&JavaRuntime::drem));
+    _buf.aluImm(JavaAluAdd, JavaESP, 16);
+    _buf.push(JavaEDX);
+    _buf.push(JavaEAX);
+    break;
+  case JOP_FNEG:
+    _buf.aluImm(JavaAluXor, top(0), 0x80000000);
+    break;
+  case JOP_DNEG:
+    _buf.aluImm(JavaAluXor, top(1), 0x80000000);
+    break;
+
+  /* conversions */
+  case JOP_I2L:
+    _buf.pop(JavaEAX);
+    _buf.cdq();
+    _buf.push(JavaEDX);
+    _buf.push(JavaEAX);
+    break;
+  case JOP_I2F:
+    _buf.fild32(top(0));
+    _buf.fstp32(top(0));
+    break;
+  case JOP_I2D:
+    _buf.fild32(top(0));
+    _buf.aluImm(JavaAluSub, JavaESP, 4);
+    _buf.fstp64(top(0));
+    break;
+  case JOP_L2I:
+    _buf.pop(JavaEAX);
+    _buf.mov(top(0), JavaEAX);
+    break;
+  case JOP_L2F:
+    _buf.fild64(top(0));
+    _buf.aluImm(JavaAluAdd, JavaESP, 4);
+    _buf.fstp32(top(0));
+    break;
+  case JOP_L2D:
+    _buf.fild64(top(0));
+    _buf.fstp64(top(0));
+    break;
+  case JOP_F2I:
+    _buf.call(JAVA_FN(&JavaRuntime::f2i));
+    _buf.mov(top(0), JavaEAX);
+    break;
+  case JOP_F2L:
+    _buf.call(JAVA_FN(&JavaRuntime::f2l));
+    _buf.mov(top(0), JavaEDX);
+    _buf.push(JavaEAX);
+    break;
+  case JOP_F2D:
+    _buf.fld32(top(0));
+    _buf.aluImm(JavaAluSub, JavaESP, 4);
+    _buf.fstp64(top(0));
+    break;
+  case JOP_D2I:
+    _buf.call(JAVA_FN(&JavaRuntime::d2i));
+    _buf.aluImm(JavaAluAdd, JavaESP, 4);
+    _buf.mov(top(0), JavaEAX);
+    break;
+  case JOP_D2L:
+    _buf.call(JAVA_FN(&JavaRuntime::d2l));
+    _buf.mov(top(0), JavaEAX);
+    _buf.mov(top(1), JavaEDX);
+    break;
+  case JOP_D2F:
+    _buf.fld64(top(0));
+    _buf.aluImm(JavaAluAdd, JavaESP, 4);
+    _buf.fstp32(top(0));
+    break;
+  case JOP_I2B:
+    _buf.movsx8(JavaEAX, top(0));
+    _buf.mov(top(0), JavaEAX);
+    break;
+  case JOP_I2C:
+    _buf.movzx16(JavaEAX, top(0));
+    _buf.mov(top(0), JavaEAX);
+    break;
+  case JOP_I2S:
+    _buf.movsx16(JavaEAX, top(0));
+    _buf.mov(top(0), JavaEAX);
+    break;
+
+  /* comparisons */
+  case JOP_LCMP: case JOP_DCMPL: case JOP_DCMPG:
+    _buf.call(op == JOP_LCMP ? JAVA_FN(&JavaRuntime::lcmp) :
+              op == JOP_DCMPL ? JAVA_FN(&JavaRuntime::dcmpl) :
+              JAVA_FN(&JavaRuntime::dcmpg));
+    _buf.aluImm(JavaAluAdd, JavaESP, 16);
+    _buf.push(JavaEAX);
+    break;
+  case JOP_FCMPL: case JOP_FCMPG:
+    _buf.call(op == JOP_FCMPL ? JAVA_FN(&JavaRuntime::fcmpl) :
+              JAVA_FN(&JavaRuntime::fcmpg));
+    _buf.aluImm(JavaAluAdd, JavaESP, 8);
+    _buf.push(JavaEAX);
+    break;
+
+  /* branches */
+  case JOP_IFEQ: case JOP_IFNE: case JOP_IFLT:
+  case JOP_IFGE: case JOP_IFGT: case JOP_IFLE:
+  case JOP_IFNULL: case JOP_IFNONNULL:
+    _buf.pop(JavaEAX);
+    _buf.test(JavaEAX, JavaEAX);
+    branch(op == JOP_IFEQ || op == JOP_IFNULL ? JavaCondE :
+           op == JOP_IFNE || op == JOP_IFNONNULL ? JavaCondNE :
+           op == JOP_IFLT ? JavaCondL : op == JOP_IFGE ? JavaCondGE :
+           op == JOP_IFGT ? JavaCondG : JavaCondLE,
+           pc, jopS2(code + pc + 1));
+    break;
+  case JOP_IF_ICMPEQ: case JOP_IF_ICMPNE: case JOP_IF_ICMPLT:
+  case JOP_IF_ICMPGE: case JOP_IF_ICMPGT: case JOP_IF_ICMPLE:
+  case JOP_IF_ACMPEQ: case JOP_IF_ACMPNE:
+    _buf.pop(JavaECX);
+    _buf.pop(JavaEAX);
+    _buf.alu(JavaAluCmp, JavaEAX, JavaECX);
+    branch(op == JOP_IF_ICMPEQ || op == JOP_IF_ACMPEQ ? JavaCondE :
+           op == JOP_IF_ICMPNE || op == JOP_IF_ACMPNE ? JavaCondNE :
+           op == JOP_IF_ICMPLT ? JavaCondL : op == JOP_IF_ICMPGE ? JavaCondGE :
+           op == JOP_IF_ICMPGT ? JavaCondG : JavaCondLE,
+           pc, jopS2(code + pc + 1));
+    break;
+  case JOP_GOTO:
+    _buf.jmp(pcLabel(pc + jopS2(code + pc + 1)));
+    break;
+  case JOP_GOTO_W:
+    _buf.jmp(pcLabel(pc + jopS4(code + pc + 1)));
+    break;
+  case JOP_TABLESWITCH:
+    /* a jump table of absolute addresses right after the indirect jump;
+       the unsigned compare also catches keys below 'lo' */
+    p = (pc + 4) & ~3;
+    lo = jopS4(code + p + 4);
+    hi = jopS4(code + p + 8);
+    l1 = _buf.newLabel();
+    _buf.pop(JavaEAX);
+    if (lo)
+      _buf.aluImm(JavaAluSub, JavaEAX, lo);
+    _buf.aluImm(JavaAluCmp, JavaEAX, hi - lo);
+    _buf.jcc(JavaCondA, pcLabel(pc + jopS4(code + p)));
+    _buf.emit1(0xB9);                   /* mov ecx, imm32 */
+    _buf.labelAddr(l1);
+    _buf.jmp(JavaMem(JavaECX, JavaEAX, 4, 0));
+    _buf.align(4);
+    _buf.bind(l1);
+    for (j = 0; j <= (u4) (hi - lo); j++)
+      _buf.labelAddr(pcLabel(pc + jopS4(code + p + 12 + 4 * j)));
+    break;
+  case JOP_LOOKUPSWITCH:
+    p = (pc + 4) & ~3;
+    n = jopS4(code + p + 4);
+    _buf.pop(JavaEAX);
+    for (j = 0; j < n; j++) {
+      _buf.aluImm(JavaAluCmp, JavaEAX, jopS4(code + p + 8 + 8 * j));
+      _buf.jcc(JavaCondE, pcLabel(pc + jopS4(code + p + 12 + 8 * j)));
+    }
+    _buf.jmp(pcLabel(pc + jopS4(code + p)));
+    break;
+
+  /* returns */
+  case JOP_IRETURN: case JOP_FRETURN: case JOP_ARETURN:
+    _buf.pop(JavaEAX);
+    epilogue('I');
+    break;
+  case JOP_LRETURN: case JOP_DRETURN:
+    _buf.pop(JavaEAX);
+    _buf.pop(JavaEDX);
+    epilogue('J');
+    break;
+  case JOP_RETURN:
+    epilogue('V');
+    break;
+
+  /* fields; class initialization is assumed done at link time */
+  case JOP_GETSTATIC:
+    e = &cp[jopU2(code + pc + 1)];
+    push_field(_buf, javaAbs(e->addr), e->type);
+    break;
+  case JOP_PUTSTATIC:
+    e = &cp[jopU2(code + pc + 1)];
+    pop_field(_buf, javaAbs(e->addr), e->type);
+    break;
+  case JOP_GETFIELD:
+    e = &cp[jopU2(code + pc + 1)];
+    _buf.pop(JavaEAX);
+    nullCheck(JavaEAX);
+    push_field(_buf, JavaMem(JavaEAX, e->offset), e->type);
+    break;
+  case JOP_PUTFIELD:
+    e = &cp[jopU2(code + pc + 1)];
+    n = is_wide(e->type) ? 2 : 1;
+    _buf.mov(JavaEAX, top(n));
+    nullCheck(JavaEAX);
+    pop_field(_buf, JavaMem(JavaEAX, e->offset), e->type);
+    _buf.aluImm(JavaAluAdd, JavaESP, 4);
+    break;
+
+  /* invocations */
+  case JOP_INVOKEVIRTUAL:
+    callee = cp[jopU2(code + pc + 1)].method;
+    invoke(callee, callee->isFinal() ? 0 :
+           JAVA_FN(&JavaRuntime::resolveVirtual));
+    break;
+  case JOP_INVOKESPECIAL: case JOP_INVOKESTATIC:
+    callee = cp[jopU2(code + pc + 1)].method;
+    if (!intrinsic(callee))
+      invoke(callee, 0);
+    break;
+  case JOP_INVOKEINTERFACE:
+    invoke(cp[jopU2(code + pc + 1)].method,
+           JAVA_FN(&JavaRuntime::resolveInterface));
+    break;
+
+  /* objects */
+  case JOP_NEW:
+    _buf.pushAddr(cp[jopU2(code + pc + 1)].klass);
+    _buf.call(JAVA_FN(&JavaRuntime::newObject));
+    _buf.mov(top(0), JavaEAX);
+    break;
+  case JOP_NEWARRAY: case JOP_ANEWARRAY:
+    _buf.pushAddr(JavaRuntime::arrayClass(op == JOP_NEWARRAY ? code[pc + 1] :
+                                          0));
+    _buf.call(JAVA_FN(&JavaRuntime::newArray));
+    _buf.aluImm(JavaAluAdd, JavaESP, 4);
+    _buf.mov(top(0), JavaEAX);
+    break;
+  case JOP_CHECKCAST:
+    _buf.mov(JavaEAX, top(0));
+    _buf.pushAddr(cp[jopU2(code + pc + 1)].klass);
+    _buf.push(JavaEAX);
+    _buf.call(JAVA_FN(&JavaRuntime::checkCast));
+    _buf.aluImm(JavaAluAdd, JavaESP, 8);
+    break;
+  case JOP_INSTANCEOF:
+    _buf.mov(JavaEAX, top(0));
+    _buf.pushAddr(cp[jopU2(code + pc + 1)].klass);
+    _buf.push(JavaEAX);
+    _buf.call(JAVA_FN(&JavaRuntime::instanceOf));
+    _buf.aluImm(JavaAluAdd, JavaESP, 8);
+    _buf.mov(top(0), JavaEAX);
+    break;
+  case JOP_ATHROW:
+    _buf.call(JAVA_FN(&JavaRuntime::throwObject));
+    break;
+  case JOP_MONITORENTER: case JOP_MONITOREXIT:
+    _buf.call(op == JOP_MONITORENTER ? JAVA_FN(&JavaRuntime::monitorEnter) :
+              JAVA_FN(&JavaRuntime::monitorExit));
+    _buf.aluImm(JavaAluAdd, JavaESP, 4);
+    break;
+
+  case JOP_WIDE:
+    i = jopU2(code + pc + 2);
+    switch (code[pc + 1]) {
+    case JOP_ILOAD: case JOP_FLOAD: case JOP_ALOAD:
+      _buf.push(local(i));
+      break;
+    case JOP_LLOAD: case JOP_DLOAD:
+      _buf.push(local(i));
+      _buf.push(local(i + 1));
+      break;
+    case JOP_ISTORE: case JOP_FSTORE: case JOP_ASTORE:
+      _buf.pop(local(i));
+      break;
+    case JOP_LSTORE: case JOP_DSTORE:
+      _buf.pop(local(i + 1));
+      _buf.pop(local(i));
+      break;
+    case JOP_IINC:
+      _buf.aluImm(JavaAluAdd, local(i), jopS2(code + pc + 4));
+      break;
+    default:
+      return false;
+    }
+    break;
+
+  default:
+    /* JSR and RET (subroutines went away with Java 6 classfiles) and
+       MULTIANEWARRAY stay with the interpreter */
+    return false;
+  }
+  return true;
+}
+
+bool JavaTranslator::translate()
+{
+  const u1 *code = _method->code();
+  u4 pc;
+
+  findLoopHeaders();
+  prologue();
+  for (pc = 0; pc < _method->codeLength(); pc += jopLength(code, pc)) {
+    _buf.bind(pcLabel(pc));
+    if (!translate(pc))
+      return false;
+  }
+  for (pc = 0; pc < _method->codeLength(); pc++)
+    if (_loopHeaders[pc])
+      osrEntry(pc);
+
+  /* out-of-line exception paths shared by the whole method */
+  _buf.bind(_npeLabel);
+  _buf.pushImm(JavaNullPointerException);
+  _buf.call(JAVA_FN(&JavaRuntime::throwException));
+  _buf.bind(_rangeLabel);
+  _buf.pushImm(JavaArrayIndexOutOfBoundsException);
+  _buf.call(JAVA_FN(&JavaRuntime::throwException));
+  _buf.bind(_arithLabel);
+  _buf.pushImm(JavaArithmeticException);
+  _buf.call(JAVA_FN(&JavaRuntime::throwException));
+
+  return _buf.finish();
+}
+
+bool JavaTranslator::compile(JavaVMMethod *m)
+{
+  JavaTranslator t(m);
+  JavaCompiledMethod *cm;
+  JavaOsrPoint *p;
+  u1 *code;
+  u4 i;
+
+  if (!m->code() || m->notCompilable() || !t.translate()) {
+    m->notCompilable(true);
+    return false;
+  }
+
+  /* a full code cache fails the request; the method stays where it is */
+  code = JavaCodeCache::alloc(JAVA_TIER_BASELINE, t.buffer().size());
+  if (!code)
+    return false;
+  t.buffer().install(code);
+  cm = new JavaCompiledMethod(m, code, t.buffer().size(), JAVA_TIER_BASELINE);
+  m->compiled(cm);
+
+  /* optimized OSR code may already be there for a loop */
+  for (i = 0; i < t._osrLabels.size(); i++) {
+    p = m->addOsrPoint(t._osrLabels[i].first);
+    if (p->tier < JAVA_TIER_BASELINE) {
+      p->entry = (JavaOsrEntry) (uintptr)
+        (code + t.buffer().labelOffset(t._osrLabels[i].second));
+      p->tier = JAVA_TIER_BASELINE;
+    }
+  }
+
+  /* callers pick up the new entry on their next call */
+  m->tier(JAVA_TIER_BASELINE);
+  m->entry((JavaEntry) (uintptr) code);
+  JavaCodeCache::add(cm);
+  return true;
+}